@@ -0,0 +1,40 @@
+#!/usr/bin/env ruby
+# vim: set et sw=2 ts=2:
+#
+# Compares the ns/op of two result files of runner.rb and exits with a
+# failure, if any case got slower by more than the threshold in percent.
+#
+#   ruby compare.rb BASELINE.json RESULTS.json [THRESHOLD]
+
+require 'json'
+
+baseline, current, threshold = ARGV
+baseline && current or abort "Usage: #{File.basename($0)} BASELINE.json RESULTS.json [THRESHOLD]"
+threshold = (threshold || 10).to_f
+
+def load_results(filename)
+  JSON.parse(File.read(filename))['results'].inject({}) do |h, r|
+    h[r['name']] = r
+    h
+  end
+end
+
+old, new = load_results(baseline), load_results(current)
+regressions = 0
+(old.keys & new.keys).sort.each do |name|
+  before, after = old[name]['ns_per_op'], new[name]['ns_per_op']
+  change = (after - before) / before * 100
+  flag = ''
+  if change > threshold
+    flag = '  REGRESSION'
+    regressions += 1
+  elsif change < -threshold
+    flag = '  improvement'
+  end
+  printf "%-48s %12.1f -> %12.1f ns/op %+7.1f%%%s\n", name, before, after,
+    change, flag
+end
+(old.keys - new.keys).sort.each { |name| puts "#{name}: missing" }
+if regressions > 0
+  abort "#{regressions} case(s) slower by more than #{threshold}%."
+end
@@ -0,0 +1,153 @@
+#!/usr/bin/env ruby
+# vim: set et sw=2 ts=2:
+#
+# Runs every metric class over generated corpora and reports ns/op, the
+# throughput in DP cells/s and MB/s and the objects allocated per call.
+# The results are saved as JSON, so two runs can be compared with
+# compare.rb.
+#
+# Environment:
+#   BENCH_TIME    seconds to run each case (default 0.5)
+#   BENCH_FILTER  regular expression selecting the cases to run
+#   BENCH_OUTPUT  file to save the results to (default results-TIME.json)
+#   BENCH_SEED    seed of the generated corpora (default 42)
+
+$:.unshift File.expand_path(File.join(File.dirname(__FILE__), '..', 'ext'))
+require 'amatch'
+require 'json'
+require 'rbconfig'
+include Amatch
+
+module Bench
+  module_function
+
+  ALPHABET = ('a'..'z').to_a + [' ']
+
+  def text(len, alphabet = ALPHABET)
+    s = ''
+    len.times { s << alphabet[rand(alphabet.size)] }
+    s
+  end
+
+  # Copies string with about a tenth of its characters changed.
+  def mutate(string)
+    s = string.dup
+    (string.size / 10 + 1).times { s[rand(s.size)] = ALPHABET[rand(26)] if s.size > 0 }
+    s
+  end
+
+  # The corpora: each one is a pattern and the strings it is matched
+  # against. A batch is passed as one Array, the others one at a time.
+  def corpora
+    srand((ENV['BENCH_SEED'] || 42).to_i)
+    short = text(8)
+    long = text(1000)
+    words = Array.new(100_000) { mutate(text(4 + rand(9))) }
+    {
+      'short/short' => [short, Array.new(100) { mutate(short) }],
+      'short/long'  => [text(16), [text(64 * 1024)]],
+      'long/long'   => [long, Array.new(4) { mutate(long) }],
+      'batch'       => [short, words],
+    }
+  end
+
+  # Class, method and the arguments after the strings of every case.
+  METHODS = [
+    [ Levenshtein,        :match,   [] ],
+    [ Levenshtein,        :search,  [] ],
+    [ Levenshtein,        :similar, [] ],
+    [ Sellers,            :match,   [] ],
+    [ Sellers,            :search,  [] ],
+    [ Sellers,            :similar, [] ],
+    [ Hamming,            :match,   [] ],
+    [ Hamming,            :similar, [] ],
+    [ PairDistance,       :match,   [] ],
+    [ PairDistance,       :match,   [ nil ] ],
+    [ LongestSubsequence, :match,   [] ],
+    [ LongestSubsequence, :similar, [] ],
+    [ LongestSubstring,   :match,   [] ],
+    [ LongestSubstring,   :similar, [] ],
+    [ Jaro,               :match,   [] ],
+    [ JaroWinkler,        :match,   [] ],
+    [ Bitap,              :search,  [ 2 ] ],
+  ]
+
+  def allocated_objects
+    GC.respond_to?(:stat) && GC.stat.key?(:total_allocated_objects) ?
+      GC.stat[:total_allocated_objects] : nil
+  end
+
+  def now
+    Process.clock_gettime(Process::CLOCK_MONOTONIC)
+  rescue NameError
+    Time.now.to_f
+  end
+
+  # Calls the block repeatedly for at least seconds and returns the number
+  # of calls, the time taken and the objects allocated.
+  def measure(seconds)
+    yield
+    calls, start, objects = 0, now, allocated_objects
+    begin
+      yield
+      calls += 1
+    end until (elapsed = now - start) >= seconds
+    objects = allocated_objects - objects if objects
+    return calls, elapsed, objects
+  end
+
+  def run
+    seconds = (ENV['BENCH_TIME'] || 0.5).to_f
+    filter = ENV['BENCH_FILTER'] && Regexp.new(ENV['BENCH_FILTER'])
+    results = []
+    corpora.each do |corpus, (pattern, strings)|
+      METHODS.each do |klass, method, args|
+        name = "#{klass.name.sub(/^Amatch::/, '')}##{method}" +
+          (args.empty? ? '' : "(#{args.map { |a| a.inspect } * ', '})") +
+          " #{corpus}"
+        filter and filter !~ name and next
+        # patterns, that a class can't compile, are skipped (Bitap's are
+        # limited to 64 positions)
+        matcher = klass.new(pattern) rescue next
+        if corpus == 'batch'
+          ops = strings.size
+          calls, elapsed, objects = measure(seconds) do
+            matcher.__send__(method, strings, *args)
+          end
+        else
+          ops = strings.size
+          calls, elapsed, objects = measure(seconds) do
+            strings.each { |s| matcher.__send__(method, s, *args) }
+          end
+        end
+        bytes = strings.inject(0) { |sum, s| sum + s.size }
+        cells = strings.inject(0) { |sum, s| sum + s.size * pattern.size }
+        result = {
+          'name'        => name,
+          'ns_per_op'   => elapsed * 1e9 / (calls * ops),
+          'cells_per_s' => cells * calls / elapsed,
+          'mb_per_s'    => bytes * calls / elapsed / 1e6,
+          'allocations_per_op' => objects && objects.to_f / (calls * ops),
+        }
+        printf "%-48s %12.1f ns/op %10.1f Mcells/s %9.1f MB/s %7s allocs/op\n",
+          name, result['ns_per_op'], result['cells_per_s'] / 1e6,
+          result['mb_per_s'],
+          objects ? '%.1f' % result['allocations_per_op'] : '-'
+        results << result
+      end
+    end
+    output = ENV['BENCH_OUTPUT'] ||
+      "results-#{Time.now.strftime('%Y%m%d%H%M%S')}.json"
+    File.open(output, 'w') do |f|
+      f.puts JSON.pretty_generate(
+        'ruby'    => "#{RUBY_VERSION} #{RUBY_PLATFORM}",
+        'time'    => Time.now.to_s,
+        'seconds' => seconds,
+        'results' => results
+      )
+    end
+    puts "Saved results to #{output}."
+  end
+end
+
+Bench.run
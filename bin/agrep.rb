@@ -17,14 +17,8 @@ def usage(msg, options)
   exit 0
 end
 
-class Amatch::Levenshtein
-  def search_relative(strings)
-    search(strings).to_f / pattern.size
-  end
-end
-
 $distance = 1
-$mode = :search
+$relative = false
 begin
   parser = GetoptLong.new
   options = [
@@ -40,7 +34,7 @@ begin
     when 'distance'
       $distance = arg.to_f
     when 'relative'
-      $mode = :search_relative
+      $relative = true
     when 'verbose'
       $verbose = 1
     when 'help'
@@ -53,6 +47,7 @@ end
 pattern = ARGV.shift or usage('Pattern needed!', options)
 
 matcher = Amatch::Levenshtein.new(pattern)
+max_distance = $relative ? $distance * pattern.size : $distance
 size = 0
 start = Time.new
 if ARGV.size > 0 then
@@ -60,10 +55,8 @@ if ARGV.size > 0 then
     File.stat(filename).file? or next
     size += File.size(filename)
     begin
-      File.open(filename, 'r').each_line do |line|
-        if matcher.__send__($mode, line) <= $distance
-          puts "#{filename}:#{line}"
-        end
+      matcher.grep_file(filename, max_distance) do |line,|
+        puts "#{filename}:#{line}"
       end
     rescue
       STDERR.puts "Failure at #{filename}: #{$!} => Skipping!"
@@ -72,7 +65,7 @@ if ARGV.size > 0 then
 else
   STDIN.each_line do |line|
     size += line.size
-    if matcher.__send__($mode, line) <= $distance
+    if matcher.search(line, max_distance)
       puts line
     end
   end
@@ -0,0 +1,420 @@
+#include "alignment.h"
+#include <math.h>
+#include <stdlib.h>
+
+/*
+ * Optimal alignments of the pattern and a string under the Sellers
+ * recurrence (see COMPUTE_SELLERS_DISTANCE in amatch.c) are computed here
+ * in linear space, by Hirschberg's divide and conquer (D. S. Hirschberg, "A
+ * linear space algorithm for computing maximal common subsequences", 1975):
+ * the costs from the top left corner to the middle row of the matrix, and
+ * from there to the bottom right corner, are computed row by row, and the
+ * optimal path crosses the middle row, where their sum is lowest. Both
+ * halves are then aligned the same way, until they are small enough for a
+ * full matrix with a traceback. Only the diagonals, that a path with the
+ * cost of the optimal alignment can pass, are computed, so similar strings
+ * are aligned in about the time of a pass over their band.
+ *
+ * The rows are taken along the longer one of the two strings, so the rows
+ * have the length of the shorter one. Like the Sellers recurrence, moving
+ * along the string costs a deletion, along the pattern an insertion, except
+ * in the first column (before the first character of the string), where it
+ * costs a deletion as well. Nothing in this file may call the Ruby API: it
+ * runs without the global interpreter lock, so memory is allocated with
+ * plain malloc.
+ */
+
+#define SMALL_CELLS 4096
+
+typedef struct AlignerStruct {
+    const char  *x;         /* the longer string, split into halves */
+    const char  *y;         /* the shorter one, along the rows */
+    int         x_is_pattern;
+    double      substitution;
+    double      insertion;
+    double      deletion;
+    double      *forward;
+    double      *backward;
+    double      *small;
+    AlignmentRun *runs;
+    long        len;
+    long        size;
+    int         failed;
+} Aligner;
+
+/*
+ * The costs of moving along x at position y of the other string, and along
+ * y at position x.
+ */
+static double gap_x(Aligner *al, long y)
+{
+    if (!al->x_is_pattern) return al->deletion;
+    return y == 0 ? al->deletion : al->insertion;
+}
+
+static double gap_y(Aligner *al, long x)
+{
+    if (al->x_is_pattern) return al->deletion;
+    return x == 0 ? al->deletion : al->insertion;
+}
+
+static int op_x(Aligner *al)
+{
+    return al->x_is_pattern ? ALIGNMENT_INSERT : ALIGNMENT_DELETE;
+}
+
+static int op_y(Aligner *al)
+{
+    return al->x_is_pattern ? ALIGNMENT_DELETE : ALIGNMENT_INSERT;
+}
+
+static void run_add(Aligner *al, int op, long len)
+{
+    AlignmentRun *runs;
+
+    if (len <= 0 || al->failed) return;
+    if (al->len > 0 && al->runs[al->len - 1].op == op) {
+        al->runs[al->len - 1].len += len;
+        return;
+    }
+    if (al->len == al->size) {
+        al->size = al->size ? 2 * al->size : 16;
+        runs = (AlignmentRun *) realloc(al->runs,
+            al->size * sizeof(AlignmentRun));
+        if (!runs) {
+            al->failed = 1;
+            return;
+        }
+        al->runs = runs;
+    }
+    al->runs[al->len].op = op;
+    al->runs[al->len].len = len;
+    al->len++;
+}
+
+/*
+ * Aligns x[x0, x1) and y[y0, y1) with a full matrix of their costs, and
+ * adds the operations of the path traced back from its bottom right corner.
+ */
+static void align_small(Aligner *al, long x0, long x1, long y0, long y1)
+{
+    long w = y1 - y0 + 1, i, j, k, len = 0;
+    double *v = al->small, weight, gx, gy;
+    int *ops = (int *) (al->small + (x1 - x0 + 1) * w);
+
+    for (j = 1, v[0] = 0; j < w; j++) {
+        v[j] = v[j - 1] + gap_y(al, x0);
+    }
+    for (i = 1; i <= x1 - x0; i++) {
+        gx = gap_x(al, y0);
+        gy = gap_y(al, x0 + i);
+        v[i * w] = v[(i - 1) * w] + gx;
+        gx = gap_x(al, y0 + 1);
+        for (j = 1; j < w; j++) {
+            weight = v[(i - 1) * w + j - 1] +
+                (al->x[x0 + i - 1] == al->y[y0 + j - 1] ? 0 : al->substitution);
+            if (weight > v[(i - 1) * w + j] + gx) {
+                weight = v[(i - 1) * w + j] + gx;
+            }
+            if (weight > v[i * w + j - 1] + gy) {
+                weight = v[i * w + j - 1] + gy;
+            }
+            v[i * w + j] = weight;
+        }
+    }
+    for (i = x1 - x0, j = w - 1; i > 0 || j > 0;) {
+        if (i > 0 && j > 0 && v[i * w + j] == v[(i - 1) * w + j - 1] +
+                (al->x[x0 + i - 1] == al->y[y0 + j - 1] ? 0 :
+                 al->substitution)) {
+            ops[len++] = al->x[x0 + i - 1] == al->y[y0 + j - 1] ?
+                ALIGNMENT_MATCH : ALIGNMENT_SUBSTITUTE;
+            i--;
+            j--;
+        } else if (i > 0 &&
+                v[i * w + j] == v[(i - 1) * w + j] + gap_x(al, y0 + j)) {
+            ops[len++] = op_x(al);
+            i--;
+        } else {
+            ops[len++] = op_y(al);
+            j--;
+        }
+    }
+    for (k = len - 1; k >= 0; k--) run_add(al, ops[k], 1);
+}
+
+/*
+ * Aligns the single character x[x0] and y[y0, y1): it is either matched
+ * with one of them, or moved along right before one of them or the end.
+ */
+static void align_one(Aligner *al, long x0, long y0, long y1)
+{
+    double before = gap_y(al, x0), after = gap_y(al, x0 + 1), weight, best;
+    long j, at;
+    int matched = 0;
+
+    best = (y1 - y0) * after + gap_x(al, y0);
+    at = y0;
+    for (j = y0; j < y1; j++) {
+        weight = (j - y0) * before + (y1 - j - 1) * after +
+            (al->x[x0] == al->y[j] ? 0 : al->substitution);
+        if (weight < best) {
+            best = weight;
+            at = j;
+            matched = 1;
+        }
+        weight = (j + 1 - y0) * before + (y1 - j - 1) * after +
+            gap_x(al, j + 1);
+        if (weight < best) {
+            best = weight;
+            at = j + 1;
+            matched = 0;
+        }
+    }
+    run_add(al, op_y(al), at - y0);
+    if (matched) {
+        run_add(al, al->x[x0] == al->y[at] ?
+            ALIGNMENT_MATCH : ALIGNMENT_SUBSTITUTE, 1);
+        at++;
+    } else {
+        run_add(al, op_x(al), 1);
+    }
+    run_add(al, op_y(al), y1 - at);
+}
+
+/*
+ * Sets *lo and *hi to the first and last diagonal (j - y0) - (i - x0) of
+ * the matrix of x[x0, x1) and y[y0, y1), that a path costing at most cost
+ * can pass: leaving the diagonal from the top left to the bottom right
+ * corner costs at least the cheaper gap per step, there and back again
+ * (Ukkonen's cut-off). All diagonals are passable, if a gap costs nothing.
+ */
+static void band(Aligner *al, long x0, long x1, long y0, long y1,
+    double cost, long *lo, long *hi)
+{
+    double gap = al->insertion < al->deletion ? al->insertion : al->deletion;
+    long dd = (y1 - y0) - (x1 - x0), k, e;
+
+    if (gap <= 0 || cost / gap >= (double) ((x1 - x0) + (y1 - y0))) {
+        *lo = -(x1 - x0);
+        *hi = y1 - y0;
+        return;
+    }
+    k = (long) floor(cost / gap + 1e-6);
+    e = (k - (dd < 0 ? -dd : dd)) / 2;
+    if (e < 0) e = 0;
+    *lo = (dd < 0 ? dd : 0) - e;
+    *hi = (dd > 0 ? dd : 0) + e;
+}
+
+/*
+ * Computes the costs from (x0, y0) to every cell of row to within the
+ * diagonals lo and hi into forward. The other cells of the row are left
+ * alone, except the ones next to the band, which are infinite.
+ */
+static void pass_forward(Aligner *al, long x0, long y0, long y1, long lo,
+    long hi, long to)
+{
+    double *f = al->forward, diag, left, weight, gx, gy;
+    long i, j, first, last;
+
+    last = hi < y1 - y0 ? y0 + hi : y1;
+    for (j = y0 + 1, f[y0] = 0; j <= last; j++) {
+        f[j] = f[j - 1] + gap_y(al, x0);
+    }
+    if (last < y1) f[last + 1] = HUGE_VAL;
+    gx = gap_x(al, y0 + 1);
+    for (i = x0 + 1; i <= to; i++) {
+        gy = gap_y(al, i);
+        first = i - x0 + lo > 0 ? y0 + i - x0 + lo : y0;
+        last = i - x0 + hi < y1 - y0 ? y0 + i - x0 + hi : y1;
+        j = first;
+        if (first == y0) {
+            diag = f[y0];
+            f[y0] += gap_x(al, y0);
+            j++;
+        } else {
+            diag = f[first - 1];
+            f[first - 1] = HUGE_VAL;
+        }
+        for (; j <= last; j++) {
+            left = f[j];
+            weight = diag + (al->x[i - 1] == al->y[j - 1] ? 0 : al->substitution);
+            if (weight > left + gx) weight = left + gx;
+            if (weight > f[j - 1] + gy) weight = f[j - 1] + gy;
+            diag = left;
+            f[j] = weight;
+        }
+        if (last < y1) f[last + 1] = HUGE_VAL;
+    }
+}
+
+/*
+ * Computes the costs from every cell of row to to (x1, y1) within the
+ * diagonals lo and hi into backward, like pass_forward.
+ */
+static void pass_backward(Aligner *al, long x0, long x1, long y0, long y1,
+    long lo, long hi, long to)
+{
+    double *b = al->backward, diag, left, weight, gy;
+    long i, j, first, last;
+
+    first = x1 - x0 + lo > 0 ? y0 + x1 - x0 + lo : y0;
+    for (j = y1 - 1, b[y1] = 0; j >= first; j--) {
+        b[j] = b[j + 1] + gap_y(al, x1);
+    }
+    if (first > y0) b[first - 1] = HUGE_VAL;
+    for (i = x1 - 1; i >= to; i--) {
+        gy = gap_y(al, i);
+        first = i - x0 + lo > 0 ? y0 + i - x0 + lo : y0;
+        last = i - x0 + hi < y1 - y0 ? y0 + i - x0 + hi : y1;
+        j = last;
+        if (last == y1) {
+            diag = b[y1];
+            b[y1] += gap_x(al, y1);
+            j--;
+        } else {
+            diag = b[last + 1];
+            b[last + 1] = HUGE_VAL;
+        }
+        for (; j >= first; j--) {
+            left = b[j];
+            weight = diag + (al->x[i] == al->y[j] ? 0 : al->substitution);
+            if (weight > left + gap_x(al, j)) weight = left + gap_x(al, j);
+            if (weight > b[j + 1] + gy) weight = b[j + 1] + gy;
+            diag = left;
+            b[j] = weight;
+        }
+        if (first > y0) b[first - 1] = HUGE_VAL;
+    }
+}
+
+/*
+ * Aligns x[x0, x1) and y[y0, y1), whose optimal alignment costs cost. The
+ * halves of it cost what their optimal paths to and from the middle row
+ * cost, so their bands get narrower and narrower.
+ */
+static void align(Aligner *al, long x0, long x1, long y0, long y1,
+    double cost)
+{
+    double *f = al->forward, *b = al->backward, best;
+    long mid, j, lo, hi, first, last, split;
+
+    if (al->failed) return;
+    if (x1 == x0) {
+        run_add(al, op_y(al), y1 - y0);
+        return;
+    }
+    if (y1 == y0) {
+        run_add(al, op_x(al), x1 - x0);
+        return;
+    }
+    if ((x1 - x0 + 1) * (y1 - y0 + 1) <= SMALL_CELLS) {
+        align_small(al, x0, x1, y0, y1);
+        return;
+    }
+    if (x1 - x0 == 1) {
+        align_one(al, x0, y0, y1);
+        return;
+    }
+    mid = x0 + (x1 - x0) / 2;
+    band(al, x0, x1, y0, y1, cost, &lo, &hi);
+    pass_forward(al, x0, y0, y1, lo, hi, mid);
+    pass_backward(al, x0, x1, y0, y1, lo, hi, mid);
+    first = mid - x0 + lo > 0 ? y0 + mid - x0 + lo : y0;
+    last = mid - x0 + hi < y1 - y0 ? y0 + mid - x0 + hi : y1;
+    for (j = first, split = first, best = HUGE_VAL; j <= last; j++) {
+        if (f[j] + b[j] < best) {
+            best = f[j] + b[j];
+            split = j;
+        }
+    }
+    cost = f[split];
+    best = b[split];
+    align(al, x0, mid, y0, split, cost);
+    align(al, mid, x1, split, y1, best);
+}
+
+/*
+ * Returns the cost of the optimal alignment of x[x0, x1) and y[y0, y1),
+ * computed within bands, that are doubled until the cost fits into them.
+ */
+static double align_cost(Aligner *al, long x0, long x1, long y0, long y1)
+{
+    double gap = al->insertion < al->deletion ? al->insertion : al->deletion;
+    double bound, cost;
+    long lo, hi, dd = (y1 - y0) - (x1 - x0);
+
+    bound = gap * ((dd < 0 ? -dd : dd) + 32);
+    for (;;) {
+        band(al, x0, x1, y0, y1, bound, &lo, &hi);
+        pass_forward(al, x0, y0, y1, lo, hi, x1);
+        cost = al->forward[y1];
+        if (cost <= bound || (lo == -(x1 - x0) && hi == y1 - y0)) {
+            return cost;
+        }
+        bound *= 2;
+    }
+}
+
+/*
+ * Computes an optimal alignment of pattern and string, and stores it in
+ * *runs as runs of operations, that transform string into pattern, which
+ * the caller has to free. Returns the number of runs, or -1, if the memory
+ * for them couldn't be allocated.
+ *
+ * A common prefix and suffix are matched right away, wherever that can't
+ * make the alignment more expensive: it always can't, if inserting and
+ * deleting a character cost the same (see the exchange argument in Gusfield,
+ * "Algorithms on Strings, Trees and Sequences", 11.6), but the cheaper
+ * insertions into the first column need some care.
+ */
+long alignment_compute(const char *pattern, long pattern_len,
+    const char *string, long string_len, double substitution,
+    double insertion, double deletion, AlignmentRun **runs)
+{
+    Aligner al;
+    long prefix = 0, suffix = 0, rows, x1, y1;
+
+    while (suffix < pattern_len && suffix < string_len &&
+            (string_len - suffix >= 2 || deletion <= insertion) &&
+            pattern[pattern_len - suffix - 1] ==
+            string[string_len - suffix - 1]) {
+        suffix++;
+    }
+    while (insertion <= deletion && prefix < pattern_len - suffix &&
+            prefix < string_len - suffix && pattern[prefix] == string[prefix]) {
+        prefix++;
+    }
+    al.x_is_pattern = pattern_len >= string_len;
+    al.x = al.x_is_pattern ? pattern : string;
+    al.y = al.x_is_pattern ? string : pattern;
+    al.substitution = substitution;
+    al.insertion = insertion;
+    al.deletion = deletion;
+    al.runs = NULL;
+    al.len = al.size = 0;
+    al.failed = 0;
+    rows = (al.x_is_pattern ? string_len : pattern_len) + 1;
+    al.forward = (double *) malloc(2 * rows * sizeof(double));
+    al.backward = al.forward + rows;
+    al.small = (double *) malloc(SMALL_CELLS * (sizeof(double) + sizeof(int)));
+    if (!al.forward || !al.small) al.failed = 1;
+    run_add(&al, ALIGNMENT_MATCH, prefix);
+    x1 = (al.x_is_pattern ? pattern_len : string_len) - suffix;
+    y1 = (al.x_is_pattern ? string_len : pattern_len) - suffix;
+    if (!al.failed) {
+        align(&al, prefix, x1, prefix, y1,
+            align_cost(&al, prefix, x1, prefix, y1));
+    }
+    run_add(&al, ALIGNMENT_MATCH, suffix);
+    free(al.forward);
+    free(al.small);
+    if (al.failed) {
+        free(al.runs);
+        *runs = NULL;
+        return -1;
+    }
+    *runs = al.runs;
+    return al.len;
+}
+  /* vim: set et cindent sw=4 ts=4: */
@@ -0,0 +1,21 @@
+#ifndef ALIGNMENT_H_INCLUDED
+#define ALIGNMENT_H_INCLUDED
+
+#include "ruby.h"
+
+#define ALIGNMENT_MATCH         0
+#define ALIGNMENT_SUBSTITUTE    1
+#define ALIGNMENT_INSERT        2   /* a character of the pattern */
+#define ALIGNMENT_DELETE        3   /* a character of the string */
+
+typedef struct AlignmentRunStruct {
+    int         op;
+    long        len;
+} AlignmentRun;
+
+long alignment_compute(const char *pattern, long pattern_len,
+    const char *string, long string_len, double substitution,
+    double insertion, double deletion, AlignmentRun **runs);
+
+#endif
+  /* vim: set et cindent sw=4 ts=4: */
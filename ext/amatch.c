@@ -1,6 +1,27 @@
 #include "ruby.h"
+#ifdef HAVE_RB_THREAD_CALL_WITHOUT_GVL
+#include "ruby/thread.h"
+#endif
 #include "pair.h"
-#include <ctype.h>
+#include "pattern_mask.h"
+#include "comparison.h"
+#include "workspace.h"
+#include "hamming.h"
+#include "ranking.h"
+#include "bktree.h"
+#include "suffix_automaton.h"
+#include "bitap.h"
+#include "pattern_set.h"
+#include "alignment.h"
+#include "codepoints.h"
+#include "prefilter.h"
+#include "stats.h"
+#include "join.h"
+#include "qgram.h"
+#include "mapped_file.h"
+#include <limits.h>
+#include <math.h>
+#include <string.h>
 
 /*
  * Document-method: pattern
@@ -18,18 +39,90 @@
  * Sets the current pattern string of this instance to <code>pattern</code>.
  */
 
+/*
+ * Document-method: codepoints
+ *
+ * call-seq: codepoints -> true/false
+ *
+ * Returns whether this instance compares UTF-8 characters instead of bytes.
+ * It doesn't by default.
+ */
+
+/*
+ * Document-method: codepoints=
+ *
+ * call-seq: codepoints=(true/false)
+ *
+ * Makes this instance compare UTF-8 characters instead of bytes, if true is
+ * given, so that a multibyte character counts as one character, and
+ * lengths and offsets in the results count characters. The pattern is
+ * decoded once, when it's set, and strings only, if they aren't pure ASCII.
+ * Bytes, that aren't valid UTF-8, count as characters of their own.
+ * Raises an ArgumentError, if the pattern has more than 127 distinct
+ * non-ASCII characters, as does setting such a pattern in this mode.
+ *
+ *  m = Amatch::Levenshtein.new('häll')
+ *  m.match('hell')
+ *  # => 2
+ *  m.codepoints = true
+ *  m.match('hell')
+ *  # => 1
+ */
+
+/*
+ * Document-method: stats
+ *
+ * call-seq: stats -> hash
+ *
+ * Returns the statistics of the calls of this instance, that were made
+ * while Amatch.collect_stats was on, as a Hash from the names of the
+ * methods to Hashes like those of Amatch.stats.
+ *
+ *  Amatch.collect_stats = true
+ *  m = Amatch::Levenshtein.new('test')
+ *  m.match(%w[tset test])
+ *  m.stats[:match][:comparisons]
+ *  # => 2
+ */
+
+/*
+ * Document-method: reset_stats
+ *
+ * call-seq: reset_stats
+ *
+ * Forgets the statistics of this instance, see stats.
+ */
+
 
 static VALUE rb_mAmatch, rb_cLevenshtein, rb_cSellers, rb_cHamming,
              rb_cPairDistance, rb_cLongestSubsequence, rb_cLongestSubstring,
-             rb_cJaro, rb_cJaroWinkler;
+             rb_cJaro, rb_cJaroWinkler, rb_cBitap, rb_cPatternSet,
+             rb_cBKTree, rb_cQGramIndex;
 
-static ID id_split, id_to_f;
+static ID id_split, id_to_f, id_match, id_substitute, id_insert, id_delete,
+          id_read;
+
+#ifdef HAVE_TYPE_RB_DATA_TYPE_T
+/*
+ * Every C structure has a data type, that is the parent of the data types of
+ * the classes using it (see DEF_WRAP_STRUCT).
+ */
+#define DEF_DATA_TYPE(type)                                     \
+static const rb_data_type_t type##_data_type = { #type, };
+
+#define GET_STRUCT(klass)                 \
+    klass *amatch;                        \
+    TypedData_Get_Struct(self, klass, &klass##_data_type, amatch);
+#else
+#define DEF_DATA_TYPE(type)
 
 #define GET_STRUCT(klass)                 \
     klass *amatch;                        \
     Data_Get_Struct(self, klass, amatch);
+#endif
 
 #define DEF_ALLOCATOR(type)                                             \
+DEF_DATA_TYPE(type)                                                     \
 static type *type##_allocate()                                          \
 {                                                                       \
     type *obj = ALLOC(type);                                            \
@@ -37,11 +130,47 @@ static type *type##_allocate()                                          \
     return obj;                                                         \
 }
 
+/*
+ * If typed data is available, matchers report the memory they hold on to,
+ * including their workspace, as their memsize.
+ */
+#ifdef HAVE_TYPE_RB_DATA_TYPE_T
+#define DEF_WRAP_STRUCT(klass, type)                                    \
+static size_t rb_##klass##_memsize(const void *ptr)                     \
+{                                                                       \
+    const type *amatch = (const type *) ptr;                            \
+    return sizeof(type) + amatch->pattern_len +                         \
+        amatch->workspace.size + stats_memsize(&amatch->stats) +        \
+        type##_pattern_memsize(amatch);                                 \
+}                                                                       \
+static const rb_data_type_t rb_##klass##_type = {                       \
+    "Amatch::" #klass,                                                  \
+    {                                                                   \
+        NULL,                                                           \
+        (void (*)(void *)) rb_##klass##_free,                           \
+        rb_##klass##_memsize,                                           \
+    },                                                                  \
+    &type##_data_type,                                                  \
+};                                                                      \
+static VALUE rb_##klass##_wrap(VALUE klass2, type *amatch)              \
+{                                                                       \
+    return TypedData_Wrap_Struct(klass2, &rb_##klass##_type, amatch);   \
+}
+#else
+#define DEF_WRAP_STRUCT(klass, type)                                    \
+static VALUE rb_##klass##_wrap(VALUE klass2, type *amatch)              \
+{                                                                       \
+    return Data_Wrap_Struct(klass2, NULL, rb_##klass##_free, amatch);   \
+}
+#endif
+
 #define DEF_CONSTRUCTOR(klass, type)                                    \
+DEF_WRAP_STRUCT(klass, type)                                            \
 static VALUE rb_##klass##_s_allocate(VALUE klass2)                      \
 {                                                                       \
     type *amatch = type##_allocate();                                   \
-    return Data_Wrap_Struct(klass2, NULL, rb_##klass##_free, amatch);   \
+    amatch->stats.class_name = #klass;                                  \
+    return rb_##klass##_wrap(klass2, amatch);                           \
 }                                                                       \
 VALUE rb_##klass##_new(VALUE klass2, VALUE pattern)                     \
 {                                                                       \
@@ -53,6 +182,9 @@ VALUE rb_##klass##_new(VALUE klass2, VALUE pattern)                     \
 #define DEF_RB_FREE(klass, type)                            \
 static void rb_##klass##_free(type *amatch)                 \
 {                                                           \
+    type##_pattern_release(amatch);                         \
+    workspace_release(&amatch->workspace);                  \
+    stats_release(&amatch->stats);                          \
     MEMZERO(amatch->pattern, char, amatch->pattern_len);    \
     free(amatch->pattern);                                  \
     MEMZERO(amatch, type, 1);                               \
@@ -63,11 +195,18 @@ static void rb_##klass##_free(type *amatch)                 \
 static void type##_pattern_set(type *amatch, VALUE pattern)     \
 {                                                               \
     Check_Type(pattern, T_STRING);                              \
+    if (amatch->busy) {                                         \
+        rb_raise(rb_eRuntimeError,                              \
+            "can't modify pattern while matching");             \
+    }                                                           \
+    if (amatch->codepoints) check_codepoints(pattern);          \
     free(amatch->pattern);                                      \
     amatch->pattern_len = RSTRING(pattern)->len;                \
     amatch->pattern = ALLOC_N(char, amatch->pattern_len);       \
     MEMCPY(amatch->pattern, RSTRING(pattern)->ptr, char,        \
         RSTRING(pattern)->len);                                 \
+    type##_pattern_release(amatch);                             \
+    type##_pattern_compile(amatch);                             \
 }                                                               \
 static VALUE rb_##type##_pattern(VALUE self)                    \
 {                                                               \
@@ -81,29 +220,209 @@ static VALUE rb_##type##_pattern_set(VALUE self, VALUE pattern) \
     return Qnil;                                                \
 }
 
-#define DEF_ITERATE_STRINGS(type)                                   \
-static VALUE type##_iterate_strings(type *amatch, VALUE strings,     \
-    VALUE (*match_function) (type *amatch, VALUE strings))        \
-{                                                                   \
-    if (TYPE(strings) == T_STRING) {                                \
-        return match_function(amatch, strings);                     \
-    } else {                                                        \
-        Check_Type(strings, T_ARRAY);                               \
-        int i;                                                      \
-        VALUE result = rb_ary_new2(RARRAY(strings)->len);           \
-        for (i = 0; i < RARRAY(strings)->len; i++) {                \
-            VALUE string = rb_ary_entry(strings, i);                \
-            if (TYPE(string) != T_STRING) {                         \
-                rb_raise(rb_eTypeError,                             \
-                    "array has to contain only strings (%s given)", \
-                    NIL_P(string) ?                                 \
-                        "NilClass" :                                \
-                        rb_class2name(CLASS_OF(string)));           \
-            }                                                       \
-            rb_ary_push(result, match_function(amatch, string));    \
-        }                                                           \
-        return result;                                              \
-    }                                                               \
+/*
+ * Types, that don't precompute anything from their pattern, use this to
+ * define empty compile, release and memsize hooks for DEF_PATTERN_ACCESSOR,
+ * DEF_RB_FREE and DEF_CONSTRUCTOR.
+ */
+#define DEF_PLAIN_PATTERN(type)                                     \
+static void type##_pattern_compile(type *amatch) {}                 \
+static void type##_pattern_release(type *amatch) {}                 \
+static size_t type##_pattern_memsize(const type *amatch) { return 0; }
+
+#define DEF_ITERATE_STRINGS(type)                                       \
+static VALUE type##_iterate_strings(type *amatch, VALUE strings,        \
+    double bound,                                                       \
+    void (*prepare) (type *amatch, VALUE string, Comparison *cmp),      \
+    VALUE (*finish) (Comparison *cmp))                                  \
+{                                                                       \
+    Comparison cmp, *cmps;                                              \
+    VALUE result = Qnil;                                                \
+    long i, len;                                                        \
+    int state, status;                                                  \
+                                                                        \
+    if (TYPE(strings) == T_STRING) {                                    \
+        MEMZERO(&cmp, Comparison, 1);                                   \
+        cmp.bound = bound;                                              \
+        prepare(amatch, strings, &cmp);                                 \
+        compare_protected(&cmp, strings, &amatch->stats, &amatch->busy, \
+            &amatch->workspace, &state);                                \
+        if (!state) result = finish(&cmp);                              \
+        xfree(cmp.symbols);                                             \
+        if (state) rb_jump_tag(state);                                  \
+        return result;                                                  \
+    }                                                                   \
+    check_strings(strings);                                             \
+    len = RARRAY(strings)->len;                                         \
+    cmps = ALLOC_N(Comparison, len);                                    \
+    MEMZERO(cmps, Comparison, len);                                     \
+    for (i = 0; i < len; i++) {                                         \
+        cmps[i].bound = bound;                                          \
+        prepare(amatch, rb_ary_entry(strings, i), cmps + i);            \
+    }                                                                   \
+    status = compare_batch_protected(cmps, len, strings, &amatch->stats,\
+        &amatch->busy, &amatch->workspace, &state);                     \
+    if (state || status != 0) {                                         \
+        comparisons_release(cmps, len);                                 \
+        xfree(cmps);                                                    \
+        if (state) rb_jump_tag(state);                                  \
+        rb_raise(rb_eNoMemError, "failed to allocate memory");          \
+    }                                                                   \
+    result = rb_ary_new2(len);                                          \
+    for (i = 0; i < len; i++) {                                         \
+        rb_ary_push(result, finish(cmps + i));                          \
+        xfree(cmps[i].symbols);                                         \
+    }                                                                   \
+    xfree(cmps);                                                        \
+    return result;                                                      \
+}
+
+/*
+ * Defines type_best, which returns the best k comparisons of the pattern
+ * with the Array strings as [index, score] pairs, best first. Lower scores
+ * are better, unless descending is true. The prepare function gets the
+ * score to beat as the bound of the comparison, or an infinite one, and
+ * returns false, if the string can't beat it, without preparing anything.
+ * The ranking is released by an ensure clause, as an interrupt can raise
+ * out of the preparations and the comparisons.
+ */
+#define DEF_BEST(type)                                                  \
+typedef struct type##BestStruct {                                       \
+    type        *amatch;                                                \
+    VALUE       strings;                                                \
+    VALUE       options;                                                \
+    int         (*prepare) (type *amatch, VALUE string, VALUE options,  \
+        Comparison *cmp);                                               \
+    VALUE       (*finish) (Comparison *cmp);                            \
+    Ranking     *ranking;                                               \
+    Comparison  cmp;                                                    \
+} type##Best;                                                           \
+                                                                        \
+static VALUE type##_best_run(VALUE data)                                \
+{                                                                       \
+    type##Best *best = (type##Best *) data;                             \
+    Comparison *cmp = &best->cmp;                                       \
+    VALUE string, result;                                               \
+    long i, len = RARRAY(best->strings)->len;                           \
+                                                                        \
+    for (i = 0; i < len; i++) {                                         \
+        string = rb_ary_entry(best->strings, i);                        \
+        MEMZERO(cmp, Comparison, 1);                                    \
+        cmp->bound = ranking_cutoff(best->ranking);                     \
+        if (!best->prepare(best->amatch, string, best->options, cmp)) { \
+            continue;                                                   \
+        }                                                               \
+        compare(cmp, string, &best->amatch->stats, &best->amatch->busy, \
+            &best->amatch->workspace);                                  \
+        comparisons_release(cmp, 1);                                    \
+        ranking_offer(best->ranking, i, cmp->result);                   \
+    }                                                                   \
+    ranking_sort(best->ranking);                                        \
+    result = rb_ary_new2(best->ranking->len);                           \
+    for (i = 0; i < best->ranking->len; i++) {                          \
+        cmp->result = best->ranking->entries[i].score;                  \
+        rb_ary_push(result, rb_assoc_new(                               \
+            LONG2NUM(best->ranking->entries[i].index),                  \
+            best->finish(cmp)));                                        \
+    }                                                                   \
+    return result;                                                      \
+}                                                                       \
+                                                                        \
+static VALUE type##_best_finish(VALUE data)                             \
+{                                                                       \
+    type##Best *best = (type##Best *) data;                             \
+                                                                        \
+    comparisons_release(&best->cmp, 1);                                 \
+    ranking_destroy(best->ranking);                                     \
+    return Qnil;                                                        \
+}                                                                       \
+                                                                        \
+static VALUE type##_best(type *amatch, VALUE strings, VALUE k,          \
+    int descending, VALUE options,                                      \
+    int (*prepare) (type *amatch, VALUE string, VALUE options,          \
+        Comparison *cmp),                                               \
+    VALUE (*finish) (Comparison *cmp))                                  \
+{                                                                       \
+    type##Best best;                                                    \
+    long len, capacity = NUM2LONG(k);                                   \
+                                                                        \
+    if (capacity < 0) rb_raise(rb_eArgError, "k has to be >= 0");       \
+    check_strings(strings);                                             \
+    len = RARRAY(strings)->len;                                         \
+    best.amatch = amatch;                                               \
+    best.strings = strings;                                             \
+    best.options = options;                                             \
+    best.prepare = prepare;                                             \
+    best.finish = finish;                                               \
+    MEMZERO(&best.cmp, Comparison, 1);                                  \
+    best.ranking = Ranking_new(capacity < len ? capacity : len,         \
+        descending);                                                    \
+    return rb_ensure(type##_best_run, (VALUE) &best,                    \
+        type##_best_finish, (VALUE) &best);                             \
+}
+
+/*
+ * Defines type_select, which returns the comparisons of the pattern with
+ * the Array strings, whose scores are within bound, as [index, score]
+ * pairs, and type_rejected, the reader of the rejected counters. The
+ * prepare function also checks the cheap lower bounds of filter (see
+ * prefilter.c) for the comparison, and returns the number of the first
+ * stage, that rejects it, or 0. Only the comparisons, that survive all of
+ * them, are computed, and the rejections of each stage are counted. Scores
+ * have to be at most bound, or at least bound, if descending is true.
+ */
+#define DEF_SELECT(type)                                                \
+static VALUE type##_select(type *amatch, VALUE strings, double bound,   \
+    int descending, Prefilter *filter,                                  \
+    int (*prepare) (type *amatch, VALUE string, Prefilter *filter,      \
+        Comparison *cmp),                                               \
+    VALUE (*finish) (Comparison *cmp))                                  \
+{                                                                       \
+    Comparison *cmps;                                                   \
+    VALUE result, score;                                                \
+    long i, len = RARRAY(strings)->len;                                 \
+    int stage, status, state;                                           \
+                                                                        \
+    MEMZERO(amatch->rejected, long, PREFILTER_STAGES);                  \
+    cmps = ALLOC_N(Comparison, len);                                    \
+    MEMZERO(cmps, Comparison, len);                                     \
+    for (i = 0; i < len; i++) {                                         \
+        cmps[i].bound = bound;                                          \
+        stage = prepare(amatch, rb_ary_entry(strings, i), filter,       \
+            cmps + i);                                                  \
+        if (stage > 0) {                                                \
+            amatch->rejected[stage - 1]++;                              \
+            cmps[i].kernel = NULL;                                      \
+            cmps[i].result = descending ? -HUGE_VAL : HUGE_VAL;         \
+        }                                                               \
+    }                                                                   \
+    prefilter_release(filter);                                          \
+    status = compare_batch_protected(cmps, len, strings, &amatch->stats,\
+        &amatch->busy, &amatch->workspace, &state);                     \
+    if (state) {                                                        \
+        comparisons_release(cmps, len);                                 \
+        xfree(cmps);                                                    \
+        rb_jump_tag(state);                                             \
+    }                                                                   \
+    result = rb_ary_new();                                              \
+    for (i = 0; i < len; i++) {                                         \
+        if (status == 0) {                                              \
+            score = finish(cmps + i);                                   \
+            if (!NIL_P(score)) {                                        \
+                rb_ary_push(result, rb_assoc_new(LONG2NUM(i), score));  \
+            }                                                           \
+        }                                                               \
+        xfree(cmps[i].symbols);                                         \
+    }                                                                   \
+    xfree(cmps);                                                        \
+    if (status != 0) rb_raise(rb_eNoMemError, "failed to allocate memory"); \
+    return result;                                                      \
+}                                                                       \
+static VALUE rb_##type##_rejected(VALUE self)                           \
+{                                                                       \
+    GET_STRUCT(type)                                                    \
+    return rb_ary_new3(PREFILTER_STAGES, LONG2NUM(amatch->rejected[0]), \
+        LONG2NUM(amatch->rejected[1]), LONG2NUM(amatch->rejected[2]));  \
 }
 
 #define DEF_RB_READER(type, function, name, converter)              \
@@ -142,1398 +461,5572 @@ VALUE function(VALUE self, VALUE value)                                 \
 #define BOOL2C(obj) (obj == Qtrue)
 #define C2BOOL(obj) (obj ? Qtrue : Qfalse)
 
+/*
+ * In codepoint mode, matchers compare the symbols of the characters of the
+ * pattern and the strings instead of their bytes (see codepoints.c). The
+ * pattern is translated, when it's compiled, a string, unless it's ASCII,
+ * into the symbols of its comparison, which own them.
+ */
+#define SYMBOLS(amatch) \
+    ((amatch)->symbols ? (amatch)->symbols->pattern : (amatch)->pattern)
+#define SYMBOLS_LEN(amatch) \
+    ((amatch)->symbols ? (amatch)->symbols->len : (amatch)->pattern_len)
+
+#define DONT_OPTIMIZE                                                   \
+    a_ptr = SYMBOLS(amatch);                                            \
+    a_len = SYMBOLS_LEN(amatch);                                        \
+    b_ptr = RSTRING(string)->ptr;                                       \
+    b_len = RSTRING(string)->len;                                       \
+    if (amatch->symbols && !codepoints_ascii(b_ptr, b_len)) {           \
+        cmp->symbols = ALLOC_N(char, b_len);                            \
+        b_len = (int) codepoints_translate(amatch->symbols, b_ptr,      \
+            b_len, cmp->symbols);                                       \
+        b_ptr = cmp->symbols;                                           \
+    }
+
 #define OPTIMIZE_TIME                                   \
-    if (amatch->pattern_len < RSTRING(string)->len) {   \
-        a_ptr = amatch->pattern;                        \
-        a_len = amatch->pattern_len;                    \
-        b_ptr = RSTRING(string)->ptr;                   \
-        b_len = RSTRING(string)->len;                   \
-    } else {                                            \
-        a_ptr = RSTRING(string)->ptr;                   \
-        a_len = RSTRING(string)->len;                   \
-        b_ptr = amatch->pattern;                        \
-        b_len = amatch->pattern_len;                    \
+    DONT_OPTIMIZE                                       \
+    if (a_len >= b_len) {                               \
+        char *t_ptr = a_ptr;                            \
+        int t_len = a_len;                              \
+        a_ptr = b_ptr;                                  \
+        a_len = b_len;                                  \
+        b_ptr = t_ptr;                                  \
+        b_len = t_len;                                  \
     }
 
-#define DONT_OPTIMIZE                                   \
-        a_ptr = amatch->pattern;                        \
-        a_len = amatch->pattern_len;                    \
-        b_ptr = RSTRING(string)->ptr;                   \
-        b_len = RSTRING(string)->len;                   \
+/*
+ * Number of native threads used to compare the pattern with an Array of
+ * strings, see Amatch.threads=.
+ */
+static int amatch_threads = 1;
 
 /*
- * C structures of the Amatch classes
+ * Comparisons of the pattern with one string are computed by kernels, that
+ * only get to see a Comparison (see comparison.h): the strings, the scratch
+ * memory and the matcher are all gathered beforehand, by a prepare function.
+ * Kernels don't touch Ruby objects or allocate memory, so long comparisons
+ * can run without holding the global interpreter lock. Afterwards a finish
+ * function turns the result into a Ruby object.
  */
 
-typedef struct GeneralStruct {
-    char        *pattern;
-    int         pattern_len;
-} General;
+#define SET_COMPARISON(cmp, kernel_function, size, estimate)   \
+    (cmp)->amatch = amatch;                                     \
+    (cmp)->a_ptr = a_ptr;                                       \
+    (cmp)->a_len = a_len;                                       \
+    (cmp)->b_ptr = b_ptr;                                       \
+    (cmp)->b_len = b_len;                                       \
+    (cmp)->kernel = kernel_function;                            \
+    (cmp)->scratch_size = size;                                 \
+    (cmp)->cost = estimate;
 
-DEF_ALLOCATOR(General)
-DEF_PATTERN_ACCESSOR(General)
-DEF_ITERATE_STRINGS(General)
+/*
+ * The similarity of empty strings is known without running a kernel.
+ */
+#define SIMILAR_EMPTY_STRINGS(cmp)                  \
+    if (a_len == 0 || b_len == 0) {                 \
+        (cmp)->result = a_len == b_len ? 1.0 : 0.0; \
+        return;                                     \
+    }
 
-typedef struct SellersStruct {
-    char        *pattern;
-    int         pattern_len;
-    double      substitution;
-    double      deletion;
-    double      insertion;
-} Sellers;
+#define GET_COMPARISON(type)                    \
+    Comparison *cmp = (Comparison *) data;      \
+    type *amatch = (type *) cmp->amatch;
 
-DEF_ALLOCATOR(Sellers)
-DEF_PATTERN_ACCESSOR(Sellers)
-DEF_ITERATE_STRINGS(Sellers)
+#define GET_COMPARISON_STRINGS                  \
+    char *a_ptr = cmp->a_ptr;                   \
+    int a_len = cmp->a_len;                     \
+    char *b_ptr = cmp->b_ptr;                   \
+    int b_len = cmp->b_len;
 
-static void Sellers_reset_weights(Sellers *self)
+/*
+ * Comparisons estimated to take at least this many elementary steps (DP
+ * cells, bit vector words or characters) release the global interpreter
+ * lock while they are computed, so other threads can run meanwhile.
+ *
+ * Ruby only handles an interrupt of such a thread (Thread#kill,
+ * Thread#raise or a signal), once it holds the lock again. Batches of
+ * comparisons are canceled by their unblocking function, and stop after the
+ * comparisons they're computing. Scans of long texts hold the lock again
+ * after every chunk. A single comparison, alignment or pattern set search
+ * can't be interrupted, though: it runs to its end, before the interrupt is
+ * handled.
+ */
+#define UNBLOCKING_COST (1 << 20)
+
+#ifdef HAVE_RB_THREAD_CALL_WITHOUT_GVL
+typedef struct UnblockedComparisonStruct {
+    Comparison  *cmp;
+    long        len;
+    int         *busy;
+    Workspace   *workspace;
+    char        *copy;
+    void        *scratch;
+    int         status;
+    volatile int canceled;
+} UnblockedComparison;
+
+/*
+ * The kernels don't look for interrupts, so a single comparison can't be
+ * canceled (see UNBLOCKING_COST).
+ */
+static VALUE comparison_run_unblocked(VALUE data)
 {
-    self->substitution = 1.0;
-    self->deletion     = 1.0;
-    self->insertion    = 1.0;
+    UnblockedComparison *run = (UnblockedComparison *) data;
+    rb_thread_call_without_gvl(run->cmp->kernel, run->cmp, NULL, NULL);
+    return Qnil;
 }
 
-typedef struct PairDistanceStruct {
-    char        *pattern;
-    int         pattern_len;
-    PairArray   *pattern_pair_array;
-} PairDistance;
+static void *comparisons_run_without_gvl(void *data)
+{
+    UnblockedComparison *run = (UnblockedComparison *) data;
+    run->status = comparisons_run(run->cmp, run->len, amatch_threads,
+        run->workspace, &run->canceled);
+    return NULL;
+}
 
-DEF_ALLOCATOR(PairDistance)
-DEF_PATTERN_ACCESSOR(PairDistance)
+static void comparisons_cancel(void *data)
+{
+    ((UnblockedComparison *) data)->canceled = 1;
+}
 
-typedef struct JaroStruct {
-    char *pattern;
-    int   pattern_len;
-    int   ignore_case;
-} Jaro;
+/*
+ * A batch, that was canceled, is left by the exception of the interrupt.
+ * If there is none, because a trap handler took care of a signal, say, the
+ * batch is computed again.
+ */
+static VALUE comparisons_run_unblocked(VALUE data)
+{
+    UnblockedComparison *run = (UnblockedComparison *) data;
+
+    do {
+        run->canceled = 0;
+        rb_thread_call_without_gvl(comparisons_run_without_gvl, (void *) data,
+            comparisons_cancel, (void *) data);
+    } while (run->status == 1);
+    return Qnil;
+}
 
-DEF_ALLOCATOR(Jaro)
-DEF_PATTERN_ACCESSOR(Jaro)
-DEF_ITERATE_STRINGS(Jaro)
+static VALUE comparison_finish_unblocked(VALUE data)
+{
+    UnblockedComparison *run = (UnblockedComparison *) data;
+    (*run->busy)--;
+    xfree(run->copy);
+    xfree(run->scratch);
+    return Qnil;
+}
+#endif
 
-typedef struct JaroWinklerStruct {
-    char *pattern;
-    int   pattern_len;
-    int   ignore_case;
-    float scaling_factor;
-} JaroWinkler;
+/*
+ * The workspace of a matcher may only be used by one comparison (or batch)
+ * at a time. While the matcher is busy with a comparison without the global
+ * interpreter lock, other comparisons allocate their own scratch memory.
+ */
+#define FREE_WORKSPACE(busy, workspace) (*(busy) ? NULL : (workspace))
 
-DEF_ALLOCATOR(JaroWinkler)
-DEF_PATTERN_ACCESSOR(JaroWinkler)
-DEF_ITERATE_STRINGS(JaroWinkler)
+/*
+ * Computes the prepared comparison cmp with its kernel, using workspace as
+ * its scratch memory. If the estimated cost is high enough, the kernel runs
+ * without the global interpreter lock. In that case the matcher is marked
+ * as busy, so its pattern can't be changed, and string is copied, unless
+ * it's frozen or the comparison has its symbols. string may be nil for
+ * kernels, that don't look at the strings of the comparison.
+ */
+static void compare_kernel(Comparison *cmp, VALUE string, int *busy,
+    Workspace *workspace)
+{
+    void *scratch = NULL;
+
+    workspace = FREE_WORKSPACE(busy, workspace);
+    cmp->scratch = NULL;
+    if (cmp->scratch_size > 0) {
+        if (workspace) {
+            cmp->scratch = workspace_reserve(workspace, cmp->scratch_size);
+            if (!cmp->scratch) rb_memerror();
+        } else {
+            cmp->scratch = scratch = ALLOC_N(char, cmp->scratch_size);
+        }
+    }
+#ifdef HAVE_RB_THREAD_CALL_WITHOUT_GVL
+    if (cmp->cost >= UNBLOCKING_COST) {
+        UnblockedComparison run;
+        run.cmp = cmp;
+        run.len = 1;
+        run.busy = busy;
+        run.workspace = NULL;
+        run.scratch = scratch;
+        run.copy = NULL;
+        if (!NIL_P(string) && !OBJ_FROZEN(string) && !cmp->symbols) {
+            run.copy = ALLOC_N(char, RSTRING(string)->len);
+            MEMCPY(run.copy, RSTRING(string)->ptr, char,
+                RSTRING(string)->len);
+            if (cmp->a_ptr == RSTRING(string)->ptr) {
+                cmp->a_ptr = run.copy;
+            } else {
+                cmp->b_ptr = run.copy;
+            }
+        }
+        (*busy)++;
+        rb_ensure(comparison_run_unblocked, (VALUE) &run,
+            comparison_finish_unblocked, (VALUE) &run);
+        return;
+    }
+#endif
+    cmp->kernel(cmp);
+    xfree(scratch);
+}
 
 /*
- * Levenshtein edit distances are computed here:
+ * Computes the len prepared comparisons in cmps, one for every string of
+ * the Array strings (or nil, as for compare). If cost, the sum of their
+ * estimated costs, is high enough, they are computed by Amatch.threads
+ * native threads without the global interpreter lock, after copying the
+ * strings into one buffer. Otherwise they are computed one after another. The
+ * calling thread uses workspace as its scratch memory. Returns 0 on
+ * success, or -1, if no scratch memory could be allocated.
  */
+static int compare_batch_kernels(Comparison *cmps, long len, VALUE strings,
+    double cost, int *busy, Workspace *workspace)
+{
+    long i;
+
+#ifdef HAVE_RB_THREAD_CALL_WITHOUT_GVL
+    if (cost >= UNBLOCKING_COST) {
+        UnblockedComparison run;
+        VALUE string;
+        long size = 0;
+
+        run.cmp = cmps;
+        run.len = len;
+        run.busy = busy;
+        run.workspace = FREE_WORKSPACE(busy, workspace);
+        run.scratch = NULL;
+        run.copy = NULL;
+        run.status = 0;
+        if (!NIL_P(strings)) {
+            for (i = 0; i < len; i++) {
+                size += RSTRING(rb_ary_entry(strings, i))->len;
+            }
+            run.copy = ALLOC_N(char, size > 0 ? size : 1);
+            for (i = 0, size = 0; i < len; i++) {
+                char *copy = run.copy + size;
+                string = rb_ary_entry(strings, i);
+                MEMCPY(copy, RSTRING(string)->ptr, char, RSTRING(string)->len);
+                size += RSTRING(string)->len;
+                if (!cmps[i].kernel || cmps[i].symbols) continue;
+                if (cmps[i].a_ptr == RSTRING(string)->ptr) {
+                    cmps[i].a_ptr = copy;
+                } else {
+                    cmps[i].b_ptr = copy;
+                }
+            }
+        }
+        (*busy)++;
+        rb_ensure(comparisons_run_unblocked, (VALUE) &run,
+            comparison_finish_unblocked, (VALUE) &run);
+        return run.status;
+    }
+#endif
+    return comparisons_run(cmps, len, 1, FREE_WORKSPACE(busy, workspace),
+        NULL);
+}
 
-#define COMPUTE_LEVENSHTEIN_DISTANCE                                        \
-    for (i = 1, c = 0, p = 1; i <= a_len; i++) {                            \
-        c = i % 2;                      /* current row */                   \
-        p = (i + 1) % 2;                /* previous row */                  \
-        v[c][0] = i;                    /* first column */                  \
-        for (j = 1; j <= b_len; j++) {                                      \
-            /* Bellman's principle of optimality: */                        \
-            weight = v[p][j - 1] + (a_ptr[i - 1] == b_ptr[j - 1] ? 0 : 1);  \
-            if (weight > v[p][j] + 1) {                                     \
-                 weight = v[p][j] + 1;                                      \
-            }                                                               \
-            if (weight > v[c][j - 1] + 1) {                                 \
-                weight = v[c][j - 1] + 1;                                   \
-            }                                                               \
-            v[c][j] = weight;                                               \
-        }                                                                   \
-        p = c;                                                              \
-        c = (c + 1) % 2;                                                    \
+/*
+ * The kernels are always entered by compare and compare_batch, which fire
+ * the probes (see stats.h) and record the calls in stats, if
+ * Amatch.collect_stats is on.
+ */
+static void compare(Comparison *cmp, VALUE string, Stats *stats, int *busy,
+    Workspace *workspace)
+{
+    int enabled = stats_enabled;
+    uint64_t start = 0;
+
+    if (!cmp->kernel) return;
+    STATS_PROBE_ENTRY(stats->class_name, 1, cmp->cost);
+    if (enabled) start = stats_clock();
+    compare_kernel(cmp, string, busy, workspace);
+    STATS_PROBE_RETURN(stats->class_name, 1);
+    if (enabled) {
+        stats_record(stats, 1, cmp->cost, NIL_P(string) ?
+            0.0 : (double) RSTRING(string)->len, stats_clock() - start);
     }
+}
 
-static VALUE Levenshtein_match(General *amatch, VALUE string)
+static int compare_batch(Comparison *cmps, long len, VALUE strings,
+    Stats *stats, int *busy, Workspace *workspace)
 {
-    VALUE result;
-    char *a_ptr, *b_ptr;
-    int a_len, b_len;
-    int *v[2], weight;
-    int  i, j, c, p;
+    int enabled = stats_enabled, status;
+    uint64_t start = 0;
+    double cost = 0.0, bytes = 0.0;
+    long i, n = 0;
+
+    for (i = 0; i < len; i++) {
+        if (!cmps[i].kernel) continue;
+        cost += cmps[i].cost;
+        n++;
+        if (enabled && !NIL_P(strings)) {
+            bytes += RSTRING(rb_ary_entry(strings, i))->len;
+        }
+    }
+    STATS_PROBE_ENTRY(stats->class_name, n, cost);
+    if (enabled) start = stats_clock();
+    status = compare_batch_kernels(cmps, len, strings, cost, busy,
+        workspace);
+    STATS_PROBE_RETURN(stats->class_name, n);
+    if (enabled && status == 0) {
+        stats_record(stats, n, cost, bytes, stats_clock() - start);
+    }
+    return status;
+}
 
-    Check_Type(string, T_STRING);
-    DONT_OPTIMIZE
+/*
+ * An interrupt of the thread, while a kernel runs without the global
+ * interpreter lock, raises an exception out of compare and compare_batch.
+ * The protected variants store its tag in *state instead, so the caller can
+ * release its comparisons, before it raises it again by rb_jump_tag.
+ */
+typedef struct ProtectedCompareStruct {
+    Comparison  *cmps;
+    long        len;            /* -1 for compare */
+    VALUE       strings;
+    Stats       *stats;
+    int         *busy;
+    Workspace   *workspace;
+    int         status;
+} ProtectedCompare;
+
+static VALUE compare_protected_run(VALUE data)
+{
+    ProtectedCompare *args = (ProtectedCompare *) data;
 
-    v[0] = ALLOC_N(int, b_len + 1);
-    v[1] = ALLOC_N(int, b_len + 1);
-    for (i = 0; i <= b_len; i++) {
-        v[0][i] = i;
-        v[1][i] = i;
+    if (args->len < 0) {
+        compare(args->cmps, args->strings, args->stats, args->busy,
+            args->workspace);
+    } else {
+        args->status = compare_batch(args->cmps, args->len, args->strings,
+            args->stats, args->busy, args->workspace);
     }
+    return Qnil;
+}
 
-    COMPUTE_LEVENSHTEIN_DISTANCE
+static void compare_protected(Comparison *cmp, VALUE string, Stats *stats,
+    int *busy, Workspace *workspace, int *state)
+{
+    ProtectedCompare args;
+
+    args.cmps = cmp;
+    args.len = -1;
+    args.strings = string;
+    args.stats = stats;
+    args.busy = busy;
+    args.workspace = workspace;
+    args.status = 0;
+    rb_protect(compare_protected_run, (VALUE) &args, state);
+}
 
-    result = INT2FIX(v[p][b_len]);
+static int compare_batch_protected(Comparison *cmps, long len,
+    VALUE strings, Stats *stats, int *busy, Workspace *workspace, int *state)
+{
+    ProtectedCompare args;
+
+    args.cmps = cmps;
+    args.len = len;
+    args.strings = strings;
+    args.stats = stats;
+    args.busy = busy;
+    args.workspace = workspace;
+    args.status = 0;
+    rb_protect(compare_protected_run, (VALUE) &args, state);
+    return args.status;
+}
 
-    free(v[0]);
-    free(v[1]);
+/*
+ * Releases the memory the prepared comparisons in cmps own, but not cmps.
+ */
+static void comparisons_release(Comparison *cmps, long len)
+{
+    long i;
 
-    return result;
+    for (i = 0; i < len; i++) {
+        pair_array_destroy(cmps[i].b_pairs);
+        xfree(cmps[i].symbols);
+        cmps[i].b_pairs = NULL;
+        cmps[i].symbols = NULL;
+    }
 }
 
-static VALUE Levenshtein_similar(General *amatch, VALUE string)
+/*
+ * Scans of whole texts don't go through compare, they call scan_start
+ * before, and scan_finish after they're done, to fire the probes and record
+ * the call in stats. started is 0, unless Amatch.collect_stats is on.
+ */
+static uint64_t scan_start(Stats *stats, double cells)
 {
-    VALUE result;
-    char *a_ptr, *b_ptr;
-    int a_len, b_len;
-    int *v[2], weight;
-    int  i, j, c, p;
+    STATS_PROBE_ENTRY(stats->class_name, 1, cells);
+    return stats_enabled ? stats_clock() : 0;
+}
 
-    Check_Type(string, T_STRING);
-    DONT_OPTIMIZE
-    if (a_len == 0 && b_len == 0) return rb_float_new(1.0);
-    if (a_len == 0 || b_len == 0) return rb_float_new(0.0);
-    v[0] = ALLOC_N(int, b_len + 1);
-    v[1] = ALLOC_N(int, b_len + 1);
-    for (i = 0; i <= b_len; i++) {
-        v[0][i] = i;
-        v[1][i] = i;
+static void scan_finish(Stats *stats, uint64_t started, double cells,
+    double bytes)
+{
+    STATS_PROBE_RETURN(stats->class_name, 1);
+    if (started) {
+        stats_record(stats, 1, cells, bytes, stats_clock() - started);
     }
+}
 
-    COMPUTE_LEVENSHTEIN_DISTANCE
-
-    if (b_len > a_len) {
-        result = rb_float_new(1.0 - ((double) v[p][b_len]) / b_len);
-    } else {
-        result = rb_float_new(1.0 - ((double) v[p][b_len]) / a_len);
+/*
+ * Raises a TypeError, unless strings is an Array of Strings.
+ */
+static void check_strings(VALUE strings)
+{
+    long i;
+
+    Check_Type(strings, T_ARRAY);
+    for (i = 0; i < RARRAY(strings)->len; i++) {
+        VALUE string = rb_ary_entry(strings, i);
+        if (TYPE(string) != T_STRING) {
+            rb_raise(rb_eTypeError,
+                "array has to contain only strings (%s given)",
+                NIL_P(string) ?
+                    "NilClass" :
+                    rb_class2name(CLASS_OF(string)));
+        }
     }
-    free(v[0]);
-    free(v[1]);
-    return result;
 }
 
-static VALUE Levenshtein_search(General *amatch, VALUE string)
+/*
+ * Raises an ArgumentError, if pattern has too many distinct non-ASCII
+ * characters to be translated into symbols (see codepoints.c).
+ */
+static void check_codepoints(VALUE pattern)
 {
-    VALUE result;
-    char *a_ptr, *b_ptr;
-    int a_len, b_len;
-    int *v[2], weight, min;
-    int  i, j, c, p;
+    if (codepoints_distinct(RSTRING(pattern)->ptr, RSTRING(pattern)->len) >
+            CODEPOINTS_MAX) {
+        rb_raise(rb_eArgError,
+            "pattern has more than %d distinct non-ASCII characters",
+            CODEPOINTS_MAX);
+    }
+}
 
-    Check_Type(string, T_STRING);
-    DONT_OPTIMIZE
+/*
+ * Returns the length of string in characters, if symbols isn't NULL, and in
+ * bytes otherwise, like the comparisons see it.
+ */
+static long string_length(Codepoints *symbols, VALUE string)
+{
+    if (!symbols || codepoints_ascii(RSTRING(string)->ptr,
+                RSTRING(string)->len)) {
+        return RSTRING(string)->len;
+    }
+    return codepoints_count(RSTRING(string)->ptr, RSTRING(string)->len);
+}
 
-    v[0] = ALLOC_N(int, b_len + 1);
-    v[1] = ALLOC_N(int, b_len + 1);
-    MEMZERO(v[0], int, b_len + 1);
-    MEMZERO(v[1], int, b_len + 1);
+/*
+ * Finish functions for results, that only need to be boxed. A result beyond
+ * the bound of a bounded comparison becomes nil.
+ */
 
-    COMPUTE_LEVENSHTEIN_DISTANCE
+static VALUE finish_int(Comparison *cmp)
+{
+    return INT2FIX((int) cmp->result);
+}
 
-    for (i = 0, min = a_len; i <= b_len; i++) {
-        if (v[p][i] < min) min = v[p][i];
-    }
+static VALUE finish_float(Comparison *cmp)
+{
+    return rb_float_new(cmp->result);
+}
 
-    result = INT2FIX(min);
+static VALUE finish_bounded_int(Comparison *cmp)
+{
+    return cmp->result > cmp->bound ? Qnil : INT2FIX((int) cmp->result);
+}
 
-    free(v[0]);
-    free(v[1]);
-    
-    return result;
+static VALUE finish_bounded_float(Comparison *cmp)
+{
+    return cmp->result > cmp->bound ? Qnil : rb_float_new(cmp->result);
 }
 
+/*
+ * For similarities, that have to be at least the bound.
+ */
+static VALUE finish_min_float(Comparison *cmp)
+{
+    return cmp->result < cmp->bound ? Qnil : rb_float_new(cmp->result);
+}
 
 /*
- * Sellers edit distances are computed here:
+ * Matchers, that can compare characters instead of bytes, have a codepoints
+ * flag, and keep their pattern translated into symbols, while it's set (see
+ * DONT_OPTIMIZE). Their compile and release hooks translate and free it
+ * with these, and setting codepoints compiles the pattern again.
  */
+#define COMPILE_SYMBOLS(amatch)                                 \
+    if ((amatch)->codepoints) {                                 \
+        (amatch)->symbols = Codepoints_new((amatch)->pattern,   \
+            (amatch)->pattern_len);                             \
+    }
 
-#define COMPUTE_SELLERS_DISTANCE                                            \
-    for (i = 1, c = 0, p = 1; i <= a_len; i++) {                            \
-        c = i % 2;                      /* current row */                   \
-        p = (i + 1) % 2;                /* previous row */                  \
-        v[c][0] = i * amatch->deletion; /* first column */                  \
-        for (j = 1; j <= b_len; j++) {                                      \
-            /* Bellman's principle of optimality: */                        \
-            weight = v[p][j - 1] +                                          \
-                (a_ptr[i - 1] == b_ptr[j - 1] ? 0 : amatch->substitution);  \
-            if (weight > v[p][j] + amatch->insertion) {                     \
-                 weight = v[p][j] + amatch->insertion;                      \
-            }                                                               \
-            if (weight > v[c][j - 1] + amatch->deletion) {                  \
-                weight = v[c][j - 1] + amatch->deletion;                    \
-            }                                                               \
-            v[c][j] = weight;                                               \
-        }                                                                   \
-        p = c;                                                              \
-        c = (c + 1) % 2;                                                    \
-    }
+#define RELEASE_SYMBOLS(amatch)             \
+    codepoints_destroy((amatch)->symbols);  \
+    (amatch)->symbols = NULL;
+
+#define DEF_CODEPOINTS(type)                                            \
+static VALUE rb_##type##_codepoints(VALUE self)                         \
+{                                                                       \
+    GET_STRUCT(type)                                                    \
+    return C2BOOL(amatch->codepoints);                                  \
+}                                                                       \
+static VALUE rb_##type##_codepoints_set(VALUE self, VALUE value)        \
+{                                                                       \
+    GET_STRUCT(type)                                                    \
+    if (amatch->busy) {                                                 \
+        rb_raise(rb_eRuntimeError,                                      \
+            "can't modify codepoints while matching");                  \
+    }                                                                   \
+    CAST2BOOL(value);                                                   \
+    if (BOOL2C(value)) {                                                \
+        check_codepoints(rb_str_new(amatch->pattern,                    \
+            amatch->pattern_len));                                      \
+    }                                                                   \
+    amatch->codepoints = BOOL2C(value);                                 \
+    type##_pattern_release(amatch);                                     \
+    type##_pattern_compile(amatch);                                     \
+    return Qnil;                                                        \
+}
 
-static VALUE Sellers_match(Sellers *amatch, VALUE string)
+/*
+ * Returns the counters of the stats entry e as a Hash, see Amatch.stats.
+ */
+static VALUE stats_entry_hash(const StatsEntry *e)
 {
-    VALUE result;
-    char *a_ptr, *b_ptr;
-    int a_len, b_len;
-    double *v[2], weight;
-    int  i, j, c, p;
+    VALUE hash = rb_hash_new(), histogram = rb_ary_new();
+    int i;
+
+    rb_hash_aset(hash, ID2SYM(rb_intern("calls")), ULONG2NUM(e->calls));
+    rb_hash_aset(hash, ID2SYM(rb_intern("comparisons")),
+        ULONG2NUM(e->comparisons));
+    rb_hash_aset(hash, ID2SYM(rb_intern("max_batch")),
+        ULONG2NUM(e->max_batch));
+    rb_hash_aset(hash, ID2SYM(rb_intern("cells")), rb_dbl2big(e->cells));
+    rb_hash_aset(hash, ID2SYM(rb_intern("bytes")), rb_dbl2big(e->bytes));
+    rb_hash_aset(hash, ID2SYM(rb_intern("seconds")),
+        rb_float_new(e->nanoseconds / 1e9));
+    for (i = 0; i < STATS_BUCKETS; i++) {
+        if (e->histogram[i] == 0) continue;
+        rb_ary_push(histogram, rb_assoc_new(
+            rb_float_new(stats_bucket_limit(i) / 1e9),
+            ULONG2NUM(e->histogram[i])));
+    }
+    rb_hash_aset(hash, ID2SYM(rb_intern("histogram")), histogram);
+    return hash;
+}
 
-    Check_Type(string, T_STRING);
-    DONT_OPTIMIZE
+/*
+ * Returns the entries of stats as a Hash from the names of their methods
+ * to their counters.
+ */
+static VALUE stats_methods_hash(const Stats *stats)
+{
+    VALUE hash = rb_hash_new();
+    int i;
 
-    v[0] = ALLOC_N(double, b_len + 1);
-    v[1] = ALLOC_N(double, b_len + 1);
-    for (i = 0; i <= b_len; i++) {
-        v[0][i] = i * amatch->deletion;
-        v[1][i] = i * amatch->deletion;
+    for (i = 0; i < stats->len; i++) {
+        rb_hash_aset(hash, ID2SYM(stats->entries[i].method),
+            stats_entry_hash(stats->entries + i));
     }
+    return hash;
+}
 
-    COMPUTE_SELLERS_DISTANCE
+#define DEF_STATS(type)                                                 \
+static VALUE rb_##type##_stats(VALUE self)                              \
+{                                                                       \
+    GET_STRUCT(type)                                                    \
+    return stats_methods_hash(&amatch->stats);                          \
+}                                                                       \
+static VALUE rb_##type##_reset_stats(VALUE self)                        \
+{                                                                       \
+    GET_STRUCT(type)                                                    \
+    stats_release(&amatch->stats);                                      \
+    return Qnil;                                                        \
+}
 
-    result = rb_float_new(v[p][b_len]);
-    free(v[0]);
-    free(v[1]);
-    return result;
+/*
+ * C structures of the Amatch classes
+ */
+
+typedef struct GeneralStruct {
+    char        *pattern;
+    int         pattern_len;
+    int         busy;
+    Workspace   workspace;
+    Stats       stats;
+    int         codepoints;
+    Codepoints  *symbols;
+    PatternMask *pattern_mask;
+    long        rejected[PREFILTER_STAGES];     /* by the last select */
+} General;
+
+static void General_pattern_compile(General *amatch)
+{
+    COMPILE_SYMBOLS(amatch)
+    amatch->pattern_mask = PatternMask_new(SYMBOLS(amatch),
+        SYMBOLS_LEN(amatch));
 }
 
-static VALUE Sellers_similar(Sellers *amatch, VALUE string)
+static void General_pattern_release(General *amatch)
 {
-    VALUE result;
-    char *a_ptr, *b_ptr;
-    int a_len, b_len;
-    double *v[2], weight, max_weight;
-    int  i, j, c, p;
+    RELEASE_SYMBOLS(amatch)
+    pattern_mask_destroy(amatch->pattern_mask);
+    amatch->pattern_mask = NULL;
+}
 
-    if (amatch->insertion >= amatch->deletion) {
-        if (amatch->substitution >= amatch->insertion) {
-            max_weight = amatch->substitution;
-        } else {
-            max_weight = amatch->insertion;
-        }
-    } else {
-        if (amatch->substitution >= amatch->deletion) {
-            max_weight = amatch->substitution;
-        } else {
-            max_weight = amatch->deletion;
-        }
-    }
-    
-    Check_Type(string, T_STRING);
-    DONT_OPTIMIZE
-    if (a_len == 0 && b_len == 0) return rb_float_new(1.0);
-    if (a_len == 0 || b_len == 0) return rb_float_new(0.0);
-    v[0] = ALLOC_N(double, b_len + 1);
-    v[1] = ALLOC_N(double, b_len + 1);
-    for (i = 0; i <= b_len; i++) {
-        v[0][i] = i * amatch->deletion;
-        v[1][i] = i * amatch->deletion;
-    }
+static size_t General_pattern_memsize(const General *amatch)
+{
+    if (!amatch->pattern_mask) return 0;
+    return sizeof(PatternMask) + codepoints_memsize(amatch->symbols) +
+        256 * amatch->pattern_mask->words * sizeof(uint64_t);
+}
 
-    COMPUTE_SELLERS_DISTANCE
+DEF_ALLOCATOR(General)
+DEF_STATS(General)
+DEF_PATTERN_ACCESSOR(General)
+DEF_CODEPOINTS(General)
+DEF_ITERATE_STRINGS(General)
+DEF_BEST(General)
+DEF_SELECT(General)
 
-    if (b_len > a_len) {
-        result = rb_float_new(1.0 - v[p][b_len] / (b_len * max_weight));
-    } else {
-        result = rb_float_new(1.0 - v[p][b_len] / (a_len * max_weight));
-    }
-    free(v[0]);
-    free(v[1]);
-    return result;
-}
+typedef struct SellersStruct {
+    char        *pattern;
+    int         pattern_len;
+    int         busy;
+    Workspace   workspace;
+    Stats       stats;
+    int         codepoints;
+    Codepoints  *symbols;
+    double      substitution;
+    double      deletion;
+    double      insertion;
+    long        rejected[PREFILTER_STAGES];
+} Sellers;
 
-static VALUE Sellers_search(Sellers *amatch, VALUE string)
+static void Sellers_pattern_compile(Sellers *amatch)
 {
-    VALUE result;
-    char *a_ptr, *b_ptr;
-    int a_len, b_len;
-    double *v[2], weight, min;
-    int  i, j, c, p;
+    COMPILE_SYMBOLS(amatch)
+}
 
-    Check_Type(string, T_STRING);
-    DONT_OPTIMIZE
+static void Sellers_pattern_release(Sellers *amatch)
+{
+    RELEASE_SYMBOLS(amatch)
+}
 
-    v[0] = ALLOC_N(double, b_len + 1);
-    v[1] = ALLOC_N(double, b_len + 1);
-    MEMZERO(v[0], double, b_len + 1);
-    MEMZERO(v[1], double, b_len + 1);
+static size_t Sellers_pattern_memsize(const Sellers *amatch)
+{
+    return codepoints_memsize(amatch->symbols);
+}
 
-    COMPUTE_SELLERS_DISTANCE
+DEF_ALLOCATOR(Sellers)
+DEF_STATS(Sellers)
+DEF_PATTERN_ACCESSOR(Sellers)
+DEF_CODEPOINTS(Sellers)
+DEF_ITERATE_STRINGS(Sellers)
+DEF_BEST(Sellers)
+DEF_SELECT(Sellers)
 
-    for (i = 0, min = a_len; i <= b_len; i++) {
-        if (v[p][i] < min) min = v[p][i];
-    }
-    result = rb_float_new(min);
-    free(v[0]);
-    free(v[1]);
-    
-    return result;
+static void Sellers_reset_weights(Sellers *self)
+{
+    self->substitution = 1.0;
+    self->deletion     = 1.0;
+    self->insertion    = 1.0;
 }
 
+typedef struct PairDistanceStruct {
+    char        *pattern;
+    int         pattern_len;
+    int         busy;
+    Workspace   workspace;
+    Stats       stats;
+    int         codepoints;     /* always false, pairs are made of bytes */
+    PairCounts  *pattern_pairs;
+    char        *pattern_pairs_key;
+    int         pattern_pairs_key_len;
+} PairDistance;
+
 /*
- * Pair distances are computed here:
+ * The pairs of the pattern depend on how it was split into tokens, so they
+ * are computed when they are needed, see PairDistance_pattern_pairs.
  */
+static void PairDistance_pattern_compile(PairDistance *amatch) {}
 
-static VALUE PairDistance_match(
-        PairDistance *amatch, VALUE string, VALUE regexp, int use_regexp)
+static void PairDistance_pattern_release(PairDistance *amatch)
 {
-    double result;
-    VALUE tokens;
-    PairArray *pair_array;
-    
-    Check_Type(string, T_STRING);
-    if (!NIL_P(regexp) || use_regexp) {
-        tokens = rb_funcall(
-            rb_str_new(amatch->pattern, amatch->pattern_len),
-            id_split, 1, regexp
-        );
-        if (!amatch->pattern_pair_array) {
-            amatch->pattern_pair_array = PairArray_new(tokens);
-        } else {
-            pair_array_reactivate(amatch->pattern_pair_array);
-        }
-        tokens = rb_funcall(string, id_split, 1, regexp);
-        pair_array = PairArray_new(tokens);
-    } else {
-        VALUE tmp = rb_str_new(amatch->pattern, amatch->pattern_len);
-        tokens = rb_ary_new4(1, &tmp);
-        if (!amatch->pattern_pair_array) {
-            amatch->pattern_pair_array = PairArray_new(tokens);
-        } else {
-            pair_array_reactivate(amatch->pattern_pair_array);
-        }
-        tokens = rb_ary_new4(1, &string);
-        pair_array = PairArray_new(tokens);
-    }
-    result = pair_array_match(amatch->pattern_pair_array, pair_array);
-    pair_array_destroy(pair_array);
-    return rb_float_new(result);
+    pair_counts_destroy(amatch->pattern_pairs);
+    amatch->pattern_pairs = NULL;
+    free(amatch->pattern_pairs_key);
+    amatch->pattern_pairs_key = NULL;
+    amatch->pattern_pairs_key_len = 0;
 }
 
-/*
- * Hamming distances are computed here:
- */
+static size_t PairDistance_pattern_memsize(const PairDistance *amatch)
+{
+    return pair_counts_memsize(amatch->pattern_pairs) +
+        amatch->pattern_pairs_key_len;
+}
 
-#define COMPUTE_HAMMING_DISTANCE                            \
-    for (i = 0, result = b_len - a_len; i < a_len; i++) {   \
-        if (i >= b_len) {                                   \
-            result +=  a_len - b_len;                       \
-            break;                                          \
-        }                                                   \
-        if (b_ptr[i] != a_ptr[i]) result++;                 \
-    }
+DEF_ALLOCATOR(PairDistance)
+DEF_STATS(PairDistance)
+DEF_PATTERN_ACCESSOR(PairDistance)
+DEF_BEST(PairDistance)
+
+typedef struct LongestSubstringStruct {
+    char            *pattern;
+    int             pattern_len;
+    int             busy;
+    Workspace       workspace;
+    Stats           stats;
+    int             codepoints;
+    Codepoints      *symbols;
+    SuffixAutomaton *automaton;
+} LongestSubstring;
+
+static void LongestSubstring_pattern_compile(LongestSubstring *amatch)
+{
+    COMPILE_SYMBOLS(amatch)
+    amatch->automaton = SuffixAutomaton_new(SYMBOLS(amatch),
+        SYMBOLS_LEN(amatch));
+}
 
-static VALUE Hamming_match(General *amatch, VALUE string)
+static void LongestSubstring_pattern_release(LongestSubstring *amatch)
 {
-    char *a_ptr, *b_ptr;
-    int a_len, b_len;
-    int i, result;
-    
-    Check_Type(string, T_STRING);
-    OPTIMIZE_TIME
-    COMPUTE_HAMMING_DISTANCE
-    return INT2FIX(result);
+    RELEASE_SYMBOLS(amatch)
+    suffix_automaton_destroy(amatch->automaton);
+    amatch->automaton = NULL;
 }
 
-static VALUE Hamming_similar(General *amatch, VALUE string)
+static size_t LongestSubstring_pattern_memsize(const LongestSubstring *amatch)
 {
-    char *a_ptr, *b_ptr;
-    int a_len, b_len;
-    int i, result;
-    
-    Check_Type(string, T_STRING);
-    OPTIMIZE_TIME
-    if (a_len == 0 && b_len == 0) return rb_float_new(1.0);
-    if (a_len == 0 || b_len == 0) return rb_float_new(0.0);
-    COMPUTE_HAMMING_DISTANCE
-    return rb_float_new(1.0 - ((double) result) / b_len);
+    if (!amatch->automaton) return 0;
+    return suffix_automaton_memsize(amatch->automaton) +
+        codepoints_memsize(amatch->symbols);
 }
 
+DEF_ALLOCATOR(LongestSubstring)
+DEF_STATS(LongestSubstring)
+DEF_PATTERN_ACCESSOR(LongestSubstring)
+DEF_CODEPOINTS(LongestSubstring)
+DEF_ITERATE_STRINGS(LongestSubstring)
+
 /*
- * Longest Common Subsequence computation
+ * Jaro and JaroWinkler look the characters of the strings up in a pattern
+ * mask. If case is ignored, the mask is folded (see PatternMask_new_folded),
+ * so that neither the pattern nor the strings have to be upcased while
+ * matching. Setting ignore_case compiles the mask again. In codepoint mode
+ * only ASCII letters are folded, the symbols of the others aren't letters.
  */
+#define DEF_FOLDED_PATTERN(type)                                        \
+static void type##_pattern_compile(type *amatch)                        \
+{                                                                       \
+    COMPILE_SYMBOLS(amatch)                                             \
+    amatch->pattern_mask = amatch->ignore_case ?                        \
+        PatternMask_new_folded(SYMBOLS(amatch), SYMBOLS_LEN(amatch)) :  \
+        PatternMask_new(SYMBOLS(amatch), SYMBOLS_LEN(amatch));          \
+}                                                                       \
+static void type##_pattern_release(type *amatch)                        \
+{                                                                       \
+    RELEASE_SYMBOLS(amatch)                                             \
+    pattern_mask_destroy(amatch->pattern_mask);                         \
+    amatch->pattern_mask = NULL;                                        \
+}                                                                       \
+static size_t type##_pattern_memsize(const type *amatch)                \
+{                                                                       \
+    if (!amatch->pattern_mask) return 0;                                \
+    return sizeof(PatternMask) + codepoints_memsize(amatch->symbols) +  \
+        256 * amatch->pattern_mask->words * sizeof(uint64_t);           \
+}                                                                       \
+static VALUE rb_##type##_ignore_case_set(VALUE self, VALUE value)       \
+{                                                                       \
+    GET_STRUCT(type)                                                    \
+    if (amatch->busy) {                                                 \
+        rb_raise(rb_eRuntimeError,                                      \
+            "can't modify ignore_case while matching");                 \
+    }                                                                   \
+    CAST2BOOL(value);                                                   \
+    amatch->ignore_case = BOOL2C(value);                                \
+    type##_pattern_release(amatch);                                     \
+    type##_pattern_compile(amatch);                                     \
+    return Qnil;                                                        \
+}
 
-#define COMPUTE_LONGEST_SUBSEQUENCE                         \
-    l[0] = ALLOC_N(int, b_len + 1);                         \
-    l[1] = ALLOC_N(int, b_len + 1);                         \
-    for (i = a_len, c = 0, p = 1; i >= 0; i--) {            \
-        for (j = b_len; j >= 0; j--) {                      \
-            if (i == a_len || j == b_len) {                 \
-                l[c][j] = 0;                                \
-            } else if (a_ptr[i] == b_ptr[j]) {              \
-                l[c][j] = 1 + l[p][j + 1];                  \
-            } else {                                        \
-                int x = l[p][j], y = l[c][j + 1];           \
-                if (x > y) l[c][j] = x; else l[c][j] = y;   \
-            }                                               \
-        }                                                   \
-        p = c;                                              \
-        c = (c + 1) % 2;                                    \
-    }                                                       \
-    result = l[p][0];                                       \
-    free(l[0]);                                             \
-    free(l[1]);
-
+typedef struct JaroStruct {
+    char *pattern;
+    int   pattern_len;
+    int   busy;
+    Workspace workspace;
+    Stats     stats;
+    int   ignore_case;
+    int   codepoints;
+    Codepoints *symbols;
+    PatternMask *pattern_mask;
+    long  rejected[PREFILTER_STAGES];
+} Jaro;
 
-static VALUE LongestSubsequence_match(General *amatch, VALUE string)
-{
-    char *a_ptr, *b_ptr;
-    int a_len, b_len;
-    int result, c, p, i, j, *l[2];
-    
-    Check_Type(string, T_STRING);
-    OPTIMIZE_TIME
+DEF_ALLOCATOR(Jaro)
+DEF_STATS(Jaro)
+DEF_FOLDED_PATTERN(Jaro)
+DEF_PATTERN_ACCESSOR(Jaro)
+DEF_CODEPOINTS(Jaro)
+DEF_ITERATE_STRINGS(Jaro)
+DEF_SELECT(Jaro)
 
-    if (a_len == 0 || b_len == 0) return INT2FIX(0);
-    COMPUTE_LONGEST_SUBSEQUENCE
-    return INT2FIX(result);
-}
+typedef struct JaroWinklerStruct {
+    char *pattern;
+    int   pattern_len;
+    int   busy;
+    Workspace workspace;
+    Stats     stats;
+    int   ignore_case;
+    float scaling_factor;
+    int   codepoints;
+    Codepoints *symbols;
+    PatternMask *pattern_mask;
+    long  rejected[PREFILTER_STAGES];
+} JaroWinkler;
 
-static VALUE LongestSubsequence_similar(General *amatch, VALUE string)
-{
-    char *a_ptr, *b_ptr;
-    int a_len, b_len;
-    int result, c, p, i, j, *l[2];
-    
-    Check_Type(string, T_STRING);
-    OPTIMIZE_TIME
+DEF_ALLOCATOR(JaroWinkler)
+DEF_STATS(JaroWinkler)
+DEF_FOLDED_PATTERN(JaroWinkler)
+DEF_PATTERN_ACCESSOR(JaroWinkler)
+DEF_CODEPOINTS(JaroWinkler)
+DEF_ITERATE_STRINGS(JaroWinkler)
+DEF_BEST(JaroWinkler)
+DEF_SELECT(JaroWinkler)
 
-    if (a_len == 0 && b_len == 0) return rb_float_new(1.0);
-    if (a_len == 0 || b_len == 0) return rb_float_new(0.0);
-    COMPUTE_LONGEST_SUBSEQUENCE
-    return rb_float_new(((double) result) / b_len);
-}
+typedef struct BitapStruct {
+    char        *pattern;
+    int         pattern_len;
+    int         busy;
+    Workspace   workspace;
+    Stats       stats;
+    int         ignore_case;
+    BitapMask   *mask;
+} Bitap;
 
 /*
- * Longest Common Substring computation
+ * Bitap patterns have a syntax (see bitap.c), so they are compiled before
+ * they replace the old pattern, and an invalid one raises an ArgumentError
+ * and leaves the matcher as it was. Therefore Bitap doesn't use
+ * DEF_PATTERN_ACCESSOR.
  */
+static BitapMask *Bitap_compile(char *pattern, int len, int ignore_case)
+{
+    BitapMask *mask = ALLOC(BitapMask);
+    int status = bitap_mask_compile(mask, pattern, len, ignore_case);
+
+    if (status != 0) {
+        xfree(mask);
+        if (status == BITAP_TOO_LONG) {
+            rb_raise(rb_eArgError, "pattern has more than %d positions",
+                BITAP_MAX_LEN);
+        }
+        rb_raise(rb_eArgError, "unterminated character class in pattern");
+    }
+    return mask;
+}
 
-#define COMPUTE_LONGEST_SUBSTRING                           \
-    l[0] = ALLOC_N(int, b_len);                             \
-    MEMZERO(l[0], int, b_len);                              \
-    l[1] = ALLOC_N(int, b_len);                             \
-    MEMZERO(l[1], int, b_len);                              \
-    result = 0;                                             \
-    for (i = 0, c = 0, p = 1; i < a_len; i++) {             \
-        for (j = 0; j < b_len; j++) {                       \
-            if (a_ptr[i] == b_ptr[j]) {                     \
-                l[c][j] = j == 0 ? 1 : 1 + l[p][j - 1];     \
-                if (l[c][j] > result) result = l[c][j];     \
-            } else {                                        \
-                l[c][j] = 0;                                \
-            }                                               \
-        }                                                   \
-        p = c;                                              \
-        c = (c + 1) % 2;                                    \
-    }                                                       \
-    free(l[0]);                                             \
-    free(l[1]);
+static void Bitap_pattern_release(Bitap *amatch)
+{
+    xfree(amatch->mask);
+    amatch->mask = NULL;
+}
 
-static VALUE LongestSubstring_match(General *amatch, VALUE string)
+static size_t Bitap_pattern_memsize(const Bitap *amatch)
 {
-    char *a_ptr, *b_ptr;
-    int a_len, b_len;
-    int result, c, p, i, j, *l[2];
-    
-    Check_Type(string, T_STRING);
-    OPTIMIZE_TIME
-    if (a_len == 0 || b_len == 0) return INT2FIX(0);
-    COMPUTE_LONGEST_SUBSTRING
-    return INT2FIX(result);
+    return amatch->mask ? sizeof(BitapMask) : 0;
 }
 
-static VALUE LongestSubstring_similar(General *amatch, VALUE string)
+static void Bitap_pattern_set(Bitap *amatch, VALUE pattern)
 {
-    char *a_ptr, *b_ptr;
-    int a_len, b_len;
-    int result, c, p, i, j, *l[2];
-    
-    Check_Type(string, T_STRING);
-    OPTIMIZE_TIME
-    if (a_len == 0 && b_len == 0) return rb_float_new(1.0);
-    if (a_len == 0 || b_len == 0) return rb_float_new(0.0);
-    COMPUTE_LONGEST_SUBSTRING
-    return rb_float_new(((double) result) / b_len);
+    BitapMask *mask;
+
+    Check_Type(pattern, T_STRING);
+    if (amatch->busy) {
+        rb_raise(rb_eRuntimeError, "can't modify pattern while matching");
+    }
+    mask = Bitap_compile(RSTRING(pattern)->ptr, RSTRING(pattern)->len,
+        amatch->ignore_case);
+    free(amatch->pattern);
+    amatch->pattern_len = RSTRING(pattern)->len;
+    amatch->pattern = ALLOC_N(char, amatch->pattern_len);
+    MEMCPY(amatch->pattern, RSTRING(pattern)->ptr, char,
+        RSTRING(pattern)->len);
+    Bitap_pattern_release(amatch);
+    amatch->mask = mask;
 }
 
+DEF_ALLOCATOR(Bitap)
+DEF_STATS(Bitap)
+DEF_ITERATE_STRINGS(Bitap)
+
 /*
- * Jaro computation
+ * Distances bounded by a maximum are computed here:
  */
 
-#define COMPUTE_JARO                                                                \
-    l[0] = ALLOC_N(int, a_len);                                                     \
-    MEMZERO(l[0], int, a_len);                                                      \
-    l[1] = ALLOC_N(int, b_len);                                                     \
-    MEMZERO(l[1], int, b_len);                                                      \
-    max_dist = ((a_len > b_len ? a_len : b_len) / 2) - 1;                           \
-    m = 0;                                                                          \
-    for (i = 0; i < a_len; i++) {                                                   \
-        low = (i > max_dist ? i - max_dist : 0);                                     \
-        high = (i + max_dist < b_len ? i + max_dist : b_len);                       \
-        for (j = low; j <= high; j++) {                                              \
-            if (!l[1][j] && a_ptr[i] == b_ptr[j]) {                                 \
-                l[0][i] = 1;                                                        \
-                l[1][j] = 1;                                                        \
-                m++;                                                                \
-                break;                                                              \
-            }                                                                       \
-        }                                                                           \
-    }                                                                               \
-    if (m == 0) {                                                                   \
-        result = 0.0;                                                               \
-    } else {                                                                        \
-        k = t = 0;                                                                  \
-        for (i = 0; i < a_len; i++) {                                               \
-            if (l[0][i]) {                                                          \
-                for (j = k; j < b_len; j++) {                                       \
-                    if (l[1][j]) {                                                  \
-                        k = j + 1;                                                  \
-                        break;                                                      \
-                    }                                                               \
-                }                                                                   \
-                if (a_ptr[i] != b_ptr[j]) {                                         \
-                    t++;                                                            \
-                }                                                                   \
-            }                                                                       \
-        }                                                                           \
-        t = t / 2;                                                                  \
-        result = (((double)m)/a_len + ((double)m)/b_len + ((double)(m-t))/m)/3.0;   \
-    }
-
-#define LOWERCASE_STRINGS                                       \
-     char *ying = ALLOC_N(char, a_len);                         \
-     MEMCPY(ying, a_ptr, char, a_len);                          \
-     a_ptr = ying;                                              \
-     char *yang = ALLOC_N(char, b_len);                         \
-     MEMCPY(yang, b_ptr, char, b_len);                          \
-     b_ptr = yang;                                              \
-     for (i = 0; i < a_len; i++) {                              \
-         if (islower(a_ptr[i])) a_ptr[i] = toupper(a_ptr[i]);   \
-     }                                                          \
-     for (i = 0; i < b_len; i++) {                              \
-         if (islower(b_ptr[i])) b_ptr[i] = toupper(b_ptr[i]);   \
-     }
-
-#define FREE_STRINGS \
-     xfree(a_ptr);   \
-     xfree(b_ptr);
-
-static VALUE Jaro_match(Jaro *amatch, VALUE string)
-{
-    char *a_ptr, *b_ptr;
-    int a_len, b_len, max_dist, m, t, i, j, k, low, high;
-    int *l[2];
-    double result;
+/*
+ * Lower bounds of weighted distances are products of the weights, while the
+ * distances are sums of them, that can round differently. A lower bound
+ * only rules a distance <= max out, if it exceeds max by more than this
+ * relative slack.
+ */
+#define BOUND_SLACK 1e-9
+#define BOUND_EXCEEDS(lower, max) \
+    ((lower) > (max) + fabs(max) * BOUND_SLACK)
 
-    Check_Type(string, T_STRING);
-    OPTIMIZE_TIME
-    if (a_len == 0 && b_len == 0) return rb_float_new(1.0);
-    if (a_len == 0 || b_len == 0) return rb_float_new(0.0);
-    if (amatch->ignore_case) {
-        LOWERCASE_STRINGS
-    }
-    COMPUTE_JARO
-    if (amatch->ignore_case) {
-        FREE_STRINGS
-    }
-    return rb_float_new(result);
-}
+/*
+ * Likewise, an upper bound of a similarity only rules a similarity >= min
+ * out, if it falls short of min by more than the slack.
+ */
+#define BOUND_FALLS_SHORT(upper, min) \
+    ((upper) < (min) - fabs(min) * BOUND_SLACK)
 
 /*
- * Jaro-Winkler computation
+ * Lower bound of the costs of a path from the top left to the bottom right
+ * cell of the matrix, that passes diagonal d = j - i. Moving right always
+ * costs a deletion, moving down an insertion (or a deletion in the first
+ * column), so it's at least the cheaper one of both.
  */
+#define BAND_COST(d) \
+    ((d) >= 0 ? (d) * del : -(d) * (ins < del ? ins : del))
+#define BAND_LOWER_BOUND(d) (BAND_COST(d) + BAND_COST(b_len - a_len - (d)))
 
-static VALUE JaroWinkler_match(JaroWinkler *amatch, VALUE string)
+/*
+ * Computes the same distance as COMPUTE_SELLERS_DISTANCE, but only for the
+ * diagonals a path of costs <= max can pass through (Ukkonen's cut-off).
+ * All other cells are treated as infinite, and the computation stops as soon
+ * as every cell of a row exceeds max. In both cases a value > max is
+ * returned. v has to point to two rows of b_len + 1 doubles.
+ */
+static double banded_distance(char *a_ptr, int a_len, char *b_ptr,
+    int b_len, double sub, double ins, double del, double max, double *v[2])
 {
-    char *a_ptr, *b_ptr;
-    int a_len, b_len, max_dist, m, t, i, j, k, low, high, n;
-    int *l[2];
-    double result;
+    double weight, min;
+    int i, j, c, p, lo, hi, dlo, dhi;
 
-    Check_Type(string, T_STRING);
-    OPTIMIZE_TIME
-    if (a_len == 0 && b_len == 0) return rb_float_new(1.0);
-    if (a_len == 0 || b_len == 0) return rb_float_new(0.0);
-    if (amatch->ignore_case) {
-        LOWERCASE_STRINGS
-    }
-    COMPUTE_JARO
-    n = 0;
-    for (i = 0; i < (a_len >= 4 ? 4 : a_len); i++) {
-        if (a_ptr[i] == b_ptr[i]) {
-            n++;
+    if (BOUND_EXCEEDS(BAND_LOWER_BOUND(0), max)) return HUGE_VAL;
+    dlo = b_len - a_len < 0 ? b_len - a_len : 0;
+    while (dlo > -a_len && !BOUND_EXCEEDS(BAND_LOWER_BOUND(dlo - 1), max)) {
+        dlo--;
+    }
+    dhi = b_len - a_len > 0 ? b_len - a_len : 0;
+    while (dhi < b_len && !BOUND_EXCEEDS(BAND_LOWER_BOUND(dhi + 1), max)) {
+        dhi++;
+    }
+
+    hi = dhi;
+    for (j = 0; j <= hi; j++) v[0][j] = j * del;
+    if (hi < b_len) v[0][hi + 1] = HUGE_VAL;
+    for (i = 1, c = 0, p = 0; i <= a_len; i++) {
+        c = i % 2;                      /* current row */
+        p = (i + 1) % 2;                /* previous row */
+        lo = i + dlo > 0 ? i + dlo : 0;
+        hi = i + dhi < b_len ? i + dhi : b_len;
+        if (lo == 0) {
+            v[c][0] = i * del;          /* first column */
+            min = v[c][0];
+            lo = 1;
         } else {
-            break;
+            v[c][lo - 1] = HUGE_VAL;
+            min = HUGE_VAL;
         }
+        for (j = lo; j <= hi; j++) {
+            weight = v[p][j - 1] + (a_ptr[i - 1] == b_ptr[j - 1] ? 0 : sub);
+            if (weight > v[p][j] + ins) {
+                weight = v[p][j] + ins;
+            }
+            if (weight > v[c][j - 1] + del) {
+                weight = v[c][j - 1] + del;
+            }
+            v[c][j] = weight;
+            if (weight < min) min = weight;
+        }
+        if (hi < b_len) v[c][hi + 1] = HUGE_VAL;
+        if (min > max) return HUGE_VAL;
     }
-    result = result + n*amatch->scaling_factor*(1-result);
-    if (amatch->ignore_case) {
-        FREE_STRINGS
-    }
-    return rb_float_new(result);
+    return v[c][b_len];
 }
 
+#undef BAND_COST
+#undef BAND_LOWER_BOUND
+
+/*
+ * Converts a maximum distance to the largest integer distance within it.
+ */
+#define BOUND2INT(bound) \
+    ((bound) < INT_MAX - 1 ? (int) floor(bound) : INT_MAX - 1)
+
+/*
+ * Levenshtein edit distances are computed here, by running the bit vectors
+ * of the precomputed pattern mask over the string (see pattern_mask.c):
+ */
+
+#define PATTERN_MASK_SCRATCH_SIZE \
+    (pattern_mask_scratch_len(amatch->pattern_mask) * sizeof(uint64_t))
+
+#define PATTERN_MASK_COST \
+    ((double) b_len * (amatch->pattern_mask->words > 1 ? \
+        amatch->pattern_mask->words : 1))
+
+static void *Levenshtein_match_kernel(void *data)
+{
+    GET_COMPARISON(General)
+    cmp->result = pattern_mask_distance(amatch->pattern_mask, cmp->b_ptr,
+        cmp->b_len, cmp->scratch);
+    return NULL;
+}
+
+static void *Levenshtein_search_kernel(void *data)
+{
+    GET_COMPARISON(General)
+    cmp->result = pattern_mask_search(amatch->pattern_mask, cmp->b_ptr,
+        cmp->b_len, cmp->scratch);
+    return NULL;
+}
+
+/*
+ * Bounded distances of multi-word patterns are computed by the banded
+ * algorithm, if the band of 2k + 1 diagonals is narrow compared to the
+ * pattern, and by the bit vectors otherwise.
+ */
+#define LEVENSHTEIN_BANDED(k) \
+    (amatch->pattern_mask->words > 1 && \
+        (k) < 2 * amatch->pattern_mask->words)
+
+static void *Levenshtein_match_bounded_kernel(void *data)
+{
+    GET_COMPARISON(General)
+    GET_COMPARISON_STRINGS
+    int k = BOUND2INT(cmp->bound);
+
+    if ((a_len > b_len ? a_len - b_len : b_len - a_len) > k) {
+        cmp->result = k + 1;
+    } else if (!LEVENSHTEIN_BANDED(k)) {
+        cmp->result = pattern_mask_distance_bounded(amatch->pattern_mask,
+            b_ptr, b_len, k, cmp->scratch);
+    } else {
+        double *v[2];
+        v[0] = (double *) cmp->scratch;
+        v[1] = v[0] + b_len + 1;
+        cmp->result = banded_distance(a_ptr, a_len, b_ptr, b_len, 1, 1, 1, k,
+            v);
+    }
+    return NULL;
+}
+
+static void *Levenshtein_search_bounded_kernel(void *data)
+{
+    GET_COMPARISON(General)
+    cmp->result = pattern_mask_search_bounded(amatch->pattern_mask,
+        cmp->b_ptr, cmp->b_len, BOUND2INT(cmp->bound), cmp->scratch);
+    return NULL;
+}
+
+static void Levenshtein_match_prepare(General *amatch, VALUE string, Comparison *cmp)
+{
+    char *a_ptr, *b_ptr;
+    int a_len, b_len;
+
+    Check_Type(string, T_STRING);
+    DONT_OPTIMIZE
+    SET_COMPARISON(cmp, Levenshtein_match_kernel, PATTERN_MASK_SCRATCH_SIZE,
+        PATTERN_MASK_COST)
+}
+
+static void Levenshtein_similar_prepare(General *amatch, VALUE string, Comparison *cmp)
+{
+    char *a_ptr, *b_ptr;
+    int a_len, b_len;
+
+    Check_Type(string, T_STRING);
+    DONT_OPTIMIZE
+    SIMILAR_EMPTY_STRINGS(cmp)
+    SET_COMPARISON(cmp, Levenshtein_match_kernel, PATTERN_MASK_SCRATCH_SIZE,
+        PATTERN_MASK_COST)
+}
+
+static VALUE Levenshtein_similar_finish(Comparison *cmp)
+{
+    if (!cmp->kernel) return rb_float_new(cmp->result);
+    if (cmp->b_len > cmp->a_len) {
+        return rb_float_new(1.0 - cmp->result / cmp->b_len);
+    } else {
+        return rb_float_new(1.0 - cmp->result / cmp->a_len);
+    }
+}
+
+static void Levenshtein_search_prepare(General *amatch, VALUE string, Comparison *cmp)
+{
+    char *a_ptr, *b_ptr;
+    int a_len, b_len;
+
+    Check_Type(string, T_STRING);
+    DONT_OPTIMIZE
+    SET_COMPARISON(cmp, Levenshtein_search_kernel, PATTERN_MASK_SCRATCH_SIZE,
+        PATTERN_MASK_COST)
+}
+
+static void Levenshtein_match_bounded_prepare(General *amatch, VALUE string, Comparison *cmp)
+{
+    char *a_ptr, *b_ptr;
+    int a_len, b_len;
+
+    Check_Type(string, T_STRING);
+    DONT_OPTIMIZE
+    SET_COMPARISON(cmp, Levenshtein_match_bounded_kernel,
+        LEVENSHTEIN_BANDED(BOUND2INT(cmp->bound)) ?
+            2 * (b_len + 1) * sizeof(double) : PATTERN_MASK_SCRATCH_SIZE,
+        PATTERN_MASK_COST)
+}
+
+static void Levenshtein_search_bounded_prepare(General *amatch, VALUE string, Comparison *cmp)
+{
+    char *a_ptr, *b_ptr;
+    int a_len, b_len;
+
+    Check_Type(string, T_STRING);
+    DONT_OPTIMIZE
+    SET_COMPARISON(cmp, Levenshtein_search_bounded_kernel,
+        PATTERN_MASK_SCRATCH_SIZE, PATTERN_MASK_COST)
+}
+
+/*
+ * The distance of strings, whose lengths differ by at least the distance to
+ * beat, can't be lower, the others are matched with the next lower distance
+ * as bound.
+ */
+static int Levenshtein_best_prepare(General *amatch, VALUE string,
+    VALUE options, Comparison *cmp)
+{
+    long diff = string_length(amatch->symbols, string) - SYMBOLS_LEN(amatch);
+
+    if (cmp->bound == HUGE_VAL) {
+        Levenshtein_match_prepare(amatch, string, cmp);
+        return 1;
+    }
+    if ((diff < 0 ? -diff : diff) >= cmp->bound) return 0;
+    cmp->bound -= 1;
+    Levenshtein_match_bounded_prepare(amatch, string, cmp);
+    return 1;
+}
+
+/*
+ * Rejects strings within the maximum distance k by the difference of their
+ * lengths, then by the characters missing from either string, then by the
+ * number of 2-grams of the pattern they lack (see prefilter.c).
+ */
+static int Levenshtein_select_prepare(General *amatch, VALUE string,
+    Prefilter *filter, Comparison *cmp)
+{
+    int k = (int) cmp->bound, missing, surplus;
+
+    Levenshtein_match_bounded_prepare(amatch, string, cmp);
+    if ((cmp->a_len > cmp->b_len ? cmp->a_len - cmp->b_len :
+                cmp->b_len - cmp->a_len) > k) {
+        return 1;
+    }
+    prefilter_excess(filter, cmp->b_ptr, cmp->b_len, &missing, &surplus);
+    if (missing > k || surplus > k) return 2;
+    if (filter->grams && prefilter_common_grams(filter, cmp->b_ptr,
+                cmp->b_len) < cmp->a_len - 1 - 2 * k) {
+        return 3;
+    }
+    return 0;
+}
+
+/*
+ * Lines of a file, that contain the pattern of a Levenshtein matcher with at
+ * most k differences, are found here, directly in the mapped file. The
+ * file is scanned without the global interpreter lock, in chunks of about
+ * GREP_CHUNK bytes, that end early after GREP_MATCHES matching lines, so the
+ * lines can be yielded and interrupts handled in between.
+ *
+ * If the pattern is long enough, it's split into k + 1 pieces first: every
+ * occurrence with at most k differences contains one of them unchanged, so
+ * only the lines, in which memmem finds a piece, have to be searched for
+ * the pattern.
+ */
+
+#define GREP_MATCHES 256
+#define GREP_CHUNK (1 << 24)
+#define GREP_PIECES 8
+#define GREP_PIECE_MIN 4
+
+typedef struct GrepLineStruct {
+    size_t      offset;
+    size_t      len;
+    long        number;
+} GrepLine;
+
+typedef struct GrepStruct {
+    General     *amatch;
+    MappedFile  file;
+    int         k;
+    uint64_t    *scratch;
+    size_t      next;           /* offset of the next line to scan */
+    long        number;         /* number of the last line scanned */
+    int         pieces;
+    int         piece_offset[GREP_PIECES + 1];
+    size_t      piece_found[GREP_PIECES];
+    char        *symbols;       /* the line translated in codepoint mode */
+    size_t      symbols_size;
+    int         failed;         /* whether symbols couldn't be allocated */
+    GrepLine    lines[GREP_MATCHES];
+    int         len;
+    uint64_t    started;        /* see scan_start */
+    VALUE       result;
+} Grep;
+
+/*
+ * In codepoint mode the pieces are cut between characters, and their bytes
+ * are searched.
+ */
+static void grep_pieces(Grep *grep)
+{
+    General *amatch = grep->amatch;
+    int i, pieces = grep->k + 1, len = SYMBOLS_LEN(amatch);
+
+    grep->pieces = 0;
+#ifdef HAVE_MEMMEM
+    if (grep->k < 0 || pieces > GREP_PIECES || len / pieces < GREP_PIECE_MIN) {
+        return;
+    }
+    grep->pieces = pieces;
+    for (i = 0; i <= pieces; i++) {
+        grep->piece_offset[i] = (int) ((long) len * i / pieces);
+        if (amatch->symbols) {
+            grep->piece_offset[i] = (int) codepoints_skip(amatch->pattern,
+                amatch->pattern_len, grep->piece_offset[i]);
+        }
+    }
+    for (i = 0; i < pieces; i++) grep->piece_found[i] = 0;
+#endif
+}
+
+/*
+ * Returns the offset of the first line at or after offset next, that
+ * contains a piece of the pattern, or the length of the file, if there is
+ * none.
+ */
+static size_t grep_candidate(Grep *grep)
+{
+    size_t found = grep->file.len;
+#ifdef HAVE_MEMMEM
+    char *ptr = grep->file.ptr, *piece;
+    int i, len;
+
+    for (i = 0; i < grep->pieces; i++) {
+        if (grep->piece_found[i] < grep->next) {
+            len = grep->piece_offset[i + 1] - grep->piece_offset[i];
+            piece = memmem(ptr + grep->next, grep->file.len - grep->next,
+                grep->amatch->pattern + grep->piece_offset[i], len);
+            grep->piece_found[i] = piece ? (size_t) (piece - ptr) : grep->file.len;
+        }
+        if (grep->piece_found[i] < found) found = grep->piece_found[i];
+    }
+    while (found > grep->next && ptr[found - 1] != '\n') found--;
+#endif
+    return found;
+}
+
+/*
+ * Moves next forward to offset to, which has to be the beginning of a line,
+ * counting the lines skipped.
+ */
+static void grep_skip(Grep *grep, size_t to)
+{
+    char *ptr = grep->file.ptr + grep->next, *end = grep->file.ptr + to;
+
+    while ((ptr = memchr(ptr, '\n', end - ptr))) {
+        grep->number++;
+        ptr++;
+    }
+    grep->next = to;
+}
+
+static void *grep_scan(void *data)
+{
+    Grep *grep = (Grep *) data;
+    Codepoints *symbols = grep->amatch->symbols;
+    char *line, *eol, *end = grep->file.ptr + grep->file.len, *text;
+    size_t len, text_len, candidate, stop = grep->next + GREP_CHUNK;
+
+    grep->len = 0;
+    while (grep->next < grep->file.len && grep->next < stop &&
+            grep->len < GREP_MATCHES) {
+        if (grep->pieces > 0) {
+            candidate = grep_candidate(grep);
+            if (candidate > stop) {
+                eol = memchr(grep->file.ptr + stop, '\n', candidate - stop);
+                candidate = eol ? (size_t) (eol - grep->file.ptr) + 1 : candidate;
+            }
+            grep_skip(grep, candidate);
+            if (candidate >= grep->file.len || candidate > stop) break;
+        }
+        line = grep->file.ptr + grep->next;
+        eol = memchr(line, '\n', end - line);
+        len = (eol ? eol : end) - line;
+        text = line;
+        text_len = len;
+        if (symbols && !codepoints_ascii(line, len)) {
+            if (len > grep->symbols_size) {
+                free(grep->symbols);
+                grep->symbols_size = 0;
+                if (!(grep->symbols = malloc(len))) {
+                    grep->failed = 1;
+                    break;
+                }
+                grep->symbols_size = len;
+            }
+            text = grep->symbols;
+            text_len = codepoints_translate(symbols, line, len, text);
+        }
+        grep->number++;
+        if (pattern_mask_occurs(grep->amatch->pattern_mask, text,
+                    text_len < INT_MAX ? (int) text_len : INT_MAX, grep->k,
+                    grep->scratch)) {
+            grep->lines[grep->len].offset = grep->next;
+            grep->lines[grep->len].len = len;
+            grep->lines[grep->len].number = grep->number;
+            grep->len++;
+        }
+        grep->next += len + (eol ? 1 : 0);
+    }
+    return NULL;
+}
+
+/*
+ * Sellers edit distances are computed here:
+ */
+
+#define COMPUTE_SELLERS_DISTANCE                                            \
+    for (i = 1, c = 0, p = 1; i <= a_len; i++) {                            \
+        c = i % 2;                      /* current row */                   \
+        p = (i + 1) % 2;                /* previous row */                  \
+        v[c][0] = i * amatch->deletion; /* first column */                  \
+        for (j = 1; j <= b_len; j++) {                                      \
+            /* Bellman's principle of optimality: */                        \
+            weight = v[p][j - 1] +                                          \
+                (a_ptr[i - 1] == b_ptr[j - 1] ? 0 : amatch->substitution);  \
+            if (weight > v[p][j] + amatch->insertion) {                     \
+                 weight = v[p][j] + amatch->insertion;                      \
+            }                                                               \
+            if (weight > v[c][j - 1] + amatch->deletion) {                  \
+                weight = v[c][j - 1] + amatch->deletion;                    \
+            }                                                               \
+            v[c][j] = weight;                                               \
+        }                                                                   \
+        p = c;                                                              \
+        c = (c + 1) % 2;                                                    \
+    }
+
+#define SELLERS_SCRATCH_SIZE (2 * (b_len + 1) * sizeof(double))
+
+static void *Sellers_match_kernel(void *data)
+{
+    GET_COMPARISON(Sellers)
+    GET_COMPARISON_STRINGS
+    double *v[2], weight;
+    int  i, j, c, p;
+
+    v[0] = (double *) cmp->scratch;
+    v[1] = v[0] + b_len + 1;
+    for (i = 0; i <= b_len; i++) {
+        v[0][i] = i * amatch->deletion;
+        v[1][i] = i * amatch->deletion;
+    }
+
+    COMPUTE_SELLERS_DISTANCE
+
+    cmp->result = v[p][b_len];
+    return NULL;
+}
+
+static void *Sellers_search_kernel(void *data)
+{
+    GET_COMPARISON(Sellers)
+    GET_COMPARISON_STRINGS
+    double *v[2], weight, min;
+    int  i, j, c, p;
+
+    v[0] = (double *) cmp->scratch;
+    v[1] = v[0] + b_len + 1;
+    MEMZERO(v[0], double, b_len + 1);
+    MEMZERO(v[1], double, b_len + 1);
+
+    COMPUTE_SELLERS_DISTANCE
+
+    for (i = 0, min = a_len; i <= b_len; i++) {
+        if (v[p][i] < min) min = v[p][i];
+    }
+    cmp->result = min;
+    return NULL;
+}
+
+static void *Sellers_match_bounded_kernel(void *data)
+{
+    GET_COMPARISON(Sellers)
+    GET_COMPARISON_STRINGS
+    double *v[2];
+
+    v[0] = (double *) cmp->scratch;
+    v[1] = v[0] + b_len + 1;
+    cmp->result = banded_distance(a_ptr, a_len, b_ptr, b_len,
+        amatch->substitution, amatch->insertion, amatch->deletion,
+        cmp->bound, v);
+    return NULL;
+}
+
+/*
+ * Computes the same value as Sellers_search_kernel, but column by column,
+ * and only down to the last row of each column, that has a value <= bound
+ * (Ukkonen's cut-off). The rows below it can't lead to a match within bound
+ * anymore. Needs a_len + 1 doubles of scratch memory.
+ */
+static void *Sellers_search_bounded_kernel(void *data)
+{
+    GET_COMPARISON(Sellers)
+    GET_COMPARISON_STRINGS
+    double *v, weight, diag, left, min, bound = cmp->bound;
+    int  i, j, last, end;
+
+    v = (double *) cmp->scratch;
+    for (i = 0, last = 0; i <= a_len; i++) {
+        v[i] = i * amatch->deletion;
+        if (v[i] <= bound) last = i;
+    }
+    min = a_len;
+    if (v[a_len] < min) min = v[a_len];
+
+    for (j = 1; j <= b_len; j++) {
+        end = last < a_len ? last + 1 : a_len;
+        for (i = 1, diag = 0; i <= a_len; i++) {
+            if (i <= end) {
+                left = i <= last ? v[i] : HUGE_VAL;
+                weight = diag +
+                    (a_ptr[i - 1] == b_ptr[j - 1] ? 0 : amatch->substitution);
+            } else {
+                left = weight = HUGE_VAL;
+            }
+            if (weight > v[i - 1] + amatch->insertion) {
+                weight = v[i - 1] + amatch->insertion;
+            }
+            if (weight > left + amatch->deletion) {
+                weight = left + amatch->deletion;
+            }
+            if (i > end && weight > bound) break;
+            diag = left;
+            v[i] = weight;
+        }
+        for (last = i - 1; last > 0 && v[last] > bound; last--);
+        if (last == a_len && v[a_len] < min) min = v[a_len];
+    }
+
+    cmp->result = min;
+    return NULL;
+}
+
+static void Sellers_match_prepare(Sellers *amatch, VALUE string, Comparison *cmp)
+{
+    char *a_ptr, *b_ptr;
+    int a_len, b_len;
+
+    Check_Type(string, T_STRING);
+    DONT_OPTIMIZE
+    SET_COMPARISON(cmp, Sellers_match_kernel, SELLERS_SCRATCH_SIZE,
+        (double) a_len * b_len)
+}
+
+static void Sellers_similar_prepare(Sellers *amatch, VALUE string, Comparison *cmp)
+{
+    char *a_ptr, *b_ptr;
+    int a_len, b_len;
+
+    Check_Type(string, T_STRING);
+    DONT_OPTIMIZE
+    SIMILAR_EMPTY_STRINGS(cmp)
+    SET_COMPARISON(cmp, Sellers_match_kernel, SELLERS_SCRATCH_SIZE,
+        (double) a_len * b_len)
+}
+
+static VALUE Sellers_similar_finish(Comparison *cmp)
+{
+    Sellers *amatch = (Sellers *) cmp->amatch;
+    double max_weight;
+
+    if (!cmp->kernel) return rb_float_new(cmp->result);
+    if (amatch->insertion >= amatch->deletion) {
+        if (amatch->substitution >= amatch->insertion) {
+            max_weight = amatch->substitution;
+        } else {
+            max_weight = amatch->insertion;
+        }
+    } else {
+        if (amatch->substitution >= amatch->deletion) {
+            max_weight = amatch->substitution;
+        } else {
+            max_weight = amatch->deletion;
+        }
+    }
+    if (cmp->b_len > cmp->a_len) {
+        return rb_float_new(1.0 - cmp->result / (cmp->b_len * max_weight));
+    } else {
+        return rb_float_new(1.0 - cmp->result / (cmp->a_len * max_weight));
+    }
+}
+
+static void Sellers_search_prepare(Sellers *amatch, VALUE string, Comparison *cmp)
+{
+    char *a_ptr, *b_ptr;
+    int a_len, b_len;
+
+    Check_Type(string, T_STRING);
+    DONT_OPTIMIZE
+    SET_COMPARISON(cmp, Sellers_search_kernel, SELLERS_SCRATCH_SIZE,
+        (double) a_len * b_len)
+}
+
+static void Sellers_match_bounded_prepare(Sellers *amatch, VALUE string, Comparison *cmp)
+{
+    char *a_ptr, *b_ptr;
+    int a_len, b_len;
+
+    Check_Type(string, T_STRING);
+    DONT_OPTIMIZE
+    SET_COMPARISON(cmp, Sellers_match_bounded_kernel, SELLERS_SCRATCH_SIZE,
+        (double) a_len * b_len)
+}
+
+static void Sellers_search_bounded_prepare(Sellers *amatch, VALUE string, Comparison *cmp)
+{
+    char *a_ptr, *b_ptr;
+    int a_len, b_len;
+
+    Check_Type(string, T_STRING);
+    DONT_OPTIMIZE
+    SET_COMPARISON(cmp, Sellers_search_bounded_kernel,
+        (a_len + 1) * sizeof(double), (double) a_len * b_len)
+}
+
+/*
+ * The surplus characters of the longer string cost at least a deletion or
+ * an insertion each, the strings, for which that's not less than the
+ * distance to beat, are skipped.
+ */
+static int Sellers_best_prepare(Sellers *amatch, VALUE string,
+    VALUE options, Comparison *cmp)
+{
+    long diff = string_length(amatch->symbols, string) - SYMBOLS_LEN(amatch);
+    double lower;
+
+    if (cmp->bound == HUGE_VAL) {
+        Sellers_match_prepare(amatch, string, cmp);
+        return 1;
+    }
+    if (diff >= 0) {
+        lower = diff * amatch->deletion;
+    } else {
+        lower = -diff * (amatch->insertion < amatch->deletion ?
+            amatch->insertion : amatch->deletion);
+    }
+    if (BOUND_EXCEEDS(lower, cmp->bound)) return 0;
+    Sellers_match_bounded_prepare(amatch, string, cmp);
+    return 1;
+}
+
+/*
+ * Like Levenshtein_select_prepare, with the cheapest operations, that can
+ * make up for the differences: surplus characters of the string cost a
+ * deletion, missing characters of the pattern an insertion or a deletion,
+ * and one of each can be replaced by a substitution.
+ */
+static int Sellers_select_prepare(Sellers *amatch, VALUE string,
+    Prefilter *filter, Comparison *cmp)
+{
+    double sub = amatch->substitution, del = amatch->deletion,
+           ins = amatch->insertion < del ? amatch->insertion : del,
+           lower, paired, min = sub < ins ? sub : ins;
+    int missing, surplus, pairs, common;
+
+    Sellers_match_bounded_prepare(amatch, string, cmp);
+    if (cmp->b_len >= cmp->a_len) {
+        lower = (cmp->b_len - cmp->a_len) * del;
+    } else {
+        lower = (cmp->a_len - cmp->b_len) * ins;
+    }
+    if (BOUND_EXCEEDS(lower, cmp->bound)) return 1;
+    prefilter_excess(filter, cmp->b_ptr, cmp->b_len, &missing, &surplus);
+    pairs = missing < surplus ? missing : surplus;
+    lower = missing * ins + surplus * del;
+    paired = pairs * sub + (missing - pairs) * ins + (surplus - pairs) * del;
+    if (BOUND_EXCEEDS(paired < lower ? paired : lower, cmp->bound)) return 2;
+    if (filter->grams) {
+        common = prefilter_common_grams(filter, cmp->b_ptr, cmp->b_len);
+        if (BOUND_EXCEEDS((cmp->a_len - common) / 2 * min, cmp->bound)) {
+            return 3;
+        }
+    }
+    return 0;
+}
+
+/*
+ * All approximate occurrences of the pattern in a text are found here, in
+ * one pass over the text: the last row of the search matrix is computed
+ * column by column, by the bit vectors of the pattern mask for Levenshtein
+ * and by the weighted recurrence for Sellers. Consecutive text positions,
+ * where it is within the maximum distance, end overlapping occurrences, so
+ * only the first position with the lowest distance of each such run is
+ * reported. Its start is found by a short pass backwards from there.
+ *
+ * Like grep_file, the text is scanned in chunks without the global
+ * interpreter lock, if it's long, and the occurrences are handed over to
+ * Ruby after each chunk.
+ *
+ * An IO is searched the same way, while it's read in chunks of
+ * SEARCH_IO_CHUNK bytes: the column state carries over from one chunk to the
+ * next, and only the last pattern_len + k / deletion characters of the text
+ * are kept for the backward passes. If an occurrence is still running, when
+ * they're about to be dropped, its start is found right away.
+ */
+
+#define SEARCH_HITS 256
+#define SEARCH_CHUNK (1 << 22)
+#define SEARCH_IO_CHUNK (1 << 20)
+
+typedef struct SearchHitStruct {
+    long        start;
+    long        end;
+    double      distance;
+} SearchHit;
+
+typedef struct SearchStruct {
+    char        *pattern;
+    int         pattern_len;
+    PatternMask *pattern_mask;      /* NULL for the weighted recurrence */
+    double      substitution;
+    double      insertion;
+    double      deletion;
+    double      k;
+    int         integer;            /* whether distances are Integers */
+    Codepoints  *symbols;           /* translating the text, or NULL */
+    char        *text;
+    long        text_len;
+    long        base;               /* text offset of text[0] */
+    int         eof;                /* whether the text ends at text_len */
+    VALUE       io;                 /* the text is read from, or 0 */
+    long        keep;               /* text characters kept for the hits */
+    long        size;               /* of copy, when reading io */
+    char        *raw;               /* bytes of io left to translate */
+    long        raw_len;
+    long        raw_size;
+    long        next;               /* next text position to advance over */
+    double      score;              /* last row of the column at next */
+    uint64_t    *state;             /* vertical delta vectors */
+    double      *column;            /* or column of the weighted recurrence */
+    double      *reverse;           /* two columns for the backward pass */
+    int         in_run;
+    long        best_end;
+    double      best_distance;
+    long        start;              /* of the best occurrence, or -1 */
+    int         finished;
+    SearchHit   hits[SEARCH_HITS];
+    int         len;
+    int         unblocked;
+    char        *copy;
+    int         *busy;
+    Stats       *stats;
+    uint64_t    started;            /* see scan_start */
+    VALUE       result;
+} Search;
+
+static void search_advance(Search *search)
+{
+    char c = search->text[search->next++], *pattern = search->pattern;
+    double *v = search->column, diag, left, weight;
+    int i;
+
+    if (search->pattern_mask) {
+        search->score += pattern_mask_step(search->pattern_mask,
+            search->state, c);
+        return;
+    }
+    for (i = 1, diag = v[0]; i <= search->pattern_len; i++) {
+        left = v[i];
+        weight = diag + (pattern[i - 1] == c ? 0 : search->substitution);
+        if (weight > v[i - 1] + search->insertion) {
+            weight = v[i - 1] + search->insertion;
+        }
+        if (weight > left + search->deletion) {
+            weight = left + search->deletion;
+        }
+        diag = left;
+        v[i] = weight;
+    }
+    search->score = v[search->pattern_len];
+}
+
+/*
+ * Finds the start of the occurrence ending at best_end, by computing the
+ * costs of reaching its end from every cell, column by column, backwards.
+ * The occurrence starts in the column, from whose top row this is cheapest,
+ * the last one of those, if there are several. An occurrence with cost d
+ * spans at most pattern_len + d / deletion text characters, so the pass
+ * stops there. Returns the start as a text offset.
+ */
+static long search_start(Search *search)
+{
+    int i, m = search->pattern_len;
+    long j, end = search->best_end, from = -search->base, start = end;
+    double *p = search->reverse, *c = p + m + 1, *t, weight, vertical, best;
+
+    if (search->deletion > 0 && m + search->best_distance /
+            search->deletion < search->base + end) {
+        from = end - m - (long) (search->best_distance / search->deletion);
+    }
+    /* down the first column, the recurrence charges deletions */
+    vertical = search->base + end > 0 ? search->insertion : search->deletion;
+    for (p[m] = 0, i = m - 1; i >= 0; i--) p[i] = p[i + 1] + vertical;
+    best = p[0];
+    for (j = end - 1; j >= from; j--) {
+        vertical = search->base + j > 0 ?
+            search->insertion : search->deletion;
+        c[m] = p[m] + search->deletion;
+        for (i = m - 1; i >= 0; i--) {
+            weight = p[i + 1] + (search->pattern[i] == search->text[j] ?
+                0 : search->substitution);
+            if (weight > p[i] + search->deletion) {
+                weight = p[i] + search->deletion;
+            }
+            if (weight > c[i + 1] + vertical) weight = c[i + 1] + vertical;
+            c[i] = weight;
+        }
+        if (c[0] < best) {
+            best = c[0];
+            start = j;
+        }
+        t = p;
+        p = c;
+        c = t;
+    }
+    return search->base + start;
+}
+
+static void search_hit(Search *search)
+{
+    SearchHit *hit = search->hits + search->len++;
+
+    hit->start = search->start >= 0 ? search->start : search_start(search);
+    hit->end = search->base + search->best_end;
+    hit->distance = search->best_distance;
+}
+
+static void search_offer(Search *search)
+{
+    if (search->score <= search->k) {
+        if (!search->in_run || search->score < search->best_distance) {
+            search->best_end = search->next;
+            search->best_distance = search->score;
+            search->start = -1;
+        }
+        search->in_run = 1;
+    } else if (search->in_run) {
+        search_hit(search);
+        search->in_run = 0;
+    }
+}
+
+static void *search_scan(void *data)
+{
+    Search *search = (Search *) data;
+    long stop = search->next + SEARCH_CHUNK;
+
+    search->len = 0;
+    /* every step reports at most one occurrence, and so does the end */
+    while (search->next < search->text_len && search->next < stop &&
+            search->len < SEARCH_HITS - 1) {
+        search_advance(search);
+        search_offer(search);
+    }
+    if (search->next == search->text_len && search->eof) {
+        if (search->in_run) search_hit(search);
+        search->finished = 1;
+    }
+    return NULL;
+}
+
+/*
+ * Returns the number of 64 bit words the columns of search take.
+ */
+static int search_words(Search *search)
+{
+    return search->pattern_mask ? search->pattern_mask->words :
+        search->pattern_len / PATTERN_MASK_WORD_BITS + 1;
+}
+
+/*
+ * Makes room for len more text characters in copy, the window of the text
+ * read from io, by dropping all but the last keep of those before it.
+ */
+static void search_make_room(Search *search, long len)
+{
+    long drop = search->text_len - search->keep;
+
+    if (drop > 0) {
+        /* a running occurrence might start in the dropped characters */
+        if (search->in_run && search->start < 0) {
+            search->start = search_start(search);
+        }
+        MEMMOVE(search->copy, search->copy + drop, char, search->keep);
+        search->text_len = search->keep;
+        search->next -= drop;
+        search->best_end -= drop;
+        search->base += drop;
+    }
+    if (search->text_len + len > search->size) {
+        search->size = search->text_len + len;
+        REALLOC_N(search->copy, char, search->size);
+    }
+    search->text = search->copy;
+}
+
+/*
+ * Reads the next chunk of io into the window of the text, translating it
+ * in codepoint mode. A character split by the chunk boundary waits for the
+ * rest of its bytes in raw.
+ */
+static void search_read(Search *search)
+{
+    VALUE chunk = rb_funcall(search->io, id_read, 1,
+        INT2FIX(SEARCH_IO_CHUNK));
+    char *ptr;
+    long len, complete;
+
+    if (NIL_P(chunk)) {
+        search->eof = 1;
+        ptr = search->raw;
+        len = complete = search->raw_len;
+    } else {
+        StringValue(chunk);
+        ptr = RSTRING(chunk)->ptr;
+        len = complete = RSTRING(chunk)->len;
+        if (search->symbols) {
+            if (search->raw_len + len > search->raw_size) {
+                search->raw_size = search->raw_len + len;
+                REALLOC_N(search->raw, char, search->raw_size);
+            }
+            MEMCPY(search->raw + search->raw_len, ptr, char, len);
+            ptr = search->raw;
+            len = search->raw_len + len;
+            complete = codepoints_boundary(ptr, len);
+        }
+    }
+    search_make_room(search, complete);
+    if (search->symbols) {
+        search->text_len += codepoints_translate(search->symbols, ptr,
+            complete, search->copy + search->text_len);
+        search->raw_len = len - complete;
+        MEMMOVE(search->raw, search->raw + complete, char, search->raw_len);
+    } else {
+        MEMCPY(search->copy + search->text_len, ptr, char, complete);
+        search->text_len += complete;
+    }
+    search->unblocked = (double) (search->text_len - search->next) *
+        search_words(search) >= UNBLOCKING_COST;
+}
+
+static VALUE search_run(VALUE data)
+{
+    Search *search = (Search *) data;
+    SearchHit *hit;
+    VALUE start, end, distance;
+    int i;
+
+    while (!search->finished) {
+        if (search->io && search->next == search->text_len) {
+            search_read(search);
+        }
+#ifdef HAVE_RB_THREAD_CALL_WITHOUT_GVL
+        if (search->unblocked) {
+            rb_thread_call_without_gvl(search_scan, search, NULL, NULL);
+        } else {
+            search_scan(search);
+        }
+#else
+        search_scan(search);
+#endif
+        for (i = 0; i < search->len; i++) {
+            hit = search->hits + i;
+            start = LONG2NUM(hit->start);
+            end = LONG2NUM(hit->end);
+            distance = search->integer ?
+                INT2FIX((int) hit->distance) : rb_float_new(hit->distance);
+            if (NIL_P(search->result)) {
+                rb_yield_values(3, start, end, distance);
+            } else {
+                rb_ary_push(search->result, rb_ary_new3(3, start, end,
+                    distance));
+            }
+        }
+    }
+    return search->result;
+}
+
+static VALUE search_finish(VALUE data)
+{
+    Search *search = (Search *) data;
+    long scanned = search->base + search->text_len;
+
+    (*search->busy)--;
+    scan_finish(search->stats, search->started,
+        (double) scanned * search_words(search), scanned + search->raw_len);
+    xfree(search->copy);
+    xfree(search->raw);
+    xfree(search->state);
+    xfree(search->column);
+    xfree(search->reverse);
+    return Qnil;
+}
+
+/*
+ * Allocates the columns of search and offers the empty prefix of the text.
+ */
+static void search_start_columns(Search *search)
+{
+    int i;
+
+    if (search->pattern_mask) {
+        search->state = ALLOC_N(uint64_t, 2 * search_words(search) + 1);
+        pattern_mask_start(search->pattern_mask, search->state);
+        search->score = search->pattern_len;
+    } else {
+        search->column = ALLOC_N(double, search->pattern_len + 1);
+        for (i = 0; i <= search->pattern_len; i++) {
+            search->column[i] = i * search->deletion;
+        }
+        search->score = search->column[search->pattern_len];
+    }
+    search->reverse = ALLOC_N(double, 2 * (search->pattern_len + 1));
+    search_offer(search);
+}
+
+/*
+ * Returns all occurrences of the pattern in string, with at most max
+ * differences, as an Array of [start, end, distance] triples. search has
+ * to be set up with the pattern and the costs of the matcher, whose busy
+ * counter is busy, and with its symbols in codepoint mode, so the offsets
+ * count characters.
+ */
+static VALUE search_all(Search *search, VALUE string, double max, int *busy)
+{
+    Check_Type(string, T_STRING);
+    search->k = max;
+    search->text = RSTRING(string)->ptr;
+    search->text_len = RSTRING(string)->len;
+    search->eof = 1;
+    search->busy = busy;
+    search->result = rb_ary_new();
+    if (max < 0) return search->result;
+    if (search->symbols &&
+            !codepoints_ascii(search->text, search->text_len)) {
+        search->copy = ALLOC_N(char, search->text_len);
+        search->text_len = codepoints_translate(search->symbols,
+            search->text, search->text_len, search->copy);
+        search->text = search->copy;
+    }
+    search_start_columns(search);
+#ifdef HAVE_RB_THREAD_CALL_WITHOUT_GVL
+    if ((double) search->text_len * search_words(search) >=
+            UNBLOCKING_COST) {
+        search->unblocked = 1;
+        if (!OBJ_FROZEN(string) && !search->copy) {
+            search->copy = ALLOC_N(char, search->text_len);
+            MEMCPY(search->copy, search->text, char, search->text_len);
+            search->text = search->copy;
+        }
+    }
+#endif
+    search->started = scan_start(search->stats,
+        (double) search->text_len * search_words(search));
+    (*busy)++;
+    return rb_ensure(search_run, (VALUE) search, search_finish,
+        (VALUE) search);
+}
+
+/*
+ * Like search_all, but reads the text from io, and yields the occurrences
+ * and returns nil, if a block is given. The deletion weight has to be
+ * positive, so the occurrences have a bounded length.
+ */
+static VALUE search_io(Search *search, VALUE io, double max, int *busy)
+{
+    double span;
+
+    if (!rb_respond_to(io, id_read)) {
+        rb_raise(rb_eTypeError, "wrong argument type %s (expected IO)",
+            rb_obj_classname(io));
+    }
+    if (search->deletion <= 0) {
+        rb_raise(rb_eArgError, "deletion weight has to be positive");
+    }
+    search->k = max;
+    search->io = io;
+    /* if the span of an occurrence doesn't fit in a long, nothing's dropped */
+    span = search->pattern_len + max / search->deletion + 1;
+    search->keep = span < (double) (LONG_MAX / 2) ? (long) span : LONG_MAX;
+    search->busy = busy;
+    search->result = rb_block_given_p() ? Qnil : rb_ary_new();
+    if (max < 0) return search->result;
+    search_start_columns(search);
+    search->started = scan_start(search->stats, 0.0);
+    (*busy)++;
+    return rb_ensure(search_run, (VALUE) search, search_finish,
+        (VALUE) search);
+}
+
+/*
+ * Edit scripts of the pattern and a string are computed here, in linear
+ * space (see alignment.c). Like a comparison, an alignment runs without the
+ * global interpreter lock, if the matrix is large, after copying the
+ * string, unless it's frozen.
+ */
+
+typedef struct AlignmentStruct {
+    char        *pattern;
+    int         pattern_len;
+    double      substitution;
+    double      insertion;
+    double      deletion;
+    Codepoints  *symbols;
+    char        *text;
+    long        text_len;
+    char        *copy;
+    int         *busy;
+    AlignmentRun *runs;
+    long        len;
+} Alignment;
+
+static void *alignment_kernel(void *data)
+{
+    Alignment *alignment = (Alignment *) data;
+    alignment->len = alignment_compute(alignment->pattern,
+        alignment->pattern_len, alignment->text, alignment->text_len,
+        alignment->substitution, alignment->insertion, alignment->deletion,
+        &alignment->runs);
+    return NULL;
+}
+
+#ifdef HAVE_RB_THREAD_CALL_WITHOUT_GVL
+/*
+ * Can't be canceled, like a single comparison (see UNBLOCKING_COST).
+ */
+static VALUE alignment_run_unblocked(VALUE data)
+{
+    rb_thread_call_without_gvl(alignment_kernel, (void *) data, NULL, NULL);
+    return Qnil;
+}
+
+static VALUE alignment_finish_unblocked(VALUE data)
+{
+    Alignment *alignment = (Alignment *) data;
+    (*alignment->busy)--;
+    xfree(alignment->copy);
+    alignment->copy = NULL;
+    return Qnil;
+}
+#endif
+
+/*
+ * Returns the edit script of string for alignment, which has to be set up
+ * with the pattern and the costs of the matcher, whose busy counter is busy,
+ * like a Search.
+ */
+static VALUE alignment_script(Alignment *alignment, VALUE string, int *busy)
+{
+    static ID *ops[] = { &id_match, &id_substitute, &id_insert, &id_delete };
+    VALUE result;
+    long i;
+
+    Check_Type(string, T_STRING);
+    alignment->text = RSTRING(string)->ptr;
+    alignment->text_len = RSTRING(string)->len;
+    alignment->busy = busy;
+    if (alignment->symbols &&
+            !codepoints_ascii(alignment->text, alignment->text_len)) {
+        alignment->copy = ALLOC_N(char, alignment->text_len);
+        alignment->text_len = codepoints_translate(alignment->symbols,
+            alignment->text, alignment->text_len, alignment->copy);
+        alignment->text = alignment->copy;
+    }
+#ifdef HAVE_RB_THREAD_CALL_WITHOUT_GVL
+    if (2.0 * alignment->pattern_len * alignment->text_len >=
+            UNBLOCKING_COST) {
+        if (!OBJ_FROZEN(string) && !alignment->copy) {
+            alignment->copy = ALLOC_N(char, alignment->text_len);
+            MEMCPY(alignment->copy, alignment->text, char,
+                alignment->text_len);
+            alignment->text = alignment->copy;
+        }
+        (*busy)++;
+        rb_ensure(alignment_run_unblocked, (VALUE) alignment,
+            alignment_finish_unblocked, (VALUE) alignment);
+    } else {
+        alignment_kernel(alignment);
+    }
+#else
+    alignment_kernel(alignment);
+#endif
+    xfree(alignment->copy);
+    if (alignment->len < 0) rb_raise(rb_eNoMemError, "failed to allocate memory");
+    result = rb_ary_new2(alignment->len);
+    for (i = 0; i < alignment->len; i++) {
+        rb_ary_push(result, rb_assoc_new(
+            ID2SYM(*ops[alignment->runs[i].op]),
+            LONG2NUM(alignment->runs[i].len)));
+    }
+    free(alignment->runs);
+    return result;
+}
+
+/*
+ * Pair distances are computed here:
+ */
+
+static VALUE PairDistance_tokens(VALUE string, VALUE regexp, int use_regexp)
+{
+    if (!NIL_P(regexp) || use_regexp) {
+        return rb_funcall(string, id_split, 1, regexp);
+    }
+    return rb_ary_new4(1, &string);
+}
+
+static PairArray *PairDistance_pair_array(VALUE string, VALUE regexp,
+    int use_regexp)
+{
+    return PairArray_new(PairDistance_tokens(string, regexp, use_regexp));
+}
+
+/*
+ * Returns the counted pairs of the pattern, split by regexp like the
+ * strings. They are kept until the pattern changes, or the pattern is split
+ * differently. The key describing the splitting is the inspected regexp.
+ */
+static PairCounts *PairDistance_pattern_pairs(PairDistance *amatch,
+    VALUE regexp, int use_regexp)
+{
+    PairArray *pattern_array;
+    VALUE key;
+
+    if (!NIL_P(regexp)) {
+        key = rb_str_concat(rb_str_new2("r"), rb_inspect(regexp));
+    } else {
+        key = rb_str_new2(use_regexp ? "d" : "n");
+    }
+    if (amatch->pattern_pairs &&
+            amatch->pattern_pairs_key_len == RSTRING(key)->len &&
+            memcmp(amatch->pattern_pairs_key, RSTRING(key)->ptr,
+                RSTRING(key)->len) == 0) {
+        return amatch->pattern_pairs;
+    }
+    if (amatch->busy) {
+        rb_raise(rb_eRuntimeError, "can't modify pattern while matching");
+    }
+    pattern_array = PairDistance_pair_array(
+        rb_str_new(amatch->pattern, amatch->pattern_len), regexp, use_regexp);
+    PairDistance_pattern_release(amatch);
+    amatch->pattern_pairs = PairCounts_new(pattern_array);
+    pair_array_destroy(pattern_array);
+    amatch->pattern_pairs_key_len = RSTRING(key)->len;
+    amatch->pattern_pairs_key = ALLOC_N(char, RSTRING(key)->len);
+    MEMCPY(amatch->pattern_pairs_key, RSTRING(key)->ptr, char,
+        RSTRING(key)->len);
+    return amatch->pattern_pairs;
+}
+
+static void *PairDistance_match_kernel(void *data)
+{
+    Comparison *cmp = (Comparison *) data;
+    if (cmp->b_pairs) {
+        cmp->result = pair_counts_match(cmp->a_pairs, cmp->b_pairs,
+            cmp->scratch);
+    } else {
+        cmp->result = pair_counts_match_string(cmp->a_pairs, cmp->b_ptr,
+            cmp->b_len, cmp->scratch);
+    }
+    return NULL;
+}
+
+/*
+ * Strings, that aren't split, are counted by the kernel directly, the
+ * others are split into tokens and their pairs are collected here.
+ */
+static void PairDistance_prepare(PairDistance *amatch, VALUE string,
+    VALUE regexp, int use_regexp, Comparison *cmp)
+{
+    int len;
+
+    Check_Type(string, T_STRING);
+    cmp->amatch = amatch;
+    cmp->a_pairs = amatch->pattern_pairs;
+    if (!NIL_P(regexp) || use_regexp) {
+        cmp->b_pairs = PairDistance_pair_array(string, regexp, use_regexp);
+        len = cmp->b_pairs->len;
+    } else {
+        cmp->b_ptr = RSTRING(string)->ptr;
+        cmp->b_len = RSTRING(string)->len;
+        len = cmp->b_len > 1 ? cmp->b_len - 1 : 0;
+    }
+    cmp->kernel = PairDistance_match_kernel;
+    cmp->scratch_size = pair_counts_scratch_size(len);
+    cmp->cost = (double) cmp->a_pairs->unique + len;
+}
+
+/*
+ * At most as many pairs as the smaller one of both strings has can match.
+ * options is false, if the strings shouldn't be split, and the regexp to
+ * split them with otherwise.
+ */
+static int PairDistance_best_prepare(PairDistance *amatch, VALUE string,
+    VALUE options, Comparison *cmp)
+{
+    double bound = cmp->bound;
+    int a_len, b_len, sum;
+
+    if (options == Qfalse) {
+        PairDistance_prepare(amatch, string, Qnil, 0, cmp);
+    } else {
+        PairDistance_prepare(amatch, string, options, 1, cmp);
+    }
+    a_len = cmp->a_pairs->len;
+    if (cmp->b_pairs) {
+        b_len = cmp->b_pairs->len;
+    } else {
+        b_len = cmp->b_len > 1 ? cmp->b_len - 1 : 0;
+    }
+    sum = a_len + b_len;
+    if (sum > 0 &&
+            ((double) (2 * (a_len < b_len ? a_len : b_len))) / sum <= bound) {
+        pair_array_destroy(cmp->b_pairs);
+        cmp->b_pairs = NULL;
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ * Hamming distances are computed here:
+ */
+
+/*
+ * The characters missing from the shorter string all count as different,
+ * the others are compared by the vectorized code in hamming.c.
+ */
+#define COMPUTE_HAMMING_DISTANCE                                    \
+    if (a_len <= b_len) {                                           \
+        result = b_len - a_len + hamming_mismatches(a_ptr, b_ptr, a_len); \
+    } else {                                                        \
+        result = a_len - b_len + hamming_mismatches(a_ptr, b_ptr, b_len); \
+    }
+
+static void *Hamming_match_kernel(void *data)
+{
+    Comparison *cmp = (Comparison *) data;
+    GET_COMPARISON_STRINGS
+    int result;
+
+    COMPUTE_HAMMING_DISTANCE
+    cmp->result = result;
+    return NULL;
+}
+
+static void Hamming_match_prepare(General *amatch, VALUE string, Comparison *cmp)
+{
+    char *a_ptr, *b_ptr;
+    int a_len, b_len;
+
+    Check_Type(string, T_STRING);
+    OPTIMIZE_TIME
+    SET_COMPARISON(cmp, Hamming_match_kernel, 0, b_len)
+}
+
+static void Hamming_similar_prepare(General *amatch, VALUE string, Comparison *cmp)
+{
+    char *a_ptr, *b_ptr;
+    int a_len, b_len;
+
+    Check_Type(string, T_STRING);
+    OPTIMIZE_TIME
+    SIMILAR_EMPTY_STRINGS(cmp)
+    SET_COMPARISON(cmp, Hamming_match_kernel, 0, b_len)
+}
+
+static VALUE Hamming_similar_finish(Comparison *cmp)
+{
+    if (!cmp->kernel) return rb_float_new(cmp->result);
+    return rb_float_new(1.0 - cmp->result / cmp->b_len);
+}
+
+/*
+ * Longest Common Subsequence computation, by running the bit vectors of the
+ * precomputed pattern mask over the string (see pattern_mask.c).
+ */
+
+static void *LongestSubsequence_match_kernel(void *data)
+{
+    GET_COMPARISON(General)
+    cmp->result = pattern_mask_lcs(amatch->pattern_mask, cmp->b_ptr,
+        cmp->b_len, cmp->scratch);
+    return NULL;
+}
+
+static void LongestSubsequence_match_prepare(General *amatch, VALUE string, Comparison *cmp)
+{
+    char *a_ptr, *b_ptr;
+    int a_len, b_len;
+
+    Check_Type(string, T_STRING);
+    DONT_OPTIMIZE
+    if (a_len == 0 || b_len == 0) return;
+    SET_COMPARISON(cmp, LongestSubsequence_match_kernel,
+        PATTERN_MASK_SCRATCH_SIZE, PATTERN_MASK_COST)
+}
+
+static void LongestSubsequence_similar_prepare(General *amatch, VALUE string, Comparison *cmp)
+{
+    char *a_ptr, *b_ptr;
+    int a_len, b_len;
+
+    Check_Type(string, T_STRING);
+    DONT_OPTIMIZE
+    SIMILAR_EMPTY_STRINGS(cmp)
+    SET_COMPARISON(cmp, LongestSubsequence_match_kernel,
+        PATTERN_MASK_SCRATCH_SIZE, PATTERN_MASK_COST)
+}
+
+/*
+ * Used by the similar methods of LongestSubsequence and LongestSubstring.
+ */
+static VALUE longest_similar_finish(Comparison *cmp)
+{
+    if (!cmp->kernel) return rb_float_new(cmp->result);
+    if (cmp->b_len > cmp->a_len) {
+        return rb_float_new(cmp->result / cmp->b_len);
+    } else {
+        return rb_float_new(cmp->result / cmp->a_len);
+    }
+}
+
+/*
+ * Longest Common Substring computation, by running the string through the
+ * suffix automaton of the pattern (see suffix_automaton.c).
+ */
+
+static void *LongestSubstring_match_kernel(void *data)
+{
+    GET_COMPARISON(LongestSubstring)
+    cmp->result = suffix_automaton_match(amatch->automaton, cmp->b_ptr,
+        cmp->b_len, &cmp->a_offset, &cmp->b_offset);
+    return NULL;
+}
+
+static void LongestSubstring_match_prepare(LongestSubstring *amatch, VALUE string, Comparison *cmp)
+{
+    char *a_ptr, *b_ptr;
+    int a_len, b_len;
+
+    Check_Type(string, T_STRING);
+    DONT_OPTIMIZE
+    if (a_len == 0 || b_len == 0) return;
+    SET_COMPARISON(cmp, LongestSubstring_match_kernel, 0, (double) b_len)
+}
+
+static void LongestSubstring_similar_prepare(LongestSubstring *amatch, VALUE string, Comparison *cmp)
+{
+    char *a_ptr, *b_ptr;
+    int a_len, b_len;
+
+    Check_Type(string, T_STRING);
+    DONT_OPTIMIZE
+    SIMILAR_EMPTY_STRINGS(cmp)
+    SET_COMPARISON(cmp, LongestSubstring_match_kernel, 0, (double) b_len)
+}
+
+static VALUE LongestSubstring_locate_finish(Comparison *cmp)
+{
+    return rb_ary_new3(3, INT2FIX((int) cmp->result),
+        INT2FIX(cmp->a_offset), INT2FIX(cmp->b_offset));
+}
+
+/*
+ * Jaro computation
+ *
+ * Every character of the string is matched with the first pattern character
+ * in its window, that is equal to it and wasn't matched yet: the lowest bit
+ * of its row in the pattern mask, once the bits outside of the window and
+ * those of matched characters are masked out. The matched characters of
+ * both strings are flagged in bit vectors, and transpositions are counted
+ * by walking them in order. This yields the same matches and transpositions
+ * as going through the pattern instead, so it doesn't matter, which of both
+ * strings is the shorter one.
+ */
+
+#define JARO_WORDS(len) \
+    (((len) + PATTERN_MASK_WORD_BITS - 1) / PATTERN_MASK_WORD_BITS)
+
+#define JARO_SCRATCH_SIZE \
+    ((JARO_WORDS(a_len) + JARO_WORDS(b_len)) * sizeof(uint64_t))
+
+static double jaro_similarity(PatternMask *mask, const char *b_ptr, int b_len,
+    uint64_t *scratch)
+{
+    int a_len = mask->len, a_words = JARO_WORDS(a_len);
+    int max_dist, low, high, i, w, end, m = 0, t = 0;
+    uint64_t *a_flags = scratch, *b_flags = scratch + a_words, *eq, bits;
+
+    MEMZERO(scratch, uint64_t, a_words + JARO_WORDS(b_len));
+    max_dist = ((a_len > b_len ? a_len : b_len) / 2) - 1;
+    /* the windows of later characters lie beyond the end of the pattern */
+    end = a_len + max_dist < b_len ? a_len + max_dist : b_len;
+    for (i = 0; i < end && m < a_len; i++) {
+        low = (i > max_dist ? i - max_dist : 0);
+        high = (i + max_dist < a_len ? i + max_dist : a_len - 1);
+        if (low > high) continue;
+        eq = pattern_mask_row(mask, b_ptr[i]);
+        for (w = low / PATTERN_MASK_WORD_BITS;
+                w <= high / PATTERN_MASK_WORD_BITS; w++) {
+            bits = eq[w] & ~a_flags[w];
+            if (w == low / PATTERN_MASK_WORD_BITS) {
+                bits &= ~(uint64_t) 0 << (low % PATTERN_MASK_WORD_BITS);
+            }
+            if (w == high / PATTERN_MASK_WORD_BITS) {
+                bits &= ~(uint64_t) 0 >>
+                    (PATTERN_MASK_WORD_BITS - 1 - high % PATTERN_MASK_WORD_BITS);
+            }
+            if (bits) {
+                a_flags[w] |= bits & (~bits + 1);
+                b_flags[i / PATTERN_MASK_WORD_BITS] |=
+                    (uint64_t) 1 << (i % PATTERN_MASK_WORD_BITS);
+                m++;
+                break;
+            }
+        }
+    }
+    if (m == 0) return 0.0;
+    for (end = i, i = 0, w = 0, bits = a_flags[0]; i < end; i++) {
+        if (!(b_flags[i / PATTERN_MASK_WORD_BITS] >>
+                    (i % PATTERN_MASK_WORD_BITS) & 1)) continue;
+        while (!bits) bits = a_flags[++w];
+        if (!(pattern_mask_row(mask, b_ptr[i])[w] & bits & (~bits + 1))) t++;
+        bits &= bits - 1;
+    }
+    t = t / 2;
+    return (((double)m)/a_len + ((double)m)/b_len + ((double)(m-t))/m)/3.0;
+}
+
+static void *Jaro_match_kernel(void *data)
+{
+    GET_COMPARISON(Jaro)
+    cmp->result = jaro_similarity(amatch->pattern_mask, cmp->b_ptr,
+        cmp->b_len, (uint64_t *) cmp->scratch);
+    return NULL;
+}
+
+static void Jaro_match_prepare(Jaro *amatch, VALUE string, Comparison *cmp)
+{
+    char *a_ptr, *b_ptr;
+    int a_len, b_len;
+
+    Check_Type(string, T_STRING);
+    DONT_OPTIMIZE
+    SIMILAR_EMPTY_STRINGS(cmp)
+    SET_COMPARISON(cmp, Jaro_match_kernel, JARO_SCRATCH_SIZE,
+        (double) b_len * JARO_WORDS(a_len))
+}
+
+/*
+ * The Jaro similarity of strings of lengths a_len and b_len, with at most m
+ * matching characters, is at most, what it would be, if m matched without
+ * transpositions.
+ */
+static double jaro_upper(int m, int a_len, int b_len)
+{
+    if (m == 0) return 0.0;
+    return (((double) m) / a_len + ((double) m) / b_len + 1.0) / 3.0;
+}
+
+/*
+ * Strings, whose similarity can't reach the minimum, are rejected by the
+ * length of the shorter string, and then by the number of characters, that
+ * both strings have in common (see prefilter.c). There is no q-gram stage.
+ */
+static int Jaro_select_prepare(Jaro *amatch, VALUE string,
+    Prefilter *filter, Comparison *cmp)
+{
+    int missing, surplus;
+
+    Jaro_match_prepare(amatch, string, cmp);
+    if (!cmp->kernel) return 0;
+    if (BOUND_FALLS_SHORT(jaro_upper(
+                    cmp->a_len < cmp->b_len ? cmp->a_len : cmp->b_len,
+                    cmp->a_len, cmp->b_len), cmp->bound)) {
+        return 1;
+    }
+    prefilter_excess(filter, cmp->b_ptr, cmp->b_len, &missing, &surplus);
+    if (BOUND_FALLS_SHORT(jaro_upper(cmp->a_len - missing, cmp->a_len,
+                    cmp->b_len), cmp->bound)) {
+        return 2;
+    }
+    return 0;
+}
+
+/*
+ * Jaro-Winkler computation
+ */
+
+/*
+ * Upper bound of the Jaro-Winkler similarity, if the Jaro similarity is at
+ * most upper, and the common prefix at most n characters long. The prefix
+ * is weighted in float like the kernel does, the rest is only good up to
+ * the slack.
+ */
+static double jaro_winkler_upper(double upper, int n, float scaling_factor)
+{
+    float weight = n * scaling_factor;
+    double prefixed = upper + weight * (1 - upper);
+    return prefixed < weight ? weight : prefixed;
+}
+
+static void *JaroWinkler_match_kernel(void *data)
+{
+    GET_COMPARISON(JaroWinkler)
+    PatternMask *mask = amatch->pattern_mask;
+    int i, n = 0, prefix = cmp->a_len < cmp->b_len ? cmp->a_len : cmp->b_len;
+    double result;
+
+    result = jaro_similarity(mask, cmp->b_ptr, cmp->b_len,
+        (uint64_t *) cmp->scratch);
+    for (i = 0; i < (prefix >= 4 ? 4 : prefix); i++) {
+        if (*pattern_mask_row(mask, cmp->b_ptr[i]) >> i & 1) {
+            n++;
+        } else {
+            break;
+        }
+    }
+    result = result + n*amatch->scaling_factor*(1-result);
+    cmp->result = result;
+    return NULL;
+}
+
+static void JaroWinkler_match_prepare(JaroWinkler *amatch, VALUE string, Comparison *cmp)
+{
+    char *a_ptr, *b_ptr;
+    int a_len, b_len;
+
+    Check_Type(string, T_STRING);
+    DONT_OPTIMIZE
+    SIMILAR_EMPTY_STRINGS(cmp)
+    SET_COMPARISON(cmp, JaroWinkler_match_kernel, JARO_SCRATCH_SIZE,
+        (double) b_len * JARO_WORDS(a_len))
+}
+
+/*
+ * The Jaro-Winkler similarity of two strings is at most, what it would be,
+ * if all the characters of the shorter one matched without transpositions,
+ * and they had the longest possible common prefix. Strings, for which that
+ * is less than the similarity to beat, are skipped.
+ */
+static int JaroWinkler_best_prepare(JaroWinkler *amatch, VALUE string,
+    VALUE options, Comparison *cmp)
+{
+    int shorter;
+
+    JaroWinkler_match_prepare(amatch, string, cmp);
+    if (!cmp->kernel) return 1;
+    shorter = cmp->a_len < cmp->b_len ? cmp->a_len : cmp->b_len;
+    if (!BOUND_FALLS_SHORT(jaro_winkler_upper(jaro_upper(shorter,
+                        cmp->a_len, cmp->b_len), shorter >= 4 ? 4 : shorter,
+                    amatch->scaling_factor), cmp->bound)) {
+        return 1;
+    }
+    xfree(cmp->symbols);
+    cmp->symbols = NULL;
+    return 0;
+}
+
+/*
+ * Like Jaro_select_prepare, the second stage also takes the actual common
+ * prefix into account.
+ */
+static int JaroWinkler_select_prepare(JaroWinkler *amatch, VALUE string,
+    Prefilter *filter, Comparison *cmp)
+{
+    int shorter, missing, surplus, n;
+
+    JaroWinkler_match_prepare(amatch, string, cmp);
+    if (!cmp->kernel) return 0;
+    shorter = cmp->a_len < cmp->b_len ? cmp->a_len : cmp->b_len;
+    if (BOUND_FALLS_SHORT(jaro_winkler_upper(jaro_upper(shorter,
+                        cmp->a_len, cmp->b_len), shorter >= 4 ? 4 : shorter,
+                    amatch->scaling_factor), cmp->bound)) {
+        return 1;
+    }
+    prefilter_excess(filter, cmp->b_ptr, cmp->b_len, &missing, &surplus);
+    for (n = 0; n < (shorter >= 4 ? 4 : shorter); n++) {
+        if (!(*pattern_mask_row(amatch->pattern_mask, cmp->b_ptr[n]) >> n & 1)) {
+            break;
+        }
+    }
+    if (BOUND_FALLS_SHORT(jaro_winkler_upper(jaro_upper(
+                        cmp->a_len - missing, cmp->a_len, cmp->b_len), n,
+                    amatch->scaling_factor), cmp->bound)) {
+        return 2;
+    }
+    return 0;
+}
+
+/*
+ * Bitap computation (see bitap.c): the first occurrence in each string is
+ * found by a kernel, all of them in one string like search_all does.
+ */
+
+#define BITAP_HITS 1024
+
+typedef struct BitapRunStruct {
+    Bitap       *amatch;
+    int         k;
+    uint64_t    state[BITAP_MAX_LEN + 1];
+    char        *text;
+    long        text_len;
+    long        next;
+    BitapHit    hits[BITAP_HITS];
+    int         len;
+    int         unblocked;
+    char        *copy;
+    uint64_t    started;        /* see scan_start */
+    VALUE       result;
+} BitapRun;
+
+static void *Bitap_search_kernel(void *data)
+{
+    GET_COMPARISON(Bitap)
+    cmp->result = bitap_first(amatch->mask, (int) cmp->bound,
+        (uint64_t *) cmp->scratch, cmp->b_ptr, cmp->b_len);
+    return NULL;
+}
+
+static void Bitap_search_prepare(Bitap *amatch, VALUE string, Comparison *cmp)
+{
+    char *a_ptr, *b_ptr;
+    int a_len, b_len;
+
+    Check_Type(string, T_STRING);
+    /* the positions of a Bitap pattern are always bytes */
+    a_ptr = amatch->pattern;
+    a_len = amatch->pattern_len;
+    b_ptr = RSTRING(string)->ptr;
+    b_len = RSTRING(string)->len;
+    if (cmp->bound < 0) {
+        cmp->result = -1;
+        return;
+    }
+    SET_COMPARISON(cmp, Bitap_search_kernel,
+        ((int) cmp->bound + 1) * sizeof(uint64_t),
+        (double) b_len * (cmp->bound + 1))
+}
+
+static VALUE Bitap_search_finish(Comparison *cmp)
+{
+    return cmp->result < 0 ? Qnil : LONG2NUM((long) cmp->result);
+}
+
+static void *bitap_run_scan(void *data)
+{
+    BitapRun *run = (BitapRun *) data;
+    long stop = run->next + SEARCH_CHUNK;
+
+    run->len = 0;
+    run->next = bitap_scan(run->amatch->mask, run->k, run->state, run->text,
+        run->next, stop < run->text_len ? stop : run->text_len, run->hits,
+        &run->len, BITAP_HITS);
+    return NULL;
+}
+
+static VALUE bitap_run(VALUE data)
+{
+    BitapRun *run = (BitapRun *) data;
+    int i;
+
+    while (run->next < run->text_len) {
+#ifdef HAVE_RB_THREAD_CALL_WITHOUT_GVL
+        if (run->unblocked) {
+            rb_thread_call_without_gvl(bitap_run_scan, run, NULL, NULL);
+        } else {
+            bitap_run_scan(run);
+        }
+#else
+        bitap_run_scan(run);
+#endif
+        for (i = 0; i < run->len; i++) {
+            rb_ary_push(run->result, rb_assoc_new(LONG2NUM(run->hits[i].end),
+                INT2FIX(run->hits[i].distance)));
+        }
+    }
+    return run->result;
+}
+
+static VALUE bitap_run_finish(VALUE data)
+{
+    BitapRun *run = (BitapRun *) data;
+    run->amatch->busy--;
+    scan_finish(&run->amatch->stats, run->started,
+        (double) run->text_len * (run->k + 1), run->text_len);
+    xfree(run->copy);
+    return Qnil;
+}
+
+/*
+ * Ruby API
+ */
+
+ /* 
+  * Document-class: Amatch::Levenshtein
+  *
+  * The Levenshtein edit distance is defined as the minimal costs involved to
+  * transform one string into another by using three elementary operations:
+  * deletion, insertion and substitution of a character. To transform "water"
+  * into "wine", for instance, you have to substitute "a" -> "i": "witer", "t"
+  * -> "n": "winer" and delete "r": "wine". The edit distance between "water"
+  * and "wine" is 3, because you have to apply three operations. The edit
+  * distance between "wine" and "wine" is 0 of course: no operation is
+  * necessary for the transformation -- they're already the same string. It's
+  * easy to see that more similar strings have smaller edit distances than
+  * strings that differ a lot.
+  */
+
+DEF_RB_FREE(Levenshtein, General)
+
+/*
+ * call-seq: new(pattern)
+ *
+ * Creates a new Amatch::Levenshtein instance from <code>pattern</code>.
+ */
+static VALUE rb_Levenshtein_initialize(VALUE self, VALUE pattern)
+{
+    GET_STRUCT(General)
+    General_pattern_set(amatch, pattern);
+    return self;
+}
+
+DEF_CONSTRUCTOR(Levenshtein, General)
+
+/*
+ * call-seq: match(strings, max_distance = nil) -> results
+ * 
+ * Uses this Amatch::Levenshtein instance to match Amatch::Levenshtein#pattern
+ * against <code>strings</code>. It returns the number operations, the Sellers
+ * distance. <code>strings</code> has to be either a String or an Array of
+ * Strings. The returned <code>results</code> are either a Float or an Array of
+ * Floats respectively.
+ *
+ * If <code>max_distance</code> is given, only the part of the computation,
+ * that can lead to a distance <= <code>max_distance</code>, is done, and nil
+ * is returned for strings with a greater distance.
+ */
+static VALUE rb_Levenshtein_match(int argc, VALUE *argv, VALUE self)
+{                                                                            
+    VALUE strings, max_distance = Qnil;
+    GET_STRUCT(General)
+
+    rb_scan_args(argc, argv, "11", &strings, &max_distance);
+    if (NIL_P(max_distance)) {
+        return General_iterate_strings(amatch, strings, 0.0,
+            Levenshtein_match_prepare, finish_int);
+    }
+    CAST2FLOAT(max_distance);
+    return General_iterate_strings(amatch, strings, FLOAT2C(max_distance),
+        Levenshtein_match_bounded_prepare, finish_bounded_int);
+}
+
+/*
+ * call-seq: similar(strings) -> results
+ * 
+ * Uses this Amatch::Levenshtein instance to match  Amatch::Levenshtein#pattern
+ * against <code>strings</code>, and compute a Levenshtein distance metric
+ * number between 0.0 for very unsimilar strings and 1.0 for an exact match.
+ * <code>strings</code> has to be either a String or an Array of Strings. The
+ * returned <code>results</code> are either a Fixnum or an Array of Fixnums
+ * respectively.
+ */
+static VALUE rb_Levenshtein_similar(VALUE self, VALUE strings)
+{                                                                            
+    GET_STRUCT(General)
+    return General_iterate_strings(amatch, strings, 0.0,
+        Levenshtein_similar_prepare, Levenshtein_similar_finish);
+}
+
+/*
+ * call-seq: levenshtein_similar(strings) -> results
+ * 
+ * If called on a String, this string is used as a Amatch::Levenshtein#pattern
+ * to match against <code>strings</code>. It returns a Levenshtein distance
+ * metric number between 0.0 for very unsimilar strings and 1.0 for an exact
+ * match. <code>strings</code> has to be either a String or an Array of
+ * Strings. The returned <code>results</code> are either a Float or an Array of
+ * Floats respectively.
+ */
+static VALUE rb_str_levenshtein_similar(VALUE self, VALUE strings)
+{
+    VALUE amatch = rb_Levenshtein_new(rb_cLevenshtein, self);
+    return rb_Levenshtein_similar(amatch, strings);
+}
+
+/*
+ * call-seq: search(strings, max_distance = nil) -> results
+ * 
+ * searches Amatch::Levenshtein#pattern in <code>strings</code> and returns the
+ * edit distance (the sum of character operations) as a Fixnum value, by greedy
+ * trimming prefixes or postfixes of the match. <code>strings</code> has
+ * to be either a String or an Array of Strings. The returned
+ * <code>results</code> are either a Float or an Array of Floats respectively.
+ *
+ * If <code>max_distance</code> is given, nil is returned for strings, that
+ * don't contain the pattern with at most <code>max_distance</code>
+ * operations, and only the pattern prefixes, that can still lead to such a
+ * match, are considered for every position of the string.
+ */
+static VALUE rb_Levenshtein_search(int argc, VALUE *argv, VALUE self)
+{                                                                            
+    VALUE strings, max_distance = Qnil;
+    GET_STRUCT(General)
+
+    rb_scan_args(argc, argv, "11", &strings, &max_distance);
+    if (NIL_P(max_distance)) {
+        return General_iterate_strings(amatch, strings, 0.0,
+            Levenshtein_search_prepare, finish_int);
+    }
+    CAST2FLOAT(max_distance);
+    return General_iterate_strings(amatch, strings, FLOAT2C(max_distance),
+        Levenshtein_search_bounded_prepare, finish_bounded_int);
+}
+
+/*
+ * call-seq: search_all(string, max_distance) -> results
+ *
+ * Returns all occurrences of Amatch::Levenshtein#pattern in
+ * <code>string</code> with at most <code>max_distance</code> operations, as
+ * an Array of <code>[start, end, distance]</code> triples, so that
+ * <code>string[start...end]</code> is an occurrence. Occurrences ending at
+ * consecutive positions overlap, and are reported only once, where their
+ * distance is lowest, starting as late as possible.
+ *
+ *  Amatch::Levenshtein.new('test').search_all('a tst, a test', 1)
+ *  # => [[2, 5, 1], [9, 13, 0]]
+ */
+static VALUE rb_Levenshtein_search_all(VALUE self, VALUE string,
+    VALUE max_distance)
+{
+    Search search;
+    GET_STRUCT(General)
+
+    CAST2FLOAT(max_distance);
+    MEMZERO(&search, Search, 1);
+    search.pattern = SYMBOLS(amatch);
+    search.pattern_len = SYMBOLS_LEN(amatch);
+    search.symbols = amatch->symbols;
+    search.pattern_mask = amatch->pattern_mask;
+    search.substitution = search.insertion = search.deletion = 1.0;
+    search.integer = 1;
+    search.stats = &amatch->stats;
+    return search_all(&search, string, FLOAT2C(max_distance) < 0 ?
+        -1.0 : BOUND2INT(FLOAT2C(max_distance)), &amatch->busy);
+}
+
+/*
+ * call-seq: search_io(io, max_distance) { |start, end, distance| ... }
+ *           search_io(io, max_distance) -> results
+ *
+ * Searches Amatch::Levenshtein#pattern in the text read from
+ * <code>io</code>, like Amatch::Levenshtein#search_all, and yields the
+ * occurrences with at most <code>max_distance</code> operations, as their
+ * offsets from the beginning of the text and their distances. Without a
+ * block an Array of <code>[start, end, distance]</code> triples is returned.
+ *
+ * <code>io</code> is read in chunks of 1 MiB by calling its read method,
+ * so it can be any IO like object, e. g. a StringIO. Occurrences spanning
+ * several chunks are found as well, and only the last
+ * <code>pattern.size + max_distance</code> characters read are kept, so
+ * the memory needed doesn't grow with the text.
+ *
+ *  Amatch::Levenshtein.new('test').search_io(StringIO.new('a tst, a test'), 1)
+ *  # => [[2, 5, 1], [9, 13, 0]]
+ */
+static VALUE rb_Levenshtein_search_io(VALUE self, VALUE io,
+    VALUE max_distance)
+{
+    Search search;
+    VALUE result;
+    GET_STRUCT(General)
+
+    CAST2FLOAT(max_distance);
+    MEMZERO(&search, Search, 1);
+    search.pattern = SYMBOLS(amatch);
+    search.pattern_len = SYMBOLS_LEN(amatch);
+    search.symbols = amatch->symbols;
+    search.pattern_mask = amatch->pattern_mask;
+    search.substitution = search.insertion = search.deletion = 1.0;
+    search.integer = 1;
+    search.stats = &amatch->stats;
+    result = search_io(&search, io, FLOAT2C(max_distance) < 0 ?
+        -1.0 : BOUND2INT(FLOAT2C(max_distance)), &amatch->busy);
+    return NIL_P(result) ? self : result;
+}
+
+/*
+ * call-seq: alignment(string) -> script
+ *
+ * Returns an optimal edit script, that transforms <code>string</code> into
+ * Amatch::Levenshtein#pattern, as an Array of <code>[operation,
+ * length]</code> runs. The operations are <code>:match</code>,
+ * <code>:substitute</code>, <code>:insert</code> (characters of the pattern)
+ * and <code>:delete</code> (characters of <code>string</code>), and the
+ * number of operations other than <code>:match</code> is
+ * Amatch::Levenshtein#match of <code>string</code>. The script is computed
+ * in memory linear in the length of the shorter string, by Hirschberg's
+ * algorithm.
+ *
+ *  Amatch::Levenshtein.new('wine').alignment('water')
+ *  # => [[:match, 1], [:substitute, 2], [:match, 1], [:delete, 1]]
+ */
+static VALUE rb_Levenshtein_alignment(VALUE self, VALUE string)
+{
+    Alignment alignment;
+    GET_STRUCT(General)
+
+    MEMZERO(&alignment, Alignment, 1);
+    alignment.pattern = SYMBOLS(amatch);
+    alignment.pattern_len = SYMBOLS_LEN(amatch);
+    alignment.symbols = amatch->symbols;
+    alignment.substitution = alignment.insertion = alignment.deletion = 1.0;
+    return alignment_script(&alignment, string, &amatch->busy);
+}
+
+/*
+ * call-seq: best(strings, k) -> results
+ *
+ * Matches Amatch::Levenshtein#pattern against the Array
+ * <code>strings</code> and returns the <code>k</code> strings with the
+ * smallest edit distances as <code>[index, distance]</code> pairs, sorted by
+ * distance. Of strings with the same distance, the ones with lower indexes
+ * come first. Once <code>k</code> strings were matched, only as much of
+ * every further match is computed, as is needed to tell, that it isn't any
+ * better, and strings, whose length alone rules them out, are skipped.
+ */
+static VALUE rb_Levenshtein_best(VALUE self, VALUE strings, VALUE k)
+{
+    GET_STRUCT(General)
+    return General_best(amatch, strings, k, 0, Qnil,
+        Levenshtein_best_prepare, finish_int);
+}
+
+/*
+ * call-seq: select(strings, max_distance) -> results
+ *
+ * Matches Amatch::Levenshtein#pattern against the Array
+ * <code>strings</code> and returns the strings within
+ * <code>max_distance</code> operations as <code>[index, distance]</code>
+ * pairs, in the order of <code>strings</code>. Strings are rejected by
+ * cheap lower bounds of their distances first, in three stages: by the
+ * difference of the lengths, by the characters missing from either string,
+ * and by the pairs of adjacent pattern characters missing from the string.
+ * Only the others are matched.
+ *
+ *  m = Amatch::Levenshtein.new('test')
+ *  m.select(%w[tset test testing bestow], 1)
+ *  # => [[1, 0]]
+ *  m.rejected
+ *  # => [2, 0, 1]
+ */
+static VALUE rb_Levenshtein_select(VALUE self, VALUE strings,
+    VALUE max_distance)
+{
+    Prefilter filter;
+    int k;
+    GET_STRUCT(General)
+
+    CAST2FLOAT(max_distance);
+    check_strings(strings);
+    k = FLOAT2C(max_distance) < 0 ? -1 : BOUND2INT(FLOAT2C(max_distance));
+    prefilter_init(&filter, SYMBOLS(amatch), SYMBOLS_LEN(amatch), 0,
+        SYMBOLS_LEN(amatch) - 1 > 2L * k);
+    return General_select(amatch, strings, k, 0, &filter,
+        Levenshtein_select_prepare, finish_bounded_int);
+}
+
+/*
+ * Document-method: rejected
+ *
+ * call-seq: rejected -> [length, histogram, grams]
+ *
+ * Returns how many strings the last call of select rejected in each of its
+ * stages, see Amatch::Levenshtein#select.
+ */
+
+#ifndef SIZET2NUM
+#define SIZET2NUM(v) ULONG2NUM(v)
+#endif
+
+static VALUE grep_run(VALUE data)
+{
+    Grep *grep = (Grep *) data;
+    GrepLine *line;
+    VALUE string, number, offset;
+    int i;
+
+    while (grep->next < grep->file.len) {
+#ifdef HAVE_RB_THREAD_CALL_WITHOUT_GVL
+        rb_thread_call_without_gvl(grep_scan, grep, NULL, NULL);
+#else
+        grep_scan(grep);
+#endif
+        if (grep->failed) rb_raise(rb_eNoMemError, "failed to allocate memory");
+        for (i = 0; i < grep->len; i++) {
+            line = grep->lines + i;
+            string = rb_str_new(grep->file.ptr + line->offset, line->len);
+            number = LONG2NUM(line->number);
+            offset = SIZET2NUM(line->offset);
+            if (NIL_P(grep->result)) {
+                rb_yield_values(3, string, number, offset);
+            } else {
+                rb_ary_push(grep->result, rb_ary_new3(3, string, number,
+                    offset));
+            }
+        }
+    }
+    return grep->result;
+}
+
+static VALUE grep_finish(VALUE data)
+{
+    Grep *grep = (Grep *) data;
+    grep->amatch->busy--;
+    scan_finish(&grep->amatch->stats, grep->started, (double) grep->next *
+        grep->amatch->pattern_mask->words, grep->next);
+    mapped_file_close(&grep->file);
+    xfree(grep->scratch);
+    free(grep->symbols);
+    return Qnil;
+}
+
+/*
+ * call-seq: grep_file(path, max_distance) { |line, number, offset| ... }
+ *           grep_file(path, max_distance) -> results
+ *
+ * Searches Amatch::Levenshtein#pattern in every line of the file at
+ * <code>path</code>, like Amatch::Levenshtein#search, and yields the lines,
+ * that contain it with at most <code>max_distance</code> operations,
+ * together with their line numbers, starting at 1, and the byte offsets of
+ * their beginnings in the file. The lines don't include their newlines.
+ * Without a block an Array of <code>[line, number, offset]</code> triples is
+ * returned.
+ *
+ * The file is mapped into memory and scanned in C, so only the matching
+ * lines become Ruby strings.
+ */
+static VALUE rb_Levenshtein_grep_file(VALUE self, VALUE path,
+    VALUE max_distance)
+{
+    Grep grep;
+    char *filename = StringValueCStr(path);
+    int scratch_len;
+    GET_STRUCT(General)
+
+    CAST2FLOAT(max_distance);
+    MEMZERO(&grep, Grep, 1);
+    if (mapped_file_open(&grep.file, filename) < 0) rb_sys_fail(filename);
+    grep.amatch = amatch;
+    grep.k = FLOAT2C(max_distance) < 0 ?
+        -1 : BOUND2INT(FLOAT2C(max_distance));
+    grep_pieces(&grep);
+    scratch_len = pattern_mask_scratch_len(amatch->pattern_mask);
+    if (scratch_len > 0) grep.scratch = ALLOC_N(uint64_t, scratch_len);
+    grep.result = rb_block_given_p() ? Qnil : rb_ary_new();
+    grep.started = scan_start(&amatch->stats, (double) grep.file.len *
+        amatch->pattern_mask->words);
+    amatch->busy++;
+    rb_ensure(grep_run, (VALUE) &grep, grep_finish, (VALUE) &grep);
+    return NIL_P(grep.result) ? self : grep.result;
+}
+
+/* 
+ * Document-class: Amatch::Sellers
+ *
+ * The Sellers edit distance is very similar to the Levenshtein edit distance.
+ * The difference is, that you can also specify different weights for every
+ * operation to prefer special operations over others. This extension of the
+ * Sellers edit distance is also known under the names: Needleman-Wunsch
+ * distance.
+ */
+
+DEF_RB_FREE(Sellers, Sellers)
+
+/*
+ * Document-method: substitution
+ *
+ * call-seq: substitution -> weight
+ *
+ * Returns the weight of the substitution operation, that is used to compute
+ * the Sellers distance.
+ */
+DEF_RB_READER(Sellers, rb_Sellers_substitution, substitution,
+    rb_float_new)
+
+/*
+ * Document-method: deletion
+ *
+ * call-seq: deletion -> weight
+ *
+ * Returns the weight of the deletion operation, that is used to compute
+ * the Sellers distance.
+ */
+DEF_RB_READER(Sellers, rb_Sellers_deletion, deletion,
+    rb_float_new)
+
+/*
+ * Document-method: insertion
+ *
+ * call-seq: insertion -> weight
+ *
+ * Returns the weight of the insertion operation, that is used to compute
+ * the Sellers distance.
+ */
+DEF_RB_READER(Sellers, rb_Sellers_insertion, insertion,
+    rb_float_new)
+
+/*
+ * Document-method: substitution=
+ *
+ * call-seq: substitution=(weight)
+ *
+ * Sets the weight of the substitution operation, that is used to compute
+ * the Sellers distance, to <code>weight</code>. The <code>weight</code>
+ * should be a Float value >= 0.0.
+ */
+DEF_RB_WRITER(Sellers, rb_Sellers_substitution_set, substitution,
+    double, CAST2FLOAT, FLOAT2C, >= 0)
+
+/*
+ * Document-method: deletion=
+ *
+ * call-seq: deletion=(weight)
+ *
+ * Sets the weight of the deletion operation, that is used to compute
+ * the Sellers distance, to <code>weight</code>. The <code>weight</code>
+ * should be a Float value >= 0.0.
+ */
+DEF_RB_WRITER(Sellers, rb_Sellers_deletion_set, deletion,
+    double, CAST2FLOAT, FLOAT2C, >= 0)
+
+/*
+ * Document-method: insertion=
+ *
+ * call-seq: insertion=(weight)
+ *
+ * Sets the weight of the insertion operation, that is used to compute
+ * the Sellers distance, to <code>weight</code>. The <code>weight</code>
+ * should be a Float value >= 0.0.
+ */
+DEF_RB_WRITER(Sellers, rb_Sellers_insertion_set, insertion,
+    double, CAST2FLOAT, FLOAT2C, >= 0)
+
+/*
+ * Resets all weights (substitution, deletion, and insertion) to 1.0.
+ */
+static VALUE rb_Sellers_reset_weights(VALUE self)
+{
+    GET_STRUCT(Sellers)
+    Sellers_reset_weights(amatch);
+    return self;
+}
+
+/*
+ * call-seq: new(pattern)
+ *
+ * Creates a new Amatch::Sellers instance from <code>pattern</code>,
+ * with all weights initially set to 1.0.
+ */
+static VALUE rb_Sellers_initialize(VALUE self, VALUE pattern)
+{
+    GET_STRUCT(Sellers)
+    Sellers_pattern_set(amatch, pattern);
+    Sellers_reset_weights(amatch);
+    return self;
+}
+
+DEF_CONSTRUCTOR(Sellers, Sellers)
+
+/*
+ * Document-method: pattern
+ *
+ * call-seq: pattern -> pattern string
+ *
+ * Returns the current pattern string of this Amatch::Sellers instance.
+ */
+
+/*
+ * Document-method: pattern=
+ *
+ * call-seq: pattern=(pattern)
+ * 
+ * Sets the current pattern string of this Amatch::Sellers instance to
+ * <code>pattern</code>.
+ */
+
+/*
+ * call-seq: match(strings, max_distance = nil) -> results
+ * 
+ * Uses this Amatch::Sellers instance to match Sellers#pattern against
+ * <code>strings</code>, while taking into account the given weights. It
+ * returns the number of weighted character operations, the Sellers distance.
+ * <code>strings</code> has to be either a String or an Array of Strings. The
+ * returned <code>results</code> are either a Float or an Array of Floats
+ * respectively.
+ *
+ * If <code>max_distance</code> is given, only the diagonals of the matrix,
+ * that can lead to a distance <= <code>max_distance</code>, are computed,
+ * and nil is returned for strings with a greater distance.
+ */
+static VALUE rb_Sellers_match(int argc, VALUE *argv, VALUE self)
+{                                                                            
+    VALUE strings, max_distance = Qnil;
+    GET_STRUCT(Sellers)
+
+    rb_scan_args(argc, argv, "11", &strings, &max_distance);
+    if (NIL_P(max_distance)) {
+        return Sellers_iterate_strings(amatch, strings, 0.0,
+            Sellers_match_prepare, finish_float);
+    }
+    CAST2FLOAT(max_distance);
+    return Sellers_iterate_strings(amatch, strings, FLOAT2C(max_distance),
+        Sellers_match_bounded_prepare, finish_bounded_float);
+}
+
+/*
+ * call-seq: similar(strings) -> results
+ * 
+ * Uses this Amatch::Sellers instance to match Amatch::Sellers#pattern
+ * against <code>strings</code> (taking into account the given weights), and
+ * compute a Sellers distance metric number between 0.0 for very unsimilar
+ * strings and 1.0 for an exact match. <code>strings</code> has to be either a
+ * String or an Array of Strings. The returned <code>results</code> are either
+ * a Fixnum or an Array of Fixnums
+ * respectively.
+ */
+static VALUE rb_Sellers_similar(VALUE self, VALUE strings)
+{                                                                            
+    GET_STRUCT(Sellers)
+    return Sellers_iterate_strings(amatch, strings, 0.0,
+        Sellers_similar_prepare, Sellers_similar_finish);
+}
+
+/*
+ * call-seq: search(strings, max_distance = nil) -> results
+ *
+ * searches Sellers#pattern in <code>strings</code> and returns the edit
+ * distance (the sum of weighted character operations) as a Float value, by
+ * greedy trimming prefixes or postfixes of the match. <code>strings</code> has
+ * to be either a String or an Array of Strings. The returned
+ * <code>results</code> are either a Float or an Array of Floats respectively.
+ *
+ * If <code>max_distance</code> is given, nil is returned for strings, that
+ * don't contain the pattern within a distance of
+ * <code>max_distance</code>.
+ */
+static VALUE rb_Sellers_search(int argc, VALUE *argv, VALUE self)
+{                                                                            
+    VALUE strings, max_distance = Qnil;
+    GET_STRUCT(Sellers)
+
+    rb_scan_args(argc, argv, "11", &strings, &max_distance);
+    if (NIL_P(max_distance)) {
+        return Sellers_iterate_strings(amatch, strings, 0.0,
+            Sellers_search_prepare, finish_float);
+    }
+    CAST2FLOAT(max_distance);
+    return Sellers_iterate_strings(amatch, strings, FLOAT2C(max_distance),
+        Sellers_search_bounded_prepare, finish_bounded_float);
+}
+
+/*
+ * call-seq: search_all(string, max_distance) -> results
+ *
+ * Returns all occurrences of Amatch::Sellers#pattern in <code>string</code>
+ * with a Sellers distance of at most <code>max_distance</code>, as an Array
+ * of <code>[start, end, distance]</code> triples, so that
+ * <code>string[start...end]</code> is an occurrence. Occurrences ending at
+ * consecutive positions overlap, and are reported only once, where their
+ * distance is lowest, starting as late as possible.
+ */
+static VALUE rb_Sellers_search_all(VALUE self, VALUE string,
+    VALUE max_distance)
+{
+    Search search;
+    GET_STRUCT(Sellers)
+
+    CAST2FLOAT(max_distance);
+    MEMZERO(&search, Search, 1);
+    search.pattern = SYMBOLS(amatch);
+    search.pattern_len = SYMBOLS_LEN(amatch);
+    search.symbols = amatch->symbols;
+    search.substitution = amatch->substitution;
+    search.insertion = amatch->insertion;
+    search.deletion = amatch->deletion;
+    search.stats = &amatch->stats;
+    return search_all(&search, string, FLOAT2C(max_distance), &amatch->busy);
+}
+
+/*
+ * call-seq: search_io(io, max_distance) { |start, end, distance| ... }
+ *           search_io(io, max_distance) -> results
+ *
+ * Searches Amatch::Sellers#pattern in the text read from <code>io</code>,
+ * like Amatch::Levenshtein#search_io, with a Sellers distance of at most
+ * <code>max_distance</code>. Only the last <code>pattern.size +
+ * max_distance / deletion</code> characters read are kept, so the deletion
+ * weight has to be positive, or an ArgumentError is raised.
+ */
+static VALUE rb_Sellers_search_io(VALUE self, VALUE io, VALUE max_distance)
+{
+    Search search;
+    VALUE result;
+    GET_STRUCT(Sellers)
+
+    CAST2FLOAT(max_distance);
+    MEMZERO(&search, Search, 1);
+    search.pattern = SYMBOLS(amatch);
+    search.pattern_len = SYMBOLS_LEN(amatch);
+    search.symbols = amatch->symbols;
+    search.substitution = amatch->substitution;
+    search.insertion = amatch->insertion;
+    search.deletion = amatch->deletion;
+    search.stats = &amatch->stats;
+    result = search_io(&search, io, FLOAT2C(max_distance), &amatch->busy);
+    return NIL_P(result) ? self : result;
+}
+
+/*
+ * call-seq: alignment(string) -> script
+ *
+ * Returns an optimal edit script, that transforms <code>string</code> into
+ * Amatch::Sellers#pattern, like Amatch::Levenshtein#alignment does. The
+ * weights of its operations add up to Amatch::Sellers#match of
+ * <code>string</code>: <code>:substitute</code> costs a substitution,
+ * <code>:delete</code> a deletion and <code>:insert</code> an insertion, or
+ * a deletion, if it comes before any character of <code>string</code>.
+ */
+static VALUE rb_Sellers_alignment(VALUE self, VALUE string)
+{
+    Alignment alignment;
+    GET_STRUCT(Sellers)
+
+    MEMZERO(&alignment, Alignment, 1);
+    alignment.pattern = SYMBOLS(amatch);
+    alignment.pattern_len = SYMBOLS_LEN(amatch);
+    alignment.symbols = amatch->symbols;
+    alignment.substitution = amatch->substitution;
+    alignment.insertion = amatch->insertion;
+    alignment.deletion = amatch->deletion;
+    return alignment_script(&alignment, string, &amatch->busy);
+}
+
+/*
+ * call-seq: best(strings, k) -> results
+ *
+ * Matches Amatch::Sellers#pattern against the Array <code>strings</code>
+ * and returns the <code>k</code> strings with the smallest Sellers distances
+ * as <code>[index, distance]</code> pairs, sorted by distance. Of strings
+ * with the same distance, the ones with lower indexes come first. Once
+ * <code>k</code> strings were matched, only the diagonals of the matrix,
+ * that can lead to a better distance, are computed, and strings, whose
+ * length alone rules them out, are skipped.
+ */
+static VALUE rb_Sellers_best(VALUE self, VALUE strings, VALUE k)
+{
+    GET_STRUCT(Sellers)
+    return Sellers_best(amatch, strings, k, 0, Qnil, Sellers_best_prepare,
+        finish_float);
+}
+
+/*
+ * call-seq: select(strings, max_distance) -> results
+ *
+ * Matches Amatch::Sellers#pattern against the Array <code>strings</code>
+ * and returns the strings with Sellers distances of at most
+ * <code>max_distance</code> as <code>[index, distance]</code> pairs, in
+ * the order of <code>strings</code>. Strings are rejected by the same
+ * stages of lower bounds as by Amatch::Levenshtein#select first, with
+ * their operations weighted as cheaply as possible, and counted by
+ * Amatch::Sellers#rejected.
+ */
+static VALUE rb_Sellers_select(VALUE self, VALUE strings, VALUE max_distance)
+{
+    Prefilter filter;
+    double min;
+    GET_STRUCT(Sellers)
+
+    CAST2FLOAT(max_distance);
+    check_strings(strings);
+    min = amatch->insertion < amatch->deletion ?
+        amatch->insertion : amatch->deletion;
+    if (amatch->substitution < min) min = amatch->substitution;
+    prefilter_init(&filter, SYMBOLS(amatch), SYMBOLS_LEN(amatch), 0,
+        min > 0 && SYMBOLS_LEN(amatch) - 1 > 2 * FLOAT2C(max_distance) / min);
+    return Sellers_select(amatch, strings, FLOAT2C(max_distance), 0, &filter,
+        Sellers_select_prepare, finish_bounded_float);
+}
+
+/* 
+ * Document-class: Amatch::PairDistance
+ *
+ * The pair distance between two strings is based on the number of adjacent
+ * character pairs, that are contained in both strings. The similiarity
+ * metric of two strings s1 and s2 is
+ *   2*|union(pairs(s1), pairs(s2))| / |pairs(s1)| + |pairs(s2)|
+ * If it is 1.0 the two strings are an exact match, if less than 1.0 they
+ * are more dissimilar. The advantage of considering adjacent characters, is to
+ * take account not only of the characters, but also of the character ordering
+ * in the original strings.
+ * 
+ * This metric is very capable to find similarities in natural languages.
+ * It is explained in more detail in Simon White's article "How to Strike a
+ * Match", located at this url:
+ * http://www.catalysoft.com/articles/StrikeAMatch.html
+ * It is also very similar (a special case) to the method described under
+ * http://citeseer.lcs.mit.edu/gravano01using.html in "Using q-grams in a DBMS
+ * for Approximate String Processing."
+ */
+DEF_RB_FREE(PairDistance, PairDistance)
+
+/*
+ * call-seq: new(pattern)
+ *
+ * Creates a new Amatch::PairDistance instance from <code>pattern</code>.
+ */
+static VALUE rb_PairDistance_initialize(VALUE self, VALUE pattern)
+{
+    GET_STRUCT(PairDistance)
+    PairDistance_pattern_set(amatch, pattern);
+    return self;
+}
+
+DEF_CONSTRUCTOR(PairDistance, PairDistance)
+
+/*
+ * The strings are split into their pairs, which calls back into Ruby, and
+ * compared in PairDistance_match_run, and the pairs are released by
+ * PairDistance_match_finish, even if an interrupt raises in between.
+ */
+typedef struct PairDistanceMatchStruct {
+    PairDistance    *amatch;
+    VALUE           list;
+    VALUE           regexp;
+    int             use_regexp;
+    int             single;         /* whether a single String was given */
+    Comparison      *cmps;
+    long            len;
+} PairDistanceMatch;
+
+static VALUE PairDistance_match_run(VALUE data)
+{
+    PairDistanceMatch *match = (PairDistanceMatch *) data;
+    PairDistance *amatch = match->amatch;
+    VALUE result;
+    long i;
+
+    for (i = 0; i < match->len; i++) {
+        PairDistance_prepare(amatch, rb_ary_entry(match->list, i),
+            match->regexp, match->use_regexp, match->cmps + i);
+    }
+    if (compare_batch(match->cmps, match->len, match->list, &amatch->stats,
+                &amatch->busy, &amatch->workspace) != 0) {
+        rb_raise(rb_eNoMemError, "failed to allocate memory");
+    }
+    if (match->single) return finish_float(match->cmps);
+    result = rb_ary_new2(match->len);
+    for (i = 0; i < match->len; i++) {
+        rb_ary_push(result, finish_float(match->cmps + i));
+    }
+    return result;
+}
+
+static VALUE PairDistance_match_finish(VALUE data)
+{
+    PairDistanceMatch *match = (PairDistanceMatch *) data;
+
+    comparisons_release(match->cmps, match->len);
+    xfree(match->cmps);
+    return Qnil;
+}
+
+/*
+ * call-seq: match(strings, regexp = /\s+/) -> results
+ * 
+ * Uses this Amatch::PairDistance instance to match  PairDistance#pattern against
+ * <code>strings</code>. It returns the pair distance measure, that is a
+ * returned value of 1.0 is an exact match, partial matches are lower
+ * values, while 0.0 means no match at all.
+ *
+ * <code>strings</code> has to be either a String or an
+ * Array of Strings. The argument <code>regexp</code> is used to split the
+ * pattern and strings into tokens first. It defaults to /\s+/. If the
+ * splitting should be omitted, call the method with nil as <code>regexp</code>
+ * explicitly.
+ *
+ * The returned <code>results</code> are either a Float or an
+ * Array of Floats respectively.
+ */
+static VALUE rb_PairDistance_match(int argc, VALUE *argv, VALUE self)
+{                                                                            
+    PairDistanceMatch match;
+    VALUE strings, regexp = Qnil;
+    GET_STRUCT(PairDistance)
+
+    rb_scan_args(argc, argv, "11", &strings, &regexp);
+    match.amatch = amatch;
+    match.regexp = regexp;
+    match.use_regexp = NIL_P(regexp) && argc != 2;
+    match.single = TYPE(strings) == T_STRING;
+    if (match.single) {
+        match.list = rb_ary_new4(1, &strings);
+    } else {
+        check_strings(strings);
+        match.list = strings;
+    }
+    match.len = RARRAY(match.list)->len;
+    PairDistance_pattern_pairs(amatch, regexp, match.use_regexp);
+    match.cmps = ALLOC_N(Comparison, match.len);
+    MEMZERO(match.cmps, Comparison, match.len);
+    return rb_ensure(PairDistance_match_run, (VALUE) &match,
+        PairDistance_match_finish, (VALUE) &match);
+}
+
+/*
+ * call-seq: best(strings, k, regexp = /\s+/) -> results
+ *
+ * Matches PairDistance#pattern against the Array <code>strings</code>, split
+ * by <code>regexp</code> as in PairDistance#match, and returns the
+ * <code>k</code> most similar strings as <code>[index, similarity]</code>
+ * pairs, sorted by decreasing similarity. Of strings with the same
+ * similarity, the ones with lower indexes come first. Once <code>k</code>
+ * strings were matched, strings, whose number of pairs alone rules them out,
+ * aren't compared anymore.
+ */
+static VALUE rb_PairDistance_best(int argc, VALUE *argv, VALUE self)
+{
+    VALUE strings, k, regexp = Qnil;
+    int use_regexp;
+    GET_STRUCT(PairDistance)
+
+    rb_scan_args(argc, argv, "21", &strings, &k, &regexp);
+    use_regexp = NIL_P(regexp) && argc != 3;
+    PairDistance_pattern_pairs(amatch, regexp, use_regexp);
+    return PairDistance_best(amatch, strings, k, 1,
+        NIL_P(regexp) && !use_regexp ? Qfalse : regexp,
+        PairDistance_best_prepare, finish_float);
+}
+
+/*
+ * call-seq: pair_distance_similar(strings) -> results
+ *
+ * If called on a String, this string is used as a Amatch::PairDistance#pattern
+ * to match against <code>strings</code> using /\s+/ as the tokenizing regular
+ * expression. It returns a pair distance metric number between 0.0 for very
+ * unsimilar strings and 1.0 for an exact match. <code>strings</code> has to be
+ * either a String or an Array of Strings. The returned <code>results</code>
+ * are either a Float or an Array of Floats respectively.
+ */
+static VALUE rb_str_pair_distance_similar(VALUE self, VALUE strings)
+{
+    VALUE amatch = rb_PairDistance_new(rb_cPairDistance, self);
+    return rb_PairDistance_match(1, &strings, amatch);
+}
+
+/* 
+ * Document-class: Amatch::Hamming
+ *
+ *  This class computes the Hamming distance between two strings.
+ *
+ *  The Hamming distance between two strings is the number of characters, that
+ *  are different. Thus a hamming distance of 0 means an exact
+ *  match, a hamming distance of 1 means one character is different, and so on.
+ *  If one string is longer than the other string, the missing characters are
+ *  counted as different characters.
+ */
+
+DEF_RB_FREE(Hamming, General)
+
+/*
+ * call-seq: new(pattern)
+ *
+ * Creates a new Amatch::Hamming instance from <code>pattern</code>.
+ */
+static VALUE rb_Hamming_initialize(VALUE self, VALUE pattern)
+{
+    GET_STRUCT(General)
+    General_pattern_set(amatch, pattern);
+    return self;
+}
+
+DEF_CONSTRUCTOR(Hamming, General)
+
+/*
+ * call-seq: match(strings) -> results
+ * 
+ * Uses this Amatch::Hamming instance to match Amatch::Hamming#pattern against
+ * <code>strings</code>, that is compute the hamming distance between
+ * <code>pattern</code> and <code>strings</code>. <code>strings</code> has to
+ * be either a String or an Array of Strings. The returned <code>results</code>
+ * are either a Fixnum or an Array of Fixnums respectively.
+ */
+static VALUE rb_Hamming_match(VALUE self, VALUE strings)
+{                                                                            
+    GET_STRUCT(General)
+    return General_iterate_strings(amatch, strings, 0.0,
+        Hamming_match_prepare, finish_int);
+}
+
+/*
+ * call-seq: similar(strings) -> results
+ *
+ * Uses this Amatch::Hamming instance to match  Amatch::Hamming#pattern against
+ * <code>strings</code>, and compute a Hamming distance metric number between
+ * 0.0 for very unsimilar strings and 1.0 for an exact match.
+ * <code>strings</code> has to be either a String or an Array of Strings. The
+ * returned <code>results</code> are either a Fixnum or an Array of Fixnums
+ * respectively.
+ */
+static VALUE rb_Hamming_similar(VALUE self, VALUE strings)
+{                                                                            
+    GET_STRUCT(General)
+    return General_iterate_strings(amatch, strings, 0.0,
+        Hamming_similar_prepare, Hamming_similar_finish);
+}
+
+/*
+ * call-seq: hamming_similar(strings) -> results
+ *
+ * If called on a String, this string is used as a Amatch::Hamming#pattern to
+ * match against <code>strings</code>. It returns a Hamming distance metric
+ * number between 0.0 for very unsimilar strings and 1.0 for an exact match.
+ * <code>strings</code>
+ * has to be either a String or an Array of Strings. The returned
+ * <code>results</code> are either a Float or an Array of Floats respectively.
+ */
+static VALUE rb_str_hamming_similar(VALUE self, VALUE strings)
+{
+    VALUE amatch = rb_Hamming_new(rb_cHamming, self);
+    return rb_Hamming_similar(amatch, strings);
+}
+
+
+/* 
+ * Document-class: Amatch::LongestSubsequence
+ *
+ *  This class computes the length of the longest subsequence common to two
+ *  strings. A subsequence doesn't have to be contiguous. The longer the common
+ *  subsequence is, the more similar the two strings will be.
+ *
+ *  The longest common subsequence between "test" and "test" is of length 4,
+ *  because "test" itself is this subsequence. The longest common subsequence
+ *  between "test" and "east" is "e", "s", "t" and the length of the
+ *  sequence is 3.
+ */
+DEF_RB_FREE(LongestSubsequence, General)
+
+/*
+ * call-seq: new(pattern)
+ *
+ * Creates a new Amatch::LongestSubsequence instance from <code>pattern</code>.
+ */
+static VALUE rb_LongestSubsequence_initialize(VALUE self, VALUE pattern)
+{
+    GET_STRUCT(General)
+    General_pattern_set(amatch, pattern);
+    return self;
+}
+
+DEF_CONSTRUCTOR(LongestSubsequence, General)
+
+/*
+ * call-seq: match(strings) -> results
+ * 
+ * Uses this Amatch::LongestSubsequence instance to match
+ * LongestSubsequence#pattern against <code>strings</code>, that is compute the
+ * length of the longest common subsequence. <code>strings</code> has to be
+ * either a String or an Array of Strings. The returned <code>results</code>
+ * are either a Fixnum or an Array of Fixnums respectively.
+ */
+static VALUE rb_LongestSubsequence_match(VALUE self, VALUE strings)
+{                                                                            
+    GET_STRUCT(General)
+    return General_iterate_strings(amatch, strings, 0.0,
+        LongestSubsequence_match_prepare, finish_int);
+}
+
+/*
+ * call-seq: similar(strings) -> results
+ * 
+ * Uses this Amatch::LongestSubsequence instance to match
+ * Amatch::LongestSubsequence#pattern against <code>strings</code>, and compute
+ * a longest substring distance metric number between 0.0 for very unsimilar
+ * strings and 1.0 for an exact match. <code>strings</code> has to be either a
+ * String or an Array of Strings. The returned <code>results</code> are either
+ * a Fixnum or an Array of Fixnums
+ */
+static VALUE rb_LongestSubsequence_similar(VALUE self, VALUE strings)
+{                                                                            
+    GET_STRUCT(General)
+    return General_iterate_strings(amatch, strings, 0.0,
+        LongestSubsequence_similar_prepare, longest_similar_finish);
+}
+
+/*
+ * call-seq: longest_subsequence_similar(strings) -> results
+ *
+ * If called on a String, this string is used as a
+ * Amatch::LongestSubsequence#pattern to match against <code>strings</code>. It
+ * returns a longest subsequence distance metric number between 0.0 for very
+ * unsimilar strings and 1.0 for an exact match. <code>strings</code> has to be
+ * either a String or an Array of Strings. The returned <code>results</code>
+ * are either a Float or an Array of Floats respectively.
+ */
+static VALUE rb_str_longest_subsequence_similar(VALUE self, VALUE strings)
+{                                                                            
+    VALUE amatch = rb_LongestSubsequence_new(rb_cLongestSubsequence, self);
+    return rb_LongestSubsequence_similar(amatch, strings);
+}
+
+/* 
+ * Document-class: Amatch::LongestSubstring
+ *
+ * The longest common substring is the longest substring, that is part of
+ * two strings. A substring is contiguous, while a subsequence need not to
+ * be. The longer the common substring is, the more similar the two strings
+ * will be.
+ *
+ * The longest common substring between 'string' and 'string' is 'string'
+ * again, thus the longest common substring length is 6. The longest common
+ * substring between 'string' and 'storing' is 'ring', thus the longest common
+ * substring length is 4. 
+ */
+
+DEF_RB_FREE(LongestSubstring, LongestSubstring)
+
+/*
+ * call-seq: new(pattern)
+ *
+ * Creates a new Amatch::LongestSubstring instance from <code>pattern</code>.
+ */
+static VALUE rb_LongestSubstring_initialize(VALUE self, VALUE pattern)
+{
+    GET_STRUCT(LongestSubstring)
+    LongestSubstring_pattern_set(amatch, pattern);
+    return self;
+}
+
+DEF_CONSTRUCTOR(LongestSubstring, LongestSubstring)
+
+/*
+ * call-seq: match(strings) -> results
+ * 
+ * Uses this Amatch::LongestSubstring instance to match
+ * LongestSubstring#pattern against <code>strings</code>, that is compute the
+ * length of the longest common substring. <code>strings</code> has to be
+ * either a String or an Array of Strings. The returned <code>results</code>
+ * are either a Fixnum or an Array of Fixnums respectively.
+ */
+static VALUE rb_LongestSubstring_match(VALUE self, VALUE strings)
+{
+    GET_STRUCT(LongestSubstring)
+    return LongestSubstring_iterate_strings(amatch, strings, 0.0,
+        LongestSubstring_match_prepare, finish_int);
+}
+
+/*
+ * call-seq: locate(strings) -> results
+ *
+ * Like LongestSubstring#match, but returns the length of the longest common
+ * substring together with its offsets as an Array [length, pattern_offset,
+ * offset]: <code>offset</code> is where it first occurs in the string, and
+ * <code>pattern_offset</code> where this substring first occurs in the
+ * pattern. Both offsets are 0, if there is no common substring.
+ *
+ *  Amatch::LongestSubstring.new('storing').locate('string')  # => [4, 3, 2]
+ */
+static VALUE rb_LongestSubstring_locate(VALUE self, VALUE strings)
+{
+    GET_STRUCT(LongestSubstring)
+    return LongestSubstring_iterate_strings(amatch, strings, 0.0,
+        LongestSubstring_match_prepare, LongestSubstring_locate_finish);
+}
+
+/*
+ * call-seq: similar(strings) -> results
+ * 
+ * Uses this Amatch::LongestSubstring instance to match
+ * Amatch::LongestSubstring#pattern against <code>strings</code>, and compute a
+ * longest substring distance metric number between 0.0 for very unsimilar
+ * strings and 1.0 for an exact match. <code>strings</code> has to be either a
+ * String or an Array of Strings. The returned <code>results</code> are either
+ * a Fixnum or an Array of Fixnums
+ * respectively.
+ */
+static VALUE rb_LongestSubstring_similar(VALUE self, VALUE strings)
+{
+    GET_STRUCT(LongestSubstring)
+    return LongestSubstring_iterate_strings(amatch, strings, 0.0,
+        LongestSubstring_similar_prepare, longest_similar_finish);
+}
+
+/*
+ * call-seq: longest_substring_similar(strings) -> results
+ *
+ * If called on a String, this string is used as a
+ * Amatch::LongestSubstring#pattern to match against <code>strings</code>. It
+ * returns a longest substring distance metric number between 0.0 for very
+ * unsimilar strings and 1.0 for an exact match. <code>strings</code> has to be
+ * either a String or an Array of Strings. The returned <code>results</code>
+ * are either a Float or an Array of Floats respectively.
+ */
+static VALUE rb_str_longest_substring_similar(VALUE self, VALUE strings)
+{                                                                            
+    VALUE amatch = rb_LongestSubstring_new(rb_cLongestSubstring, self);
+    return rb_LongestSubstring_similar(amatch, strings);
+}
+
+/*
+ * Document-class: Amatch::Jaro
+ *
+ * This class computes the Jaro metric for two strings.
+ * The Jaro metric computes the similarity between 0 (no match)
+ * and 1 (exact match) by looking for matching and transposed characters.
+ */
+DEF_RB_FREE(Jaro, Jaro)
+
+/*
+ * Document-method: ignore_case
+ *
+ * call-seq: ignore_case -> true/false
+ *
+ * Returns whether case is ignored when computing matching characters.
+ */
+DEF_RB_READER(Jaro, rb_Jaro_ignore_case, ignore_case, C2BOOL)
+
+/*
+ * Document-method: ignore_case=
+ *
+ * call-seq: ignore_case=(true/false)
+ *
+ * Sets whether case is ignored when computing matching characters.
+ */
+
+/*
+ * call-seq: new(pattern)
+ *
+ * Creates a new Amatch::Jaro instance from <code>pattern</code>.
+ */
+static VALUE rb_Jaro_initialize(VALUE self, VALUE pattern)
+{
+    GET_STRUCT(Jaro)
+    amatch->ignore_case = 1;
+    Jaro_pattern_set(amatch, pattern);
+    return self;
+}
+
+DEF_CONSTRUCTOR(Jaro, Jaro)
+
+/*
+ * call-seq: match(strings) -> results
+ *
+ * Uses this Amatch::Jaro instance to match
+ * Jaro#pattern against <code>strings</code>, that is compute the
+ * jaro metric with the strings. <code>strings</code> has to be
+ * either a String or an Array of Strings. The returned <code>results</code>
+ * are either a Float or an Array of Floats respectively.
+ */
+static VALUE rb_Jaro_match(VALUE self, VALUE strings)
+{
+    GET_STRUCT(Jaro)
+    return Jaro_iterate_strings(amatch, strings, 0.0, Jaro_match_prepare,
+        finish_float);
+}
+
+/*
+ * call-seq: select(strings, min_similarity) -> results
+ *
+ * Matches Jaro#pattern against the Array <code>strings</code> and returns
+ * the strings with a Jaro metric of at least <code>min_similarity</code>
+ * as <code>[index, similarity]</code> pairs, in the order of
+ * <code>strings</code>. Strings are rejected by upper bounds of their
+ * similarities first, in two stages: by the length of the shorter string,
+ * and by the number of characters both strings have in common. Only the
+ * others are matched. Jaro#rejected counts the rejections of each stage,
+ * the third one is always 0.
+ */
+static VALUE rb_Jaro_select(VALUE self, VALUE strings, VALUE min_similarity)
+{
+    Prefilter filter;
+    GET_STRUCT(Jaro)
+
+    CAST2FLOAT(min_similarity);
+    check_strings(strings);
+    prefilter_init(&filter, SYMBOLS(amatch), SYMBOLS_LEN(amatch),
+        amatch->ignore_case, 0);
+    return Jaro_select(amatch, strings, FLOAT2C(min_similarity), 1, &filter,
+        Jaro_select_prepare, finish_min_float);
+}
+
+/*
+ * call-seq: jaro_similar(strings) -> results
+ *
+ * If called on a String, this string is used as a
+ * Amatch::Jaro#pattern to match against <code>strings</code>. It
+ * returns a Jaro metric number between 0.0 for very
+ * unsimilar strings and 1.0 for an exact match. <code>strings</code> has to be
+ * either a String or an Array of Strings. The returned <code>results</code>
+ * are either a Float or an Array of Floats respectively.
+ */
+static VALUE rb_str_jaro_similar(VALUE self, VALUE strings)
+{
+    VALUE amatch = rb_Jaro_new(rb_cJaro, self);
+    return rb_Jaro_match(amatch, strings);
+}
+
+/*
+ * Document-class: Amatch::JaroWinkler
+ *
+ * This class computes the Jaro-Winkler metric for two strings.
+ * The Jaro-Winkler metric computes the similarity between 0 (no match)
+ * and 1 (exact match) by looking for matching and transposed characters.
+ *
+ * It is a variant of the Jaro metric, with additional weighting towards
+ * common prefixes.
+ */
+DEF_RB_FREE(JaroWinkler, JaroWinkler)
+
+/*
+ * Document-method: ignore_case
+ *
+ * call-seq: ignore_case -> true/false
+ *
+ * Returns whether case is ignored when computing matching characters.
+ * Default is true.
+ */
+DEF_RB_READER(JaroWinkler, rb_JaroWinkler_ignore_case, ignore_case, C2BOOL)
+
+/*
+ * Document-method: scaling_factor
+ *
+ * call-seq: scaling_factor -> weight
+ *
+ * The scaling factor is how much weight to give common prefixes.
+ * Default is 0.1.
+ */
+DEF_RB_READER(JaroWinkler, rb_JaroWinkler_scaling_factor, scaling_factor, rb_float_new)
+
 /*
- * Ruby API
+ * Document-method: ignore_case=
+ *
+ * call-seq: ignore_case=(true/false)
+ *
+ * Sets whether case is ignored when computing matching characters.
  */
 
- /* 
-  * Document-class: Amatch::Levenshtein
-  *
-  * The Levenshtein edit distance is defined as the minimal costs involved to
-  * transform one string into another by using three elementary operations:
-  * deletion, insertion and substitution of a character. To transform "water"
-  * into "wine", for instance, you have to substitute "a" -> "i": "witer", "t"
-  * -> "n": "winer" and delete "r": "wine". The edit distance between "water"
-  * and "wine" is 3, because you have to apply three operations. The edit
-  * distance between "wine" and "wine" is 0 of course: no operation is
-  * necessary for the transformation -- they're already the same string. It's
-  * easy to see that more similar strings have smaller edit distances than
-  * strings that differ a lot.
-  */
-
-DEF_RB_FREE(Levenshtein, General)
+/*
+ * Document-method: scaling_factor=
+ *
+ * call-seq: scaling_factor=(weight)
+ *
+ * Sets the weight to give common prefixes.
+ */
+DEF_RB_WRITER(JaroWinkler, rb_JaroWinkler_scaling_factor_set, scaling_factor,
+    double, CAST2FLOAT, FLOAT2C, >= 0)
 
 /*
  * call-seq: new(pattern)
  *
- * Creates a new Amatch::Levenshtein instance from <code>pattern</code>.
+ * Creates a new Amatch::JaroWinkler instance from <code>pattern</code>.
  */
-static VALUE rb_Levenshtein_initialize(VALUE self, VALUE pattern)
+static VALUE rb_JaroWinkler_initialize(VALUE self, VALUE pattern)
 {
-    GET_STRUCT(General)
-    General_pattern_set(amatch, pattern);
+    GET_STRUCT(JaroWinkler)
+    amatch->ignore_case = 1;
+    JaroWinkler_pattern_set(amatch, pattern);
+    amatch->scaling_factor = 0.1;
     return self;
 }
 
-DEF_CONSTRUCTOR(Levenshtein, General)
+DEF_CONSTRUCTOR(JaroWinkler, JaroWinkler)
 
 /*
  * call-seq: match(strings) -> results
- * 
- * Uses this Amatch::Levenshtein instance to match Amatch::Levenshtein#pattern
- * against <code>strings</code>. It returns the number operations, the Sellers
- * distance. <code>strings</code> has to be either a String or an Array of
- * Strings. The returned <code>results</code> are either a Float or an Array of
- * Floats respectively.
+ *
+ * Uses this Amatch::Jaro instance to match
+ * Jaro#pattern against <code>strings</code>, that is compute the
+ * jaro metric with the strings. <code>strings</code> has to be
+ * either a String or an Array of Strings. The returned <code>results</code>
+ * are either a Float or an Array of Floats respectively.
  */
-static VALUE rb_Levenshtein_match(VALUE self, VALUE strings)
-{                                                                            
-    GET_STRUCT(General)
-    return General_iterate_strings(amatch, strings, Levenshtein_match);
+static VALUE rb_JaroWinkler_match(VALUE self, VALUE strings)
+{
+    GET_STRUCT(JaroWinkler)
+    return JaroWinkler_iterate_strings(amatch, strings, 0.0,
+        JaroWinkler_match_prepare, finish_float);
 }
 
 /*
- * call-seq: similar(strings) -> results
- * 
- * Uses this Amatch::Levenshtein instance to match  Amatch::Levenshtein#pattern
- * against <code>strings</code>, and compute a Levenshtein distance metric
- * number between 0.0 for very unsimilar strings and 1.0 for an exact match.
- * <code>strings</code> has to be either a String or an Array of Strings. The
- * returned <code>results</code> are either a Fixnum or an Array of Fixnums
- * respectively.
+ * call-seq: best(strings, k) -> results
+ *
+ * Matches JaroWinkler#pattern against the Array <code>strings</code> and
+ * returns the <code>k</code> most similar strings as
+ * <code>[index, similarity]</code> pairs, sorted by decreasing similarity.
+ * Of strings with the same similarity, the ones with lower indexes come
+ * first. Once <code>k</code> strings were matched, strings, whose length
+ * alone rules them out, aren't compared anymore.
  */
-static VALUE rb_Levenshtein_similar(VALUE self, VALUE strings)
-{                                                                            
-    GET_STRUCT(General)
-    return General_iterate_strings(amatch, strings, Levenshtein_similar);
+static VALUE rb_JaroWinkler_best(VALUE self, VALUE strings, VALUE k)
+{
+    GET_STRUCT(JaroWinkler)
+    return JaroWinkler_best(amatch, strings, k, 1, Qnil,
+        JaroWinkler_best_prepare, finish_float);
 }
 
 /*
- * call-seq: levenshtein_similar(strings) -> results
- * 
- * If called on a String, this string is used as a Amatch::Levenshtein#pattern
- * to match against <code>strings</code>. It returns a Levenshtein distance
- * metric number between 0.0 for very unsimilar strings and 1.0 for an exact
- * match. <code>strings</code> has to be either a String or an Array of
- * Strings. The returned <code>results</code> are either a Float or an Array of
- * Floats respectively.
+ * call-seq: select(strings, min_similarity) -> results
+ *
+ * Matches JaroWinkler#pattern against the Array <code>strings</code> like
+ * Jaro#select does, but with the Jaro-Winkler metric. Its upper bounds
+ * also take the common prefix into account.
  */
-static VALUE rb_str_levenshtein_similar(VALUE self, VALUE strings)
+static VALUE rb_JaroWinkler_select(VALUE self, VALUE strings,
+    VALUE min_similarity)
 {
-    VALUE amatch = rb_Levenshtein_new(rb_cLevenshtein, self);
-    return rb_Levenshtein_similar(amatch, strings);
+    Prefilter filter;
+    GET_STRUCT(JaroWinkler)
+
+    CAST2FLOAT(min_similarity);
+    check_strings(strings);
+    prefilter_init(&filter, SYMBOLS(amatch), SYMBOLS_LEN(amatch),
+        amatch->ignore_case, 0);
+    return JaroWinkler_select(amatch, strings, FLOAT2C(min_similarity), 1,
+        &filter, JaroWinkler_select_prepare, finish_min_float);
 }
 
 /*
- * call-seq: search(strings) -> results
- * 
- * searches Amatch::Levenshtein#pattern in <code>strings</code> and returns the
- * edit distance (the sum of character operations) as a Fixnum value, by greedy
- * trimming prefixes or postfixes of the match. <code>strings</code> has
- * to be either a String or an Array of Strings. The returned
- * <code>results</code> are either a Float or an Array of Floats respectively.
+ * call-seq: jarowinkler_similar(strings) -> results
+ *
+ * If called on a String, this string is used as a
+ * Amatch::JaroWinkler#pattern to match against <code>strings</code>. It
+ * returns a Jaro-Winkler metric number between 0.0 for very
+ * unsimilar strings and 1.0 for an exact match. <code>strings</code> has to be
+ * either a String or an Array of Strings. The returned <code>results</code>
+ * are either a Float or an Array of Floats respectively.
  */
-static VALUE rb_Levenshtein_search(VALUE self, VALUE strings)
-{                                                                            
-    GET_STRUCT(General)
-    return General_iterate_strings(amatch, strings, Levenshtein_search);
+static VALUE rb_str_jarowinkler_similar(VALUE self, VALUE strings)
+{
+    VALUE amatch = rb_JaroWinkler_new(rb_cJaro, self);
+    return rb_JaroWinkler_match(amatch, strings);
 }
 
-/* 
- * Document-class: Amatch::Sellers
+/*
+ * Document-class: Amatch::Bitap
  *
- * The Sellers edit distance is very similar to the Levenshtein edit distance.
- * The difference is, that you can also specify different weights for every
- * operation to prefer special operations over others. This extension of the
- * Sellers edit distance is also known under the names: Needleman-Wunsch
- * distance.
+ * Bitap searches a short pattern in strings with the shift-and algorithm
+ * for k differences of Wu and Manber: the pattern is compiled into a bit
+ * mask for every character, and each character of a string advances k + 1
+ * bit vectors, one for every number of differences. Differences are
+ * insertions, deletions and substitutions, as for Amatch::Levenshtein.
+ *
+ * Patterns have up to 64 positions. Every position is a character, or
+ * <code>.</code> for any character, or a class like <code>[a-z_]</code> or
+ * <code>[^0-9]</code>. A backslash makes the next character stand for
+ * itself, like in <code>\\.</code> or <code>[\\]]</code>.
  */
 
-DEF_RB_FREE(Sellers, Sellers)
+DEF_RB_FREE(Bitap, Bitap)
 
 /*
- * Document-method: substitution
+ * Document-method: ignore_case
  *
- * call-seq: substitution -> weight
+ * call-seq: ignore_case -> true/false
  *
- * Returns the weight of the substitution operation, that is used to compute
- * the Sellers distance.
+ * Returns whether case is ignored. Default is false.
  */
-DEF_RB_READER(Sellers, rb_Sellers_substitution, substitution,
-    rb_float_new)
+DEF_RB_READER(Bitap, rb_Bitap_ignore_case, ignore_case, C2BOOL)
 
 /*
- * Document-method: deletion
- *
- * call-seq: deletion -> weight
+ * call-seq: ignore_case=(true/false)
  *
- * Returns the weight of the deletion operation, that is used to compute
- * the Sellers distance.
+ * Sets whether case is ignored, and compiles the pattern again.
  */
-DEF_RB_READER(Sellers, rb_Sellers_deletion, deletion,
-    rb_float_new)
+static VALUE rb_Bitap_ignore_case_set(VALUE self, VALUE value)
+{
+    BitapMask *mask;
+    GET_STRUCT(Bitap)
+
+    if (amatch->busy) {
+        rb_raise(rb_eRuntimeError, "can't modify ignore_case while matching");
+    }
+    CAST2BOOL(value);
+    mask = Bitap_compile(amatch->pattern, amatch->pattern_len,
+        BOOL2C(value));
+    amatch->ignore_case = BOOL2C(value);
+    Bitap_pattern_release(amatch);
+    amatch->mask = mask;
+    return Qnil;
+}
+
+static VALUE rb_Bitap_pattern(VALUE self)
+{
+    GET_STRUCT(Bitap)
+    return rb_str_new(amatch->pattern, amatch->pattern_len);
+}
+
+static VALUE rb_Bitap_pattern_set(VALUE self, VALUE pattern)
+{
+    GET_STRUCT(Bitap)
+    Bitap_pattern_set(amatch, pattern);
+    return Qnil;
+}
 
 /*
- * Document-method: insertion
- *
- * call-seq: insertion -> weight
+ * call-seq: new(pattern)
  *
- * Returns the weight of the insertion operation, that is used to compute
- * the Sellers distance.
+ * Creates a new Amatch::Bitap instance from <code>pattern</code>. Raises an
+ * ArgumentError, if the pattern has more than 64 positions or a character
+ * class isn't terminated.
  */
-DEF_RB_READER(Sellers, rb_Sellers_insertion, insertion,
-    rb_float_new)
+static VALUE rb_Bitap_initialize(VALUE self, VALUE pattern)
+{
+    GET_STRUCT(Bitap)
+    Bitap_pattern_set(amatch, pattern);
+    return self;
+}
+
+DEF_CONSTRUCTOR(Bitap, Bitap)
 
 /*
- * Document-method: substitution=
- *
- * call-seq: substitution=(weight)
- *
- * Sets the weight of the substitution operation, that is used to compute
- * the Sellers distance, to <code>weight</code>. The <code>weight</code>
- * should be a Float value >= 0.0.
+ * The number of differences allowed, at most the number of positions of
+ * the pattern, which always suffice, or -1 for none at all.
  */
-DEF_RB_WRITER(Sellers, rb_Sellers_substitution_set, substitution,
-    double, CAST2FLOAT, FLOAT2C, >= 0)
+static int Bitap_max_distance(Bitap *amatch, VALUE max_distance)
+{
+    int k;
+
+    if (NIL_P(max_distance)) return 0;
+    CAST2FLOAT(max_distance);
+    if (FLOAT2C(max_distance) < 0) return -1;
+    k = BOUND2INT(FLOAT2C(max_distance));
+    return k < amatch->mask->len ? k : amatch->mask->len;
+}
 
 /*
- * Document-method: deletion=
+ * call-seq: search(strings, max_distance = 0) -> results
  *
- * call-seq: deletion=(weight)
+ * Searches Amatch::Bitap#pattern in <code>strings</code>, and returns the
+ * offset right after the end of its first occurrence with at most
+ * <code>max_distance</code> differences, or nil, if there is none.
+ * <code>strings</code> has to be either a String or an Array of Strings.
+ * The returned <code>results</code> are either an Integer (or nil) or an
+ * Array of them respectively.
  *
- * Sets the weight of the deletion operation, that is used to compute
- * the Sellers distance, to <code>weight</code>. The <code>weight</code>
- * should be a Float value >= 0.0.
+ *  Amatch::Bitap.new('t[aeiou]st').search('a tost here')  # => 6
  */
-DEF_RB_WRITER(Sellers, rb_Sellers_deletion_set, deletion,
-    double, CAST2FLOAT, FLOAT2C, >= 0)
+static VALUE rb_Bitap_search(int argc, VALUE *argv, VALUE self)
+{
+    VALUE strings, max_distance = Qnil;
+    GET_STRUCT(Bitap)
+
+    rb_scan_args(argc, argv, "11", &strings, &max_distance);
+    return Bitap_iterate_strings(amatch, strings,
+        Bitap_max_distance(amatch, max_distance), Bitap_search_prepare,
+        Bitap_search_finish);
+}
 
 /*
- * Document-method: insertion=
+ * call-seq: search_all(string, max_distance = 0) -> results
  *
- * call-seq: insertion=(weight)
+ * Returns the end offsets of all occurrences of Amatch::Bitap#pattern in
+ * <code>string</code> with at most <code>max_distance</code> differences,
+ * as an Array of <code>[end, distance]</code> pairs: every offset, that an
+ * occurrence ends right before, with the lowest number of differences of
+ * the occurrences ending there. Long strings are scanned without the
+ * global interpreter lock.
  *
- * Sets the weight of the insertion operation, that is used to compute
- * the Sellers distance, to <code>weight</code>. The <code>weight</code>
- * should be a Float value >= 0.0.
+ *  Amatch::Bitap.new('t[aeiou]st').search_all('test tst', 1)
+ *  # => [[3, 1], [4, 0], [5, 1], [8, 1]]
  */
-DEF_RB_WRITER(Sellers, rb_Sellers_insertion_set, insertion,
-    double, CAST2FLOAT, FLOAT2C, >= 0)
+static VALUE rb_Bitap_search_all(int argc, VALUE *argv, VALUE self)
+{
+    VALUE string, max_distance = Qnil;
+    BitapRun run;
+    GET_STRUCT(Bitap)
+
+    rb_scan_args(argc, argv, "11", &string, &max_distance);
+    Check_Type(string, T_STRING);
+    MEMZERO(&run, BitapRun, 1);
+    run.amatch = amatch;
+    run.k = Bitap_max_distance(amatch, max_distance);
+    run.result = rb_ary_new();
+    if (run.k < 0) return run.result;
+    run.text = RSTRING(string)->ptr;
+    run.text_len = RSTRING(string)->len;
+    bitap_start(amatch->mask, run.k, run.state);
+    if (amatch->mask->len <= run.k) {
+        rb_ary_push(run.result, rb_assoc_new(INT2FIX(0),
+            INT2FIX(amatch->mask->len)));
+    }
+#ifdef HAVE_RB_THREAD_CALL_WITHOUT_GVL
+    if ((double) run.text_len * (run.k + 1) >= UNBLOCKING_COST) {
+        run.unblocked = 1;
+        if (!OBJ_FROZEN(string)) {
+            run.copy = ALLOC_N(char, run.text_len);
+            MEMCPY(run.copy, run.text, char, run.text_len);
+            run.text = run.copy;
+        }
+    }
+#endif
+    run.started = scan_start(&amatch->stats,
+        (double) run.text_len * (run.k + 1));
+    amatch->busy++;
+    return rb_ensure(bitap_run, (VALUE) &run, bitap_run_finish,
+        (VALUE) &run);
+}
 
 /*
- * Resets all weights (substitution, deletion, and insertion) to 1.0.
+ * Document-class: Amatch::PatternSet
+ *
+ * A PatternSet searches many patterns in a text at once, with at most a
+ * fixed number of differences each, like Amatch::Levenshtein#search_all
+ * does for one of them. Every pattern is split into max_distance + 1
+ * pieces, one of which has to occur exactly in any of its occurrences, and
+ * the pieces of all the patterns are found by one automaton in one pass
+ * over the text. Only their surroundings are searched for the patterns
+ * themselves, so the time taken grows with the size of the text and the
+ * number of pieces found, but hardly with the number of patterns.
  */
-static VALUE rb_Sellers_reset_weights(VALUE self)
+
+typedef struct PatternSetObjectStruct {
+    PatternSet  set;
+    PatternScan *scan;
+    int         busy;
+} PatternSetObject;
+
+static void rb_PatternSet_free(PatternSetObject *amatch)
 {
-    GET_STRUCT(Sellers)
-    Sellers_reset_weights(amatch);
-    return self;
+    pattern_scan_destroy(amatch->scan);
+    pattern_set_release(&amatch->set);
+    free(amatch);
+}
+
+#ifdef HAVE_TYPE_RB_DATA_TYPE_T
+static size_t rb_PatternSet_memsize(const void *ptr)
+{
+    PatternSetObject *amatch = (PatternSetObject *) ptr;
+    return sizeof(PatternSetObject) + pattern_set_memsize(&amatch->set) +
+        (amatch->scan ? pattern_scan_memsize(&amatch->set) : 0);
+}
+
+static const rb_data_type_t PatternSetObject_data_type = {
+    "Amatch::PatternSet",
+    {
+        NULL,
+        (void (*)(void *)) rb_PatternSet_free,
+        rb_PatternSet_memsize,
+    },
+};
+#endif
+
+static VALUE rb_PatternSet_s_allocate(VALUE klass)
+{
+    PatternSetObject *amatch = ALLOC(PatternSetObject);
+    MEMZERO(amatch, PatternSetObject, 1);
+#ifdef HAVE_TYPE_RB_DATA_TYPE_T
+    return TypedData_Wrap_Struct(klass, &PatternSetObject_data_type, amatch);
+#else
+    return Data_Wrap_Struct(klass, NULL, rb_PatternSet_free, amatch);
+#endif
 }
 
 /*
- * call-seq: new(pattern)
+ * call-seq: new(patterns, max_distance)
  *
- * Creates a new Amatch::Sellers instance from <code>pattern</code>,
- * with all weights initially set to 1.0.
+ * Creates a new Amatch::PatternSet instance from the Array of Strings
+ * <code>patterns</code>, that finds their occurrences with at most
+ * <code>max_distance</code> differences in a text.
  */
-static VALUE rb_Sellers_initialize(VALUE self, VALUE pattern)
+static VALUE rb_PatternSet_initialize(VALUE self, VALUE patterns,
+    VALUE max_distance)
 {
-    GET_STRUCT(Sellers)
-    Sellers_pattern_set(amatch, pattern);
-    Sellers_reset_weights(amatch);
+    GET_STRUCT(PatternSetObject)
+
+    check_strings(patterns);
+    CAST2FLOAT(max_distance);
+    if (FLOAT2C(max_distance) < 0) {
+        rb_raise(rb_eArgError, "max_distance has to be >= 0");
+    }
+    if (amatch->busy) {
+        rb_raise(rb_eRuntimeError, "can't modify patterns while matching");
+    }
+    pattern_scan_destroy(amatch->scan);
+    amatch->scan = NULL;
+    pattern_set_release(&amatch->set);
+    pattern_set_init(&amatch->set, patterns,
+        BOUND2INT(FLOAT2C(max_distance)));
+    amatch->scan = PatternScan_new(&amatch->set);
     return self;
 }
 
-DEF_CONSTRUCTOR(Sellers, Sellers)
+typedef struct PatternSetSearchStruct {
+    PatternSetObject *amatch;
+    PatternScan *scan;
+    PatternScan *own;
+    char        *text;
+    long        text_len;
+    char        *copy;
+    PatternHit  *hits;
+    long        len;
+} PatternSetSearch;
+
+static void *pattern_set_search_kernel(void *data)
+{
+    PatternSetSearch *search = (PatternSetSearch *) data;
+    search->len = pattern_set_search(&search->amatch->set, search->scan,
+        search->text, search->text_len, &search->hits);
+    return NULL;
+}
 
+#ifdef HAVE_RB_THREAD_CALL_WITHOUT_GVL
 /*
- * Document-method: pattern
- *
- * call-seq: pattern -> pattern string
- *
- * Returns the current pattern string of this Amatch::Sellers instance.
+ * Can't be canceled, like a single comparison (see UNBLOCKING_COST).
  */
+static VALUE pattern_set_search_unblocked(VALUE data)
+{
+    rb_thread_call_without_gvl(pattern_set_search_kernel, (void *) data,
+        NULL, NULL);
+    return Qnil;
+}
 
-/*
- * Document-method: pattern=
- *
- * call-seq: pattern=(pattern)
- * 
- * Sets the current pattern string of this Amatch::Sellers instance to
- * <code>pattern</code>.
- */
+static VALUE pattern_set_search_finish(VALUE data)
+{
+    PatternSetSearch *search = (PatternSetSearch *) data;
+    search->amatch->busy--;
+    xfree(search->copy);
+    return Qnil;
+}
+#endif
 
 /*
- * call-seq: match(strings) -> results
- * 
- * Uses this Amatch::Sellers instance to match Sellers#pattern against
- * <code>strings</code>, while taking into account the given weights. It
- * returns the number of weighted character operations, the Sellers distance.
- * <code>strings</code> has to be either a String or an Array of Strings. The
- * returned <code>results</code> are either a Float or an Array of Floats
- * respectively.
+ * Searches string like compare does: the scan runs without the global
+ * interpreter lock for long strings, which are copied unless frozen. The
+ * scan of the set may only be used by one search at a time, the others
+ * allocate their own.
  */
-static VALUE rb_Sellers_match(VALUE self, VALUE strings)
-{                                                                            
-    GET_STRUCT(Sellers)
-    return Sellers_iterate_strings(amatch, strings, Sellers_match);
+static VALUE PatternSet_search(PatternSetObject *amatch, VALUE string)
+{
+    PatternSetSearch search;
+    PatternHit *hit;
+    VALUE result;
+    long i;
+
+    Check_Type(string, T_STRING);
+    MEMZERO(&search, PatternSetSearch, 1);
+    search.amatch = amatch;
+    search.scan = amatch->scan;
+    if (amatch->busy) {
+        search.scan = search.own = PatternScan_new(&amatch->set);
+    }
+    search.text = RSTRING(string)->ptr;
+    search.text_len = RSTRING(string)->len;
+#ifdef HAVE_RB_THREAD_CALL_WITHOUT_GVL
+    if (search.text_len >= UNBLOCKING_COST) {
+        if (!OBJ_FROZEN(string)) {
+            search.copy = ALLOC_N(char, search.text_len);
+            MEMCPY(search.copy, search.text, char, search.text_len);
+            search.text = search.copy;
+        }
+        amatch->busy++;
+        rb_ensure(pattern_set_search_unblocked, (VALUE) &search,
+            pattern_set_search_finish, (VALUE) &search);
+    } else {
+        pattern_set_search_kernel(&search);
+    }
+#else
+    pattern_set_search_kernel(&search);
+#endif
+    pattern_scan_destroy(search.own);
+    if (search.len < 0) rb_raise(rb_eNoMemError, "failed to allocate memory");
+    result = rb_ary_new2(search.len);
+    for (i = 0, hit = search.hits; i < search.len; i++, hit++) {
+        rb_ary_push(result, rb_ary_new3(4, INT2FIX(hit->pattern),
+            LONG2NUM(hit->start), LONG2NUM(hit->end),
+            INT2FIX(hit->distance)));
+    }
+    free(search.hits);
+    return result;
 }
 
 /*
- * call-seq: similar(strings) -> results
- * 
- * Uses this Amatch::Sellers instance to match Amatch::Sellers#pattern
- * against <code>strings</code> (taking into account the given weights), and
- * compute a Sellers distance metric number between 0.0 for very unsimilar
- * strings and 1.0 for an exact match. <code>strings</code> has to be either a
- * String or an Array of Strings. The returned <code>results</code> are either
- * a Fixnum or an Array of Fixnums
- * respectively.
+ * call-seq: search(strings) -> results
+ *
+ * Searches all patterns of this set in <code>strings</code>, and returns
+ * their occurrences as <code>[index, start, end, distance]</code> arrays,
+ * sorted by start, index and end: <code>index</code> is the index of the
+ * pattern in the Array, the set was created from, and the others are the
+ * same as for Amatch::Levenshtein#search_all.
+ * <code>strings</code> has to be either a String or an Array of Strings.
+ * For an Array, an Array of the results for each String is returned.
+ *
+ *  set = Amatch::PatternSet.new(%w[amatch ruby], 1)
+ *  set.search('use amtch in rubyy')  # => [[0, 4, 9, 1], [1, 13, 17, 0]]
  */
-static VALUE rb_Sellers_similar(VALUE self, VALUE strings)
-{                                                                            
-    GET_STRUCT(Sellers)
-    return Sellers_iterate_strings(amatch, strings, Sellers_similar);
+static VALUE rb_PatternSet_search(VALUE self, VALUE strings)
+{
+    VALUE result;
+    long i;
+    GET_STRUCT(PatternSetObject)
+
+    if (!amatch->scan) rb_raise(rb_eRuntimeError, "uninitialized pattern set");
+    if (TYPE(strings) == T_STRING) return PatternSet_search(amatch, strings);
+    check_strings(strings);
+    result = rb_ary_new2(RARRAY(strings)->len);
+    for (i = 0; i < RARRAY(strings)->len; i++) {
+        rb_ary_push(result,
+            PatternSet_search(amatch, rb_ary_entry(strings, i)));
+    }
+    return result;
 }
 
 /*
- * call-seq: search(strings) -> results
+ * call-seq: size -> number
  *
- * searches Sellers#pattern in <code>strings</code> and returns the edit
- * distance (the sum of weighted character operations) as a Float value, by
- * greedy trimming prefixes or postfixes of the match. <code>strings</code> has
- * to be either a String or an Array of Strings. The returned
- * <code>results</code> are either a Float or an Array of Floats respectively.
+ * Returns the number of patterns in this set.
  */
-static VALUE rb_Sellers_search(VALUE self, VALUE strings)
-{                                                                            
-    GET_STRUCT(Sellers)
-    return Sellers_iterate_strings(amatch, strings, Sellers_search);
+static VALUE rb_PatternSet_size(VALUE self)
+{
+    GET_STRUCT(PatternSetObject)
+    return INT2FIX(amatch->set.len);
 }
 
-/* 
- * Document-class: Amatch::PairDistance
+/*
+ * call-seq: max_distance -> number
  *
- * The pair distance between two strings is based on the number of adjacent
- * character pairs, that are contained in both strings. The similiarity
- * metric of two strings s1 and s2 is
- *   2*|union(pairs(s1), pairs(s2))| / |pairs(s1)| + |pairs(s2)|
- * If it is 1.0 the two strings are an exact match, if less than 1.0 they
- * are more dissimilar. The advantage of considering adjacent characters, is to
- * take account not only of the characters, but also of the character ordering
- * in the original strings.
- * 
- * This metric is very capable to find similarities in natural languages.
- * It is explained in more detail in Simon White's article "How to Strike a
- * Match", located at this url:
- * http://www.catalysoft.com/articles/StrikeAMatch.html
- * It is also very similar (a special case) to the method described under
- * http://citeseer.lcs.mit.edu/gravano01using.html in "Using q-grams in a DBMS
- * for Approximate String Processing."
+ * Returns the maximum number of differences of the occurrences found.
  */
-DEF_RB_FREE(PairDistance, PairDistance)
+static VALUE rb_PatternSet_max_distance(VALUE self)
+{
+    GET_STRUCT(PatternSetObject)
+    return INT2FIX(amatch->set.k);
+}
 
 /*
- * call-seq: new(pattern)
+ * Document-class: Amatch::BKTree
  *
- * Creates a new Amatch::PairDistance instance from <code>pattern</code>.
+ * A BK-tree is an index of a fixed Array of strings, that finds the strings
+ * within a given Levenshtein or Hamming distance of a query string without
+ * comparing it with all of them. Every node of the tree sorts its subtrees
+ * by their distance to it, so the triangle inequality rules out most of the
+ * subtrees for small distances. The nodes are stored in one C array, in the
+ * order of the strings, and refer to them by their index.
  */
-static VALUE rb_PairDistance_initialize(VALUE self, VALUE pattern)
+
+typedef struct BKTreeObjectStruct {
+    BKTree      tree;
+    VALUE       metric;
+} BKTreeObject;
+
+static void rb_BKTree_mark(BKTreeObject *amatch)
 {
-    GET_STRUCT(PairDistance)
-    PairDistance_pattern_set(amatch, pattern);
-    return self;
+    rb_gc_mark(amatch->metric);
 }
 
-DEF_CONSTRUCTOR(PairDistance, PairDistance)
+static void rb_BKTree_free(BKTreeObject *amatch)
+{
+    bktree_release(&amatch->tree);
+    free(amatch);
+}
+
+#ifdef HAVE_TYPE_RB_DATA_TYPE_T
+static size_t rb_BKTree_memsize(const void *ptr)
+{
+    BKTreeObject *amatch = (BKTreeObject *) ptr;
+    return sizeof(BKTreeObject) + bktree_memsize(&amatch->tree);
+}
+
+static const rb_data_type_t BKTreeObject_data_type = {
+    "Amatch::BKTree",
+    {
+        (void (*)(void *)) rb_BKTree_mark,
+        (void (*)(void *)) rb_BKTree_free,
+        rb_BKTree_memsize,
+    },
+};
+#endif
+
+static VALUE rb_BKTree_s_allocate(VALUE klass)
+{
+    BKTreeObject *amatch = ALLOC(BKTreeObject);
+    MEMZERO(amatch, BKTreeObject, 1);
+    amatch->metric = Qnil;
+#ifdef HAVE_TYPE_RB_DATA_TYPE_T
+    return TypedData_Wrap_Struct(klass, &BKTreeObject_data_type, amatch);
+#else
+    return Data_Wrap_Struct(klass, rb_BKTree_mark, rb_BKTree_free, amatch);
+#endif
+}
 
 /*
- * call-seq: match(strings, regexp = /\s+/) -> results
- * 
- * Uses this Amatch::PairDistance instance to match  PairDistance#pattern against
- * <code>strings</code>. It returns the pair distance measure, that is a
- * returned value of 1.0 is an exact match, partial matches are lower
- * values, while 0.0 means no match at all.
- *
- * <code>strings</code> has to be either a String or an
- * Array of Strings. The argument <code>regexp</code> is used to split the
- * pattern and strings into tokens first. It defaults to /\s+/. If the
- * splitting should be omitted, call the method with nil as <code>regexp</code>
- * explicitly.
+ * call-seq: new(strings, metric = Amatch::Levenshtein)
  *
- * The returned <code>results</code> are either a Float or an
- * Array of Floats respectively.
+ * Creates a new Amatch::BKTree instance from the Array
+ * <code>strings</code>, that can be queried for the strings within a
+ * <code>metric</code> distance of another string. <code>metric</code> has to
+ * be either Amatch::Levenshtein or Amatch::Hamming.
  */
-static VALUE rb_PairDistance_match(int argc, VALUE *argv, VALUE self)
-{                                                                            
-    VALUE result, strings, regexp = Qnil;
-    int use_regexp;
-    GET_STRUCT(PairDistance)
-
-    rb_scan_args(argc, argv, "11", &strings, &regexp);
-    use_regexp = NIL_P(regexp) && argc != 2;
-    if (TYPE(strings) == T_STRING) {
-        result = PairDistance_match(amatch, strings, regexp, use_regexp);
+static VALUE rb_BKTree_initialize(int argc, VALUE *argv, VALUE self)
+{
+    VALUE strings, metric = Qnil;
+    int type;
+    GET_STRUCT(BKTreeObject)
+
+    rb_scan_args(argc, argv, "11", &strings, &metric);
+    if (NIL_P(metric)) metric = rb_cLevenshtein;
+    if (metric == rb_cLevenshtein) {
+        type = BKTREE_LEVENSHTEIN;
+    } else if (metric == rb_cHamming) {
+        type = BKTREE_HAMMING;
     } else {
-        Check_Type(strings, T_ARRAY);
-        int i;
-        result = rb_ary_new2(RARRAY(strings)->len);
-        for (i = 0; i < RARRAY(strings)->len; i++) {
-            VALUE string = rb_ary_entry(strings, i);
-            if (TYPE(string) != T_STRING) {
-                rb_raise(rb_eTypeError,
-                    "array has to contain only strings (%s given)",
-                    NIL_P(string) ?
-                        "NilClass" :
-                        rb_class2name(CLASS_OF(string)));
-            }
-            rb_ary_push(result,
-                PairDistance_match(amatch, string, regexp, use_regexp));
-        }
+        rb_raise(rb_eArgError,
+            "metric has to be Amatch::Levenshtein or Amatch::Hamming");
     }
-    pair_array_destroy(amatch->pattern_pair_array);
-    amatch->pattern_pair_array = NULL;
-    return result;
+    check_strings(strings);
+    bktree_release(&amatch->tree);
+    bktree_init(&amatch->tree, strings, type);
+    amatch->metric = metric;
+    return self;
 }
 
 /*
- * call-seq: pair_distance_similar(strings) -> results
+ * call-seq: search(string, max_distance) -> results
  *
- * If called on a String, this string is used as a Amatch::PairDistance#pattern
- * to match against <code>strings</code> using /\s+/ as the tokenizing regular
- * expression. It returns a pair distance metric number between 0.0 for very
- * unsimilar strings and 1.0 for an exact match. <code>strings</code> has to be
- * either a String or an Array of Strings. The returned <code>results</code>
- * are either a Float or an Array of Floats respectively.
+ * Returns all strings of this tree within a distance of
+ * <code>max_distance</code> of <code>string</code> as
+ * <code>[index, distance]</code> pairs, sorted by distance and index.
  */
-static VALUE rb_str_pair_distance_similar(VALUE self, VALUE strings)
+static VALUE rb_BKTree_search(VALUE self, VALUE string, VALUE max_distance)
 {
-    VALUE amatch = rb_PairDistance_new(rb_cPairDistance, self);
-    return rb_PairDistance_match(1, &strings, amatch);
+    BKMatch *matches;
+    VALUE result;
+    long i, len;
+    int k;
+    GET_STRUCT(BKTreeObject)
+
+    Check_Type(string, T_STRING);
+    CAST2FLOAT(max_distance);
+    k = FLOAT2C(max_distance) < 0 ? -1 : BOUND2INT(FLOAT2C(max_distance));
+    len = bktree_search(&amatch->tree, RSTRING(string)->ptr,
+        RSTRING(string)->len, k, &matches);
+    result = rb_ary_new2(len);
+    for (i = 0; i < len; i++) {
+        rb_ary_push(result, rb_assoc_new(INT2FIX(matches[i].index),
+            INT2FIX(matches[i].distance)));
+    }
+    xfree(matches);
+    return result;
 }
 
-/* 
- * Document-class: Amatch::Hamming
- *
- *  This class computes the Hamming distance between two strings.
+/*
+ * call-seq: nearest(string) -> [index, distance]
  *
- *  The Hamming distance between two strings is the number of characters, that
- *  are different. Thus a hamming distance of 0 means an exact
- *  match, a hamming distance of 1 means one character is different, and so on.
- *  If one string is longer than the other string, the missing characters are
- *  counted as different characters.
+ * Returns the string of this tree nearest to <code>string</code> as an
+ * <code>[index, distance]</code> pair, the one with the lowest index, if
+ * there are several. Returns nil, if the tree is empty.
  */
+static VALUE rb_BKTree_nearest(VALUE self, VALUE string)
+{
+    int index, distance;
+    GET_STRUCT(BKTreeObject)
 
-DEF_RB_FREE(Hamming, General)
+    Check_Type(string, T_STRING);
+    index = bktree_nearest(&amatch->tree, RSTRING(string)->ptr,
+        RSTRING(string)->len, &distance);
+    if (index < 0) return Qnil;
+    return rb_assoc_new(INT2FIX(index), INT2FIX(distance));
+}
 
 /*
- * call-seq: new(pattern)
+ * call-seq: visited -> number
  *
- * Creates a new Amatch::Hamming instance from <code>pattern</code>.
+ * Returns the number of nodes, whose distance to the query string was
+ * computed by the last call of BKTree#search or BKTree#nearest.
  */
-static VALUE rb_Hamming_initialize(VALUE self, VALUE pattern)
+static VALUE rb_BKTree_visited(VALUE self)
 {
-    GET_STRUCT(General)
-    General_pattern_set(amatch, pattern);
-    return self;
+    GET_STRUCT(BKTreeObject)
+    return LONG2NUM(amatch->tree.visited);
 }
 
-DEF_CONSTRUCTOR(Hamming, General)
-
 /*
- * call-seq: match(strings) -> results
- * 
- * Uses this Amatch::Hamming instance to match Amatch::Hamming#pattern against
- * <code>strings</code>, that is compute the hamming distance between
- * <code>pattern</code> and <code>strings</code>. <code>strings</code> has to
- * be either a String or an Array of Strings. The returned <code>results</code>
- * are either a Fixnum or an Array of Fixnums respectively.
+ * call-seq: size -> number
+ *
+ * Returns the number of strings in this tree.
  */
-static VALUE rb_Hamming_match(VALUE self, VALUE strings)
-{                                                                            
-    GET_STRUCT(General)
-    return General_iterate_strings(amatch, strings, Hamming_match);
+static VALUE rb_BKTree_size(VALUE self)
+{
+    GET_STRUCT(BKTreeObject)
+    return INT2FIX(amatch->tree.len);
 }
 
 /*
- * call-seq: similar(strings) -> results
+ * call-seq: metric -> class
  *
- * Uses this Amatch::Hamming instance to match  Amatch::Hamming#pattern against
- * <code>strings</code>, and compute a Hamming distance metric number between
- * 0.0 for very unsimilar strings and 1.0 for an exact match.
- * <code>strings</code> has to be either a String or an Array of Strings. The
- * returned <code>results</code> are either a Fixnum or an Array of Fixnums
- * respectively.
+ * Returns the metric of this tree, Amatch::Levenshtein or Amatch::Hamming.
  */
-static VALUE rb_Hamming_similar(VALUE self, VALUE strings)
-{                                                                            
-    GET_STRUCT(General)
-    return General_iterate_strings(amatch, strings, Hamming_similar);
+static VALUE rb_BKTree_metric(VALUE self)
+{
+    GET_STRUCT(BKTreeObject)
+    return amatch->metric;
 }
 
 /*
- * call-seq: hamming_similar(strings) -> results
+ * Document-class: Amatch::QGramIndex
  *
- * If called on a String, this string is used as a Amatch::Hamming#pattern to
- * match against <code>strings</code>. It returns a Hamming distance metric
- * number between 0.0 for very unsimilar strings and 1.0 for an exact match.
- * <code>strings</code>
- * has to be either a String or an Array of Strings. The returned
- * <code>results</code> are either a Float or an Array of Floats respectively.
+ * A q-gram index is an index of a fixed Array of strings, that finds the
+ * strings with a pair distance of at least a given threshold to a query
+ * string without comparing it with all of them. Every q-gram, a pair of
+ * adjacent characters by default, is mapped to the compressed, sorted list
+ * of the strings containing it. Only the strings found often enough in the
+ * lists of the grams of the query are compared (see qgram.c), by the kernel
+ * of Amatch::PairDistance for pairs. For other q the similarity is the Dice
+ * coefficient of the q-grams.
  */
-static VALUE rb_str_hamming_similar(VALUE self, VALUE strings)
-{
-    VALUE amatch = rb_Hamming_new(rb_cHamming, self);
-    return rb_Hamming_similar(amatch, strings);
-}
 
+typedef struct QGramIndexObjectStruct {
+    QGramIndex  index;
+    VALUE       regexp;
+    int         use_regexp;
+    int         busy;
+    long        candidates;     /* compared by the last search */
+    Workspace   workspace;
+    Stats       stats;
+} QGramIndexObject;
 
-/* 
- * Document-class: Amatch::LongestSubsequence
- *
- *  This class computes the length of the longest subsequence common to two
- *  strings. A subsequence doesn't have to be contiguous. The longer the common
- *  subsequence is, the more similar the two strings will be.
- *
- *  The longest common subsequence between "test" and "test" is of length 4,
- *  because "test" itself is this subsequence. The longest common subsequence
- *  between "test" and "east" is "e", "s", "t" and the length of the
- *  sequence is 3.
+/*
+ * The query of a search, the amatch of its comparisons: its sorted grams,
+ * and for q = 2 its counted pairs.
  */
-DEF_RB_FREE(LongestSubsequence, General)
+typedef struct QGramQueryStruct {
+    int         q;
+    QGram       *grams;
+    long        len;
+    PairCounts  *pairs;
+} QGramQuery;
+
+typedef struct QGramHitStruct {
+    long        index;
+    double      similarity;
+} QGramHit;
+
+#define QGRAM_PAIRS_SIZE(n) \
+    (((n) * sizeof(Pair) + sizeof(double) - 1) / sizeof(double) * sizeof(double))
+
+static void *QGramIndex_match_kernel(void *data)
+{
+    Comparison *cmp = (Comparison *) data;
+    QGramQuery *query = (QGramQuery *) cmp->amatch;
+    QGram *grams = (QGram *) cmp->scratch;
+    long i, n = qgram_grams(query->q, (unsigned char *) cmp->b_ptr,
+        cmp->b_len, grams);
+
+    if (query->pairs) {
+        PairArray pairs;
+        pairs.pairs = (Pair *) (grams + n);
+        pairs.len = (int) n;
+        for (i = 0; i < n; i++) pairs.pairs[i] = (Pair) grams[i];
+        cmp->result = pair_counts_match(query->pairs, &pairs,
+            (char *) pairs.pairs + QGRAM_PAIRS_SIZE(n));
+    } else if (query->len + n == 0) {
+        cmp->result = 1.0;
+    } else {
+        cmp->result = ((double) (2 * qgram_overlap(query->grams, query->len,
+            grams, n))) / (query->len + n);
+    }
+    return NULL;
+}
 
 /*
- * call-seq: new(pattern)
- *
- * Creates a new Amatch::LongestSubsequence instance from <code>pattern</code>.
+ * If no posting list was skipped, the overlap of the candidate is known
+ * already, and it isn't compared anymore.
  */
-static VALUE rb_LongestSubsequence_initialize(VALUE self, VALUE pattern)
+static void QGramIndex_prepare(QGramIndexObject *amatch, QGramQuery *query,
+    long index, int overlap, int exact, Comparison *cmp)
 {
-    GET_STRUCT(General)
-    General_pattern_set(amatch, pattern);
-    return self;
+    long n = amatch->index.gram_counts[index];
+
+    if (exact) {
+        cmp->result = query->len + n == 0 ? 1.0 :
+            ((double) (2 * overlap)) / (query->len + n);
+        return;
+    }
+    cmp->amatch = query;
+    cmp->b_ptr = (char *) amatch->index.text + amatch->index.starts[index];
+    cmp->b_len = (int) (amatch->index.starts[index + 1] -
+        amatch->index.starts[index]);
+    cmp->kernel = QGramIndex_match_kernel;
+    cmp->scratch_size = n * sizeof(QGram);
+    if (query->pairs) {
+        cmp->scratch_size += QGRAM_PAIRS_SIZE(n) +
+            pair_counts_scratch_size((int) n);
+    }
+    cmp->cost = (double) query->len + n;
 }
 
-DEF_CONSTRUCTOR(LongestSubsequence, General)
+static int QGramHit_compare(const void *a, const void *b)
+{
+    const QGramHit *x = (const QGramHit *) a, *y = (const QGramHit *) b;
 
-/*
- * call-seq: match(strings) -> results
- * 
- * Uses this Amatch::LongestSubsequence instance to match
- * LongestSubsequence#pattern against <code>strings</code>, that is compute the
- * length of the longest common subsequence. <code>strings</code> has to be
- * either a String or an Array of Strings. The returned <code>results</code>
- * are either a Fixnum or an Array of Fixnums respectively.
- */
-static VALUE rb_LongestSubsequence_match(VALUE self, VALUE strings)
-{                                                                            
-    GET_STRUCT(General)
-    return General_iterate_strings(amatch, strings, LongestSubsequence_match);
+    if (x->similarity != y->similarity) {
+        return x->similarity > y->similarity ? -1 : 1;
+    }
+    return x->index < y->index ? -1 : x->index > y->index;
 }
 
-/*
- * call-seq: similar(strings) -> results
- * 
- * Uses this Amatch::LongestSubsequence instance to match
- * Amatch::LongestSubsequence#pattern against <code>strings</code>, and compute
- * a longest substring distance metric number between 0.0 for very unsimilar
- * strings and 1.0 for an exact match. <code>strings</code> has to be either a
- * String or an Array of Strings. The returned <code>results</code> are either
- * a Fixnum or an Array of Fixnums
- */
-static VALUE rb_LongestSubsequence_similar(VALUE self, VALUE strings)
-{                                                                            
-    GET_STRUCT(General)
-    return General_iterate_strings(amatch, strings, LongestSubsequence_similar);
+static void rb_QGramIndex_mark(QGramIndexObject *amatch)
+{
+    rb_gc_mark(amatch->regexp);
+}
+
+static void rb_QGramIndex_free(QGramIndexObject *amatch)
+{
+    qgram_index_release(&amatch->index);
+    workspace_release(&amatch->workspace);
+    stats_release(&amatch->stats);
+    free(amatch);
+}
+
+#ifdef HAVE_TYPE_RB_DATA_TYPE_T
+static size_t rb_QGramIndex_memsize(const void *ptr)
+{
+    QGramIndexObject *amatch = (QGramIndexObject *) ptr;
+    return sizeof(QGramIndexObject) + qgram_index_memsize(&amatch->index) +
+        amatch->workspace.size + stats_memsize(&amatch->stats);
+}
+
+static const rb_data_type_t QGramIndexObject_data_type = {
+    "Amatch::QGramIndex",
+    {
+        (void (*)(void *)) rb_QGramIndex_mark,
+        (void (*)(void *)) rb_QGramIndex_free,
+        rb_QGramIndex_memsize,
+    },
+};
+#endif
+
+static VALUE rb_QGramIndex_s_allocate(VALUE klass)
+{
+    QGramIndexObject *amatch = ALLOC(QGramIndexObject);
+    MEMZERO(amatch, QGramIndexObject, 1);
+    amatch->regexp = Qnil;
+    amatch->stats.class_name = "QGramIndex";
+#ifdef HAVE_TYPE_RB_DATA_TYPE_T
+    return TypedData_Wrap_Struct(klass, &QGramIndexObject_data_type, amatch);
+#else
+    return Data_Wrap_Struct(klass, rb_QGramIndex_mark, rb_QGramIndex_free,
+        amatch);
+#endif
 }
 
 /*
- * call-seq: longest_subsequence_similar(strings) -> results
+ * call-seq: new(strings, q = 2, regexp = /\s+/)
  *
- * If called on a String, this string is used as a
- * Amatch::LongestSubsequence#pattern to match against <code>strings</code>. It
- * returns a longest subsequence distance metric number between 0.0 for very
- * unsimilar strings and 1.0 for an exact match. <code>strings</code> has to be
- * either a String or an Array of Strings. The returned <code>results</code>
- * are either a Float or an Array of Floats respectively.
+ * Creates a new Amatch::QGramIndex instance from the Array
+ * <code>strings</code>, that can be queried for the strings similar to
+ * another string. The strings are split into tokens by <code>regexp</code>
+ * first, as by PairDistance#match, and nil as <code>regexp</code> omits the
+ * splitting. <code>q</code> is the length of the grams, from 1 to 8.
  */
-static VALUE rb_str_longest_subsequence_similar(VALUE self, VALUE strings)
-{                                                                            
-    VALUE amatch = rb_LongestSubsequence_new(rb_cLongestSubsequence, self);
-    return rb_LongestSubsequence_similar(amatch, strings);
+static VALUE rb_QGramIndex_initialize(int argc, VALUE *argv, VALUE self)
+{
+    VALUE strings, q = Qnil, regexp = Qnil, tokens;
+    long i;
+    int use_regexp;
+    GET_STRUCT(QGramIndexObject)
+
+    rb_scan_args(argc, argv, "12", &strings, &q, &regexp);
+    use_regexp = NIL_P(regexp) && argc < 3;
+    if (NIL_P(q)) q = INT2FIX(2);
+    if (NUM2INT(q) < 1 || NUM2INT(q) > QGRAM_MAX_Q) {
+        rb_raise(rb_eArgError, "q has to be between 1 and %d", QGRAM_MAX_Q);
+    }
+    check_strings(strings);
+    if (amatch->busy) {
+        rb_raise(rb_eRuntimeError, "can't modify index while searching");
+    }
+    tokens = rb_ary_new2(RARRAY(strings)->len);
+    for (i = 0; i < RARRAY(strings)->len; i++) {
+        rb_ary_push(tokens, PairDistance_tokens(rb_ary_entry(strings, i),
+            regexp, use_regexp));
+    }
+    qgram_index_release(&amatch->index);
+    qgram_index_init(&amatch->index, NUM2INT(q));
+    for (i = 0; i < RARRAY(tokens)->len; i++) {
+        qgram_index_add(&amatch->index, rb_ary_entry(tokens, i));
+    }
+    qgram_index_build(&amatch->index);
+    amatch->regexp = regexp;
+    amatch->use_regexp = use_regexp;
+    amatch->candidates = 0;
+    return self;
 }
 
-/* 
- * Document-class: Amatch::LongestSubstring
- *
- * The longest common substring is the longest substring, that is part of
- * two strings. A substring is contiguous, while a subsequence need not to
- * be. The longer the common substring is, the more similar the two strings
- * will be.
+/*
+ * call-seq: search(string, threshold) -> results
  *
- * The longest common substring between 'string' and 'string' is 'string'
- * again, thus the longest common substring length is 6. The longest common
- * substring between 'string' and 'storing' is 'ring', thus the longest common
- * substring length is 4. 
+ * Returns all strings of this index with a similarity of at least
+ * <code>threshold</code> to <code>string</code> as
+ * <code>[index, similarity]</code> pairs, sorted by decreasing similarity
+ * and index. For q = 2 the similarity is the one of PairDistance#match.
+ *
+ *  index = Amatch::QGramIndex.new(%w[amatch amatcher match ruby])
+ *  index.search('amatch', 0.85)  # => [[0, 1.0], [2, 0.888888888888889]]
  */
-
-DEF_RB_FREE(LongestSubstring, General)
+static VALUE rb_QGramIndex_search(VALUE self, VALUE string, VALUE threshold)
+{
+    QGramQuery query;
+    QGramHit *hits;
+    Comparison *cmps;
+    VALUE tokens, result;
+    long *candidates, i, len, n;
+    int *overlaps, exact, status, state;
+    double t;
+    GET_STRUCT(QGramIndexObject)
+
+    if (!amatch->index.table) rb_raise(rb_eRuntimeError, "uninitialized index");
+    Check_Type(string, T_STRING);
+    CAST2FLOAT(threshold);
+    t = FLOAT2C(threshold);
+    tokens = PairDistance_tokens(string, amatch->regexp, amatch->use_regexp);
+    query.q = amatch->index.q;
+    query.len = qgram_query_grams(query.q, tokens, &query.grams);
+    query.pairs = NULL;
+    candidates = ALLOC_N(long, amatch->index.len + 1);
+    overlaps = ALLOC_N(int, amatch->index.len + 1);
+    len = qgram_index_candidates(&amatch->index, query.grams, query.len, t,
+        candidates, overlaps, &exact);
+    if (!exact && query.q == 2) {
+        PairArray *pairs = PairArray_new(tokens);
+        query.pairs = PairCounts_new(pairs);
+        pair_array_destroy(pairs);
+    }
+    cmps = ALLOC_N(Comparison, len + 1);
+    MEMZERO(cmps, Comparison, len + 1);
+    for (i = 0; i < len; i++) {
+        QGramIndex_prepare(amatch, &query, candidates[i], overlaps[i], exact,
+            cmps + i);
+    }
+    amatch->candidates = exact ? 0 : len;
+    status = compare_batch_protected(cmps, len, Qnil, &amatch->stats,
+        &amatch->busy, &amatch->workspace, &state);
+    hits = ALLOC_N(QGramHit, len + 1);
+    for (i = 0, n = 0; state == 0 && status == 0 && i < len; i++) {
+        if (cmps[i].result < t) continue;
+        hits[n].index = candidates[i];
+        hits[n++].similarity = cmps[i].result;
+    }
+    xfree(cmps);
+    xfree(overlaps);
+    xfree(candidates);
+    pair_counts_destroy(query.pairs);
+    xfree(query.grams);
+    if (state || status != 0) {
+        xfree(hits);
+        if (state) rb_jump_tag(state);
+        rb_raise(rb_eNoMemError, "failed to allocate memory");
+    }
+    qsort(hits, n, sizeof(QGramHit), QGramHit_compare);
+    result = rb_ary_new2(n);
+    for (i = 0; i < n; i++) {
+        rb_ary_push(result, rb_assoc_new(LONG2NUM(hits[i].index),
+            rb_float_new(hits[i].similarity)));
+    }
+    xfree(hits);
+    return result;
+}
 
 /*
- * call-seq: new(pattern)
+ * call-seq: candidates -> number
  *
- * Creates a new Amatch::LongestSubstring instance from <code>pattern</code>.
+ * Returns the number of strings, that were compared with the query string
+ * by the last call of QGramIndex#search. Strings, whose similarity was
+ * known from the posting lists already, aren't counted.
  */
-static VALUE rb_LongestSubstring_initialize(VALUE self, VALUE pattern)
+static VALUE rb_QGramIndex_candidates(VALUE self)
 {
-    GET_STRUCT(General)
-    General_pattern_set(amatch, pattern);
-    return self;
+    GET_STRUCT(QGramIndexObject)
+    return LONG2NUM(amatch->candidates);
 }
 
-DEF_CONSTRUCTOR(LongestSubstring, General)
-
 /*
- * call-seq: match(strings) -> results
- * 
- * Uses this Amatch::LongestSubstring instance to match
- * LongestSubstring#pattern against <code>strings</code>, that is compute the
- * length of the longest common substring. <code>strings</code> has to be
- * either a String or an Array of Strings. The returned <code>results</code>
- * are either a Fixnum or an Array of Fixnums respectively.
+ * call-seq: size -> number
+ *
+ * Returns the number of strings in this index.
  */
-static VALUE rb_LongestSubstring_match(VALUE self, VALUE strings)
+static VALUE rb_QGramIndex_size(VALUE self)
 {
-    GET_STRUCT(General)
-    return General_iterate_strings(amatch, strings, LongestSubstring_match);
+    GET_STRUCT(QGramIndexObject)
+    return LONG2NUM(amatch->index.len);
 }
 
 /*
- * call-seq: similar(strings) -> results
- * 
- * Uses this Amatch::LongestSubstring instance to match
- * Amatch::LongestSubstring#pattern against <code>strings</code>, and compute a
- * longest substring distance metric number between 0.0 for very unsimilar
- * strings and 1.0 for an exact match. <code>strings</code> has to be either a
- * String or an Array of Strings. The returned <code>results</code> are either
- * a Fixnum or an Array of Fixnums
- * respectively.
+ * call-seq: q -> number
+ *
+ * Returns the length of the grams of this index.
  */
-static VALUE rb_LongestSubstring_similar(VALUE self, VALUE strings)
+static VALUE rb_QGramIndex_q(VALUE self)
 {
-    GET_STRUCT(General)
-    return General_iterate_strings(amatch, strings, LongestSubstring_similar);
+    GET_STRUCT(QGramIndexObject)
+    return INT2FIX(amatch->index.q);
 }
 
+DEF_STATS(QGramIndexObject)
+
 /*
- * call-seq: longest_substring_similar(strings) -> results
+ * Similarity joins: Amatch.join finds the candidates for every left string
+ * in an index of the right strings (see join.c), and verifies them with the
+ * kernels of the metric. The left strings are compiled into matchers of
+ * their own, JOIN_MATCHERS at a time, and their comparisons are computed in
+ * batches of about JOIN_BATCH by compare_batch, so they are spread over
+ * Amatch.threads native threads. All strings are copied beforehand, so the
+ * comparisons don't depend on the Ruby objects.
  *
- * If called on a String, this string is used as a
- * Amatch::LongestSubstring#pattern to match against <code>strings</code>. It
- * returns a longest substring distance metric number between 0.0 for very
- * unsimilar strings and 1.0 for an exact match. <code>strings</code> has to be
- * either a String or an Array of Strings. The returned <code>results</code>
- * are either a Float or an Array of Floats respectively.
+ * Amatch.cluster joins the strings with themselves, and only compares the
+ * candidates following a string, that have the same blocking key, and that
+ * aren't in its cluster already. Similar strings are merged into clusters
+ * by a union-find forest of parent indexes.
  */
-static VALUE rb_str_longest_substring_similar(VALUE self, VALUE strings)
-{                                                                            
-    VALUE amatch = rb_LongestSubstring_new(rb_cLongestSubstring, self);
-    return rb_LongestSubstring_similar(amatch, strings);
+
+#define JOIN_MATCHERS   1024
+#define JOIN_BATCH      (1 << 16)
+
+static Stats join_stats = { "Amatch", NULL, 0 };
+
+typedef struct JoinStruct {
+    VALUE       metric;
+    int         k;
+    double      threshold;
+    int         ignore_case;
+    float       scaling_factor;
+    char        *copy;
+    char        **ptrs;             /* of the left, then the right strings */
+    int         *lens;
+    long        left_len;
+    char        **right_ptrs;       /* the left ones again for clusters */
+    int         *right_lens;
+    long        right_len;
+    JoinIndex   index;
+    long        *candidates;
+    General     *generals;          /* matchers of the left strings, */
+    Jaro        *jaros;             /* one of them for the metric */
+    JaroWinkler *jaro_winklers;
+    Comparison  *cmps;
+    long        *lefts;             /* indexes of the strings compared */
+    long        *rights;
+    long        cmps_size;
+    int         busy;
+    Workspace   workspace;
+    long        *parents;           /* of the strings in clusters, or NULL */
+    long        *keys;              /* numbered blocking keys, or NULL */
+    VALUE       result;
+} Join;
+
+/*
+ * Copies the strings of left and right, which is nil for clusters.
+ */
+static void join_copy(Join *join, VALUE left, VALUE right)
+{
+    long i, size = 0, len = join->left_len;
+    VALUE string;
+
+    if (!NIL_P(right)) len += join->right_len;
+    for (i = 0; i < len; i++) {
+        string = rb_ary_entry(i < join->left_len ? left : right,
+            i < join->left_len ? i : i - join->left_len);
+        size += RSTRING(string)->len;
+    }
+    join->copy = ALLOC_N(char, size > 0 ? size : 1);
+    join->ptrs = ALLOC_N(char *, len > 0 ? len : 1);
+    join->lens = ALLOC_N(int, len > 0 ? len : 1);
+    for (i = 0, size = 0; i < len; i++) {
+        string = rb_ary_entry(i < join->left_len ? left : right,
+            i < join->left_len ? i : i - join->left_len);
+        join->ptrs[i] = join->copy + size;
+        join->lens[i] = (int) RSTRING(string)->len;
+        MEMCPY(join->ptrs[i], RSTRING(string)->ptr, char,
+            RSTRING(string)->len);
+        size += RSTRING(string)->len;
+    }
+    i = NIL_P(right) ? 0 : join->left_len;
+    join->right_ptrs = join->ptrs + i;
+    join->right_lens = join->lens + i;
 }
 
 /*
- * Document-class: Amatch::Jaro
- *
- * This class computes the Jaro metric for two strings.
- * The Jaro metric computes the similarity between 0 (no match)
- * and 1 (exact match) by looking for matching and transposed characters.
+ * Compiles the left string i into the matcher in slot.
  */
-DEF_RB_FREE(Jaro, Jaro)
+static void join_compile(Join *join, int slot, long i)
+{
+    if (join->metric == rb_cLevenshtein) {
+        General *amatch = join->generals + slot;
+        amatch->pattern = join->ptrs[i];
+        amatch->pattern_len = join->lens[i];
+        amatch->pattern_mask = PatternMask_new(join->ptrs[i], join->lens[i]);
+    } else if (join->metric == rb_cJaro) {
+        Jaro *amatch = join->jaros + slot;
+        amatch->pattern = join->ptrs[i];
+        amatch->pattern_len = join->lens[i];
+        amatch->ignore_case = join->ignore_case;
+        Jaro_pattern_compile(amatch);
+    } else {
+        JaroWinkler *amatch = join->jaro_winklers + slot;
+        amatch->pattern = join->ptrs[i];
+        amatch->pattern_len = join->lens[i];
+        amatch->ignore_case = join->ignore_case;
+        amatch->scaling_factor = join->scaling_factor;
+        JaroWinkler_pattern_compile(amatch);
+    }
+}
+
+static void join_release(Join *join)
+{
+    int slot;
+
+    for (slot = 0; slot < JOIN_MATCHERS; slot++) {
+        if (join->generals) {
+            pattern_mask_destroy(join->generals[slot].pattern_mask);
+            join->generals[slot].pattern_mask = NULL;
+        } else if (join->jaros) {
+            Jaro_pattern_release(join->jaros + slot);
+        } else if (join->jaro_winklers) {
+            JaroWinkler_pattern_release(join->jaro_winklers + slot);
+        }
+    }
+}
+
+static void join_levenshtein_prepare(General *amatch, char *b_ptr, int b_len,
+    int k, Comparison *cmp)
+{
+    char *a_ptr = amatch->pattern;
+    int a_len = amatch->pattern_len;
+
+    cmp->bound = k;
+    SET_COMPARISON(cmp, Levenshtein_match_bounded_kernel,
+        LEVENSHTEIN_BANDED(k) ?
+            2 * (b_len + 1) * sizeof(double) : PATTERN_MASK_SCRATCH_SIZE,
+        PATTERN_MASK_COST)
+}
+
+static void join_jaro_prepare(Jaro *amatch, char *b_ptr, int b_len,
+    Comparison *cmp)
+{
+    char *a_ptr = amatch->pattern;
+    int a_len = amatch->pattern_len;
+
+    SIMILAR_EMPTY_STRINGS(cmp)
+    SET_COMPARISON(cmp, Jaro_match_kernel, JARO_SCRATCH_SIZE,
+        (double) b_len * JARO_WORDS(a_len))
+}
+
+static void join_jaro_winkler_prepare(JaroWinkler *amatch, char *b_ptr,
+    int b_len, Comparison *cmp)
+{
+    char *a_ptr = amatch->pattern;
+    int a_len = amatch->pattern_len;
+
+    SIMILAR_EMPTY_STRINGS(cmp)
+    SET_COMPARISON(cmp, JaroWinkler_match_kernel, JARO_SCRATCH_SIZE,
+        (double) b_len * JARO_WORDS(a_len))
+}
 
 /*
- * Document-method: ignore_case
- *
- * call-seq: ignore_case -> true/false
- *
- * Returns whether case is ignored when computing matching characters.
+ * Removes the candidates of the string i, that don't have to be compared
+ * with it for clusters, and returns how many are left. Those of other
+ * blocks were never found.
  */
-DEF_RB_READER(Jaro, rb_Jaro_ignore_case, ignore_case, C2BOOL)
+static long join_filter(Join *join, long i, long count)
+{
+    long c, j, n = 0, root = join_find(join->parents, i);
+
+    for (c = 0; c < count; c++) {
+        j = join->candidates[c];
+        if (j <= i || join_find(join->parents, j) == root) {
+            continue;
+        }
+        join->candidates[n++] = j;
+    }
+    return n;
+}
 
 /*
- * Document-method: ignore_case=
- *
- * call-seq: ignore_case=(true/false)
- *
- * Sets whether case is ignored when computing matching characters.
+ * Prepares the comparisons of the left string i, compiled into the matcher
+ * in slot, with its candidates, starting at cmps[n].
  */
-DEF_RB_WRITER(Jaro, rb_Jaro_ignore_case_set, ignore_case,
-    int, CAST2BOOL, BOOL2C, != Qundef)
+static void join_prepare(Join *join, int slot, long i, long count, long n)
+{
+    long c, j;
+
+    if (n + count > join->cmps_size) {
+        while (n + count > join->cmps_size) join->cmps_size *= 2;
+        REALLOC_N(join->cmps, Comparison, join->cmps_size);
+        REALLOC_N(join->lefts, long, join->cmps_size);
+        REALLOC_N(join->rights, long, join->cmps_size);
+    }
+    for (c = 0; c < count; c++) {
+        Comparison *cmp = join->cmps + n + c;
+        j = join->candidates[c];
+        MEMZERO(cmp, Comparison, 1);
+        join->lefts[n + c] = i;
+        join->rights[n + c] = j;
+        if (join->generals) {
+            join_levenshtein_prepare(join->generals + slot,
+                join->right_ptrs[j], join->right_lens[j], join->k, cmp);
+        } else if (join->jaros) {
+            join_jaro_prepare(join->jaros + slot, join->right_ptrs[j],
+                join->right_lens[j], cmp);
+        } else {
+            join_jaro_winkler_prepare(join->jaro_winklers + slot,
+                join->right_ptrs[j], join->right_lens[j], cmp);
+        }
+    }
+}
+
+static void join_collect(Join *join, long n)
+{
+    long c;
+    VALUE score;
+
+    for (c = 0; c < n; c++) {
+        Comparison *cmp = join->cmps + c;
+        if (join->generals) {
+            if (cmp->result > join->k) continue;
+            score = INT2FIX((int) cmp->result);
+        } else {
+            if (cmp->result < join->threshold) continue;
+            score = rb_float_new(cmp->result);
+        }
+        if (join->parents) {
+            join_union(join->parents, join->lefts[c], join->rights[c]);
+        } else {
+            rb_ary_push(join->result, rb_ary_new3(3,
+                LONG2NUM(join->lefts[c]), LONG2NUM(join->rights[c]), score));
+        }
+    }
+}
 
 /*
- * call-seq: new(pattern)
- *
- * Creates a new Amatch::Jaro instance from <code>pattern</code>.
+ * Numbers the clusters in the order of their first strings.
  */
-static VALUE rb_Jaro_initialize(VALUE self, VALUE pattern)
+static VALUE join_clusters(Join *join)
 {
-    GET_STRUCT(Jaro)
-    Jaro_pattern_set(amatch, pattern);
-    amatch->ignore_case = 1;
-    return self;
+    long i, root, *ids = join->candidates, n = 0;
+
+    for (i = 0; i < join->left_len; i++) ids[i] = -1;
+    for (i = 0; i < join->left_len; i++) {
+        root = join_find(join->parents, i);
+        if (ids[root] < 0) ids[root] = n++;
+        rb_ary_push(join->result, LONG2NUM(ids[root]));
+    }
+    return join->result;
 }
 
-DEF_CONSTRUCTOR(Jaro, Jaro)
+static VALUE join_run(VALUE data)
+{
+    Join *join = (Join *) data;
+    long i = 0, start, count, n;
+
+    while (i < join->left_len) {
+        for (start = i, n = 0; i < join->left_len && n < JOIN_BATCH &&
+                i - start < JOIN_MATCHERS; i++) {
+            count = join_candidates(&join->index, i, join->ptrs[i],
+                join->lens[i], join->keys ? join->keys[i] : 0,
+                join->candidates);
+            if (join->parents) count = join_filter(join, i, count);
+            if (count == 0) continue;
+            join_compile(join, (int) (i - start), i);
+            join_prepare(join, (int) (i - start), i, count, n);
+            n += count;
+        }
+        if (compare_batch(join->cmps, n, Qnil, &join_stats, &join->busy,
+                    &join->workspace) != 0) {
+            rb_memerror();
+        }
+        join_collect(join, n);
+        join_release(join);
+    }
+    return join->parents ? join_clusters(join) : join->result;
+}
+
+static VALUE join_finish(VALUE data)
+{
+    Join *join = (Join *) data;
+
+    join_release(join);
+    join_index_destroy(&join->index);
+    workspace_release(&join->workspace);
+    xfree(join->copy);
+    xfree(join->ptrs);
+    xfree(join->lens);
+    xfree(join->candidates);
+    xfree(join->generals);
+    xfree(join->jaros);
+    xfree(join->jaro_winklers);
+    xfree(join->cmps);
+    xfree(join->lefts);
+    xfree(join->rights);
+    xfree(join->parents);
+    xfree(join->keys);
+    return Qnil;
+}
+
+static VALUE join_option(VALUE options, const char *name)
+{
+    return NIL_P(options) ? Qnil :
+        rb_hash_aref(options, ID2SYM(rb_intern(name)));
+}
 
 /*
- * call-seq: match(strings) -> results
- *
- * Uses this Amatch::Jaro instance to match
- * Jaro#pattern against <code>strings</code>, that is compute the
- * jaro metric with the strings. <code>strings</code> has to be
- * either a String or an Array of Strings. The returned <code>results</code>
- * are either a Float or an Array of Floats respectively.
+ * Reads the metric and its parameters from options.
  */
-static VALUE rb_Jaro_match(VALUE self, VALUE strings)
+static void join_init(Join *join, VALUE options)
 {
-    GET_STRUCT(Jaro)
-    return Jaro_iterate_strings(amatch, strings, Jaro_match);
+    VALUE value;
+
+    if (!NIL_P(options)) Check_Type(options, T_HASH);
+    MEMZERO(join, Join, 1);
+    join->metric = join_option(options, "metric");
+    if (NIL_P(join->metric)) join->metric = rb_cLevenshtein;
+    if (join->metric != rb_cLevenshtein && join->metric != rb_cJaro &&
+            join->metric != rb_cJaroWinkler) {
+        rb_raise(rb_eArgError, "metric has to be Amatch::Levenshtein, "
+            "Amatch::Jaro or Amatch::JaroWinkler");
+    }
+    value = join_option(options, "threshold");
+    if (NIL_P(value)) rb_raise(rb_eArgError, "threshold is required");
+    CAST2FLOAT(value);
+    join->threshold = FLOAT2C(value);
+    value = join_option(options, "ignore_case");
+    join->ignore_case = NIL_P(value) || RTEST(value);
+    value = join_option(options, "scaling_factor");
+    join->scaling_factor = 0.1f;
+    if (!NIL_P(value)) {
+        CAST2FLOAT(value);
+        if (FLOAT2C(value) < 0) {
+            rb_raise(rb_eArgError, "scaling_factor has to be >= 0");
+        }
+        join->scaling_factor = (float) FLOAT2C(value);
+    }
+    join->result = rb_ary_new();
 }
 
 /*
- * call-seq: jaro_similar(strings) -> results
- *
- * If called on a String, this string is used as a
- * Amatch::Jaro#pattern to match against <code>strings</code>. It
- * returns a Jaro metric number between 0.0 for very
- * unsimilar strings and 1.0 for an exact match. <code>strings</code> has to be
- * either a String or an Array of Strings. The returned <code>results</code>
- * are either a Float or an Array of Floats respectively.
+ * Allocates the matchers and comparisons, and indexes the right strings,
+ * after they were copied.
  */
-static VALUE rb_str_jaro_similar(VALUE self, VALUE strings)
+static void join_build(Join *join)
 {
-    VALUE amatch = rb_Jaro_new(rb_cJaro, self);
-    return rb_Jaro_match(amatch, strings);
+    double jaro;
+    long i, max_len = 0;
+
+    join->candidates = ALLOC_N(long, join->right_len > 0 ?
+        join->right_len : 1);
+    join->cmps_size = JOIN_BATCH;
+    join->cmps = ALLOC_N(Comparison, join->cmps_size);
+    join->lefts = ALLOC_N(long, join->cmps_size);
+    join->rights = ALLOC_N(long, join->cmps_size);
+    if (join->metric == rb_cLevenshtein) {
+        /* no distance exceeds the sum of the longest lengths */
+        for (i = 0; i < join->left_len; i++) {
+            if (join->lens[i] > max_len) max_len = join->lens[i];
+        }
+        for (i = 0; i < join->right_len; i++) {
+            if (join->right_lens[i] > max_len) max_len = join->right_lens[i];
+        }
+        join->k = BOUND2INT(join->threshold < 2.0 * max_len ?
+            join->threshold : 2.0 * max_len);
+        join->generals = ALLOC_N(General, JOIN_MATCHERS);
+        MEMZERO(join->generals, General, JOIN_MATCHERS);
+        join_index_segments(&join->index, join->right_ptrs, join->right_lens,
+            join->keys, join->right_len, join->k);
+    } else {
+        /*
+         * A prefix of n <= 4 common characters raises the Jaro similarity j
+         * to j + n p (1 - j), so JaroWinkler needs j >= (t - 4 p) / (1 - 4 p)
+         * for the threshold t, and can't be filtered for p >= 0.25.
+         */
+        jaro = join->threshold;
+        if (join->metric == rb_cJaro) {
+            join->jaros = ALLOC_N(Jaro, JOIN_MATCHERS);
+            MEMZERO(join->jaros, Jaro, JOIN_MATCHERS);
+        } else {
+            join->jaro_winklers = ALLOC_N(JaroWinkler, JOIN_MATCHERS);
+            MEMZERO(join->jaro_winklers, JaroWinkler, JOIN_MATCHERS);
+            jaro = 4 * join->scaling_factor < 1 ?
+                (jaro - 4 * join->scaling_factor) /
+                    (1 - 4 * join->scaling_factor) : 0.0;
+        }
+        join_index_tokens(&join->index, join->right_ptrs, join->right_lens,
+            join->keys, join->right_len, jaro - 1e-9, join->ignore_case);
+    }
 }
 
 /*
- * Document-class: Amatch::JaroWinkler
+ * call-seq: Amatch.join(left, right, options) -> results
  *
- * This class computes the Jaro-Winkler metric for two strings.
- * The Jaro-Winkler metric computes the similarity between 0 (no match)
- * and 1 (exact match) by looking for matching and transposed characters.
+ * Returns all pairs of a string of the Array <code>left</code> and a string
+ * of the Array <code>right</code>, that are similar according to the
+ * Hash <code>options</code>:
  *
- * It is a variant of the Jaro metric, with additional weighting towards
- * common prefixes.
+ * <code>:metric</code>:: Amatch::Levenshtein (the default), Amatch::Jaro
+ *                        or Amatch::JaroWinkler
+ * <code>:threshold</code>:: the maximum edit distance, or the minimum
+ *                           similarity (required)
+ * <code>:ignore_case</code>:: whether Amatch::Jaro and Amatch::JaroWinkler
+ *                             ignore case (true by default)
+ * <code>:scaling_factor</code>:: of Amatch::JaroWinkler (0.1 by default)
+ *
+ * The pairs are returned as <code>[left_index, right_index, score]</code>
+ * triples, sorted by both indexes, the score being the distance or the
+ * similarity. Instead of comparing all pairs, only the candidates are
+ * compared, that can't be ruled out by their lengths, and by what they have
+ * in common: for edit distances, one of the <code>threshold + 1</code>
+ * segments of the right string has to occur in the left string, and for
+ * Jaro similarities, enough of the rarest characters of both strings. The
+ * candidates are compared by Amatch.threads native threads.
+ *
+ *  Amatch.join(%w[kitten sitting], %w[mitten fitting bitten],
+ *    :threshold => 1)
+ *  # => [[0, 0, 1], [0, 2, 1], [1, 1, 1]]
  */
-DEF_RB_FREE(JaroWinkler, JaroWinkler)
+static VALUE rb_Amatch_join(int argc, VALUE *argv, VALUE self)
+{
+    VALUE left, right, options = Qnil;
+    Join join;
+
+    rb_scan_args(argc, argv, "21", &left, &right, &options);
+    check_strings(left);
+    check_strings(right);
+    join_init(&join, options);
+    if (join.metric == rb_cLevenshtein && join.threshold < 0) {
+        return join.result;
+    }
+    join.left_len = RARRAY(left)->len;
+    join.right_len = RARRAY(right)->len;
+    join_copy(&join, left, right);
+    join_build(&join);
+    return rb_ensure(join_run, (VALUE) &join, join_finish, (VALUE) &join);
+}
 
 /*
- * Document-method: ignore_case
+ * call-seq: Amatch.cluster(strings, options) -> ids
  *
- * call-seq: ignore_case -> true/false
+ * Groups the Array <code>strings</code> into clusters of near-duplicates,
+ * and returns the number of the cluster of every string, the clusters being
+ * numbered in the order of their first strings. Two strings are in the same
+ * cluster, if they are similar according to <code>options</code>, as for
+ * Amatch.join, or if both are similar to strings of the same cluster
+ * (single linkage). If the option <code>:keys</code> is an Array of
+ * blocking keys, one for every string, only strings with equal keys are
+ * compared.
  *
- * Returns whether case is ignored when computing matching characters.
- * Default is true.
+ * Every pair of strings is considered once, if it's a candidate (see
+ * Amatch.join), and isn't in the same cluster already. The candidates are
+ * compared by Amatch.threads native threads.
+ *
+ *  Amatch.cluster(%w[Martha Marhta Dwayne Duane Martha], :metric =>
+ *    Amatch::JaroWinkler, :threshold => 0.9)
+ *  # => [0, 0, 1, 2, 0]
  */
-DEF_RB_READER(JaroWinkler, rb_JaroWinkler_ignore_case, ignore_case, C2BOOL)
+static VALUE rb_Amatch_cluster(int argc, VALUE *argv, VALUE self)
+{
+    VALUE strings, options = Qnil, keys, numbers, number, ids = Qnil;
+    Join join;
+    long i;
+
+    rb_scan_args(argc, argv, "11", &strings, &options);
+    check_strings(strings);
+    join_init(&join, options);
+    join.left_len = join.right_len = RARRAY(strings)->len;
+    keys = join_option(options, "keys");
+    if (!NIL_P(keys)) {
+        Check_Type(keys, T_ARRAY);
+        if (RARRAY(keys)->len != join.left_len) {
+            rb_raise(rb_eArgError, "keys have to be as many as the strings");
+        }
+        numbers = rb_hash_new();
+        ids = rb_ary_new2(join.left_len);
+        for (i = 0; i < join.left_len; i++) {
+            number = rb_hash_aref(numbers, rb_ary_entry(keys, i));
+            if (NIL_P(number)) {
+                number = LONG2NUM(RARRAY(ids)->len);
+                rb_hash_aset(numbers, rb_ary_entry(keys, i), number);
+            }
+            rb_ary_push(ids, number);
+        }
+    }
+    if (join.metric == rb_cLevenshtein && join.threshold < 0) {
+        for (i = 0; i < join.left_len; i++) {
+            rb_ary_push(join.result, LONG2NUM(i));
+        }
+        return join.result;
+    }
+    join.parents = ALLOC_N(long, join.left_len > 0 ? join.left_len : 1);
+    for (i = 0; i < join.left_len; i++) join.parents[i] = i;
+    if (!NIL_P(ids)) {
+        join.keys = ALLOC_N(long, join.left_len > 0 ? join.left_len : 1);
+        for (i = 0; i < join.left_len; i++) {
+            join.keys[i] = NUM2LONG(rb_ary_entry(ids, i));
+        }
+    }
+    join_copy(&join, strings, Qnil);
+    join_build(&join);
+    return rb_ensure(join_run, (VALUE) &join, join_finish, (VALUE) &join);
+}
 
 /*
- * Document-method: scaling_factor
- *
- * call-seq: scaling_factor -> weight
+ * call-seq: Amatch.threads -> number
  *
- * The scaling factor is how much weight to give common prefixes.
- * Default is 0.1.
+ * Returns the number of native threads used to match a pattern against an
+ * Array of strings.
  */
-DEF_RB_READER(JaroWinkler, rb_JaroWinkler_scaling_factor, scaling_factor, rb_float_new)
+static VALUE rb_Amatch_threads(VALUE self)
+{
+    return INT2FIX(amatch_threads);
+}
 
 /*
- * Document-method: ignore_case=
- *
- * call-seq: ignore_case=(true/false)
+ * call-seq: Amatch.threads = number
  *
- * Sets whether case is ignored when computing matching characters.
+ * Sets the number of native threads used to match a pattern against an
+ * Array of strings to <code>number</code> (1 by default). If the Array is
+ * large enough, it is split among that many threads, which run without
+ * holding the global interpreter lock, while the strings are compared with
+ * the pattern. The results are the same for every number of threads. If
+ * the calling thread is interrupted meanwhile, they stop after the strings
+ * they're comparing.
  */
-DEF_RB_WRITER(JaroWinkler, rb_JaroWinkler_ignore_case_set, ignore_case,
-    int, CAST2BOOL, BOOL2C, != Qundef)
+static VALUE rb_Amatch_threads_set(VALUE self, VALUE threads)
+{
+    int value = NUM2INT(threads);
+    if (value < 1) {
+        rb_raise(rb_eArgError, "number of threads has to be >= 1");
+    }
+    amatch_threads = value;
+    return threads;
+}
 
 /*
- * Document-method: scaling_factor=
+ * call-seq: Amatch.collect_stats -> true/false
  *
- * call-seq: scaling_factor=(weight)
- *
- * Sets the weight to give common prefixes.
+ * Returns whether the calls of the matchers are counted and timed, see
+ * Amatch.stats. They aren't by default.
  */
-DEF_RB_WRITER(JaroWinkler, rb_JaroWinkler_scaling_factor_set, scaling_factor,
-    double, CAST2FLOAT, FLOAT2C, >= 0)
+static VALUE rb_Amatch_collect_stats(VALUE self)
+{
+    return C2BOOL(stats_enabled);
+}
 
 /*
- * call-seq: new(pattern)
+ * call-seq: Amatch.collect_stats = true/false
  *
- * Creates a new Amatch::JaroWinkler instance from <code>pattern</code>.
+ * Turns the statistics of the calls of the matchers on or off, see
+ * Amatch.stats. While they are off, the matchers only pay for a check of
+ * this flag.
  */
-static VALUE rb_JaroWinkler_initialize(VALUE self, VALUE pattern)
+static VALUE rb_Amatch_collect_stats_set(VALUE self, VALUE value)
 {
-    GET_STRUCT(JaroWinkler)
-    JaroWinkler_pattern_set(amatch, pattern);
-    amatch->ignore_case = 1;
-    amatch->scaling_factor = 0.1;
-    return self;
+    CAST2BOOL(value);
+    stats_enabled = BOOL2C(value);
+    return value;
 }
 
-DEF_CONSTRUCTOR(JaroWinkler, JaroWinkler)
-
 /*
- * call-seq: match(strings) -> results
+ * call-seq: Amatch.stats -> hash
  *
- * Uses this Amatch::Jaro instance to match
- * Jaro#pattern against <code>strings</code>, that is compute the
- * jaro metric with the strings. <code>strings</code> has to be
- * either a String or an Array of Strings. The returned <code>results</code>
- * are either a Float or an Array of Floats respectively.
+ * Returns the statistics of the calls of all matchers, that were made while
+ * Amatch.collect_stats was on, as a Hash from the classes to Hashes from the
+ * names of their methods to Hashes with these counters:
+ *
+ * <code>:calls</code>:: how often the kernels were entered, once for all
+ *                       strings of an Array
+ * <code>:comparisons</code>:: the number of strings compared or texts
+ *                             searched
+ * <code>:max_batch</code>:: the most of them in one call
+ * <code>:cells</code>:: the estimated number of steps (DP cells, bit vector
+ *                       words or characters), that were computed
+ * <code>:bytes</code>:: the length of the strings or texts
+ * <code>:seconds</code>:: the time spent in the calls
+ * <code>:histogram</code>:: the latencies of the calls, as an Array of
+ *                           <code>[seconds, count]</code> pairs: count
+ *                           calls took less than seconds, but more than
+ *                           those of the previous pair. The bounds are
+ *                           within 12.5% of each other.
+ *
+ * Strings rejected without running a kernel, e. g. by
+ * Amatch::Levenshtein#select, aren't counted. Independent of this, there
+ * are the USDT probes amatch:kernel__entry and amatch:kernel__return, if
+ * the extension was built with sys/sdt.h.
+ *
+ *  Amatch.collect_stats = true
+ *  Amatch::Levenshtein.new('test').search_all('a tst, a test', 1)
+ *  Amatch.stats[Amatch::Levenshtein][:search_all][:bytes]
+ *  # => 13
  */
-static VALUE rb_JaroWinkler_match(VALUE self, VALUE strings)
+static VALUE rb_Amatch_stats(VALUE self)
 {
-    GET_STRUCT(JaroWinkler)
-    return JaroWinkler_iterate_strings(amatch, strings, JaroWinkler_match);
+    Stats *stats = stats_global();
+    StatsEntry *e;
+    VALUE hash = rb_hash_new(), klass, methods;
+    int i;
+
+    for (i = 0; i < stats->len; i++) {
+        e = stats->entries + i;
+        klass = strcmp(e->class_name, "Amatch") == 0 ? rb_mAmatch :
+            rb_const_get(rb_mAmatch, rb_intern(e->class_name));
+        methods = rb_hash_aref(hash, klass);
+        if (NIL_P(methods)) {
+            methods = rb_hash_new();
+            rb_hash_aset(hash, klass, methods);
+        }
+        rb_hash_aset(methods, ID2SYM(e->method), stats_entry_hash(e));
+    }
+    return hash;
 }
 
 /*
- * call-seq: jarowinkler_similar(strings) -> results
+ * call-seq: Amatch.reset_stats
  *
- * If called on a String, this string is used as a
- * Amatch::JaroWinkler#pattern to match against <code>strings</code>. It
- * returns a Jaro-Winkler metric number between 0.0 for very
- * unsimilar strings and 1.0 for an exact match. <code>strings</code> has to be
- * either a String or an Array of Strings. The returned <code>results</code>
- * are either a Float or an Array of Floats respectively.
+ * Forgets the statistics of all matchers collected so far, see
+ * Amatch.stats, but not those of the instances.
  */
-static VALUE rb_str_jarowinkler_similar(VALUE self, VALUE strings)
+static VALUE rb_Amatch_reset_stats(VALUE self)
 {
-    VALUE amatch = rb_JaroWinkler_new(rb_cJaro, self);
-    return rb_JaroWinkler_match(amatch, strings);
+    stats_release(stats_global());
+    return Qnil;
 }
 
 /*
@@ -1657,6 +6150,14 @@ static VALUE rb_str_jarowinkler_similar(VALUE self, VALUE strings)
 void Init_amatch()
 {
     rb_mAmatch = rb_define_module("Amatch");
+    rb_define_module_function(rb_mAmatch, "threads", rb_Amatch_threads, 0);
+    rb_define_module_function(rb_mAmatch, "threads=", rb_Amatch_threads_set, 1);
+    rb_define_module_function(rb_mAmatch, "collect_stats", rb_Amatch_collect_stats, 0);
+    rb_define_module_function(rb_mAmatch, "collect_stats=", rb_Amatch_collect_stats_set, 1);
+    rb_define_module_function(rb_mAmatch, "stats", rb_Amatch_stats, 0);
+    rb_define_module_function(rb_mAmatch, "reset_stats", rb_Amatch_reset_stats, 0);
+    rb_define_module_function(rb_mAmatch, "join", rb_Amatch_join, -1);
+    rb_define_module_function(rb_mAmatch, "cluster", rb_Amatch_cluster, -1);
 
     /* Levenshtein */
     rb_cLevenshtein = rb_define_class_under(rb_mAmatch, "Levenshtein", rb_cObject);
@@ -1664,9 +6165,20 @@ void Init_amatch()
     rb_define_method(rb_cLevenshtein, "initialize", rb_Levenshtein_initialize, 1);
     rb_define_method(rb_cLevenshtein, "pattern", rb_General_pattern, 0);
     rb_define_method(rb_cLevenshtein, "pattern=", rb_General_pattern_set, 1);
-    rb_define_method(rb_cLevenshtein, "match", rb_Levenshtein_match, 1);
-    rb_define_method(rb_cLevenshtein, "search", rb_Levenshtein_search, 1);
+    rb_define_method(rb_cLevenshtein, "stats", rb_General_stats, 0);
+    rb_define_method(rb_cLevenshtein, "reset_stats", rb_General_reset_stats, 0);
+    rb_define_method(rb_cLevenshtein, "codepoints", rb_General_codepoints, 0);
+    rb_define_method(rb_cLevenshtein, "codepoints=", rb_General_codepoints_set, 1);
+    rb_define_method(rb_cLevenshtein, "match", rb_Levenshtein_match, -1);
+    rb_define_method(rb_cLevenshtein, "search", rb_Levenshtein_search, -1);
+    rb_define_method(rb_cLevenshtein, "search_all", rb_Levenshtein_search_all, 2);
+    rb_define_method(rb_cLevenshtein, "search_io", rb_Levenshtein_search_io, 2);
+    rb_define_method(rb_cLevenshtein, "alignment", rb_Levenshtein_alignment, 1);
     rb_define_method(rb_cLevenshtein, "similar", rb_Levenshtein_similar, 1);
+    rb_define_method(rb_cLevenshtein, "best", rb_Levenshtein_best, 2);
+    rb_define_method(rb_cLevenshtein, "select", rb_Levenshtein_select, 2);
+    rb_define_method(rb_cLevenshtein, "rejected", rb_General_rejected, 0);
+    rb_define_method(rb_cLevenshtein, "grep_file", rb_Levenshtein_grep_file, 2);
     rb_define_method(rb_cString, "levenshtein_similar", rb_str_levenshtein_similar, 1);
 
     /* Sellers */
@@ -1675,6 +6187,10 @@ void Init_amatch()
     rb_define_method(rb_cSellers, "initialize", rb_Sellers_initialize, 1);
     rb_define_method(rb_cSellers, "pattern", rb_Sellers_pattern, 0);
     rb_define_method(rb_cSellers, "pattern=", rb_Sellers_pattern_set, 1);
+    rb_define_method(rb_cSellers, "stats", rb_Sellers_stats, 0);
+    rb_define_method(rb_cSellers, "reset_stats", rb_Sellers_reset_stats, 0);
+    rb_define_method(rb_cSellers, "codepoints", rb_Sellers_codepoints, 0);
+    rb_define_method(rb_cSellers, "codepoints=", rb_Sellers_codepoints_set, 1);
     rb_define_method(rb_cSellers, "substitution", rb_Sellers_substitution, 0);
     rb_define_method(rb_cSellers, "substitution=", rb_Sellers_substitution_set, 1);
     rb_define_method(rb_cSellers, "deletion", rb_Sellers_deletion, 0);
@@ -1682,9 +6198,15 @@ void Init_amatch()
     rb_define_method(rb_cSellers, "insertion", rb_Sellers_insertion, 0);
     rb_define_method(rb_cSellers, "insertion=", rb_Sellers_insertion_set, 1);
     rb_define_method(rb_cSellers, "reset_weights", rb_Sellers_reset_weights, 0);
-    rb_define_method(rb_cSellers, "match", rb_Sellers_match, 1);
-    rb_define_method(rb_cSellers, "search", rb_Sellers_search, 1);
+    rb_define_method(rb_cSellers, "match", rb_Sellers_match, -1);
+    rb_define_method(rb_cSellers, "search", rb_Sellers_search, -1);
+    rb_define_method(rb_cSellers, "search_all", rb_Sellers_search_all, 2);
+    rb_define_method(rb_cSellers, "search_io", rb_Sellers_search_io, 2);
+    rb_define_method(rb_cSellers, "alignment", rb_Sellers_alignment, 1);
     rb_define_method(rb_cSellers, "similar", rb_Sellers_similar, 1);
+    rb_define_method(rb_cSellers, "best", rb_Sellers_best, 2);
+    rb_define_method(rb_cSellers, "select", rb_Sellers_select, 2);
+    rb_define_method(rb_cSellers, "rejected", rb_Sellers_rejected, 0);
 
     /* Hamming */
     rb_cHamming = rb_define_class_under(rb_mAmatch, "Hamming", rb_cObject);
@@ -1692,6 +6214,10 @@ void Init_amatch()
     rb_define_method(rb_cHamming, "initialize", rb_Hamming_initialize, 1);
     rb_define_method(rb_cHamming, "pattern", rb_General_pattern, 0);
     rb_define_method(rb_cHamming, "pattern=", rb_General_pattern_set, 1);
+    rb_define_method(rb_cHamming, "stats", rb_General_stats, 0);
+    rb_define_method(rb_cHamming, "reset_stats", rb_General_reset_stats, 0);
+    rb_define_method(rb_cHamming, "codepoints", rb_General_codepoints, 0);
+    rb_define_method(rb_cHamming, "codepoints=", rb_General_codepoints_set, 1);
     rb_define_method(rb_cHamming, "match", rb_Hamming_match, 1);
     rb_define_method(rb_cHamming, "similar", rb_Hamming_similar, 1);
     rb_define_method(rb_cString, "hamming_similar", rb_str_hamming_similar, 1);
@@ -1702,8 +6228,11 @@ void Init_amatch()
     rb_define_method(rb_cPairDistance, "initialize", rb_PairDistance_initialize, 1);
     rb_define_method(rb_cPairDistance, "pattern", rb_PairDistance_pattern, 0);
     rb_define_method(rb_cPairDistance, "pattern=", rb_PairDistance_pattern_set, 1);
+    rb_define_method(rb_cPairDistance, "stats", rb_PairDistance_stats, 0);
+    rb_define_method(rb_cPairDistance, "reset_stats", rb_PairDistance_reset_stats, 0);
     rb_define_method(rb_cPairDistance, "match", rb_PairDistance_match, -1);
     rb_define_alias(rb_cPairDistance, "similar", "match");
+    rb_define_method(rb_cPairDistance, "best", rb_PairDistance_best, -1);
     rb_define_method(rb_cString, "pair_distance_similar", rb_str_pair_distance_similar, 1);
 
     /* Longest Common Subsequence */
@@ -1712,6 +6241,10 @@ void Init_amatch()
     rb_define_method(rb_cLongestSubsequence, "initialize", rb_LongestSubsequence_initialize, 1);
     rb_define_method(rb_cLongestSubsequence, "pattern", rb_General_pattern, 0);
     rb_define_method(rb_cLongestSubsequence, "pattern=", rb_General_pattern_set, 1);
+    rb_define_method(rb_cLongestSubsequence, "stats", rb_General_stats, 0);
+    rb_define_method(rb_cLongestSubsequence, "reset_stats", rb_General_reset_stats, 0);
+    rb_define_method(rb_cLongestSubsequence, "codepoints", rb_General_codepoints, 0);
+    rb_define_method(rb_cLongestSubsequence, "codepoints=", rb_General_codepoints_set, 1);
     rb_define_method(rb_cLongestSubsequence, "match", rb_LongestSubsequence_match, 1);
     rb_define_method(rb_cLongestSubsequence, "similar", rb_LongestSubsequence_similar, 1);
     rb_define_method(rb_cString, "longest_subsequence_similar", rb_str_longest_subsequence_similar, 1);
@@ -1720,9 +6253,14 @@ void Init_amatch()
     rb_cLongestSubstring = rb_define_class_under(rb_mAmatch, "LongestSubstring", rb_cObject);
     rb_define_alloc_func(rb_cLongestSubstring, rb_LongestSubstring_s_allocate);
     rb_define_method(rb_cLongestSubstring, "initialize", rb_LongestSubstring_initialize, 1);
-    rb_define_method(rb_cLongestSubstring, "pattern", rb_General_pattern, 0);
-    rb_define_method(rb_cLongestSubstring, "pattern=", rb_General_pattern_set, 1);
+    rb_define_method(rb_cLongestSubstring, "pattern", rb_LongestSubstring_pattern, 0);
+    rb_define_method(rb_cLongestSubstring, "pattern=", rb_LongestSubstring_pattern_set, 1);
+    rb_define_method(rb_cLongestSubstring, "stats", rb_LongestSubstring_stats, 0);
+    rb_define_method(rb_cLongestSubstring, "reset_stats", rb_LongestSubstring_reset_stats, 0);
+    rb_define_method(rb_cLongestSubstring, "codepoints", rb_LongestSubstring_codepoints, 0);
+    rb_define_method(rb_cLongestSubstring, "codepoints=", rb_LongestSubstring_codepoints_set, 1);
     rb_define_method(rb_cLongestSubstring, "match", rb_LongestSubstring_match, 1);
+    rb_define_method(rb_cLongestSubstring, "locate", rb_LongestSubstring_locate, 1);
     rb_define_method(rb_cLongestSubstring, "similar", rb_LongestSubstring_similar, 1);
     rb_define_method(rb_cString, "longest_substring_similar", rb_str_longest_substring_similar, 1);
 
@@ -1732,9 +6270,15 @@ void Init_amatch()
     rb_define_method(rb_cJaro, "initialize", rb_Jaro_initialize, 1);
     rb_define_method(rb_cJaro, "pattern", rb_Jaro_pattern, 0);
     rb_define_method(rb_cJaro, "pattern=", rb_Jaro_pattern_set, 1);
+    rb_define_method(rb_cJaro, "stats", rb_Jaro_stats, 0);
+    rb_define_method(rb_cJaro, "reset_stats", rb_Jaro_reset_stats, 0);
+    rb_define_method(rb_cJaro, "codepoints", rb_Jaro_codepoints, 0);
+    rb_define_method(rb_cJaro, "codepoints=", rb_Jaro_codepoints_set, 1);
     rb_define_method(rb_cJaro, "ignore_case", rb_Jaro_ignore_case, 0);
     rb_define_method(rb_cJaro, "ignore_case=", rb_Jaro_ignore_case_set, 1);
     rb_define_method(rb_cJaro, "match", rb_Jaro_match, 1);
+    rb_define_method(rb_cJaro, "select", rb_Jaro_select, 2);
+    rb_define_method(rb_cJaro, "rejected", rb_Jaro_rejected, 0);
     rb_define_alias(rb_cJaro, "similar", "match");
     rb_define_method(rb_cString, "jaro_similar", rb_str_jaro_similar, 1);
 
@@ -1744,15 +6288,73 @@ void Init_amatch()
     rb_define_method(rb_cJaroWinkler, "initialize", rb_JaroWinkler_initialize, 1);
     rb_define_method(rb_cJaroWinkler, "pattern", rb_JaroWinkler_pattern, 0);
     rb_define_method(rb_cJaroWinkler, "pattern=", rb_JaroWinkler_pattern_set, 1);
+    rb_define_method(rb_cJaroWinkler, "stats", rb_JaroWinkler_stats, 0);
+    rb_define_method(rb_cJaroWinkler, "reset_stats", rb_JaroWinkler_reset_stats, 0);
+    rb_define_method(rb_cJaroWinkler, "codepoints", rb_JaroWinkler_codepoints, 0);
+    rb_define_method(rb_cJaroWinkler, "codepoints=", rb_JaroWinkler_codepoints_set, 1);
     rb_define_method(rb_cJaroWinkler, "ignore_case", rb_JaroWinkler_ignore_case, 0);
     rb_define_method(rb_cJaroWinkler, "ignore_case=", rb_JaroWinkler_ignore_case_set, 1);
     rb_define_method(rb_cJaroWinkler, "scaling_factor", rb_JaroWinkler_scaling_factor, 0);
     rb_define_method(rb_cJaroWinkler, "scaling_factor=", rb_JaroWinkler_scaling_factor_set, 1);
     rb_define_method(rb_cJaroWinkler, "match", rb_JaroWinkler_match, 1);
     rb_define_alias(rb_cJaroWinkler, "similar", "match");
+    rb_define_method(rb_cJaroWinkler, "best", rb_JaroWinkler_best, 2);
+    rb_define_method(rb_cJaroWinkler, "select", rb_JaroWinkler_select, 2);
+    rb_define_method(rb_cJaroWinkler, "rejected", rb_JaroWinkler_rejected, 0);
     rb_define_method(rb_cString, "jarowinkler_similar", rb_str_jarowinkler_similar, 1);
 
+    /* Bitap */
+    rb_cBitap = rb_define_class_under(rb_mAmatch, "Bitap", rb_cObject);
+    rb_define_alloc_func(rb_cBitap, rb_Bitap_s_allocate);
+    rb_define_method(rb_cBitap, "initialize", rb_Bitap_initialize, 1);
+    rb_define_method(rb_cBitap, "pattern", rb_Bitap_pattern, 0);
+    rb_define_method(rb_cBitap, "pattern=", rb_Bitap_pattern_set, 1);
+    rb_define_method(rb_cBitap, "stats", rb_Bitap_stats, 0);
+    rb_define_method(rb_cBitap, "reset_stats", rb_Bitap_reset_stats, 0);
+    rb_define_method(rb_cBitap, "ignore_case", rb_Bitap_ignore_case, 0);
+    rb_define_method(rb_cBitap, "ignore_case=", rb_Bitap_ignore_case_set, 1);
+    rb_define_method(rb_cBitap, "search", rb_Bitap_search, -1);
+    rb_define_method(rb_cBitap, "search_all", rb_Bitap_search_all, -1);
+
+    /* Pattern set */
+    rb_cPatternSet = rb_define_class_under(rb_mAmatch, "PatternSet", rb_cObject);
+    rb_define_alloc_func(rb_cPatternSet, rb_PatternSet_s_allocate);
+    rb_define_method(rb_cPatternSet, "initialize", rb_PatternSet_initialize, 2);
+    rb_define_method(rb_cPatternSet, "search", rb_PatternSet_search, 1);
+    rb_define_method(rb_cPatternSet, "size", rb_PatternSet_size, 0);
+    rb_define_method(rb_cPatternSet, "max_distance", rb_PatternSet_max_distance, 0);
+
+    /* BK-tree */
+    rb_cBKTree = rb_define_class_under(rb_mAmatch, "BKTree", rb_cObject);
+    rb_define_alloc_func(rb_cBKTree, rb_BKTree_s_allocate);
+    rb_define_method(rb_cBKTree, "initialize", rb_BKTree_initialize, -1);
+    rb_define_method(rb_cBKTree, "search", rb_BKTree_search, 2);
+    rb_define_method(rb_cBKTree, "nearest", rb_BKTree_nearest, 1);
+    rb_define_method(rb_cBKTree, "visited", rb_BKTree_visited, 0);
+    rb_define_method(rb_cBKTree, "size", rb_BKTree_size, 0);
+    rb_define_method(rb_cBKTree, "metric", rb_BKTree_metric, 0);
+
+    rb_cQGramIndex = rb_define_class_under(rb_mAmatch, "QGramIndex",
+        rb_cObject);
+    rb_define_alloc_func(rb_cQGramIndex, rb_QGramIndex_s_allocate);
+    rb_define_method(rb_cQGramIndex, "initialize", rb_QGramIndex_initialize,
+        -1);
+    rb_define_method(rb_cQGramIndex, "search", rb_QGramIndex_search, 2);
+    rb_define_method(rb_cQGramIndex, "candidates", rb_QGramIndex_candidates,
+        0);
+    rb_define_method(rb_cQGramIndex, "size", rb_QGramIndex_size, 0);
+    rb_define_method(rb_cQGramIndex, "q", rb_QGramIndex_q, 0);
+    rb_define_method(rb_cQGramIndex, "stats", rb_QGramIndexObject_stats, 0);
+    rb_define_method(rb_cQGramIndex, "reset_stats",
+        rb_QGramIndexObject_reset_stats, 0);
+
+    hamming_init();
     id_split = rb_intern("split");
     id_to_f = rb_intern("to_f");
+    id_match = rb_intern("match");
+    id_substitute = rb_intern("substitute");
+    id_insert = rb_intern("insert");
+    id_delete = rb_intern("delete");
+    id_read = rb_intern("read");
 }
     /* vim: set et cin sw=4 ts=4: */
@@ -0,0 +1,146 @@
+#include "bitap.h"
+#include <ctype.h>
+#include <string.h>
+
+/*
+ * Approximate search with the shift-and algorithm for k differences, after
+ * S. Wu and U. Manber, "Fast text searching allowing errors" (1992). Bit i
+ * of the state vector for d differences is set, if the first i + 1 pattern
+ * positions match a suffix of the text read so far with at most d
+ * insertions, deletions and substitutions. Every pattern position is a set
+ * of characters, so classes and wildcards cost nothing while scanning.
+ */
+
+/*
+ * Pattern syntax: [...] is a class of characters, with ranges like a-z and
+ * negated by a leading ^; a ] right after [ or [^ is part of the class. A .
+ * matches any character, and a backslash makes the next character match
+ * itself. If ignore_case is true, the other case of every letter in a
+ * position matches as well. Returns 0, or BITAP_UNTERMINATED_CLASS or
+ * BITAP_TOO_LONG.
+ */
+int bitap_mask_compile(BitapMask *self, const char *pattern, int len,
+    int ignore_case)
+{
+    unsigned char set[256], *p = (unsigned char *) pattern,
+        *end = p + len;
+    int c, to, first, negate, i = 0;
+
+    MEMZERO(self->masks, uint64_t, 256);
+    while (p < end) {
+        if (i == BITAP_MAX_LEN) return BITAP_TOO_LONG;
+        MEMZERO(set, unsigned char, 256);
+        negate = 0;
+        if (*p == '.') {
+            memset(set, 1, 256);
+            p++;
+        } else if (*p == '[') {
+            p++;
+            negate = p < end && *p == '^';
+            if (negate) p++;
+            for (first = 1; p < end && (*p != ']' || first); first = 0) {
+                if (*p == '\\' && p + 1 < end) p++;
+                c = *p++;
+                to = c;
+                if (p + 1 < end && *p == '-' && p[1] != ']') {
+                    p++;
+                    if (*p == '\\' && p + 1 < end) p++;
+                    to = *p++;
+                }
+                for (; c <= to; c++) set[c] = 1;
+            }
+            if (p == end) return BITAP_UNTERMINATED_CLASS;
+            p++;
+        } else {
+            if (*p == '\\' && p + 1 < end) p++;
+            set[*p++] = 1;
+        }
+        for (c = 0; ignore_case && c < 256; c++) {
+            if (set[c]) set[toupper(c) & 0xff] = set[tolower(c) & 0xff] = 1;
+        }
+        for (c = 0; c < 256; c++) {
+            if (negate) set[c] = !set[c];
+            if (set[c]) self->masks[c] |= (uint64_t) 1 << i;
+        }
+        i++;
+    }
+    self->len = i;
+    return 0;
+}
+
+/*
+ * Before any text is read, the first d pattern positions can be deleted.
+ */
+void bitap_start(BitapMask *self, int k, uint64_t *state)
+{
+    int d;
+
+    for (d = 0; d <= k; d++) {
+        state[d] = d < BITAP_MAX_LEN ? ((uint64_t) 1 << d) - 1 : ~(uint64_t) 0;
+    }
+}
+
+/*
+ * Advances the k + 1 state vectors by c and returns the lowest number of
+ * differences, with which the pattern ends here, or k + 1.
+ */
+static int bitap_step(BitapMask *self, int k, uint64_t *state, char c)
+{
+    uint64_t eq = self->masks[(unsigned char) c], old, previous, high;
+    int d, distance = k + 1;
+
+    if (self->len == 0) return 0;
+    high = (uint64_t) 1 << (self->len - 1);
+    old = state[0];
+    state[0] = ((old << 1) | 1) & eq;
+    if (state[0] & high) distance = 0;
+    for (d = 1; d <= k; d++) {
+        previous = old;
+        old = state[d];
+        /* match | insertion | substitution and deletion */
+        state[d] = (((old << 1) | 1) & eq) | previous |
+            ((previous | state[d - 1]) << 1) | 1;
+        if ((state[d] & high) && distance > d) distance = d;
+    }
+    return distance;
+}
+
+/*
+ * Scans text from offset from up to offset to, and records the end
+ * offsets of the occurrences with at most k differences in hits, until
+ * capacity of them are recorded. Returns the offset, where the scan
+ * stopped.
+ */
+long bitap_scan(BitapMask *self, int k, uint64_t *state, const char *text,
+    long from, long to, BitapHit *hits, int *len, int capacity)
+{
+    int distance;
+
+    while (from < to && *len < capacity) {
+        distance = bitap_step(self, k, state, text[from++]);
+        if (distance <= k) {
+            hits[*len].end = from;
+            hits[*len].distance = distance;
+            (*len)++;
+        }
+    }
+    return from;
+}
+
+/*
+ * Returns the end offset of the first occurrence with at most k
+ * differences, or -1.
+ */
+long bitap_first(BitapMask *self, int k, uint64_t *state, const char *text,
+    long text_len)
+{
+    long i;
+
+    bitap_start(self, k, state);
+    if (self->len <= k) return 0;
+    for (i = 0; i < text_len; i++) {
+        if (bitap_step(self, k, state, text[i]) <= k) return i + 1;
+    }
+    return -1;
+}
+  /* vim: set et cindent sw=4 ts=4: */
@@ -0,0 +1,35 @@
+#ifndef BITAP_H_INCLUDED
+#define BITAP_H_INCLUDED
+
+#include "ruby.h"
+#include <stdint.h>
+
+#define BITAP_MAX_LEN 64
+
+#define BITAP_UNTERMINATED_CLASS -1
+#define BITAP_TOO_LONG -2
+
+/*
+ * The compiled pattern: bit i of the mask of a character is set, if it
+ * matches the i-th position of the pattern.
+ */
+typedef struct BitapMaskStruct {
+    uint64_t    masks[256];
+    int         len;
+} BitapMask;
+
+typedef struct BitapHitStruct {
+    long        end;
+    int         distance;
+} BitapHit;
+
+int bitap_mask_compile(BitapMask *self, const char *pattern, int len,
+    int ignore_case);
+void bitap_start(BitapMask *self, int k, uint64_t *state);
+long bitap_scan(BitapMask *self, int k, uint64_t *state, const char *text,
+    long from, long to, BitapHit *hits, int *len, int capacity);
+long bitap_first(BitapMask *self, int k, uint64_t *state, const char *text,
+    long text_len);
+
+#endif
+  /* vim: set et cindent sw=4 ts=4: */
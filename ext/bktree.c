@@ -0,0 +1,257 @@
+#include "bktree.h"
+#include "pattern_mask.h"
+#include "hamming.h"
+#include <limits.h>
+#include <stdlib.h>
+
+/*
+ * Burkhard-Keller tree (BK-tree) of strings under the Levenshtein or the
+ * Hamming distance. Every child of a node is at a different distance (its
+ * key) from it, so by the triangle inequality a query, that is at distance
+ * d from a node, only has to descend into the children with keys in
+ * [d - k, d + k] to find all strings within distance k.
+ *
+ * All nodes live in one array, in the order of the strings, and the strings
+ * are copied into one buffer. Distances are computed by the bit vectors of
+ * a pattern mask of the string looked up or inserted (see pattern_mask.c).
+ */
+
+typedef struct BKQueryStruct {
+    BKTree      *tree;
+    const char  *string;
+    int         len;
+    PatternMask *mask;
+    uint64_t    *scratch;
+    int         *stack;
+    int         stack_len;
+    int         stack_size;
+} BKQuery;
+
+static void query_init(BKQuery *query, BKTree *tree, const char *string,
+    int len)
+{
+    int scratch_len;
+
+    query->tree = tree;
+    query->string = string;
+    query->len = len;
+    query->mask = NULL;
+    query->scratch = NULL;
+    query->stack = NULL;
+    query->stack_len = query->stack_size = 0;
+    if (tree->metric == BKTREE_LEVENSHTEIN) {
+        query->mask = PatternMask_new(string, len);
+        scratch_len = pattern_mask_scratch_len(query->mask);
+        if (scratch_len > 0) query->scratch = ALLOC_N(uint64_t, scratch_len);
+    }
+}
+
+static void query_release(BKQuery *query)
+{
+    pattern_mask_destroy(query->mask);
+    free(query->scratch);
+    free(query->stack);
+}
+
+/*
+ * Returns the distance of the query to node, or bound + 1, if it's greater
+ * than bound.
+ */
+static int query_distance(BKQuery *query, int node, int bound)
+{
+    BKNode *n = query->tree->nodes + node;
+    const char *string = query->tree->strings + n->offset;
+
+    query->tree->visited++;
+    if (query->tree->metric == BKTREE_HAMMING) {
+        if (query->len <= n->len) {
+            return n->len - query->len +
+                hamming_mismatches(query->string, string, query->len);
+        } else {
+            return query->len - n->len +
+                hamming_mismatches(query->string, string, n->len);
+        }
+    }
+    return pattern_mask_distance_bounded(query->mask, string, n->len, bound,
+        query->scratch);
+}
+
+static void query_push(BKQuery *query, int node)
+{
+    if (query->stack_len == query->stack_size) {
+        query->stack_size = query->stack_size ? 2 * query->stack_size : 64;
+        REALLOC_N(query->stack, int, query->stack_size);
+    }
+    query->stack[query->stack_len++] = node;
+}
+
+/*
+ * Pushes the children of node with keys in [d - k, d + k].
+ */
+static void query_push_children(BKQuery *query, int node, int d, int k)
+{
+    BKNode *nodes = query->tree->nodes;
+    int child;
+
+    for (child = nodes[node].child; child >= 0; child = nodes[child].sibling) {
+        if (nodes[child].key >= d - k && nodes[child].key <= d + k) {
+            query_push(query, child);
+        }
+    }
+}
+
+/*
+ * A node's distance is only needed exactly, if it can be within k, or if
+ * some of its children can be.
+ */
+#define QUERY_BOUND(node, k) \
+    ((k) + (nodes[node].max_key > 0 ? nodes[node].max_key : 0))
+
+/*
+ * Builds the tree of the Array of Strings strings in self, whose memory has
+ * to be released with bktree_release.
+ */
+void bktree_init(BKTree *self, VALUE strings, int metric)
+{
+    BKQuery query;
+    BKNode *nodes;
+    VALUE string;
+    long offset;
+    int i, node, child, d;
+
+    self->len = (int) RARRAY(strings)->len;
+    self->metric = metric;
+    self->visited = 0;
+    self->max_len = 0;
+    for (i = 0, self->strings_len = 0; i < self->len; i++) {
+        string = rb_ary_entry(strings, i);
+        self->strings_len += RSTRING(string)->len;
+        if (RSTRING(string)->len > self->max_len) {
+            self->max_len = (int) RSTRING(string)->len;
+        }
+    }
+    self->strings = ALLOC_N(char, self->strings_len > 0 ? self->strings_len : 1);
+    self->nodes = nodes = ALLOC_N(BKNode, self->len > 0 ? self->len : 1);
+    for (i = 0, offset = 0; i < self->len; i++) {
+        string = rb_ary_entry(strings, i);
+        nodes[i].offset = offset;
+        nodes[i].len = (int) RSTRING(string)->len;
+        nodes[i].key = 0;
+        nodes[i].max_key = -1;
+        nodes[i].child = nodes[i].sibling = -1;
+        MEMCPY(self->strings + offset, RSTRING(string)->ptr, char,
+            nodes[i].len);
+        offset += nodes[i].len;
+    }
+    for (i = 1; i < self->len; i++) {
+        query_init(&query, self, self->strings + nodes[i].offset,
+            nodes[i].len);
+        for (node = 0;;) {
+            d = query_distance(&query, node, INT_MAX - 1);
+            for (child = nodes[node].child;
+                child >= 0 && nodes[child].key != d;
+                child = nodes[child].sibling);
+            if (child < 0) break;
+            node = child;
+        }
+        nodes[i].key = d;
+        nodes[i].sibling = nodes[node].child;
+        nodes[node].child = i;
+        if (d > nodes[node].max_key) nodes[node].max_key = d;
+        query_release(&query);
+    }
+    self->visited = 0;
+}
+
+static int compare_matches(const void *x, const void *y)
+{
+    const BKMatch *a = (const BKMatch *) x, *b = (const BKMatch *) y;
+    if (a->distance != b->distance) return a->distance - b->distance;
+    return a->index - b->index;
+}
+
+/*
+ * Finds all strings within distance k of string. Stores them in *matches,
+ * sorted by distance and index, which the caller has to free, and returns
+ * their number. No distance exceeds the sum of the lengths, so larger k are
+ * clamped to that, to keep k + d from overflowing.
+ */
+long bktree_search(BKTree *self, const char *string, int len, int k,
+    BKMatch **matches)
+{
+    BKQuery query;
+    BKNode *nodes = self->nodes;
+    long found = 0, size = 16;
+    int node, d;
+
+    *matches = ALLOC_N(BKMatch, size);
+    self->visited = 0;
+    if (self->len == 0 || k < 0) return 0;
+    if ((long) k > (long) self->max_len + len) k = self->max_len + len;
+    query_init(&query, self, string, len);
+    query_push(&query, 0);
+    while (query.stack_len > 0) {
+        node = query.stack[--query.stack_len];
+        d = query_distance(&query, node, QUERY_BOUND(node, k));
+        if (d <= k) {
+            if (found == size) {
+                size *= 2;
+                REALLOC_N(*matches, BKMatch, size);
+            }
+            (*matches)[found].index = node;
+            (*matches)[found].distance = d;
+            found++;
+        }
+        query_push_children(&query, node, d, k);
+    }
+    query_release(&query);
+    qsort(*matches, found, sizeof(BKMatch), compare_matches);
+    return found;
+}
+
+/*
+ * Returns the index of the string nearest to string, the first one of them,
+ * if there are several, and stores its distance in *distance. Returns -1,
+ * if the tree is empty. The search shrinks k to the nearest distance found
+ * so far.
+ */
+int bktree_nearest(BKTree *self, const char *string, int len, int *distance)
+{
+    BKQuery query;
+    BKNode *nodes = self->nodes;
+    int node, d, best = -1, k = INT_MAX / 2;
+
+    self->visited = 0;
+    if (self->len == 0) return -1;
+    query_init(&query, self, string, len);
+    query_push(&query, 0);
+    while (query.stack_len > 0) {
+        node = query.stack[--query.stack_len];
+        d = query_distance(&query, node, QUERY_BOUND(node, k));
+        if (d < k || (d == k && node < best)) {
+            k = d;
+            best = node;
+        }
+        query_push_children(&query, node, d, k);
+    }
+    query_release(&query);
+    *distance = k;
+    return best;
+}
+
+size_t bktree_memsize(BKTree *self)
+{
+    if (!self->nodes) return 0;
+    return self->strings_len + self->len * sizeof(BKNode);
+}
+
+void bktree_release(BKTree *self)
+{
+    free(self->strings);
+    self->strings = NULL;
+    free(self->nodes);
+    self->nodes = NULL;
+    self->strings_len = 0;
+    self->len = 0;
+}
+  /* vim: set et cindent sw=4 ts=4: */
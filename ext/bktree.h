@@ -0,0 +1,45 @@
+#ifndef BKTREE_H_INCLUDED
+#define BKTREE_H_INCLUDED
+
+#include "ruby.h"
+
+#define BKTREE_LEVENSHTEIN  0
+#define BKTREE_HAMMING      1
+
+/*
+ * Node i of a tree holds string i. Its children are linked by sibling, and
+ * key is the distance of a node to its parent.
+ */
+typedef struct BKNodeStruct {
+    long    offset;
+    int     len;
+    int     key;
+    int     max_key;    /* largest key of the children, -1 for leaves */
+    int     child;
+    int     sibling;
+} BKNode;
+
+typedef struct BKTreeStruct {
+    char    *strings;
+    long    strings_len;
+    BKNode  *nodes;
+    int     len;
+    int     max_len;    /* of the strings */
+    int     metric;
+    long    visited;    /* by the last query */
+} BKTree;
+
+typedef struct BKMatchStruct {
+    int     index;
+    int     distance;
+} BKMatch;
+
+void bktree_init(BKTree *self, VALUE strings, int metric);
+long bktree_search(BKTree *self, const char *string, int len, int k,
+    BKMatch **matches);
+int bktree_nearest(BKTree *self, const char *string, int len, int *distance);
+size_t bktree_memsize(BKTree *self);
+void bktree_release(BKTree *self);
+
+#endif
+  /* vim: set et cindent sw=4 ts=4: */
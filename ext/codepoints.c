@@ -0,0 +1,254 @@
+#include "codepoints.h"
+#include <string.h>
+
+/*
+ * Codepoint mode compares characters instead of bytes, without touching the
+ * kernels: only equality of pattern characters and string characters
+ * matters to them, so every character of a UTF-8 string is translated into
+ * a one byte symbol, that is equal to the symbol of a pattern character, if
+ * and only if both characters are. ASCII characters stand for themselves,
+ * the distinct other characters of the pattern get the symbols 128, 129,
+ * ..., and all other characters share CODEPOINTS_FOREIGN, which isn't in
+ * the pattern. Strings, that are pure ASCII, need no translation at all.
+ *
+ * Bytes, that aren't part of a valid UTF-8 sequence, count as characters of
+ * their own, that differ from all real ones.
+ */
+
+#define HIGH_BITS   0x8080808080808080ULL
+#define INVALID     0x110000
+#define EMPTY       0xffffffff
+
+/*
+ * Returns true, if no byte of ptr has its high bit set, checking a machine
+ * word at a time.
+ */
+int codepoints_ascii(const char *ptr, long len)
+{
+    uint64_t word, bits = 0;
+    long i;
+
+    for (i = 0; i + 32 <= len; i += 32) {
+        memcpy(&word, ptr + i, 8);
+        bits |= word;
+        memcpy(&word, ptr + i + 8, 8);
+        bits |= word;
+        memcpy(&word, ptr + i + 16, 8);
+        bits |= word;
+        memcpy(&word, ptr + i + 24, 8);
+        bits |= word;
+        if (bits & HIGH_BITS) return 0;
+    }
+    for (; i + 8 <= len; i += 8) {
+        memcpy(&word, ptr + i, 8);
+        bits |= word;
+    }
+    for (; i < len; i++) bits |= (unsigned char) ptr[i];
+    return !(bits & HIGH_BITS);
+}
+
+/*
+ * Decodes the character at offset i of ptr into c and returns the offset of
+ * the next one.
+ */
+static long decode(const unsigned char *ptr, long len, long i, uint32_t *c)
+{
+    unsigned char b = ptr[i];
+    uint32_t value, min;
+    int n, k;
+
+    if (b < 0x80) {
+        *c = b;
+        return i + 1;
+    }
+    if (b >= 0xc2 && b <= 0xdf) {
+        n = 1; value = b & 0x1f; min = 0x80;
+    } else if (b >= 0xe0 && b <= 0xef) {
+        n = 2; value = b & 0x0f; min = 0x800;
+    } else if (b >= 0xf0 && b <= 0xf4) {
+        n = 3; value = b & 0x07; min = 0x10000;
+    } else {
+        n = 0; value = 0; min = 0;
+    }
+    if (n == 0 || i + n >= len) {
+        /* an unexpected or truncated sequence */
+        *c = INVALID + b;
+        return i + 1;
+    }
+    for (k = 1; k <= n; k++) {
+        if ((ptr[i + k] & 0xc0) != 0x80) {
+            *c = INVALID + b;
+            return i + 1;
+        }
+        value = value << 6 | (ptr[i + k] & 0x3f);
+    }
+    if (value < min || value > 0x10ffff ||
+            (value >= 0xd800 && value <= 0xdfff)) {
+        *c = INVALID + b;
+        return i + 1;
+    }
+    *c = value;
+    return i + n + 1;
+}
+
+/*
+ * Returns the number of characters of ptr.
+ */
+long codepoints_count(const char *ptr, long len)
+{
+    const unsigned char *p = (const unsigned char *) ptr;
+    uint32_t c;
+    long i, n;
+
+    for (i = 0, n = 0; i < len; n++) i = decode(p, len, i, &c);
+    return n;
+}
+
+/*
+ * Returns the offset of character n of ptr, or len, if it has at most n
+ * characters.
+ */
+long codepoints_skip(const char *ptr, long len, long n)
+{
+    const unsigned char *p = (const unsigned char *) ptr;
+    uint32_t c;
+    long i;
+
+    for (i = 0; i < len && n > 0; n--) i = decode(p, len, i, &c);
+    return i;
+}
+
+/*
+ * Returns the length of the longest prefix of ptr, that doesn't end in a
+ * truncated character, which more bytes could still complete.
+ */
+long codepoints_boundary(const char *ptr, long len)
+{
+    const unsigned char *p = (const unsigned char *) ptr;
+    long i;
+    int n;
+
+    for (i = len - 1; i >= 0 && i >= len - 3; i--) {
+        if (p[i] < 0x80) return len;
+        if (p[i] < 0xc0) continue;
+        if (p[i] >= 0xc2 && p[i] <= 0xdf) {
+            n = 1;
+        } else if (p[i] >= 0xe0 && p[i] <= 0xef) {
+            n = 2;
+        } else if (p[i] >= 0xf0 && p[i] <= 0xf4) {
+            n = 3;
+        } else {
+            n = 0;
+        }
+        return n > 0 && i + n >= len ? i : len;
+    }
+    return len;
+}
+
+/*
+ * Returns the slot of codepoint c in the hash table keys, or the empty slot
+ * it belongs into.
+ */
+static int slot(const uint32_t *keys, uint32_t c)
+{
+    int i = (int) ((uint32_t) (c * 2654435761U) >> 24);
+
+    while (keys[i] != EMPTY && keys[i] != c) {
+        i = (i + 1) % CODEPOINTS_TABLE;
+    }
+    return i;
+}
+
+/*
+ * Returns the number of distinct non-ASCII characters of ptr, but counts
+ * at most up to CODEPOINTS_MAX + 1.
+ */
+int codepoints_distinct(const char *ptr, long len)
+{
+    const unsigned char *p = (const unsigned char *) ptr;
+    uint32_t keys[CODEPOINTS_TABLE], c;
+    long i;
+    int s, n = 0;
+
+    memset(keys, 0xff, sizeof(keys));
+    for (i = 0; i < len && n <= CODEPOINTS_MAX; ) {
+        i = decode(p, len, i, &c);
+        if (c < 0x80) continue;
+        s = slot(keys, c);
+        if (keys[s] == EMPTY) {
+            keys[s] = c;
+            n++;
+        }
+    }
+    return n;
+}
+
+/*
+ * Translates the pattern of len bytes, that has to have at most
+ * CODEPOINTS_MAX distinct non-ASCII characters (see codepoints_distinct).
+ */
+Codepoints *Codepoints_new(const char *pattern, int len)
+{
+    const unsigned char *p = (const unsigned char *) pattern;
+    Codepoints *self = ALLOC(Codepoints);
+    uint32_t c;
+    long i;
+    int s, n = 0;
+
+    memset(self->keys, 0xff, sizeof(self->keys));
+    MEMZERO(self->symbols, unsigned char, CODEPOINTS_TABLE);
+    self->pattern = ALLOC_N(char, len > 0 ? len : 1);
+    self->len = 0;
+    for (i = 0; i < len; ) {
+        i = decode(p, len, i, &c);
+        if (c < 0x80) {
+            self->pattern[self->len++] = (char) c;
+            continue;
+        }
+        s = slot(self->keys, c);
+        if (self->keys[s] == EMPTY) {
+            self->keys[s] = c;
+            self->symbols[s] = (unsigned char) (0x80 + n++);
+        }
+        self->pattern[self->len++] = (char) self->symbols[s];
+    }
+    return self;
+}
+
+/*
+ * Translates the len bytes of ptr into symbols, which has to have room for
+ * len of them, and returns the number of characters.
+ */
+long codepoints_translate(Codepoints *self, const char *ptr, long len,
+    char *symbols)
+{
+    const unsigned char *p = (const unsigned char *) ptr;
+    uint32_t c;
+    long i, n = 0;
+    int s;
+
+    for (i = 0; i < len; ) {
+        if (p[i] < 0x80) {
+            symbols[n++] = (char) p[i++];
+            continue;
+        }
+        i = decode(p, len, i, &c);
+        s = slot(self->keys, c);
+        symbols[n++] = (char) (self->keys[s] == EMPTY ?
+            CODEPOINTS_FOREIGN : self->symbols[s]);
+    }
+    return n;
+}
+
+size_t codepoints_memsize(const Codepoints *self)
+{
+    return self ? sizeof(Codepoints) + self->len : 0;
+}
+
+void codepoints_destroy(Codepoints *self)
+{
+    if (!self) return;
+    free(self->pattern);
+    free(self);
+}
+  /* vim: set et cindent sw=4 ts=4: */
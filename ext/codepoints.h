@@ -0,0 +1,30 @@
+#ifndef CODEPOINTS_H_INCLUDED
+#define CODEPOINTS_H_INCLUDED
+
+#include "ruby.h"
+#include <stdint.h>
+
+#define CODEPOINTS_MAX      127     /* distinct non-ASCII pattern characters */
+#define CODEPOINTS_TABLE    256
+#define CODEPOINTS_FOREIGN  255     /* symbol of characters not in the pattern */
+
+typedef struct CodepointsStruct {
+    char        *pattern;   /* one symbol per character of the pattern */
+    int         len;
+    uint32_t    keys[CODEPOINTS_TABLE];     /* hash table of codepoints */
+    unsigned char symbols[CODEPOINTS_TABLE];
+} Codepoints;
+
+int codepoints_ascii(const char *ptr, long len);
+long codepoints_count(const char *ptr, long len);
+long codepoints_skip(const char *ptr, long len, long n);
+long codepoints_boundary(const char *ptr, long len);
+int codepoints_distinct(const char *ptr, long len);
+Codepoints *Codepoints_new(const char *pattern, int len);
+long codepoints_translate(Codepoints *self, const char *ptr, long len,
+    char *symbols);
+size_t codepoints_memsize(const Codepoints *self);
+void codepoints_destroy(Codepoints *self);
+
+#endif
+  /* vim: set et cindent sw=4 ts=4: */
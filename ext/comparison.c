@@ -0,0 +1,215 @@
+#include "comparison.h"
+#include <stdlib.h>
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
+/*
+ * Batches of comparisons are computed here, by a pool of native threads.
+ * Nothing in this file may call the Ruby API: it runs without the global
+ * interpreter lock, so memory is allocated with plain malloc.
+ *
+ * Every worker starts out owning an equal slice of the batch and takes small
+ * chunks from its front. Since the strings of a batch can differ a lot in
+ * length, a worker, that runs out of work, steals the back half of the
+ * largest slice left, until all slices are empty.
+ */
+
+#define CHUNK_MAX 16
+
+typedef struct WorkerStruct {
+#ifdef HAVE_PTHREAD_H
+    pthread_t       thread;
+    pthread_mutex_t lock;
+#endif
+    struct PoolStruct *pool;
+    long            next;
+    long            end;
+    int             started;
+    Workspace       own;
+    Workspace       *workspace;
+} Worker;
+
+typedef struct PoolStruct {
+    Comparison  *cmps;
+    Worker      *workers;
+    int         threads;
+    volatile int *canceled;
+} Pool;
+
+#define POOL_CANCELED(pool) ((pool)->canceled && *(pool)->canceled)
+
+static void run_range(Worker *worker, long from, long to)
+{
+    Comparison *cmps = worker->pool->cmps;
+    long i;
+
+    for (i = from; i < to; i++) {
+        if (POOL_CANCELED(worker->pool)) return;
+        if (cmps[i].kernel) {
+            cmps[i].scratch = worker->workspace->memory;
+            cmps[i].kernel(cmps + i);
+            cmps[i].scratch = NULL;
+        }
+    }
+}
+
+#ifdef HAVE_PTHREAD_H
+/*
+ * Takes a chunk from the front of the own slice of worker, the larger the
+ * more work is left in it.
+ */
+static int worker_take(Worker *worker, long *from, long *to)
+{
+    long n;
+
+    if (POOL_CANCELED(worker->pool)) return 0;
+    pthread_mutex_lock(&worker->lock);
+    n = (worker->end - worker->next) / 8;
+    if (n < 1) n = 1;
+    if (n > CHUNK_MAX) n = CHUNK_MAX;
+    if (worker->next + n > worker->end) n = worker->end - worker->next;
+    *from = worker->next;
+    worker->next += n;
+    *to = worker->next;
+    pthread_mutex_unlock(&worker->lock);
+    return n > 0;
+}
+
+/*
+ * Moves the back half of the largest slice of the other workers into the
+ * (empty) slice of worker. Returns false, if there was nothing left to steal.
+ */
+static int worker_steal(Worker *worker)
+{
+    Pool *pool = worker->pool;
+    Worker *victim;
+    long left, best, mid, end;
+    int i, found;
+
+    for (;;) {
+        if (POOL_CANCELED(pool)) return 0;
+        for (i = 0, found = -1, best = 0; i < pool->threads; i++) {
+            victim = pool->workers + i;
+            if (victim == worker) continue;
+            pthread_mutex_lock(&victim->lock);
+            left = victim->end - victim->next;
+            pthread_mutex_unlock(&victim->lock);
+            if (left > best) {
+                best = left;
+                found = i;
+            }
+        }
+        if (found < 0) return 0;
+        victim = pool->workers + found;
+        pthread_mutex_lock(&victim->lock);
+        left = victim->end - victim->next;
+        if (left > 0) {
+            end = victim->end;
+            mid = end - (left + 1) / 2;
+            victim->end = mid;
+            pthread_mutex_unlock(&victim->lock);
+            pthread_mutex_lock(&worker->lock);
+            worker->next = mid;
+            worker->end = end;
+            pthread_mutex_unlock(&worker->lock);
+            return 1;
+        }
+        /* the victim finished its slice meanwhile, look for another one */
+        pthread_mutex_unlock(&victim->lock);
+    }
+}
+
+static void *worker_run(void *data)
+{
+    Worker *worker = (Worker *) data;
+    long from, to;
+
+    do {
+        while (worker_take(worker, &from, &to)) {
+            run_range(worker, from, to);
+        }
+    } while (worker_steal(worker));
+    return NULL;
+}
+#endif
+
+/*
+ * Computes the len comparisons in cmps with up to threads threads, including
+ * the calling one, which uses workspace (if not NULL) as its scratch memory.
+ * Returns 0 on success, and -1 if the scratch memory for the workers couldn't
+ * be allocated. In that case no comparison was computed. If canceled isn't
+ * NULL, the workers stop after their current comparisons, as soon as it's
+ * set, and 1 is returned, leaving the other comparisons out.
+ */
+int comparisons_run(Comparison *cmps, long len, int threads,
+    Workspace *workspace, volatile int *canceled)
+{
+    Pool pool;
+    Worker *workers;
+    size_t scratch_size = 0;
+    long i;
+    int t, result = 0;
+
+    for (i = 0; i < len; i++) {
+        if (cmps[i].kernel && cmps[i].scratch_size > scratch_size) {
+            scratch_size = cmps[i].scratch_size;
+        }
+    }
+#ifdef HAVE_PTHREAD_H
+    if (threads > len) threads = (int) len;
+#endif
+    if (threads < 1) threads = 1;
+#ifndef HAVE_PTHREAD_H
+    threads = 1;
+#endif
+    workers = (Worker *) calloc(threads, sizeof(Worker));
+    if (!workers) return -1;
+    pool.cmps = cmps;
+    pool.workers = workers;
+    pool.threads = threads;
+    pool.canceled = canceled;
+    for (t = 0; t < threads; t++) {
+        workers[t].pool = &pool;
+        workers[t].next = len * t / threads;
+        workers[t].end = len * (t + 1) / threads;
+        workers[t].workspace = t == 0 && workspace ?
+            workspace : &workers[t].own;
+        if (scratch_size > 0 &&
+                !workspace_reserve(workers[t].workspace, scratch_size)) {
+            result = -1;
+        }
+    }
+    if (result == 0) {
+        if (threads == 1) {
+            run_range(workers, 0, len);
+        }
+#ifdef HAVE_PTHREAD_H
+        else {
+            for (t = 0; t < threads; t++) {
+                pthread_mutex_init(&workers[t].lock, NULL);
+            }
+            /*
+             * The calling thread is worker 0. Workers, that can't be started,
+             * leave their slices to be stolen by the others.
+             */
+            for (t = 1; t < threads; t++) {
+                workers[t].started = pthread_create(&workers[t].thread,
+                    NULL, worker_run, workers + t) == 0;
+            }
+            worker_run(workers);
+            for (t = 1; t < threads; t++) {
+                if (workers[t].started) pthread_join(workers[t].thread, NULL);
+            }
+            for (t = 0; t < threads; t++) {
+                pthread_mutex_destroy(&workers[t].lock);
+            }
+        }
+#endif
+    }
+    for (t = 0; t < threads; t++) workspace_release(&workers[t].own);
+    free(workers);
+    if (result == 0 && POOL_CANCELED(&pool)) result = 1;
+    return result;
+}
+  /* vim: set et cindent sw=4 ts=4: */
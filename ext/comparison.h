@@ -0,0 +1,37 @@
+#ifndef COMPARISON_H_INCLUDED
+#define COMPARISON_H_INCLUDED
+
+#include "ruby.h"
+#include "pair.h"
+#include "workspace.h"
+
+/*
+ * A comparison of the pattern of a matcher with one string. It's prepared
+ * with the Ruby objects at hand, and then computed by its kernel, which only
+ * looks at the fields of the comparison and at the matcher. kernel is NULL,
+ * if result could be determined while preparing the comparison already.
+ */
+typedef struct ComparisonStruct {
+    void        *amatch;
+    char        *a_ptr;
+    int         a_len;
+    char        *b_ptr;
+    int         b_len;
+    double      bound;
+    PairCounts  *a_pairs;
+    PairArray   *b_pairs;
+    char        *symbols;   /* the string translated in codepoint mode */
+    void        *(*kernel)(void *);
+    size_t      scratch_size;
+    double      cost;
+    void        *scratch;
+    double      result;
+    int         a_offset;   /* where the match found starts in a and b, */
+    int         b_offset;   /* for kernels, that locate one */
+} Comparison;
+
+int comparisons_run(Comparison *cmps, long len, int threads,
+    Workspace *workspace, volatile int *canceled);
+
+#endif
+  /* vim: set et cindent sw=4 ts=4: */
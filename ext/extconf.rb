@@ -7,5 +7,21 @@ require 'rbconfig'
 if CONFIG['CC'] == 'gcc'
   CONFIG['CC'] = 'gcc -Wall '
 end
+have_type 'rb_data_type_t', 'ruby.h'
+have_header 'immintrin.h'
+have_func 'memmem', 'string.h'
+if have_header('sys/mman.h')
+  have_func 'mmap', 'sys/mman.h'
+  have_func 'madvise', 'sys/mman.h'
+end
+have_func 'rb_thread_call_without_gvl', 'ruby/thread.h'
+have_func 'rb_frame_this_func', 'ruby.h'
+unless have_func('clock_gettime', 'time.h')
+  have_library('rt', 'clock_gettime') and have_func('clock_gettime', 'time.h')
+end
+have_header 'sys/sdt.h'
+if have_header('pthread.h')
+  have_library 'pthread', 'pthread_create'
+end
 create_makefile 'amatch' 
   # vim: set et sw=2 ts=2:
@@ -0,0 +1,134 @@
+#include "hamming.h"
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Counting the positions, at which two strings of the same length differ,
+ * is done here, with the widest vector instructions the CPU supports. The
+ * variant is picked once by hamming_init, from the CPU features detected at
+ * runtime. All variants count the equal bytes of each block and handle the
+ * bytes after the last full block with the portable code.
+ */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && \
+    defined(HAVE_IMMINTRIN_H)
+#define HAMMING_X86 1
+#include <immintrin.h>
+#endif
+
+/*
+ * Portable version, comparing a machine word at a time: every byte of the
+ * xor of two words, that has any bit set, is a mismatch.
+ */
+static int mismatches_word(const char *a, const char *b, int len)
+{
+    const uint64_t low = 0x7f7f7f7f7f7f7f7fULL;
+    uint64_t x, y;
+    int i, result = 0;
+
+    for (i = 0; i + 8 <= len; i += 8) {
+        memcpy(&x, a + i, 8);
+        memcpy(&y, b + i, 8);
+        x ^= y;
+        /* sets the high bit of every non-zero byte, then adds them up */
+        x = (((x & low) + low) | x) & ~low;
+        result += (int) (((x >> 7) * 0x0101010101010101ULL) >> 56);
+    }
+    for (; i < len; i++) {
+        if (a[i] != b[i]) result++;
+    }
+    return result;
+}
+
+#ifdef HAMMING_X86
+/*
+ * The counters of equal bytes are 8 bits wide, so they are summed up into
+ * 64-bit lanes at least every 255 blocks.
+ */
+#define BLOCKS_PER_SUM 255
+
+__attribute__((target("sse2")))
+static int mismatches_sse2(const char *a, const char *b, int len)
+{
+    __m128i sum = _mm_setzero_si128(), zero = _mm_setzero_si128();
+    int i = 0, blocks, equal = 0;
+
+    while (i + 16 <= len) {
+        __m128i count = _mm_setzero_si128();
+        for (blocks = 0; blocks < BLOCKS_PER_SUM && i + 16 <= len;
+                blocks++, i += 16) {
+            __m128i x = _mm_loadu_si128((const __m128i *) (a + i));
+            __m128i y = _mm_loadu_si128((const __m128i *) (b + i));
+            count = _mm_sub_epi8(count, _mm_cmpeq_epi8(x, y));
+        }
+        sum = _mm_add_epi64(sum, _mm_sad_epu8(count, zero));
+    }
+    equal = _mm_cvtsi128_si32(sum) +
+        _mm_cvtsi128_si32(_mm_unpackhi_epi64(sum, sum));
+    return i - equal + mismatches_word(a + i, b + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static int mismatches_avx2(const char *a, const char *b, int len)
+{
+    __m256i sum = _mm256_setzero_si256(), zero = _mm256_setzero_si256();
+    __m128i half;
+    int i = 0, blocks, equal;
+
+    while (i + 32 <= len) {
+        __m256i count = _mm256_setzero_si256();
+        for (blocks = 0; blocks < BLOCKS_PER_SUM && i + 32 <= len;
+                blocks++, i += 32) {
+            __m256i x = _mm256_loadu_si256((const __m256i *) (a + i));
+            __m256i y = _mm256_loadu_si256((const __m256i *) (b + i));
+            count = _mm256_sub_epi8(count, _mm256_cmpeq_epi8(x, y));
+        }
+        sum = _mm256_add_epi64(sum, _mm256_sad_epu8(count, zero));
+    }
+    half = _mm_add_epi64(_mm256_castsi256_si128(sum),
+        _mm256_extracti128_si256(sum, 1));
+    equal = _mm_cvtsi128_si32(half) +
+        _mm_cvtsi128_si32(_mm_unpackhi_epi64(half, half));
+    return i - equal + mismatches_word(a + i, b + i, len - i);
+}
+
+__attribute__((target("avx512f,avx512bw,popcnt")))
+static int mismatches_avx512(const char *a, const char *b, int len)
+{
+    int i, result = 0;
+
+    for (i = 0; i + 64 <= len; i += 64) {
+        __m512i x = _mm512_loadu_si512((const void *) (a + i));
+        __m512i y = _mm512_loadu_si512((const void *) (b + i));
+        result += (int) _mm_popcnt_u64(_mm512_cmpneq_epi8_mask(x, y));
+    }
+    return result + mismatches_avx2(a + i, b + i, len - i);
+}
+#endif
+
+static int (*mismatches)(const char *a, const char *b, int len) =
+    mismatches_word;
+
+void hamming_init(void)
+{
+#ifdef HAMMING_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512bw") &&
+            __builtin_cpu_supports("popcnt")) {
+        mismatches = mismatches_avx512;
+    } else if (__builtin_cpu_supports("avx2")) {
+        mismatches = mismatches_avx2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        mismatches = mismatches_sse2;
+    }
+#endif
+}
+
+/*
+ * Returns the number of positions i < len, at which a and b differ.
+ */
+int hamming_mismatches(const char *a, const char *b, int len)
+{
+    return mismatches(a, b, len);
+}
+  /* vim: set et cindent sw=4 ts=4: */
@@ -0,0 +1,8 @@
+#ifndef HAMMING_H_INCLUDED
+#define HAMMING_H_INCLUDED
+
+void hamming_init(void);
+int hamming_mismatches(const char *a, const char *b, int len);
+
+#endif
+  /* vim: set et cindent sw=4 ts=4: */
@@ -0,0 +1,521 @@
+#include "join.h"
+#include <ctype.h>
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Candidate generation for similarity joins: for every left string only
+ * those right strings are returned, that might be similar enough, the
+ * others are filtered by their lengths and by what they have in common.
+ *
+ * - Within edit distance k, a string of length L is split into k + 1
+ *   segments. Every edit operation destroys at most one of them, so the
+ *   other string contains one unchanged, shifted by at most the operations
+ *   before it (PassJoin). The segments of the right strings are indexed,
+ *   and the substrings of the left string at the possible shifts are looked
+ *   up. Right strings shorter than k + 1 are candidates by length alone.
+ * - The Jaro similarity of strings of lengths a and b with m common
+ *   characters is at most (m / a + m / b + 1) / 3, so a minimum similarity
+ *   j needs lengths within the ratio 3 j - 2 and at least (3 j - 1) a b /
+ *   (a + b) characters in common. The characters are turned into tokens,
+ *   numbered by their occurrence, so that the common characters are common
+ *   tokens, and tokens are ordered by their frequency in the right strings.
+ *   Two strings with at least o common tokens share one of their first
+ *   len - o + 1 tokens in that order (prefix filtering), so only those of
+ *   the right strings are indexed. Once a common token is found, the
+ *   tokens after it in both strings bound how many more they can have in
+ *   common, which rules out most of the candidates (positional filtering,
+ *   as in PPJoin).
+ *
+ * If the strings are divided into blocks, only strings of the same block
+ * are candidates. The block is mixed into the hashes of the segments and
+ * tokens, so other blocks are hardly ever looked at.
+ */
+
+#define FOLD(self, c) \
+    ((self)->fold && islower(c) ? toupper(c) & 0xff : (c))
+
+#define EPSILON 1e-9
+
+static uint64_t mix(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+static uint64_t segment_hash(const char *ptr, int len, int string_len,
+    int segment)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    int i;
+
+    for (i = 0; i < len; i++) {
+        h ^= (unsigned char) ptr[i];
+        h *= 0x100000001b3ULL;
+    }
+    return mix(h ^ ((uint64_t) string_len << 32 | (uint32_t) segment));
+}
+
+static uint64_t token_hash(int occ, int c)
+{
+    return mix(((uint64_t) occ << 8 | c) + 0x9e3779b97f4a7c15ULL);
+}
+
+#define BLOCK_HASH(self, hash, block) \
+    ((self)->blocks ? (hash) ^ mix((uint64_t) (block) + 1) : (hash))
+
+#define OTHER_BLOCK(self, id, block) \
+    ((self)->blocks && (self)->blocks[id] != (block))
+
+/*
+ * Computes where segment i of a string of length len starts and how long
+ * it is, the later segments being one longer, if len isn't divisible.
+ */
+static void segment_bounds(int len, int k, int i, int *pos, int *seg_len)
+{
+    int base = len / (k + 1), shorter = k + 1 - len % (k + 1);
+
+    *seg_len = base + (i >= shorter);
+    *pos = i * base + (i > shorter ? i - shorter : 0);
+}
+
+/*
+ * Sorts the ids of the strings by their lengths.
+ */
+static void index_lengths(JoinIndex *self)
+{
+    long i;
+    int l;
+
+    for (i = 0, self->max_len = 0; i < self->len; i++) {
+        if (self->lens[i] > self->max_len) self->max_len = self->lens[i];
+    }
+    self->len_start = ALLOC_N(long, self->max_len + 2);
+    MEMZERO(self->len_start, long, self->max_len + 2);
+    for (i = 0; i < self->len; i++) self->len_start[self->lens[i] + 1]++;
+    for (l = 0; l <= self->max_len; l++) {
+        self->len_start[l + 1] += self->len_start[l];
+    }
+    self->by_len = ALLOC_N(long, self->len > 0 ? self->len : 1);
+    for (i = 0; i < self->len; i++) {
+        self->by_len[self->len_start[self->lens[i]]++] = i;
+    }
+    /* every start was moved to the end of its length */
+    for (l = self->max_len; l > 0; l--) {
+        self->len_start[l] = self->len_start[l - 1];
+    }
+    self->len_start[0] = 0;
+}
+
+static int compare_entries(const void *a, const void *b)
+{
+    const JoinEntry *x = (const JoinEntry *) a, *y = (const JoinEntry *) b;
+
+    if (x->hash != y->hash) return x->hash < y->hash ? -1 : 1;
+    return x->id < y->id ? -1 : x->id > y->id;
+}
+
+/*
+ * Sorts the entries by their hashes and builds the hash table pointing to
+ * the first entry of every hash.
+ */
+static void index_entries(JoinIndex *self)
+{
+    long i, unique = 0, size = 1, slot;
+
+    qsort(self->entries, self->entries_len, sizeof(JoinEntry),
+        compare_entries);
+    for (i = 0; i < self->entries_len; i++) {
+        if (i == 0 || self->entries[i].hash != self->entries[i - 1].hash) {
+            unique++;
+        }
+    }
+    while (size < 2 * unique) size *= 2;
+    self->table = ALLOC_N(long, size);
+    self->table_mask = size - 1;
+    for (i = 0; i < size; i++) self->table[i] = -1;
+    for (i = 0; i < self->entries_len; i++) {
+        if (i > 0 && self->entries[i].hash == self->entries[i - 1].hash) {
+            continue;
+        }
+        slot = (long) (self->entries[i].hash & self->table_mask);
+        while (self->table[slot] >= 0) slot = (slot + 1) & self->table_mask;
+        self->table[slot] = i;
+    }
+}
+
+/*
+ * Returns the first entry with hash, or -1.
+ */
+static long lookup(JoinIndex *self, uint64_t hash)
+{
+    long slot = (long) (hash & self->table_mask), i;
+
+    while ((i = self->table[slot]) >= 0) {
+        if (self->entries[i].hash == hash) return i;
+        slot = (slot + 1) & self->table_mask;
+    }
+    return -1;
+}
+
+static void index_init(JoinIndex *self, char **ptrs, int *lens,
+    long *blocks, long len)
+{
+    MEMZERO(self, JoinIndex, 1);
+    self->ptrs = ptrs;
+    self->lens = lens;
+    self->blocks = blocks;
+    self->len = len;
+    self->stamp = ALLOC_N(long, len > 0 ? len : 1);
+    MEMZERO(self->stamp, long, len > 0 ? len : 1);
+    index_lengths(self);
+}
+
+/*
+ * Indexes the segments of the len right strings at ptrs with the lengths
+ * lens in the blocks, which may be NULL, for the maximum distance k >= 0.
+ */
+void join_index_segments(JoinIndex *self, char **ptrs, int *lens,
+    long *blocks, long len, int k)
+{
+    long i, n = 0;
+    int s, pos, seg_len;
+
+    index_init(self, ptrs, lens, blocks, len);
+    self->k = k;
+    for (i = 0; i < len; i++) if (lens[i] > k) n += k + 1;
+    self->entries = ALLOC_N(JoinEntry, n > 0 ? n : 1);
+    for (i = 0; i < len; i++) {
+        if (lens[i] <= k) continue;
+        for (s = 0; s <= k; s++) {
+            JoinEntry *e = self->entries + self->entries_len++;
+            segment_bounds(lens[i], k, s, &pos, &seg_len);
+            e->hash = BLOCK_HASH(self,
+                segment_hash(ptrs[i] + pos, seg_len, lens[i], s),
+                blocks ? blocks[i] : 0);
+            e->id = i;
+            e->key = s;
+            e->c = 0;
+            e->pos = 0;
+        }
+    }
+    index_entries(self);
+}
+
+static unsigned token_freq(JoinIndex *self, int occ, int c)
+{
+    return occ < JOIN_OCCURRENCES ? self->freq[occ * 256 + c] : UINT_MAX;
+}
+
+static int compare_tokens(const void *a, const void *b)
+{
+    const JoinToken *x = (const JoinToken *) a, *y = (const JoinToken *) b;
+
+    if (x->freq != y->freq) return x->freq < y->freq ? -1 : 1;
+    if (x->occ != y->occ) return x->occ < y->occ ? -1 : 1;
+    return x->c - y->c;
+}
+
+/*
+ * Computes the tokens of ptr into self->tokens, rarest first.
+ */
+static void string_tokens(JoinIndex *self, const char *ptr, int len)
+{
+    int counts[256], i, c;
+
+    if (len > self->tokens_size) {
+        self->tokens_size = len;
+        REALLOC_N(self->tokens, JoinToken, len);
+    }
+    for (i = 0; i < len; i++) counts[FOLD(self, (unsigned char) ptr[i])] = 0;
+    for (i = 0; i < len; i++) {
+        c = FOLD(self, (unsigned char) ptr[i]);
+        self->tokens[i].c = c;
+        self->tokens[i].occ = counts[c]++;
+        self->tokens[i].freq = token_freq(self, self->tokens[i].occ, c);
+    }
+    qsort(self->tokens, len, sizeof(JoinToken), compare_tokens);
+}
+
+/*
+ * Returns how many tokens strings of lengths a and b need to have in
+ * common.
+ */
+static int pair_overlap(JoinIndex *self, double a, double b)
+{
+    return (int) ceil(self->overlap * a * b / (a + b) - EPSILON);
+}
+
+/*
+ * Returns how many of its tokens a string of length len needs to have in
+ * common with any string, it can be similar enough to.
+ */
+static int min_overlap(JoinIndex *self, int len)
+{
+    double other = ceil(len * self->ratio - EPSILON);
+
+    return pair_overlap(self, len, other < 1 ? 1 : other);
+}
+
+/*
+ * Indexes the tokens of the len right strings at ptrs with the lengths
+ * lens in the blocks, which may be NULL, that are needed to find the
+ * strings with a Jaro similarity of at least jaro, ignoring case, if fold
+ * is true.
+ */
+void join_index_tokens(JoinIndex *self, char **ptrs, int *lens,
+    long *blocks, long len, double jaro, int fold)
+{
+    long i, n = 0;
+    int t, prefix;
+
+    index_init(self, ptrs, lens, blocks, len);
+    self->k = -1;
+    self->fold = fold;
+    self->overlap = 3 * jaro - 1;
+    self->ratio = 3 * jaro - 2;
+    if (self->overlap <= EPSILON) {
+        /* strings without any common characters could be similar enough */
+        self->all = 1;
+        return;
+    }
+    self->counts = ALLOC_N(int, len > 0 ? len : 1);
+    self->freq = ALLOC_N(unsigned, 256 * JOIN_OCCURRENCES);
+    MEMZERO(self->freq, unsigned, 256 * JOIN_OCCURRENCES);
+    for (i = 0; i < len; i++) {
+        string_tokens(self, ptrs[i], lens[i]);
+        for (t = 0; t < lens[i]; t++) {
+            if (self->tokens[t].occ < JOIN_OCCURRENCES) {
+                self->freq[self->tokens[t].occ * 256 + self->tokens[t].c]++;
+            }
+        }
+    }
+    for (i = 0; i < len; i++) {
+        prefix = lens[i] - min_overlap(self, lens[i]) + 1;
+        if (prefix > 0) n += prefix < lens[i] ? prefix : lens[i];
+    }
+    self->entries = ALLOC_N(JoinEntry, n > 0 ? n : 1);
+    for (i = 0; i < len; i++) {
+        prefix = lens[i] - min_overlap(self, lens[i]) + 1;
+        if (prefix > lens[i]) prefix = lens[i];
+        if (prefix <= 0) continue;
+        string_tokens(self, ptrs[i], lens[i]);
+        for (t = 0; t < prefix; t++) {
+            JoinEntry *e = self->entries + self->entries_len++;
+            e->hash = BLOCK_HASH(self,
+                token_hash(self->tokens[t].occ, self->tokens[t].c),
+                blocks ? blocks[i] : 0);
+            e->id = i;
+            e->key = self->tokens[t].occ;
+            e->c = self->tokens[t].c;
+            e->pos = t;
+        }
+    }
+    index_entries(self);
+}
+
+/*
+ * Adds all strings of length l in the block to the candidates.
+ */
+static long add_length(JoinIndex *self, long probe, int l, long block,
+    long *candidates, long n)
+{
+    long i, id;
+
+    if (l < 0 || l > self->max_len) return n;
+    for (i = self->len_start[l]; i < self->len_start[l + 1]; i++) {
+        id = self->by_len[i];
+        if (self->stamp[id] == probe + 1 || OTHER_BLOCK(self, id, block)) {
+            continue;
+        }
+        self->stamp[id] = probe + 1;
+        candidates[n++] = id;
+    }
+    return n;
+}
+
+static long segment_candidates(JoinIndex *self, long probe, const char *ptr,
+    int len, long block, long *candidates)
+{
+    int k = self->k, l, s, pos, seg_len, delta, slack, lo, hi, start;
+    long n = 0, i, from = (long) len - k, to = (long) len + k;
+    uint64_t hash;
+
+    if (from < 0) from = 0;
+    if (to > self->max_len) to = self->max_len;
+    for (l = (int) from; l <= to; l++) {
+        if (l <= k) {
+            n = add_length(self, probe, l, block, candidates, n);
+            continue;
+        }
+        delta = len - l;
+        slack = (k - (delta < 0 ? -delta : delta)) / 2;
+        for (s = 0; s <= k; s++) {
+            segment_bounds(l, k, s, &pos, &seg_len);
+            /*
+             * If segment s is the first unchanged one, there are at least
+             * s operations before it, so at most k - s after it.
+             */
+            lo = (delta < 0 ? delta : 0) - slack;
+            if (lo < delta - (k - s)) lo = delta - (k - s);
+            hi = (delta > 0 ? delta : 0) + slack;
+            if (hi > delta + (k - s)) hi = delta + (k - s);
+            for (start = pos + lo; start <= pos + hi; start++) {
+                if (start < 0 || start + seg_len > len) continue;
+                hash = BLOCK_HASH(self, segment_hash(ptr + start, seg_len,
+                    l, s), block);
+                if ((i = lookup(self, hash)) < 0) continue;
+                for (; i < self->entries_len &&
+                        self->entries[i].hash == hash; i++) {
+                    JoinEntry *e = self->entries + i;
+                    if (self->stamp[e->id] == probe + 1 || e->key != s ||
+                            self->lens[e->id] != l ||
+                            OTHER_BLOCK(self, e->id, block) ||
+                            memcmp(self->ptrs[e->id] + pos, ptr + start,
+                                seg_len) != 0) {
+                        continue;
+                    }
+                    self->stamp[e->id] = probe + 1;
+                    candidates[n++] = e->id;
+                }
+            }
+        }
+    }
+    return n;
+}
+
+/*
+ * Returns whether strings of lengths a and b can have the Jaro similarity
+ * needed.
+ */
+static int lengths_fit(JoinIndex *self, int a, int b)
+{
+    return a < b ? a >= b * self->ratio - EPSILON :
+        b >= a * self->ratio - EPSILON;
+}
+
+static long token_candidates(JoinIndex *self, long probe, const char *ptr,
+    int len, long block, long *candidates)
+{
+    int t, prefix = len - min_overlap(self, len) + 1, l, b, rest;
+    long n = 0, i, m;
+    uint64_t hash;
+
+    if (len == 0 || self->all) {
+        for (l = 0; l <= self->max_len; l++) {
+            if (self->all ? lengths_fit(self, len, l) : l == 0) {
+                n = add_length(self, probe, l, block, candidates, n);
+            }
+        }
+        return n;
+    }
+    if (prefix > len) prefix = len;
+    string_tokens(self, ptr, len);
+    for (t = 0; t < prefix; t++) {
+        JoinToken *token = self->tokens + t;
+        hash = BLOCK_HASH(self, token_hash(token->occ, token->c), block);
+        if ((i = lookup(self, hash)) < 0) continue;
+        for (; i < self->entries_len && self->entries[i].hash == hash; i++) {
+            JoinEntry *e = self->entries + i;
+            if (e->key != token->occ || e->c != token->c ||
+                    OTHER_BLOCK(self, e->id, block)) {
+                continue;
+            }
+            b = self->lens[e->id];
+            if (self->stamp[e->id] != probe + 1) {
+                if (!lengths_fit(self, len, b)) continue;
+                self->stamp[e->id] = probe + 1;
+                self->counts[e->id] = 0;
+                candidates[n++] = e->id;
+            } else if (self->counts[e->id] < 0) {
+                continue;
+            }
+            /* common tokens so far, this one, and at most rest more */
+            rest = len - t - 1 < b - e->pos - 1 ? len - t - 1 : b - e->pos - 1;
+            if (self->counts[e->id] + 1 + rest < pair_overlap(self, len, b)) {
+                self->counts[e->id] = -1;
+            } else {
+                self->counts[e->id]++;
+            }
+        }
+    }
+    for (i = 0, m = 0; i < n; i++) {
+        if (self->counts[candidates[i]] > 0) candidates[m++] = candidates[i];
+    }
+    return m;
+}
+
+static int compare_ids(const void *a, const void *b)
+{
+    long x = *(const long *) a, y = *(const long *) b;
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * Stores the ids of the right strings, that might be similar enough to the
+ * left string ptr of length len in the block (ignored without blocks), in
+ * candidates, which needs room for all of them, in ascending order, and
+ * returns how many there are. probe has to be different for every left
+ * string.
+ */
+long join_candidates(JoinIndex *self, long probe, const char *ptr, int len,
+    long block, long *candidates)
+{
+    long n = self->k >= 0 ?
+        segment_candidates(self, probe, ptr, len, block, candidates) :
+        token_candidates(self, probe, ptr, len, block, candidates);
+
+    qsort(candidates, n, sizeof(long), compare_ids);
+    return n;
+}
+
+void join_index_destroy(JoinIndex *self)
+{
+    xfree(self->by_len);
+    xfree(self->len_start);
+    xfree(self->entries);
+    xfree(self->table);
+    xfree(self->freq);
+    xfree(self->tokens);
+    xfree(self->stamp);
+    xfree(self->counts);
+    MEMZERO(self, JoinIndex, 1);
+}
+
+/*
+ * Clusters are kept in a union-find forest: parents[i] is the index of the
+ * parent of the string i, or i itself for the root of a cluster.
+ */
+
+/*
+ * Returns the root of the cluster of i, halving the path to it.
+ */
+long join_find(long *parents, long i)
+{
+    while (parents[i] != i) {
+        parents[i] = parents[parents[i]];
+        i = parents[i];
+    }
+    return i;
+}
+
+/*
+ * Merges the clusters of i and j, the lower root becoming the root of both.
+ */
+void join_union(long *parents, long i, long j)
+{
+    i = join_find(parents, i);
+    j = join_find(parents, j);
+    if (i < j) {
+        parents[j] = i;
+    } else {
+        parents[i] = j;
+    }
+}
+  /* vim: set et cindent sw=4 ts=4: */
@@ -0,0 +1,62 @@
+#ifndef JOIN_H_INCLUDED
+#define JOIN_H_INCLUDED
+
+#include "ruby.h"
+#include <stdint.h>
+
+#define JOIN_OCCURRENCES    64      /* of a character, ranked by frequency */
+
+typedef struct JoinEntryStruct {
+    uint64_t    hash;
+    long        id;                 /* of the right string */
+    int         key;                /* segment, or occurrence of the token */
+    int         c;                  /* character of the token */
+    int         pos;                /* of the token in the order */
+} JoinEntry;
+
+typedef struct JoinTokenStruct {
+    unsigned    freq;
+    int         occ;
+    int         c;
+} JoinToken;
+
+/*
+ * Index of the right strings of a join, to find the candidates among them
+ * for a left string.
+ */
+typedef struct JoinIndexStruct {
+    char        **ptrs;
+    int         *lens;
+    long        *blocks;            /* of the strings, or NULL */
+    long        len;
+    int         k;                  /* maximum distance, or -1 for tokens */
+    double      overlap;            /* 3 j - 1 for the minimum Jaro j */
+    double      ratio;              /* 3 j - 2 */
+    int         fold;
+    int         all;                /* whether nothing can be filtered */
+    long        *by_len;            /* ids sorted by length */
+    long        *len_start;         /* into by_len, for every length */
+    int         max_len;
+    JoinEntry   *entries;           /* sorted by hash */
+    long        entries_len;
+    long        *table;             /* first entry of every hash, or -1 */
+    long        table_mask;
+    unsigned    *freq;              /* of the tokens */
+    JoinToken   *tokens;            /* of the string probed */
+    int         tokens_size;
+    long        *stamp;             /* last probe finding each string + 1 */
+    int         *counts;            /* common tokens found, or -1 */
+} JoinIndex;
+
+void join_index_segments(JoinIndex *self, char **ptrs, int *lens,
+    long *blocks, long len, int k);
+void join_index_tokens(JoinIndex *self, char **ptrs, int *lens,
+    long *blocks, long len, double jaro, int fold);
+long join_candidates(JoinIndex *self, long probe, const char *ptr, int len,
+    long block, long *candidates);
+void join_index_destroy(JoinIndex *self);
+long join_find(long *parents, long i);
+void join_union(long *parents, long i, long j);
+
+#endif
+  /* vim: set et cindent sw=4 ts=4: */
@@ -0,0 +1,104 @@
+#include "ruby.h"
+#include "mapped_file.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+/*
+ * Maps the file at path into memory. Returns 0 on success, and -1 with errno
+ * set otherwise. Empty files aren't mapped, their ptr is NULL.
+ */
+int mapped_file_open(MappedFile *self, const char *path)
+{
+    struct stat st;
+    int fd, saved;
+
+    self->ptr = NULL;
+    self->len = 0;
+    self->mapped = 0;
+    fd = open(path, O_RDONLY | O_BINARY);
+    if (fd < 0) return -1;
+    if (fstat(fd, &st) < 0) goto fail;
+    if (!S_ISREG(st.st_mode)) {
+        errno = EINVAL;
+        goto fail;
+    }
+    self->len = (size_t) st.st_size;
+    if (self->len == 0) {
+        close(fd);
+        return 0;
+    }
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H)
+    self->ptr = mmap(NULL, self->len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (self->ptr != MAP_FAILED) {
+        self->mapped = 1;
+#ifdef HAVE_MADVISE
+        madvise(self->ptr, self->len, MADV_SEQUENTIAL);
+#endif
+        close(fd);
+        return 0;
+    }
+    self->ptr = NULL;
+#endif
+    {
+        size_t done = 0;
+        ssize_t n;
+
+        self->ptr = malloc(self->len);
+        if (!self->ptr) {
+            errno = ENOMEM;
+            goto fail;
+        }
+        while (done < self->len) {
+            n = read(fd, self->ptr + done, self->len - done);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                goto fail;
+            }
+            if (n == 0) {
+                errno = EIO;
+                goto fail;
+            }
+            done += (size_t) n;
+        }
+    }
+    close(fd);
+    return 0;
+fail:
+    saved = errno;
+    free(self->ptr);
+    self->ptr = NULL;
+    self->len = 0;
+    close(fd);
+    errno = saved;
+    return -1;
+}
+
+void mapped_file_close(MappedFile *self)
+{
+    if (!self->ptr) return;
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H)
+    if (self->mapped) {
+        munmap(self->ptr, self->len);
+    } else
+#endif
+    {
+        free(self->ptr);
+    }
+    self->ptr = NULL;
+    self->len = 0;
+    self->mapped = 0;
+}
+  /* vim: set et cindent sw=4 ts=4: */
@@ -0,0 +1,20 @@
+#ifndef MAPPED_FILE_H_INCLUDED
+#define MAPPED_FILE_H_INCLUDED
+
+#include <stddef.h>
+
+/*
+ * The contents of a file, mapped into memory read-only, or read into a
+ * buffer, where mmap isn't available. The functions don't use the Ruby API.
+ */
+typedef struct MappedFileStruct {
+    char        *ptr;
+    size_t      len;
+    int         mapped;
+} MappedFile;
+
+int mapped_file_open(MappedFile *self, const char *path);
+void mapped_file_close(MappedFile *self);
+
+#endif
+  /* vim: set et cindent sw=4 ts=4: */
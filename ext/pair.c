@@ -1,6 +1,12 @@
 #include "pair.h"
 
-#define DEBUG 0
+/*
+ * The pair distance counts the pairs, that two strings have in common, as
+ * multisets: a pair, that occurs n times in one string and m times in the
+ * other, is in common min(n, m) times. The pairs of the pattern are counted
+ * once, those of a string are counted in a hash table, so a comparison takes
+ * time linear in the lengths of both strings.
+ */
 
 static int predict_length(VALUE tokens)
 {
@@ -18,61 +24,143 @@ PairArray *PairArray_new(VALUE tokens)
     int i, j, k, len = predict_length(tokens); 
     PairArray *pair_array = ALLOC(PairArray);
     Pair *pairs = ALLOC_N(Pair, len);
-    MEMZERO(pairs, Pair, len);
     pair_array->pairs = pairs;
     pair_array->len = len;
     for (i = 0, k = 0; i < RARRAY(tokens)->len; i++) {
         VALUE t = rb_ary_entry(tokens, i);
         char *string = RSTRING(t)->ptr;
         for (j = 0; j < RSTRING(t)->len - 1; j++) {
-            pairs[k].fst = string[j];
-            pairs[k].snd = string[j + 1];
-            pairs[k].status = PAIR_ACTIVE;
-            k++;
+            pairs[k++] = pair_new(string[j], string[j + 1]);
         }
     }
     return pair_array;
 }
 
-void pair_array_reactivate(PairArray *self)
+void pair_array_destroy(PairArray *pair_array)
+{
+    if (!pair_array) return;
+    free(pair_array->pairs);
+    free(pair_array);
+}
+
+PairCounts *PairCounts_new(PairArray *pair_array)
 {
-    int i;
-    for (i = 0; i < self->len; i++) { 
-        self->pairs[i].status = PAIR_ACTIVE;
+    int i, *counts = ALLOC_N(int, 1 << 16);
+    PairCounts *self = ALLOC(PairCounts);
+
+    MEMZERO(counts, int, 1 << 16);
+    for (i = 0; i < pair_array->len; i++) counts[pair_array->pairs[i]]++;
+    for (i = 0, self->unique = 0; i < 1 << 16; i++) {
+        if (counts[i]) self->unique++;
     }
+    self->len = pair_array->len;
+    self->pairs = ALLOC_N(Pair, self->unique);
+    self->counts = ALLOC_N(int, self->unique);
+    for (i = 0, self->unique = 0; i < 1 << 16; i++) {
+        if (counts[i]) {
+            self->pairs[self->unique] = (Pair) i;
+            self->counts[self->unique] = counts[i];
+            self->unique++;
+        }
+    }
+    free(counts);
+    return self;
 }
 
-double pair_array_match(PairArray *self, PairArray *other)
+void pair_counts_destroy(PairCounts *self)
 {
-    int i, j, matches = 0;
-    int sum = self->len + other->len;
+    if (!self) return;
+    free(self->pairs);
+    free(self->counts);
+    free(self);
+}
+
+size_t pair_counts_memsize(PairCounts *self)
+{
+    if (!self) return 0;
+    return sizeof(PairCounts) + self->unique * (sizeof(Pair) + sizeof(int));
+}
+
+/*
+ * Number of slots of the hash table for len pairs, a power of two, so that
+ * it's at most half full.
+ */
+static int slots_for(int len)
+{
+    int slots = 16;
+    while (slots < 2 * len) slots <<= 1;
+    return slots;
+}
+
+size_t pair_counts_scratch_size(int len)
+{
+    return slots_for(len) * sizeof(PairSlot);
+}
+
+#define PAIR_HASH(pair, mask) (((uint32_t) (pair) * 40503u >> 4) & (mask))
+
+static void slots_add(PairSlot *slots, int mask, Pair pair)
+{
+    int i = PAIR_HASH(pair, mask);
+    while (slots[i].count && slots[i].pair != pair) i = (i + 1) & mask;
+    slots[i].pair = pair;
+    slots[i].count++;
+}
+
+static int slots_count(PairSlot *slots, int mask, Pair pair)
+{
+    int i = PAIR_HASH(pair, mask);
+    while (slots[i].count) {
+        if (slots[i].pair == pair) return slots[i].count;
+        i = (i + 1) & mask;
+    }
+    return 0;
+}
+
+static double counts_match(PairCounts *self, PairSlot *slots, int mask,
+    int other_len)
+{
+    int i, n, matches = 0;
+    int sum = self->len + other_len;
+
     if (sum == 0) return 1.0;
-    for (i = 0; i < self->len; i++) {
-        for (j = 0; j < other->len; j++) {
-#if DEBUG
-            pair_print(self->pairs[i]);
-            putc(' ', stdout);
-            pair_print(other->pairs[j]);
-            printf(" -> %d\n", pair_equal(self->pairs[i], other->pairs[j]));
-#endif
-            if (pair_equal(self->pairs[i], other->pairs[j])) {
-                matches++;
-                other->pairs[j].status = PAIR_INACTIVE;
-                break;
-            }
-        }
+    for (i = 0; i < self->unique; i++) {
+        n = slots_count(slots, mask, self->pairs[i]);
+        matches += n < self->counts[i] ? n : self->counts[i];
     }
     return ((double) (2 * matches)) / sum;
 }
 
-void pair_print(Pair pair)
+/*
+ * Returns the pair distance of the pairs counted in self and those in
+ * other. scratch has to point to pair_counts_scratch_size(other->len) bytes.
+ */
+double pair_counts_match(PairCounts *self, PairArray *other, void *scratch)
 {
-    printf("%c%c (%d)", pair.fst, pair.snd, pair.status);
+    PairSlot *slots = (PairSlot *) scratch;
+    int i, mask = slots_for(other->len) - 1;
+
+    MEMZERO(slots, PairSlot, mask + 1);
+    for (i = 0; i < other->len; i++) slots_add(slots, mask, other->pairs[i]);
+    return counts_match(self, slots, mask, other->len);
 }
 
-void pair_array_destroy(PairArray *pair_array)
+/*
+ * Like pair_counts_match, but takes the pairs from the unsplit string of
+ * length len. scratch has to point to pair_counts_scratch_size(len - 1)
+ * bytes.
+ */
+double pair_counts_match_string(PairCounts *self, const char *string,
+    int len, void *scratch)
 {
-    free(pair_array->pairs);
-    free(pair_array);
+    PairSlot *slots = (PairSlot *) scratch;
+    int i, other_len = len > 1 ? len - 1 : 0;
+    int mask = slots_for(other_len) - 1;
+
+    MEMZERO(slots, PairSlot, mask + 1);
+    for (i = 0; i < other_len; i++) {
+        slots_add(slots, mask, pair_new(string[i], string[i + 1]));
+    }
+    return counts_match(self, slots, mask, other_len);
 }
   /* vim: set et cindent sw=4 ts=4: */ 
@@ -2,28 +2,49 @@
 #define PAIR_H_INCLUDED
 
 #include "ruby.h"
+#include <stdint.h>
 
-enum { PAIR_ACTIVE = 1, PAIR_INACTIVE = 2 };
+/*
+ * A pair of adjacent characters, encoded as a 16-bit number.
+ */
+typedef uint16_t Pair;
 
-typedef struct PairStruct {
-    char fst;
-    char snd;
-    char status;
-    char __align;
-} Pair;
+#define pair_new(fst, snd) \
+    ((Pair) (((unsigned char) (fst) << 8) | (unsigned char) (snd)))
 
 typedef struct PairArrayStruct {
     Pair *pairs;
     int len;
 } PairArray;
 
+/*
+ * The multiset of the pairs of a PairArray: its distinct pairs in ascending
+ * order, how often each of them occurs, and the total number of pairs.
+ */
+typedef struct PairCountsStruct {
+    Pair *pairs;
+    int *counts;
+    int unique;
+    int len;
+} PairCounts;
+
+/*
+ * Open addressing hash table, that counts the pairs of a string.
+ */
+typedef struct PairSlotStruct {
+    int count;
+    Pair pair;
+} PairSlot;
+
 PairArray *PairArray_new(VALUE tokens);
-#define pair_equal(a, b) \
-    ((a).fst == (b).fst && (a).snd == (b).snd && ((a).status & (b).status & PAIR_ACTIVE))
-double pair_array_match(PairArray *self, PairArray *other);
 void pair_array_destroy(PairArray *pair_array);
-void pair_print(Pair pair);
-void pair_array_reactivate(PairArray *self);
+PairCounts *PairCounts_new(PairArray *pair_array);
+void pair_counts_destroy(PairCounts *self);
+size_t pair_counts_memsize(PairCounts *self);
+size_t pair_counts_scratch_size(int len);
+double pair_counts_match(PairCounts *self, PairArray *other, void *scratch);
+double pair_counts_match_string(PairCounts *self, const char *string,
+    int len, void *scratch);
 
 #endif
   /* vim: set et cindent sw=4 ts=4: */ 
@@ -0,0 +1,338 @@
+#include "pattern_mask.h"
+#include <ctype.h>
+#include <limits.h>
+
+/*
+ * Bit-parallel edit distance after G. Myers, "A fast bit-vector algorithm
+ * for approximate string matching based on dynamic programming" (1999),
+ * using H. Hyyrö's formulation for multi-word blocks. Every pattern
+ * character is a bit of the vertical delta vectors, so a whole DP column is
+ * advanced with a handful of word operations per text character.
+ */
+
+PatternMask *PatternMask_new(const char *pattern, int len)
+{
+    int i, words = (len + PATTERN_MASK_WORD_BITS - 1) / PATTERN_MASK_WORD_BITS;
+    PatternMask *self = ALLOC(PatternMask);
+    self->len = len;
+    self->words = words;
+    self->masks = ALLOC_N(uint64_t, 256 * words);
+    MEMZERO(self->masks, uint64_t, 256 * words);
+    for (i = 0; i < len; i++) {
+        pattern_mask_row(self, pattern[i])[i / PATTERN_MASK_WORD_BITS] |=
+            (uint64_t) 1 << (i % PATTERN_MASK_WORD_BITS);
+    }
+    return self;
+}
+
+/*
+ * Like PatternMask_new, but every pattern character also sets its bit in
+ * the rows of all characters, that are equal to it ignoring case: they are
+ * upcased, if they are lower case letters, the way Jaro always compared
+ * them.
+ */
+PatternMask *PatternMask_new_folded(const char *pattern, int len)
+{
+    PatternMask *self = PatternMask_new(pattern, len);
+    uint64_t *folded = ALLOC_N(uint64_t, 256 * self->words);
+    int c, w, upper[256];
+
+    MEMZERO(folded, uint64_t, 256 * self->words);
+    for (c = 0; c < 256; c++) {
+        upper[c] = islower(c) ? toupper(c) & 0xff : c;
+        for (w = 0; w < self->words; w++) {
+            folded[upper[c] * self->words + w] |=
+                pattern_mask_row(self, c)[w];
+        }
+    }
+    for (c = 0; c < 256; c++) {
+        MEMCPY(pattern_mask_row(self, c), folded + upper[c] * self->words,
+            uint64_t, self->words);
+    }
+    free(folded);
+    return self;
+}
+
+/*
+ * Advances one block of the vertical delta vectors by a text character,
+ * taking the horizontal delta hin coming in at the top of the block and
+ * returning the one leaving it at bit high.
+ */
+static int advance_block(uint64_t *pv, uint64_t *mv, uint64_t eq,
+    uint64_t high, int hin)
+{
+    uint64_t xv, xh, ph, mh;
+    int hout = 0;
+
+    xv = eq | *mv;
+    if (hin < 0) eq |= 1;
+    xh = (((eq & *pv) + *pv) ^ *pv) | eq;
+    ph = *mv | ~(xh | *pv);
+    mh = *pv & xh;
+    if (ph & high) {
+        hout = 1;
+    } else if (mh & high) {
+        hout = -1;
+    }
+    ph <<= 1;
+    mh <<= 1;
+    if (hin < 0) {
+        mh |= 1;
+    } else if (hin > 0) {
+        ph |= 1;
+    }
+    *pv = mh | ~(xv | ph);
+    *mv = ph & xv;
+    return hout;
+}
+
+/*
+ * Runs the pattern over text and returns the score of the last pattern row.
+ * If search is true, the top row is all zeros, so that a match may start
+ * anywhere, and the minimum score over all text positions is returned.
+ * Otherwise k + 1 is returned as soon as the score exceeds k by more than
+ * the number of text characters left, since every character can lower it by
+ * at most one.
+ */
+static int pattern_mask_run(PatternMask *self, const char *text,
+    int text_len, uint64_t *scratch, int search, int k)
+{
+    int i, w, hin, score = self->len, min = self->len;
+    int last = self->words - 1;
+    uint64_t high;
+
+    if (self->len == 0) return search ? 0 : (text_len > k ? k + 1 : text_len);
+    high = (uint64_t) 1 << ((self->len - 1) % PATTERN_MASK_WORD_BITS);
+    if (self->words == 1) {
+        uint64_t pv = ~(uint64_t) 0, mv = 0;
+        for (i = 0; i < text_len; i++) {
+            score += advance_block(&pv, &mv, *pattern_mask_row(self, text[i]),
+                high, search ? 0 : 1);
+            if (score < min) min = score;
+            if (!search && score - (text_len - 1 - i) > k) return k + 1;
+        }
+    } else {
+        uint64_t *pv = scratch, *mv = scratch + self->words;
+        for (w = 0; w <= last; w++) {
+            pv[w] = ~(uint64_t) 0;
+            mv[w] = 0;
+        }
+        for (i = 0; i < text_len; i++) {
+            uint64_t *eq = pattern_mask_row(self, text[i]);
+            hin = search ? 0 : 1;
+            for (w = 0; w < last; w++) {
+                hin = advance_block(pv + w, mv + w, eq[w],
+                    (uint64_t) 1 << (PATTERN_MASK_WORD_BITS - 1), hin);
+            }
+            score += advance_block(pv + last, mv + last, eq[last], high, hin);
+            if (score < min) min = score;
+            if (!search && score - (text_len - 1 - i) > k) return k + 1;
+        }
+    }
+    if (search) return min;
+    return score > k ? k + 1 : score;
+}
+
+int pattern_mask_distance(PatternMask *self, const char *text, int text_len,
+    uint64_t *scratch)
+{
+    return pattern_mask_run(self, text, text_len, scratch, 0, INT_MAX - 1);
+}
+
+/*
+ * Like pattern_mask_distance, but returns k + 1, as soon as it is clear,
+ * that the distance is greater than k.
+ */
+int pattern_mask_distance_bounded(PatternMask *self, const char *text,
+    int text_len, int k, uint64_t *scratch)
+{
+    if (k < 0) return k + 1;
+    return pattern_mask_run(self, text, text_len, scratch, 0, k);
+}
+
+int pattern_mask_search(PatternMask *self, const char *text, int text_len,
+    uint64_t *scratch)
+{
+    return pattern_mask_run(self, text, text_len, scratch, 1, 0);
+}
+
+/*
+ * Like pattern_mask_search, but returns k + 1 as soon as it is clear, that
+ * the pattern doesn't occur with at most k differences. For multi-word
+ * patterns only the blocks up to the last one containing a cell <= k are
+ * advanced (Ukkonen's cut-off, block-wise as in Myers' paper), so the work
+ * per text character is proportional to k instead of the pattern length.
+ */
+int pattern_mask_search_bounded(PatternMask *self, const char *text,
+    int text_len, int k, uint64_t *scratch)
+{
+    int i, b, y, carry, rows, min = self->len;
+    int last = self->words - 1;
+    uint64_t *pv, *mv, *eq, top = (uint64_t) 1 << (PATTERN_MASK_WORD_BITS - 1);
+    int64_t *score;
+
+    if (k < 0) return k + 1;
+    if (self->words <= 1 || k >= self->len) {
+        min = pattern_mask_search(self, text, text_len, scratch);
+        return min > k ? k + 1 : min;
+    }
+    pv = scratch;
+    mv = scratch + self->words;
+    score = (int64_t *) (scratch + 2 * self->words);
+#define BLOCK_HIGH(b) \
+    ((b) == last ? (uint64_t) 1 << ((self->len - 1) % PATTERN_MASK_WORD_BITS) : top)
+#define BLOCK_ROWS(b) \
+    ((b) == last ? self->len - last * PATTERN_MASK_WORD_BITS : PATTERN_MASK_WORD_BITS)
+    y = k > 0 ? (k - 1) / PATTERN_MASK_WORD_BITS : 0;
+    for (b = 0; b <= y; b++) {
+        pv[b] = ~(uint64_t) 0;
+        mv[b] = 0;
+        score[b] = b * PATTERN_MASK_WORD_BITS + BLOCK_ROWS(b);
+    }
+    for (i = 0; i < text_len; i++) {
+        eq = pattern_mask_row(self, text[i]);
+        carry = 0;
+        for (b = 0; b <= y; b++) {
+            carry = advance_block(pv + b, mv + b, eq[b], BLOCK_HIGH(b), carry);
+            score[b] += carry;
+        }
+        if (score[y] - carry <= k && y < last &&
+                ((eq[y + 1] & 1) || carry < 0)) {
+            y++;
+            rows = BLOCK_ROWS(y);
+            pv[y] = ~(uint64_t) 0;
+            mv[y] = 0;
+            score[y] = score[y - 1] - carry + rows +
+                advance_block(pv + y, mv + y, eq[y], BLOCK_HIGH(y), carry);
+        } else {
+            while (y > 0 && score[y] >= k + PATTERN_MASK_WORD_BITS) y--;
+        }
+        if (y == last && score[y] < min) min = score[y];
+    }
+#undef BLOCK_HIGH
+#undef BLOCK_ROWS
+    return min > k ? k + 1 : min;
+}
+
+/*
+ * Incremental search, one text character at a time: state holds the
+ * vertical delta vectors (2 * words), set up by pattern_mask_start, and
+ * pattern_mask_step returns by how much the score of the last row changes,
+ * when the text character c is added. The score starts out as the length
+ * of the pattern, like in pattern_mask_search.
+ */
+void pattern_mask_start(PatternMask *self, uint64_t *state)
+{
+    int w;
+
+    for (w = 0; w < self->words; w++) {
+        state[w] = ~(uint64_t) 0;
+        state[self->words + w] = 0;
+    }
+}
+
+int pattern_mask_step(PatternMask *self, uint64_t *state, char c)
+{
+    uint64_t *eq = pattern_mask_row(self, c), *pv = state,
+        *mv = state + self->words;
+    int w, hin = 0, last = self->words - 1;
+
+    if (self->len == 0) return 0;
+    for (w = 0; w < last; w++) {
+        hin = advance_block(pv + w, mv + w, eq[w],
+            (uint64_t) 1 << (PATTERN_MASK_WORD_BITS - 1), hin);
+    }
+    return advance_block(pv + last, mv + last, eq[last],
+        (uint64_t) 1 << ((self->len - 1) % PATTERN_MASK_WORD_BITS), hin);
+}
+
+/*
+ * Returns true, if the pattern occurs in text with at most k differences.
+ * For single-word patterns the scan stops at the first such occurrence.
+ */
+int pattern_mask_occurs(PatternMask *self, const char *text, int text_len,
+    int k, uint64_t *scratch)
+{
+    uint64_t pv = ~(uint64_t) 0, mv = 0, high;
+    int i, score = self->len;
+
+    if (k < 0) return 0;
+    if (score <= k) return 1;
+    if (self->words > 1) {
+        return pattern_mask_search_bounded(self, text, text_len, k,
+            scratch) <= k;
+    }
+    /* advance_block for a single block with hin = 0, without branches */
+    high = (uint64_t) 1 << (self->len - 1);
+    for (i = 0; i < text_len; i++) {
+        uint64_t eq = *pattern_mask_row(self, text[i]), xv, xh, ph, mh;
+        xv = eq | mv;
+        xh = (((eq & pv) + pv) ^ pv) | eq;
+        ph = mv | ~(xh | pv);
+        mh = pv & xh;
+        score += ((ph & high) != 0) - ((mh & high) != 0);
+        if (score <= k) return 1;
+        ph <<= 1;
+        mh <<= 1;
+        pv = mh | ~(xv | ph);
+        mv = ph & xv;
+    }
+    return 0;
+}
+
+static int count_bits(uint64_t x)
+{
+    x = x - ((x >> 1) & 0x5555555555555555ULL);
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+    return (int) ((x * 0x0101010101010101ULL) >> 56);
+}
+
+/*
+ * Returns the length of the longest common subsequence of the pattern and
+ * text, using the bit-vector algorithm of L. Allison and T. I. Dix, "A
+ * bit-string longest-common-subsequence algorithm" (1986), in H. Hyyrö's
+ * formulation: the zero bits of v mark the pattern rows, where the LCS of
+ * the prefixes grows. Since u is a subset of v, v - u has no borrows, so
+ * only the addition carries from one block into the next.
+ */
+int pattern_mask_lcs(PatternMask *self, const char *text, int text_len,
+    uint64_t *scratch)
+{
+    int i, w, lcs = 0, last = self->words - 1;
+    uint64_t *v, *eq, u, sum, carry, rest;
+
+    if (self->len == 0) return 0;
+    rest = self->len % PATTERN_MASK_WORD_BITS ?
+        ((uint64_t) 1 << (self->len % PATTERN_MASK_WORD_BITS)) - 1 :
+        ~(uint64_t) 0;
+    if (self->words == 1) {
+        uint64_t v = ~(uint64_t) 0;
+        for (i = 0; i < text_len; i++) {
+            u = v & *pattern_mask_row(self, text[i]);
+            v = (v + u) | (v - u);
+        }
+        return count_bits(~v & rest);
+    }
+    v = scratch;
+    for (w = 0; w <= last; w++) v[w] = ~(uint64_t) 0;
+    for (i = 0; i < text_len; i++) {
+        eq = pattern_mask_row(self, text[i]);
+        for (w = 0, carry = 0; w <= last; w++) {
+            u = v[w] & eq[w];
+            sum = v[w] + u + carry;
+            carry = sum < v[w] || (carry && sum == v[w]);
+            v[w] = sum | (v[w] - u);
+        }
+    }
+    for (w = 0; w < last; w++) lcs += count_bits(~v[w]);
+    return lcs + count_bits(~v[last] & rest);
+}
+
+void pattern_mask_destroy(PatternMask *self)
+{
+    if (!self) return;
+    free(self->masks);
+    free(self);
+}
+  /* vim: set et cindent sw=4 ts=4: */
@@ -0,0 +1,38 @@
+#ifndef PATTERN_MASK_H_INCLUDED
+#define PATTERN_MASK_H_INCLUDED
+
+#include "ruby.h"
+#include <stdint.h>
+
+#define PATTERN_MASK_WORD_BITS 64
+
+typedef struct PatternMaskStruct {
+    uint64_t    *masks;     /* 256 rows of words, one bit per pattern char */
+    int         words;
+    int         len;
+} PatternMask;
+
+PatternMask *PatternMask_new(const char *pattern, int len);
+PatternMask *PatternMask_new_folded(const char *pattern, int len);
+#define pattern_mask_row(self, c) \
+    ((self)->masks + (unsigned char) (c) * (self)->words)
+#define pattern_mask_scratch_len(self) \
+    ((self)->words > 1 ? 3 * (self)->words : 0)
+int pattern_mask_distance(PatternMask *self, const char *text, int text_len,
+    uint64_t *scratch);
+int pattern_mask_distance_bounded(PatternMask *self, const char *text,
+    int text_len, int k, uint64_t *scratch);
+int pattern_mask_search(PatternMask *self, const char *text, int text_len,
+    uint64_t *scratch);
+int pattern_mask_search_bounded(PatternMask *self, const char *text,
+    int text_len, int k, uint64_t *scratch);
+void pattern_mask_start(PatternMask *self, uint64_t *state);
+int pattern_mask_step(PatternMask *self, uint64_t *state, char c);
+int pattern_mask_occurs(PatternMask *self, const char *text, int text_len,
+    int k, uint64_t *scratch);
+int pattern_mask_lcs(PatternMask *self, const char *text, int text_len,
+    uint64_t *scratch);
+void pattern_mask_destroy(PatternMask *self);
+
+#endif
+  /* vim: set et cindent sw=4 ts=4: */
@@ -0,0 +1,456 @@
+#include "pattern_set.h"
+#include <stdlib.h>
+
+/*
+ * A set of patterns, that are searched in a text all at once, with at most
+ * k differences each (S. Wu and U. Manber, "Fast text searching allowing
+ * errors", 1992). A pattern split into k + 1 seeds can only occur with k
+ * differences, if one of its seeds occurs exactly (the pigeonhole
+ * principle). So the seeds of all patterns are put into an Aho-Corasick
+ * automaton (A. V. Aho and M. J. Corasick, "Efficient string matching",
+ * 1975), which finds them in one pass over the text, no matter how many
+ * there are, and only the surroundings of a seed, that occurs, are looked
+ * at closer.
+ *
+ * The occurrences of a pattern are the same as those of Levenshtein#search
+ * all: the last row of its search matrix is computed by the bit vectors of
+ * its pattern mask (see pattern_mask.c), and every run of consecutive text
+ * positions within k yields the first position with the lowest distance.
+ * An occurrence with d <= k differences spans at most m + d characters, so
+ * the vectors started m + k characters before the end of a seed yield the
+ * exact scores, that are within k, from there on. Every position within k
+ * is at most m + k characters after the end of one of the seeds, so the
+ * vectors of a pattern only run over those stretches of the text, and are
+ * started again, where they are too far apart.
+ *
+ * The edges of the automaton are stored in a hash table with linear
+ * probing, like those of a suffix automaton (see suffix_automaton.c).
+ */
+
+#define TABLE_SIZE(self) ((size_t) 1 << (64 - (self)->shift))
+
+static size_t edge_slot(PatternSet *self, int from, unsigned char c)
+{
+    size_t mask = TABLE_SIZE(self) - 1;
+    size_t i = (size_t) (((uint64_t) from << 8 | c) *
+        0x9e3779b97f4a7c15ULL >> self->shift);
+    SeedEdge *edge;
+
+    for (;; i = (i + 1) & mask) {
+        edge = self->table + i;
+        if (edge->from < 0 || (edge->from == from && edge->c == c)) return i;
+    }
+}
+
+static int edge_target(PatternSet *self, int from, unsigned char c)
+{
+    SeedEdge *edge = self->table + edge_slot(self, from, c);
+    return edge->from < 0 ? -1 : edge->to;
+}
+
+static void edge_set(PatternSet *self, int from, unsigned char c, int to)
+{
+    SeedEdge *edge = self->table + edge_slot(self, from, c);
+    edge->from = from;
+    edge->c = c;
+    edge->to = to;
+    edge->next = self->states[from].edges;
+    self->states[from].edges = (int) (edge - self->table);
+    if (from == 0) self->root[c] = to;
+}
+
+static int state_add(PatternSet *self)
+{
+    SeedState *state = self->states + self->states_len;
+    state->fail = 0;
+    state->output = -1;
+    state->seeds = -1;
+    state->edges = -1;
+    return self->states_len++;
+}
+
+static void seed_add(PatternSet *self, int pattern, int offset, int len)
+{
+    const char *seed = self->strings + self->patterns[pattern].offset +
+        offset;
+    PatternSeed *s = self->seeds + self->seeds_len;
+    int i, state, to;
+
+    for (i = 0, state = 0; i < len; i++, state = to) {
+        to = edge_target(self, state, (unsigned char) seed[i]);
+        if (to < 0) {
+            to = state_add(self);
+            edge_set(self, state, (unsigned char) seed[i], to);
+        }
+    }
+    s->pattern = pattern;
+    s->offset = offset;
+    s->len = len;
+    s->next = self->states[state].seeds;
+    self->states[state].seeds = self->seeds_len++;
+}
+
+/*
+ * Computes the failure links breadth first, so the link of a state always
+ * leads to a state, whose links are known already.
+ */
+static void link_states(PatternSet *self)
+{
+    SeedState *states = self->states;
+    int *queue = ALLOC_N(int, self->states_len), head = 0, tail = 1;
+    int u, v, f, e;
+    unsigned char c;
+
+    queue[0] = 0;
+    while (head < tail) {
+        u = queue[head++];
+        for (e = states[u].edges; e >= 0; e = self->table[e].next) {
+            v = self->table[e].to;
+            c = self->table[e].c;
+            if (u == 0) {
+                f = 0;
+            } else {
+                for (f = states[u].fail; f > 0 && edge_target(self, f, c) < 0;
+                    f = states[f].fail);
+                f = f > 0 ? edge_target(self, f, c) :
+                    (self->root[c] >= 0 ? self->root[c] : 0);
+            }
+            states[v].fail = f;
+            states[v].output = states[v].seeds >= 0 ? v : states[f].output;
+            queue[tail++] = v;
+        }
+    }
+    free(queue);
+}
+
+/*
+ * Copies the Array of Strings patterns into the set, and builds the
+ * automaton of their seeds for at most k differences.
+ */
+void pattern_set_init(PatternSet *self, VALUE patterns, int k)
+{
+    PatternEntry *entry;
+    VALUE string;
+    long offset;
+    size_t i, size, seeded_len;
+    int p, j, seed_len, rest, seed_offset;
+
+    self->len = (int) RARRAY(patterns)->len;
+    self->k = k;
+    self->max_len = 0;
+    self->vectors_len = 0;
+    for (p = 0, self->strings_len = 0; p < self->len; p++) {
+        self->strings_len += RSTRING(rb_ary_entry(patterns, p))->len;
+    }
+    self->strings = ALLOC_N(char, self->strings_len > 0 ? self->strings_len : 1);
+    self->patterns = ALLOC_N(PatternEntry, self->len > 0 ? self->len : 1);
+    self->unseeded = ALLOC_N(int, self->len > 0 ? self->len : 1);
+    self->unseeded_len = 0;
+    for (p = 0, offset = 0, seeded_len = 0; p < self->len; p++) {
+        string = rb_ary_entry(patterns, p);
+        entry = self->patterns + p;
+        entry->offset = offset;
+        entry->len = (int) RSTRING(string)->len;
+        MEMCPY(self->strings + offset, RSTRING(string)->ptr, char,
+            entry->len);
+        offset += entry->len;
+        entry->mask = PatternMask_new(self->strings + entry->offset,
+            entry->len);
+        entry->vectors = self->vectors_len;
+        self->vectors_len += 2 * entry->mask->words;
+        if (entry->len > self->max_len) self->max_len = entry->len;
+        if (entry->len <= k) {
+            self->unseeded[self->unseeded_len++] = p;
+        } else {
+            seeded_len += entry->len;
+        }
+    }
+    self->seeds = ALLOC_N(PatternSeed,
+        (size_t) (self->len - self->unseeded_len) * (k + 1) + 1);
+    self->seeds_len = 0;
+    self->states = ALLOC_N(SeedState, seeded_len + 1);
+    self->states_len = 0;
+    for (self->shift = 64, size = 1; size < 2 * seeded_len + 2; size <<= 1) {
+        self->shift--;
+    }
+    self->table = ALLOC_N(SeedEdge, size);
+    for (i = 0; i < size; i++) self->table[i].from = -1;
+    for (i = 0; i < 256; i++) self->root[i] = -1;
+    state_add(self);
+    for (p = 0; p < self->len; p++) {
+        entry = self->patterns + p;
+        if (entry->len <= k) continue;
+        seed_len = entry->len / (k + 1);
+        rest = entry->len % (k + 1);
+        for (j = 0, seed_offset = 0; j <= k; j++) {
+            seed_add(self, p, seed_offset, seed_len + (j < rest));
+            seed_offset += seed_len + (j < rest);
+        }
+    }
+    link_states(self);
+}
+
+PatternScan *PatternScan_new(PatternSet *set)
+{
+    PatternScan *self = ALLOC(PatternScan);
+    self->runs = ALLOC_N(PatternRun, set->len > 0 ? set->len : 1);
+    MEMZERO(self->runs, PatternRun, set->len > 0 ? set->len : 1);
+    self->vectors = ALLOC_N(uint64_t,
+        set->vectors_len > 0 ? set->vectors_len : 1);
+    self->touched = ALLOC_N(int, set->len > 0 ? set->len : 1);
+    self->touched_len = 0;
+    self->reverse = ALLOC_N(int, 2 * (set->max_len + 1));
+    self->scan = 0;
+    return self;
+}
+
+typedef struct HitsStruct {
+    PatternHit  *hits;
+    long        len;
+    long        size;
+    int         failed;
+} Hits;
+
+/*
+ * Finds the start of the occurrence of pattern ending at end with distance
+ * differences, like search_hit in amatch.c does for Levenshtein#search_all,
+ * and adds it to hits.
+ */
+static void hit_add(PatternSet *self, PatternScan *scan, Hits *hits,
+    int pattern, const char *text, long end, int distance)
+{
+    PatternEntry *entry = self->patterns + pattern;
+    const char *p_ptr = self->strings + entry->offset;
+    int i, m = entry->len, *p = scan->reverse, *c = p + m + 1, *t, weight;
+    int best;
+    long j, start = end, from = end - m - distance;
+    PatternHit *hit;
+
+    if (hits->failed) return;
+    if (hits->len == hits->size) {
+        hits->size = hits->size ? 2 * hits->size : 64;
+        hit = (PatternHit *) realloc(hits->hits,
+            hits->size * sizeof(PatternHit));
+        if (!hit) {
+            hits->failed = 1;
+            return;
+        }
+        hits->hits = hit;
+    }
+    if (from < 0) from = 0;
+    for (p[m] = 0, i = m - 1; i >= 0; i--) p[i] = p[i + 1] + 1;
+    best = p[0];
+    for (j = end - 1; j >= from; j--) {
+        c[m] = p[m] + 1;
+        for (i = m - 1; i >= 0; i--) {
+            weight = p[i + 1] + (p_ptr[i] != text[j]);
+            if (weight > p[i] + 1) weight = p[i] + 1;
+            if (weight > c[i + 1] + 1) weight = c[i + 1] + 1;
+            c[i] = weight;
+        }
+        if (c[0] < best) {
+            best = c[0];
+            start = j;
+        }
+        t = p;
+        p = c;
+        c = t;
+    }
+    hit = hits->hits + hits->len++;
+    hit->pattern = pattern;
+    hit->start = start;
+    hit->end = end;
+    hit->distance = distance;
+}
+
+static void run_offer(PatternSet *self, PatternScan *scan, Hits *hits,
+    int pattern, const char *text)
+{
+    PatternRun *run = scan->runs + pattern;
+
+    if (run->score <= self->k) {
+        if (!run->in_run || run->score < run->best_distance) {
+            run->best_end = run->pos;
+            run->best_distance = run->score;
+        }
+        run->in_run = 1;
+    } else if (run->in_run) {
+        hit_add(self, scan, hits, pattern, text, run->best_end,
+            run->best_distance);
+        run->in_run = 0;
+    }
+}
+
+/*
+ * Runs the vectors of pattern up to text position to, after one of its
+ * seeds has been found ending at from. Positions from there on are exact,
+ * if the vectors are started m + k characters before it.
+ */
+static void run_verify(PatternSet *self, PatternScan *scan, Hits *hits,
+    int pattern, const char *text, long from, long to)
+{
+    PatternEntry *entry = self->patterns + pattern;
+    PatternRun *run = scan->runs + pattern;
+    uint64_t *vectors = scan->vectors + entry->vectors;
+    long start = from - entry->len - self->k;
+
+    if (run->scan != scan->scan) {
+        run->scan = scan->scan;
+        run->pos = -1;
+        run->in_run = 0;
+        scan->touched[scan->touched_len++] = pattern;
+    }
+    if (start < 0) start = 0;
+    if (run->pos < start) {
+        if (run->in_run) {
+            hit_add(self, scan, hits, pattern, text, run->best_end,
+                run->best_distance);
+            run->in_run = 0;
+        }
+        pattern_mask_start(entry->mask, vectors);
+        run->pos = start;
+        run->score = entry->len;
+        run->exact_from = start > 0 ? from : 0;
+        if (run->pos >= run->exact_from) {
+            run_offer(self, scan, hits, pattern, text);
+        }
+    }
+    while (run->pos < to) {
+        run->score += pattern_mask_step(entry->mask, vectors,
+            text[run->pos++]);
+        if (run->pos >= run->exact_from) {
+            run_offer(self, scan, hits, pattern, text);
+        }
+    }
+}
+
+static int compare_hits(const void *x, const void *y)
+{
+    const PatternHit *a = (const PatternHit *) x, *b = (const PatternHit *) y;
+
+    if (a->start != b->start) return a->start < b->start ? -1 : 1;
+    if (a->pattern != b->pattern) return a->pattern - b->pattern;
+    if (a->end != b->end) return a->end < b->end ? -1 : 1;
+    return 0;
+}
+
+/*
+ * Finds the occurrences of all patterns in text with scan, which nobody
+ * else may use meanwhile. Stores them in *hits, sorted by start, pattern
+ * and end, which the caller has to free, and returns their number, or -1,
+ * if the memory for them couldn't be allocated. Doesn't call the Ruby API,
+ * so it can run without the global interpreter lock.
+ */
+long pattern_set_search(PatternSet *self, PatternScan *scan,
+    const char *text, long text_len, PatternHit **hits)
+{
+    SeedState *states = self->states;
+    PatternSeed *seed;
+    Hits found = { NULL, 0, 0, 0 };
+    PatternRun *run;
+    long i, end, limit;
+    int j, state = 0, to = 0, out, s;
+    unsigned char c;
+
+    scan->scan++;
+    scan->touched_len = 0;
+    for (j = 0; j < self->unseeded_len; j++) {
+        run_verify(self, scan, &found, self->unseeded[j], text, 0, text_len);
+    }
+    for (i = 0; i < text_len; i++) {
+        c = (unsigned char) text[i];
+        while (state > 0 && (to = edge_target(self, state, c)) < 0) {
+            state = states[state].fail;
+        }
+        state = state > 0 ? to : (self->root[c] >= 0 ? self->root[c] : 0);
+        for (out = states[state].output; out >= 0;
+                out = states[states[out].fail].output) {
+            for (s = states[out].seeds; s >= 0; s = seed->next) {
+                seed = self->seeds + s;
+                end = i + 1;
+                limit = end - seed->len - seed->offset +
+                    self->patterns[seed->pattern].len + self->k;
+                run_verify(self, scan, &found, seed->pattern, text, end,
+                    limit < text_len ? limit : text_len);
+            }
+        }
+    }
+    for (j = 0; j < scan->touched_len; j++) {
+        run = scan->runs + scan->touched[j];
+        if (run->in_run) {
+            hit_add(self, scan, &found, scan->touched[j], text,
+                run->best_end, run->best_distance);
+            run->in_run = 0;
+        }
+    }
+    if (found.failed) {
+        free(found.hits);
+        *hits = NULL;
+        return -1;
+    }
+    if (found.len > 1) {
+        qsort(found.hits, found.len, sizeof(PatternHit), compare_hits);
+    }
+    *hits = found.hits;
+    return found.len;
+}
+
+size_t pattern_set_memsize(PatternSet *self)
+{
+    size_t size;
+    int p;
+
+    if (!self->patterns) return 0;
+    size = self->strings_len + self->len * (sizeof(PatternEntry) +
+        sizeof(int) + sizeof(PatternMask)) +
+        self->seeds_len * sizeof(PatternSeed) +
+        self->states_len * sizeof(SeedState) +
+        TABLE_SIZE(self) * sizeof(SeedEdge);
+    for (p = 0; p < self->len; p++) {
+        size += 256 * self->patterns[p].mask->words * sizeof(uint64_t);
+    }
+    return size;
+}
+
+size_t pattern_scan_memsize(PatternSet *set)
+{
+    return sizeof(PatternScan) + set->len * (sizeof(PatternRun) +
+        sizeof(int)) + set->vectors_len * sizeof(uint64_t) +
+        2 * (set->max_len + 1) * sizeof(int);
+}
+
+void pattern_scan_destroy(PatternScan *self)
+{
+    if (!self) return;
+    free(self->runs);
+    free(self->vectors);
+    free(self->touched);
+    free(self->reverse);
+    free(self);
+}
+
+void pattern_set_release(PatternSet *self)
+{
+    int p;
+
+    if (self->patterns) {
+        for (p = 0; p < self->len; p++) {
+            pattern_mask_destroy(self->patterns[p].mask);
+        }
+    }
+    free(self->strings);
+    free(self->patterns);
+    free(self->unseeded);
+    free(self->seeds);
+    free(self->states);
+    free(self->table);
+    self->strings = NULL;
+    self->patterns = NULL;
+    self->unseeded = NULL;
+    self->seeds = NULL;
+    self->states = NULL;
+    self->table = NULL;
+    self->strings_len = 0;
+    self->len = 0;
+}
+  /* vim: set et cindent sw=4 ts=4: */
@@ -0,0 +1,100 @@
+#ifndef PATTERN_SET_H_INCLUDED
+#define PATTERN_SET_H_INCLUDED
+
+#include "ruby.h"
+#include "pattern_mask.h"
+#include <stdint.h>
+
+typedef struct PatternEntryStruct {
+    long        offset;     /* of the pattern in strings */
+    int         len;
+    long        vectors;    /* offset of its vectors in those of a scan */
+    PatternMask *mask;
+} PatternEntry;
+
+/*
+ * Every pattern is split into k + 1 seeds. The seeds ending in the same
+ * state of the automaton are linked by next.
+ */
+typedef struct PatternSeedStruct {
+    int         pattern;
+    int         offset;     /* of the seed in its pattern */
+    int         len;
+    int         next;
+} PatternSeed;
+
+typedef struct SeedStateStruct {
+    int         fail;       /* failure link, 0 for the initial state */
+    int         output;     /* nearest state along the failure links */
+    int         seeds;      /* (including this one) with seeds, or -1 */
+    int         edges;      /* first edge leaving the state, or -1 */
+} SeedState;
+
+typedef struct SeedEdgeStruct {
+    int         from;       /* -1 for empty slots of the table */
+    int         to;
+    int         next;       /* next edge leaving from, or -1 */
+    unsigned char c;
+} SeedEdge;
+
+typedef struct PatternSetStruct {
+    char        *strings;
+    long        strings_len;
+    PatternEntry *patterns;
+    int         len;
+    int         k;
+    int         max_len;
+    long        vectors_len;
+    PatternSeed *seeds;
+    int         seeds_len;
+    int         *unseeded;  /* patterns too short to be split */
+    int         unseeded_len;
+    SeedState   *states;
+    int         states_len;
+    SeedEdge    *table;     /* hash table of edges, at most half full */
+    int         shift;
+    int         root[256];  /* edges leaving the initial state */
+} PatternSet;
+
+/*
+ * The state of the last row of every pattern, while a text is scanned.
+ * Patterns are only touched by a scan, if one of their seeds occurs, so
+ * the runs are reset lazily, when scan differs from the one of the set.
+ */
+typedef struct PatternRunStruct {
+    long        scan;
+    long        pos;        /* text position the vectors are at */
+    long        exact_from; /* first position with an exact score */
+    int         score;
+    int         in_run;
+    long        best_end;
+    int         best_distance;
+} PatternRun;
+
+typedef struct PatternScanStruct {
+    PatternRun  *runs;
+    uint64_t    *vectors;
+    int         *touched;
+    int         touched_len;
+    int         *reverse;   /* two columns for the backward pass */
+    long        scan;
+} PatternScan;
+
+typedef struct PatternHitStruct {
+    int         pattern;
+    long        start;
+    long        end;
+    int         distance;
+} PatternHit;
+
+void pattern_set_init(PatternSet *self, VALUE patterns, int k);
+PatternScan *PatternScan_new(PatternSet *set);
+long pattern_set_search(PatternSet *self, PatternScan *scan,
+    const char *text, long text_len, PatternHit **hits);
+size_t pattern_set_memsize(PatternSet *self);
+size_t pattern_scan_memsize(PatternSet *set);
+void pattern_scan_destroy(PatternScan *self);
+void pattern_set_release(PatternSet *self);
+
+#endif
+  /* vim: set et cindent sw=4 ts=4: */
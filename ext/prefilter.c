@@ -0,0 +1,98 @@
+#include "prefilter.h"
+#include <ctype.h>
+
+/*
+ * Cheap lower bounds of the differences between the pattern and a string,
+ * computed from what characters, and 2-grams of characters, they contain,
+ * regardless of where:
+ *
+ * - The characters of the pattern missing from the string, and the surplus
+ *   characters of the string, each need an edit operation, a substitution
+ *   can take care of one of both.
+ * - Every edit operation destroys at most 2 of the pattern's 2-grams, so a
+ *   string within k operations shares at least len - 1 - 2k of them (the
+ *   q-gram lemma). The 2-grams are hashed into PREFILTER_BUCKETS buckets,
+ *   which only makes them look more alike.
+ */
+
+#define FOLD(self, c) \
+    ((self)->fold && islower(c) ? toupper(c) & 0xff : (c))
+
+#define GRAM(a, b) \
+    ((((unsigned) (unsigned char) (a) << 8 | (unsigned char) (b)) * \
+        40503U >> 4) % PREFILTER_BUCKETS)
+
+/*
+ * Counts the characters of the pattern, and also its 2-grams, if grams is
+ * true. Characters are upcased first, if fold is true.
+ */
+void prefilter_init(Prefilter *self, const char *pattern, int len, int fold,
+    int grams)
+{
+    int i;
+
+    MEMZERO(self, Prefilter, 1);
+    self->fold = fold;
+    self->len = len;
+    for (i = 0; i < len; i++) {
+        self->counts[FOLD(self, (unsigned char) pattern[i])]++;
+    }
+    MEMCPY(self->left, self->counts, int, 256);
+    if (!grams) return;
+    self->grams = ALLOC_N(int, PREFILTER_BUCKETS);
+    self->used = ALLOC_N(int, PREFILTER_BUCKETS);
+    MEMZERO(self->grams, int, PREFILTER_BUCKETS);
+    MEMZERO(self->used, int, PREFILTER_BUCKETS);
+    for (i = 1; i < len; i++) self->grams[GRAM(pattern[i - 1], pattern[i])]++;
+}
+
+/*
+ * Computes how many characters of the pattern are missing from string, and
+ * how many characters of string are surplus, compared to the pattern.
+ */
+void prefilter_excess(Prefilter *self, const char *string, int len,
+    int *missing, int *surplus)
+{
+    int i, c, matched = 0;
+
+    for (i = 0; i < len; i++) {
+        c = FOLD(self, (unsigned char) string[i]);
+        if (self->left[c] > 0) {
+            self->left[c]--;
+            matched++;
+        }
+    }
+    for (i = 0; i < len; i++) {
+        c = FOLD(self, (unsigned char) string[i]);
+        self->left[c] = self->counts[c];
+    }
+    *missing = self->len - matched;
+    *surplus = len - matched;
+}
+
+/*
+ * Returns the number of 2-grams of the pattern, that string has, too, each
+ * counted at most as often, as the pattern has it.
+ */
+int prefilter_common_grams(Prefilter *self, const char *string, int len)
+{
+    int i, g, common = 0;
+
+    for (i = 1; i < len; i++) {
+        g = GRAM(string[i - 1], string[i]);
+        if (self->used[g] < self->grams[g]) {
+            self->used[g]++;
+            common++;
+        }
+    }
+    for (i = 1; i < len; i++) self->used[GRAM(string[i - 1], string[i])] = 0;
+    return common;
+}
+
+void prefilter_release(Prefilter *self)
+{
+    xfree(self->grams);
+    xfree(self->used);
+    self->grams = self->used = NULL;
+}
+  /* vim: set et cindent sw=4 ts=4: */
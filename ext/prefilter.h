@@ -0,0 +1,26 @@
+#ifndef PREFILTER_H_INCLUDED
+#define PREFILTER_H_INCLUDED
+
+#include "ruby.h"
+
+#define PREFILTER_STAGES    3       /* length, histogram and q-grams */
+#define PREFILTER_BUCKETS   4096    /* of the hashed 2-grams */
+
+typedef struct PrefilterStruct {
+    int         counts[256];    /* of the characters of the pattern */
+    int         left[256];      /* those not matched by a string so far */
+    int         len;
+    int         *grams;         /* counts of its 2-grams, or NULL */
+    int         *used;          /* those matched by a string so far */
+    int         fold;           /* whether case is ignored */
+} Prefilter;
+
+void prefilter_init(Prefilter *self, const char *pattern, int len, int fold,
+    int grams);
+void prefilter_excess(Prefilter *self, const char *string, int len,
+    int *missing, int *surplus);
+int prefilter_common_grams(Prefilter *self, const char *string, int len);
+void prefilter_release(Prefilter *self);
+
+#endif
+  /* vim: set et cindent sw=4 ts=4: */
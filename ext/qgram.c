@@ -0,0 +1,434 @@
+#include "qgram.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Candidate retrieval for the Dice coefficient of q-grams, of which the pair
+ * distance is the case q = 2: strings with n_a and n_b grams, that have o of
+ * them in common (as multisets), have the similarity 2 o / (n_a + n_b). A
+ * minimum similarity t needs n_b within [t n_a / (2 - t), (2 - t) n_a / t],
+ * and an overlap o >= t (n_a + n_b) / 2, so at least T, the overlap needed
+ * for the smallest n_b.
+ *
+ * The posting lists of the grams of the query are read shortest first,
+ * adding up the overlaps of the strings found (ScanCount). The longest
+ * lists, which together hold at most T - 1 grams of the query, are skipped:
+ * every string reaching T is found in the other lists as well (DivideSkip).
+ * Then the strings found are filtered by their number of grams, and by the
+ * overlap they can still reach. If no list was skipped, the overlaps are
+ * exact already.
+ */
+
+#define EPSILON 1e-9
+
+static int varint_size(unsigned long value)
+{
+    int n = 1;
+
+    while (value >= 0x80) {
+        value >>= 7;
+        n++;
+    }
+    return n;
+}
+
+static unsigned char *varint_put(unsigned char *ptr, unsigned long value)
+{
+    while (value >= 0x80) {
+        *ptr++ = (unsigned char) (value | 0x80);
+        value >>= 7;
+    }
+    *ptr++ = (unsigned char) value;
+    return ptr;
+}
+
+static const unsigned char *varint_get(const unsigned char *ptr,
+    unsigned long *value)
+{
+    int shift = 0;
+
+    *value = 0;
+    while (*ptr & 0x80) {
+        *value |= (unsigned long) (*ptr++ & 0x7f) << shift;
+        shift += 7;
+    }
+    *value |= (unsigned long) *ptr++ << shift;
+    return ptr;
+}
+
+static uint64_t mix(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/*
+ * Stores the grams of the tokens at ptr, encoded like the strings of an
+ * index, in grams, and returns how many there are.
+ */
+long qgram_grams(int q, const unsigned char *ptr, long len, QGram *grams)
+{
+    const unsigned char *end = ptr + len;
+    unsigned long token_len;
+    long i, n = 0;
+    QGram gram;
+    int j;
+
+    while (ptr < end) {
+        ptr = varint_get(ptr, &token_len);
+        for (i = 0; i + q <= (long) token_len; i++) {
+            for (gram = 0, j = 0; j < q; j++) gram = gram << 8 | ptr[i + j];
+            grams[n++] = gram;
+        }
+        ptr += token_len;
+    }
+    return n;
+}
+
+static int compare_grams(const void *a, const void *b)
+{
+    QGram x = *(const QGram *) a, y = *(const QGram *) b;
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * Returns the size of the intersection of the multisets a, which has to be
+ * sorted, and b, which is sorted here.
+ */
+long qgram_overlap(const QGram *a, long a_len, QGram *b, long b_len)
+{
+    long i = 0, j = 0, n = 0;
+
+    qsort(b, b_len, sizeof(QGram), compare_grams);
+    while (i < a_len && j < b_len) {
+        if (a[i] < b[j]) {
+            i++;
+        } else if (a[i] > b[j]) {
+            j++;
+        } else {
+            n++;
+            i++;
+            j++;
+        }
+    }
+    return n;
+}
+
+/*
+ * Returns the number of grams of the Array of Strings tokens, and stores
+ * them, sorted, in *grams, which has to be freed.
+ */
+long qgram_query_grams(int q, VALUE tokens, QGram **grams)
+{
+    long i, n = 0, l;
+    int j;
+    VALUE token;
+    unsigned char *ptr;
+
+    for (i = 0; i < RARRAY(tokens)->len; i++) {
+        l = RSTRING(rb_ary_entry(tokens, i))->len - q + 1;
+        if (l > 0) n += l;
+    }
+    *grams = ALLOC_N(QGram, n > 0 ? n : 1);
+    for (i = 0, n = 0; i < RARRAY(tokens)->len; i++) {
+        token = rb_ary_entry(tokens, i);
+        ptr = (unsigned char *) RSTRING(token)->ptr;
+        for (l = 0; l + q <= RSTRING(token)->len; l++) {
+            QGram gram = 0;
+            for (j = 0; j < q; j++) gram = gram << 8 | ptr[l + j];
+            (*grams)[n++] = gram;
+        }
+    }
+    qsort(*grams, n, sizeof(QGram), compare_grams);
+    return n;
+}
+
+void qgram_index_init(QGramIndex *self, int q)
+{
+    MEMZERO(self, QGramIndex, 1);
+    self->q = q;
+    self->size = 16;
+    self->starts = ALLOC_N(long, self->size + 1);
+    self->gram_counts = ALLOC_N(int, self->size);
+    self->starts[0] = 0;
+}
+
+/*
+ * Adds a string, split into the Array of Strings tokens.
+ */
+void qgram_index_add(QGramIndex *self, VALUE tokens)
+{
+    long i, need = 0, grams = 0, l;
+    VALUE token;
+    unsigned char *ptr;
+
+    for (i = 0; i < RARRAY(tokens)->len; i++) {
+        l = RSTRING(rb_ary_entry(tokens, i))->len;
+        need += varint_size(l) + l;
+        if (l >= self->q) grams += l - self->q + 1;
+    }
+    if (self->len == self->size) {
+        self->size *= 2;
+        REALLOC_N(self->starts, long, self->size + 1);
+        REALLOC_N(self->gram_counts, int, self->size);
+    }
+    if (self->text_len + need > self->text_size) {
+        while (self->text_len + need > self->text_size) {
+            self->text_size = self->text_size ? 2 * self->text_size : 4096;
+        }
+        REALLOC_N(self->text, unsigned char, self->text_size);
+    }
+    ptr = self->text + self->text_len;
+    for (i = 0; i < RARRAY(tokens)->len; i++) {
+        token = rb_ary_entry(tokens, i);
+        ptr = varint_put(ptr, RSTRING(token)->len);
+        MEMCPY(ptr, RSTRING(token)->ptr, char, RSTRING(token)->len);
+        ptr += RSTRING(token)->len;
+    }
+    self->text_len += need;
+    self->gram_counts[self->len] = (int) grams;
+    if (grams > self->max_grams) self->max_grams = (int) grams;
+    self->starts[++self->len] = self->text_len;
+}
+
+/*
+ * Returns the index of gram in self->grams, or -1.
+ */
+static long lookup(QGramIndex *self, QGram gram)
+{
+    long slot = (long) (mix(gram) & self->table_mask), g;
+
+    while ((g = self->table[slot]) >= 0) {
+        if (self->grams[g] == gram) return g;
+        slot = (slot + 1) & self->table_mask;
+    }
+    return -1;
+}
+
+static void table_resize(QGramIndex *self, long size)
+{
+    long g, slot;
+
+    xfree(self->table);
+    self->table = ALLOC_N(long, size);
+    self->table_mask = size - 1;
+    for (slot = 0; slot < size; slot++) self->table[slot] = -1;
+    for (g = 0; g < self->grams_len; g++) {
+        slot = (long) (mix(self->grams[g]) & self->table_mask);
+        while (self->table[slot] >= 0) slot = (slot + 1) & self->table_mask;
+        self->table[slot] = g;
+    }
+}
+
+static void insert(QGramIndex *self, QGram gram, long *grams_size)
+{
+    long slot;
+
+    if (2 * (self->grams_len + 1) > self->table_mask + 1) {
+        table_resize(self, 2 * (self->table_mask + 1));
+    }
+    slot = (long) (mix(gram) & self->table_mask);
+    while (self->table[slot] >= 0) {
+        if (self->grams[self->table[slot]] == gram) return;
+        slot = (slot + 1) & self->table_mask;
+    }
+    if (self->grams_len == *grams_size) {
+        *grams_size *= 2;
+        REALLOC_N(self->grams, QGram, *grams_size);
+    }
+    self->grams[self->grams_len] = gram;
+    self->table[slot] = self->grams_len++;
+}
+
+/*
+ * Stores the sorted grams of string i in grams and returns their number.
+ */
+static long string_grams(QGramIndex *self, long i, QGram *grams)
+{
+    long n = qgram_grams(self->q, self->text + self->starts[i],
+        self->starts[i + 1] - self->starts[i], grams);
+
+    qsort(grams, n, sizeof(QGram), compare_grams);
+    return n;
+}
+
+/*
+ * Builds the posting lists of the strings added, in two passes over their
+ * grams, the first one computing the size of every list.
+ */
+void qgram_index_build(QGramIndex *self)
+{
+    QGram *grams = ALLOC_N(QGram, self->max_grams > 0 ? self->max_grams : 1);
+    long i, n, k, c, g, grams_size = 256, *last, *cursors;
+
+    self->grams = ALLOC_N(QGram, grams_size);
+    table_resize(self, 512);
+    for (i = 0; i < self->len; i++) {
+        n = qgram_grams(self->q, self->text + self->starts[i],
+            self->starts[i + 1] - self->starts[i], grams);
+        for (k = 0; k < n; k++) insert(self, grams[k], &grams_size);
+    }
+    self->postings_lens = ALLOC_N(long, self->grams_len + 1);
+    self->postings_starts = ALLOC_N(long, self->grams_len + 1);
+    last = ALLOC_N(long, self->grams_len + 1);
+    MEMZERO(self->postings_lens, long, self->grams_len + 1);
+    MEMZERO(self->postings_starts, long, self->grams_len + 1);
+    MEMZERO(last, long, self->grams_len + 1);
+    for (i = 0; i < self->len; i++) {
+        n = string_grams(self, i, grams);
+        for (k = 0; k < n; k += c) {
+            for (c = 1; k + c < n && grams[k + c] == grams[k]; c++);
+            g = lookup(self, grams[k]);
+            self->postings_lens[g]++;
+            self->postings_starts[g + 1] += varint_size(i - last[g]) +
+                varint_size(c);
+            last[g] = i;
+        }
+    }
+    for (g = 0; g < self->grams_len; g++) {
+        self->postings_starts[g + 1] += self->postings_starts[g];
+    }
+    self->postings = ALLOC_N(unsigned char,
+        self->postings_starts[self->grams_len] + 1);
+    cursors = ALLOC_N(long, self->grams_len + 1);
+    MEMCPY(cursors, self->postings_starts, long, self->grams_len + 1);
+    MEMZERO(last, long, self->grams_len + 1);
+    for (i = 0; i < self->len; i++) {
+        n = string_grams(self, i, grams);
+        for (k = 0; k < n; k += c) {
+            unsigned char *ptr;
+            for (c = 1; k + c < n && grams[k + c] == grams[k]; c++);
+            g = lookup(self, grams[k]);
+            ptr = varint_put(self->postings + cursors[g], i - last[g]);
+            ptr = varint_put(ptr, c);
+            cursors[g] = ptr - self->postings;
+            last[g] = i;
+        }
+    }
+    xfree(cursors);
+    xfree(last);
+    xfree(grams);
+    self->overlaps = ALLOC_N(int, self->len > 0 ? self->len : 1);
+    MEMZERO(self->overlaps, int, self->len > 0 ? self->len : 1);
+    self->touched = ALLOC_N(long, self->len > 0 ? self->len : 1);
+}
+
+typedef struct QueryGramStruct {
+    long    g;          /* in the index, or -1 */
+    long    len;        /* of its posting list */
+    int     count;      /* in the query */
+} QueryGram;
+
+static int compare_postings(const void *a, const void *b)
+{
+    long x = ((const QueryGram *) a)->len, y = ((const QueryGram *) b)->len;
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * Stores the strings, that can have a similarity of at least threshold
+ * with the query, which has the len sorted grams, in candidates, together
+ * with their overlaps found in overlaps, and returns how many there are.
+ * Both need room for all strings of the index. *exact is set to 1, if the
+ * overlaps are exact, and to 0, if they have to be computed.
+ */
+long qgram_index_candidates(QGramIndex *self, const QGram *grams, long len,
+    double threshold, long *candidates, int *overlaps, int *exact)
+{
+    QueryGram *query;
+    const unsigned char *ptr;
+    unsigned long delta, count;
+    long unique = 0, k, i, n = 0, touched = 0, id, skipped = 0, need;
+    double smallest;
+    int nb;
+
+    self->scanned = 0;
+    *exact = len == 0;
+    if (len == 0 || threshold <= 0) {
+        for (i = 0; i < self->len; i++) {
+            if (threshold <= 0 || self->gram_counts[i] == 0) {
+                candidates[n] = i;
+                overlaps[n++] = 0;
+            }
+        }
+        return n;
+    }
+    if (threshold > 1 + EPSILON) return 0;
+    query = ALLOC_N(QueryGram, len);
+    for (k = 0; k < len; k++) {
+        if (k > 0 && grams[k] == grams[k - 1]) {
+            query[unique - 1].count++;
+        } else {
+            query[unique].g = lookup(self, grams[k]);
+            query[unique].len = query[unique].g < 0 ? 0 :
+                self->postings_lens[query[unique].g];
+            query[unique++].count = 1;
+        }
+    }
+    qsort(query, unique, sizeof(QueryGram), compare_postings);
+    smallest = ceil(threshold * len / (2 - threshold) - EPSILON);
+    if (smallest < 1) smallest = 1;
+    need = (long) ceil(threshold * (len + smallest) / 2 - EPSILON);
+    if (need < 1) need = 1;
+    while (unique > 0 && skipped + query[unique - 1].count <= need - 1) {
+        skipped += query[--unique].count;
+    }
+    for (k = 0; k < unique; k++) {
+        if (query[k].g < 0) continue;
+        ptr = self->postings + self->postings_starts[query[k].g];
+        for (i = 0, id = 0; i < self->postings_lens[query[k].g]; i++) {
+            ptr = varint_get(ptr, &delta);
+            ptr = varint_get(ptr, &count);
+            id += delta;
+            if (self->overlaps[id] == 0) self->touched[touched++] = id;
+            self->overlaps[id] += (int) count < query[k].count ?
+                (int) count : query[k].count;
+        }
+        self->scanned += self->postings_lens[query[k].g];
+    }
+    xfree(query);
+    for (i = 0; i < touched; i++) {
+        id = self->touched[i];
+        nb = self->gram_counts[id];
+        if (threshold * (len + nb) <= 2 * (len < nb ? len : nb) + EPSILON &&
+                self->overlaps[id] + skipped >=
+                    threshold * (len + nb) / 2 - EPSILON) {
+            candidates[n] = id;
+            overlaps[n++] = self->overlaps[id];
+        }
+        self->overlaps[id] = 0;
+    }
+    *exact = skipped == 0;
+    return n;
+}
+
+size_t qgram_index_memsize(QGramIndex *self)
+{
+    return self->text_size + (self->size + 1) * sizeof(long) +
+        self->size * sizeof(int) +
+        self->grams_len * (sizeof(QGram) + 2 * sizeof(long)) +
+        (self->table_mask + 1) * sizeof(long) +
+        (self->postings_starts ? self->postings_starts[self->grams_len] : 0) +
+        self->len * (sizeof(int) + sizeof(long));
+}
+
+void qgram_index_release(QGramIndex *self)
+{
+    xfree(self->text);
+    xfree(self->starts);
+    xfree(self->gram_counts);
+    xfree(self->grams);
+    xfree(self->table);
+    xfree(self->postings_starts);
+    xfree(self->postings_lens);
+    xfree(self->postings);
+    xfree(self->overlaps);
+    xfree(self->touched);
+    MEMZERO(self, QGramIndex, 1);
+}
+  /* vim: set et cindent sw=4 ts=4: */
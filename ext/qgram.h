@@ -0,0 +1,56 @@
+#ifndef QGRAM_H_INCLUDED
+#define QGRAM_H_INCLUDED
+
+#include "ruby.h"
+#include <stdint.h>
+
+#define QGRAM_MAX_Q     8
+
+/*
+ * A q-gram, its q bytes packed into a number.
+ */
+typedef uint64_t QGram;
+
+/*
+ * Inverted index of the q-grams of a fixed Array of strings, which are
+ * split into tokens first. String i is stored in text from starts[i] to
+ * starts[i + 1], every token as its length (a varint) followed by its bytes.
+ * The posting list of grams[g] lists the strings containing it, with their
+ * number of occurrences, as varints of the differences of the indexes and
+ * of the counts.
+ */
+typedef struct QGramIndexStruct {
+    int             q;
+    long            len;
+    long            size;           /* allocated strings */
+    unsigned char   *text;
+    long            text_len;
+    long            text_size;
+    long            *starts;
+    int             *gram_counts;   /* grams of every string */
+    int             max_grams;
+    QGram           *grams;         /* distinct grams */
+    long            grams_len;
+    long            *table;         /* into grams by hash, or -1 */
+    long            table_mask;
+    long            *postings_starts;
+    long            *postings_lens; /* strings in the posting lists */
+    unsigned char   *postings;
+    int             *overlaps;      /* of the query, while it's scanned */
+    long            *touched;       /* strings with an overlap */
+    long            scanned;        /* postings read by the last query */
+} QGramIndex;
+
+void qgram_index_init(QGramIndex *self, int q);
+void qgram_index_add(QGramIndex *self, VALUE tokens);
+void qgram_index_build(QGramIndex *self);
+long qgram_grams(int q, const unsigned char *ptr, long len, QGram *grams);
+long qgram_overlap(const QGram *a, long a_len, QGram *b, long b_len);
+long qgram_query_grams(int q, VALUE tokens, QGram **grams);
+long qgram_index_candidates(QGramIndex *self, const QGram *grams, long len,
+    double threshold, long *candidates, int *overlaps, int *exact);
+size_t qgram_index_memsize(QGramIndex *self);
+void qgram_index_release(QGramIndex *self);
+
+#endif
+  /* vim: set et cindent sw=4 ts=4: */
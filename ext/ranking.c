@@ -0,0 +1,118 @@
+#include "ranking.h"
+#include <math.h>
+
+/*
+ * Keeps the best k of n scores in a heap of size k, whose top is the worst
+ * score kept: a new score only has to beat the top to get in, which takes
+ * O(log k) steps, and the top is the cut-off, that the following
+ * comparisons have to beat.
+ */
+
+#define WORSE(self, x, y)                                       \
+    ((x)->score != (y)->score ?                                 \
+        ((self)->descending ?                                   \
+            (x)->score < (y)->score : (x)->score > (y)->score) : \
+        (x)->index > (y)->index)
+
+Ranking *Ranking_new(long capacity, int descending)
+{
+    Ranking *self = ALLOC(Ranking);
+    self->entries = ALLOC_N(RankingEntry, capacity > 0 ? capacity : 1);
+    self->len = 0;
+    self->capacity = capacity;
+    self->descending = descending;
+    return self;
+}
+
+/*
+ * Returns the score, that has to be beaten to get into the ranking, or an
+ * infinite one, if there is still room left.
+ */
+double ranking_cutoff(Ranking *self)
+{
+    if (!ranking_full(self)) return self->descending ? -HUGE_VAL : HUGE_VAL;
+    if (self->capacity == 0) return self->descending ? HUGE_VAL : -HUGE_VAL;
+    return self->entries[0].score;
+}
+
+/*
+ * Returns true, if an entry with score, that is offered next, would get into
+ * the ranking.
+ */
+int ranking_admits(Ranking *self, double score)
+{
+    if (!ranking_full(self)) return 1;
+    if (self->capacity == 0) return 0;
+    return self->descending ?
+        score > self->entries[0].score : score < self->entries[0].score;
+}
+
+static void sift_down(Ranking *self, long i, long len)
+{
+    RankingEntry *e = self->entries, tmp;
+    long child;
+
+    while ((child = 2 * i + 1) < len) {
+        if (child + 1 < len && WORSE(self, e + child + 1, e + child)) child++;
+        if (!WORSE(self, e + child, e + i)) break;
+        tmp = e[i];
+        e[i] = e[child];
+        e[child] = tmp;
+        i = child;
+    }
+}
+
+/*
+ * Adds the entry index with score, if it's admitted, pushing out the worst
+ * entry, if the ranking is full already. Entries have to be offered in
+ * ascending order of their indexes.
+ */
+void ranking_offer(Ranking *self, long index, double score)
+{
+    RankingEntry *e = self->entries, tmp;
+    long i, parent;
+
+    if (!ranking_admits(self, score)) return;
+    if (ranking_full(self)) {
+        e[0].index = index;
+        e[0].score = score;
+        sift_down(self, 0, self->len);
+        return;
+    }
+    i = self->len++;
+    e[i].index = index;
+    e[i].score = score;
+    while (i > 0) {
+        parent = (i - 1) / 2;
+        if (!WORSE(self, e + i, e + parent)) break;
+        tmp = e[i];
+        e[i] = e[parent];
+        e[parent] = tmp;
+        i = parent;
+    }
+}
+
+/*
+ * Sorts the entries from the best to the worst one. Afterwards no more
+ * entries may be offered.
+ */
+void ranking_sort(Ranking *self)
+{
+    RankingEntry tmp;
+    long len;
+
+    for (len = self->len; len > 1; len--) {
+        tmp = self->entries[0];
+        self->entries[0] = self->entries[len - 1];
+        self->entries[len - 1] = tmp;
+        sift_down(self, 0, len - 1);
+    }
+}
+
+void ranking_destroy(Ranking *self)
+{
+    if (!self) return;
+    free(self->entries);
+    free(self);
+}
+  /* vim: set et cindent sw=4 ts=4: */
@@ -0,0 +1,33 @@
+#ifndef RANKING_H_INCLUDED
+#define RANKING_H_INCLUDED
+
+#include "ruby.h"
+
+typedef struct RankingEntryStruct {
+    long        index;
+    double      score;
+} RankingEntry;
+
+/*
+ * The best entries (index and score) offered so far, at most capacity of
+ * them. Lower scores are better, unless the ranking is descending. Of two
+ * entries with the same score, the one offered first is better. Until it's
+ * sorted, the entries form a heap with the worst entry on top.
+ */
+typedef struct RankingStruct {
+    RankingEntry    *entries;
+    long            len;
+    long            capacity;
+    int             descending;
+} Ranking;
+
+Ranking *Ranking_new(long capacity, int descending);
+#define ranking_full(self) ((self)->len >= (self)->capacity)
+double ranking_cutoff(Ranking *self);
+int ranking_admits(Ranking *self, double score);
+void ranking_offer(Ranking *self, long index, double score);
+void ranking_sort(Ranking *self);
+void ranking_destroy(Ranking *self);
+
+#endif
+  /* vim: set et cindent sw=4 ts=4: */
@@ -0,0 +1,140 @@
+#include "stats.h"
+#include <string.h>
+#ifdef HAVE_CLOCK_GETTIME
+#include <time.h>
+#else
+#include <sys/time.h>
+#endif
+
+/*
+ * Opt-in statistics of the calls of the kernels, see Amatch.collect_stats=.
+ * Every matcher keeps its own entries, one per method, and every call is
+ * also added to the entries of its class and method in a global table.
+ * Calls are recorded, while the global interpreter lock is held, so the
+ * counters don't have to be atomic.
+ *
+ * Latencies are counted in a histogram of log-linear buckets, like HDR
+ * histograms do it: the nanoseconds below STATS_SUB_BUCKETS have buckets of
+ * their own, and every power of 2 above is divided into STATS_SUB_BUCKETS
+ * buckets of equal width.
+ */
+
+int stats_enabled = 0;
+
+static Stats global;
+
+uint64_t stats_clock(void)
+{
+#ifdef HAVE_CLOCK_GETTIME
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+#else
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return (uint64_t) now.tv_sec * 1000000000 + now.tv_usec * 1000;
+#endif
+}
+
+int stats_bucket(uint64_t nanoseconds)
+{
+    int e = 0, bucket;
+
+    if (nanoseconds < STATS_SUB_BUCKETS) return (int) nanoseconds;
+    while (nanoseconds >> (e + 1)) e++;
+    /* e >= 3, the 3 bits after the leading one pick the sub-bucket */
+    bucket = (e - 2) * STATS_SUB_BUCKETS +
+        (int) ((nanoseconds >> (e - 3)) & (STATS_SUB_BUCKETS - 1));
+    return bucket < STATS_BUCKETS ? bucket : STATS_BUCKETS - 1;
+}
+
+/*
+ * Returns the nanoseconds, that are just too many for bucket.
+ */
+uint64_t stats_bucket_limit(int bucket)
+{
+    int e = bucket / STATS_SUB_BUCKETS + 2;
+
+    if (bucket < STATS_SUB_BUCKETS) return bucket + 1;
+    return (uint64_t) (STATS_SUB_BUCKETS + bucket % STATS_SUB_BUCKETS + 1) <<
+        (e - 3);
+}
+
+/*
+ * Returns the entry of self for the method of the class class_name, adding
+ * it, if it doesn't exist yet.
+ */
+static StatsEntry *entry(Stats *self, const char *class_name, ID method)
+{
+    StatsEntry *e;
+    int i;
+
+    for (i = 0; i < self->len; i++) {
+        e = self->entries + i;
+        if (e->method == method && strcmp(e->class_name, class_name) == 0) {
+            return e;
+        }
+    }
+    REALLOC_N(self->entries, StatsEntry, self->len + 1);
+    e = self->entries + self->len++;
+    MEMZERO(e, StatsEntry, 1);
+    e->class_name = class_name;
+    e->method = method;
+    return e;
+}
+
+static void add(StatsEntry *e, long comparisons, double cells, double bytes,
+    uint64_t nanoseconds)
+{
+    e->calls++;
+    e->comparisons += comparisons;
+    if ((unsigned long) comparisons > e->max_batch) {
+        e->max_batch = comparisons;
+    }
+    e->cells += cells;
+    e->bytes += bytes;
+    e->nanoseconds += nanoseconds;
+    e->histogram[stats_bucket(nanoseconds)]++;
+}
+
+/*
+ * Records a call of the kernels of the matcher with the stats self by the
+ * method, that's running now.
+ */
+void stats_record(Stats *self, long comparisons, double cells, double bytes,
+    uint64_t nanoseconds)
+{
+#ifdef HAVE_RB_FRAME_THIS_FUNC
+    ID method = rb_frame_this_func();
+#else
+    ID method = rb_frame_last_func();
+#endif
+
+    add(entry(self, self->class_name, method), comparisons, cells, bytes,
+        nanoseconds);
+    add(entry(&global, self->class_name, method), comparisons, cells,
+        bytes, nanoseconds);
+}
+
+Stats *stats_global(void)
+{
+    return &global;
+}
+
+size_t stats_memsize(const Stats *self)
+{
+    return self->len * sizeof(StatsEntry);
+}
+
+/*
+ * Forgets the entries of self, but not its class.
+ */
+void stats_release(Stats *self)
+{
+    xfree(self->entries);
+    self->entries = NULL;
+    self->len = 0;
+}
+  /* vim: set et cindent sw=4 ts=4: */
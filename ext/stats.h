@@ -0,0 +1,64 @@
+#ifndef STATS_H_INCLUDED
+#define STATS_H_INCLUDED
+
+#include "ruby.h"
+#include <stdint.h>
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#endif
+
+#define STATS_SUB_BUCKETS   8       /* per power of 2, within 12.5% */
+#define STATS_BUCKETS       (STATS_SUB_BUCKETS * 40)    /* up to 2^40 ns */
+
+/*
+ * Probes at the entry and the return of the kernels of every class, for
+ * bpftrace and the like, e. g.
+ *
+ *  bpftrace -e 'usdt:./amatch.so:amatch:kernel__entry
+ *      { @[str(arg0)] = sum(arg2); }'
+ *
+ * The arguments are the name of the class, the number of strings, and the
+ * estimated cost of the comparisons (see UNBLOCKING_COST).
+ */
+#ifdef HAVE_SYS_SDT_H
+#define STATS_PROBE_ENTRY(class_name, comparisons, cells) \
+    DTRACE_PROBE3(amatch, kernel__entry, class_name, (long) (comparisons), \
+        (long) (cells))
+#define STATS_PROBE_RETURN(class_name, comparisons) \
+    DTRACE_PROBE2(amatch, kernel__return, class_name, (long) (comparisons))
+#else
+#define STATS_PROBE_ENTRY(class_name, comparisons, cells)
+#define STATS_PROBE_RETURN(class_name, comparisons)
+#endif
+
+typedef struct StatsEntryStruct {
+    const char  *class_name;
+    ID          method;
+    unsigned long calls;            /* times the kernels were entered */
+    unsigned long comparisons;      /* strings compared or texts searched */
+    unsigned long max_batch;
+    double      cells;              /* estimated steps of the kernels */
+    double      bytes;              /* of the strings or texts */
+    uint64_t    nanoseconds;
+    unsigned long histogram[STATS_BUCKETS];     /* of the latencies */
+} StatsEntry;
+
+typedef struct StatsStruct {
+    const char  *class_name;        /* of the matcher, or NULL */
+    StatsEntry  *entries;           /* one per class and method */
+    int         len;
+} Stats;
+
+extern int stats_enabled;
+
+uint64_t stats_clock(void);
+void stats_record(Stats *self, long comparisons, double cells, double bytes,
+    uint64_t nanoseconds);
+Stats *stats_global(void);
+int stats_bucket(uint64_t nanoseconds);
+uint64_t stats_bucket_limit(int bucket);
+size_t stats_memsize(const Stats *self);
+void stats_release(Stats *self);
+
+#endif
+  /* vim: set et cindent sw=4 ts=4: */
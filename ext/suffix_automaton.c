@@ -0,0 +1,156 @@
+#include "suffix_automaton.h"
+
+/*
+ * The suffix automaton of the pattern (A. Blumer et al., "The smallest
+ * automaton recognizing the subwords of a text", 1985) recognizes all of
+ * its substrings. It has at most 2m states and 3m edges, and is built in
+ * O(m) by adding one pattern character after the other. Running a text
+ * through it, and following the suffix links whenever a character can't be
+ * read, finds the longest common substring in O(n).
+ *
+ * The edges are stored in one hash table with linear probing, so every
+ * step is a single lookup no matter how many edges leave a state. The
+ * edges leaving a state are also linked, so they can be copied when a state
+ * is cloned. The edges of the initial state are kept in an array as well:
+ * most steps end up there, and a character without an edge leaving it
+ * doesn't occur in the pattern at all, so the text can skip it right away.
+ */
+
+#define TABLE_SIZE(self) ((size_t) 1 << (64 - (self)->shift))
+
+static size_t edge_slot(SuffixAutomaton *self, int from, unsigned char c)
+{
+    size_t mask = TABLE_SIZE(self) - 1;
+    size_t i = (size_t) (((uint64_t) from << 8 | c) *
+        0x9e3779b97f4a7c15ULL >> self->shift);
+    SuffixEdge *edge;
+
+    for (;; i = (i + 1) & mask) {
+        edge = self->table + i;
+        if (edge->from < 0 || (edge->from == from && edge->c == c)) return i;
+    }
+}
+
+/*
+ * Returns the state reached from state from by reading c, or -1.
+ */
+static int edge_target(SuffixAutomaton *self, int from, unsigned char c)
+{
+    SuffixEdge *edge = self->table + edge_slot(self, from, c);
+    return edge->from < 0 ? -1 : edge->to;
+}
+
+static void edge_set(SuffixAutomaton *self, int from, unsigned char c, int to)
+{
+    SuffixEdge *edge = self->table + edge_slot(self, from, c);
+    if (edge->from < 0) {
+        edge->from = from;
+        edge->c = c;
+        edge->next = self->states[from].edges;
+        self->states[from].edges = (int) (edge - self->table);
+    }
+    edge->to = to;
+    if (from == 0) self->root[c] = to;
+}
+
+static int state_add(SuffixAutomaton *self, int len, int link, int end)
+{
+    SuffixState *state = self->states + self->len;
+    state->len = len;
+    state->link = link;
+    state->end = end;
+    state->edges = -1;
+    return self->len++;
+}
+
+SuffixAutomaton *SuffixAutomaton_new(const char *pattern, int len)
+{
+    SuffixAutomaton *self = ALLOC(SuffixAutomaton);
+    size_t i, size;
+    int last, cur, p, q, clone, e;
+    unsigned char c;
+
+    self->pattern_len = len;
+    self->len = 0;
+    self->states = ALLOC_N(SuffixState, 2 * (size_t) len + 1);
+    for (self->shift = 64, size = 1; size < 6 * (size_t) len + 2; size <<= 1) {
+        self->shift--;
+    }
+    self->table = ALLOC_N(SuffixEdge, size);
+    for (i = 0; i < size; i++) self->table[i].from = -1;
+    for (i = 0; i < 256; i++) self->root[i] = -1;
+    last = state_add(self, 0, -1, -1);
+    for (i = 0; i < (size_t) len; i++) {
+        c = (unsigned char) pattern[i];
+        cur = state_add(self, self->states[last].len + 1, 0, (int) i);
+        for (p = last; p >= 0 && edge_target(self, p, c) < 0;
+                p = self->states[p].link) {
+            edge_set(self, p, c, cur);
+        }
+        last = cur;
+        if (p < 0) continue;
+        q = edge_target(self, p, c);
+        if (self->states[p].len + 1 == self->states[q].len) {
+            self->states[cur].link = q;
+            continue;
+        }
+        clone = state_add(self, self->states[p].len + 1,
+            self->states[q].link, self->states[q].end);
+        for (e = self->states[q].edges; e >= 0; e = self->table[e].next) {
+            edge_set(self, clone, self->table[e].c, self->table[e].to);
+        }
+        for (; p >= 0 && edge_target(self, p, c) == q;
+                p = self->states[p].link) {
+            edge_set(self, p, c, clone);
+        }
+        self->states[q].link = self->states[cur].link = clone;
+    }
+    return self;
+}
+
+/*
+ * Returns the length of the longest common substring of the pattern and
+ * text. Its first occurrence in text starts at *text_offset, and the first
+ * occurrence of that substring in the pattern at *pattern_offset.
+ */
+int suffix_automaton_match(SuffixAutomaton *self, const char *text,
+    int text_len, int *pattern_offset, int *text_offset)
+{
+    int i, to, state = 0, len = 0, best = 0;
+
+    *pattern_offset = *text_offset = 0;
+    for (i = 0; i < text_len; i++) {
+        unsigned char c = (unsigned char) text[i];
+        if (self->root[c] < 0) {
+            state = len = 0;
+            continue;
+        }
+        while (state > 0 && (to = edge_target(self, state, c)) < 0) {
+            state = self->states[state].link;
+            len = self->states[state].len;
+        }
+        state = state > 0 ? to : self->root[c];
+        if (++len > best) {
+            best = len;
+            *text_offset = i - len + 1;
+            *pattern_offset = self->states[state].end - len + 1;
+        }
+    }
+    return best;
+}
+
+size_t suffix_automaton_memsize(const SuffixAutomaton *self)
+{
+    return sizeof(SuffixAutomaton) +
+        (2 * (size_t) self->pattern_len + 1) * sizeof(SuffixState) +
+        TABLE_SIZE(self) * sizeof(SuffixEdge);
+}
+
+void suffix_automaton_destroy(SuffixAutomaton *self)
+{
+    if (!self) return;
+    free(self->states);
+    free(self->table);
+    free(self);
+}
+  /* vim: set et cindent sw=4 ts=4: */
@@ -0,0 +1,37 @@
+#ifndef SUFFIX_AUTOMATON_H_INCLUDED
+#define SUFFIX_AUTOMATON_H_INCLUDED
+
+#include "ruby.h"
+#include <stdint.h>
+
+typedef struct SuffixStateStruct {
+    int         len;        /* length of the longest substring in the state */
+    int         link;       /* suffix link, -1 for the initial state */
+    int         end;        /* end of its first occurrence in the pattern */
+    int         edges;      /* first edge leaving the state, or -1 */
+} SuffixState;
+
+typedef struct SuffixEdgeStruct {
+    int         from;       /* -1 for empty slots of the table */
+    int         to;
+    int         next;       /* next edge leaving from, or -1 */
+    unsigned char c;
+} SuffixEdge;
+
+typedef struct SuffixAutomatonStruct {
+    SuffixState *states;
+    int         len;
+    SuffixEdge  *table;     /* hash table of edges, at most half full */
+    int         shift;
+    int         root[256];  /* edges leaving the initial state */
+    int         pattern_len;
+} SuffixAutomaton;
+
+SuffixAutomaton *SuffixAutomaton_new(const char *pattern, int len);
+int suffix_automaton_match(SuffixAutomaton *self, const char *text,
+    int text_len, int *pattern_offset, int *text_offset);
+size_t suffix_automaton_memsize(const SuffixAutomaton *self);
+void suffix_automaton_destroy(SuffixAutomaton *self);
+
+#endif
+  /* vim: set et cindent sw=4 ts=4: */
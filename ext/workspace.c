@@ -0,0 +1,33 @@
+#include "workspace.h"
+#include <stdint.h>
+#include <stdlib.h>
+
+/*
+ * Returns at least size bytes of scratch memory, or NULL if it couldn't be
+ * allocated. The previous contents aren't kept, if the memory has to grow.
+ */
+void *workspace_reserve(Workspace *self, size_t size)
+{
+    size_t grown;
+    void *raw;
+
+    if (size <= self->size) return self->memory;
+    grown = 2 * self->size > size ? 2 * self->size : size;
+    grown = (grown + WORKSPACE_ALIGNMENT - 1) & ~(size_t) (WORKSPACE_ALIGNMENT - 1);
+    raw = malloc(grown + WORKSPACE_ALIGNMENT - 1);
+    if (!raw) return NULL;
+    free(self->raw);
+    self->raw = raw;
+    self->memory = (void *) (((uintptr_t) raw + WORKSPACE_ALIGNMENT - 1) &
+        ~(uintptr_t) (WORKSPACE_ALIGNMENT - 1));
+    self->size = grown;
+    return self->memory;
+}
+
+void workspace_release(Workspace *self)
+{
+    free(self->raw);
+    self->raw = self->memory = NULL;
+    self->size = 0;
+}
+  /* vim: set et cindent sw=4 ts=4: */
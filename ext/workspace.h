@@ -0,0 +1,23 @@
+#ifndef WORKSPACE_H_INCLUDED
+#define WORKSPACE_H_INCLUDED
+
+#include <stddef.h>
+
+#define WORKSPACE_ALIGNMENT 64
+
+/*
+ * Scratch memory, that is kept between comparisons and only grows. It's
+ * aligned to cache lines. The functions don't use the Ruby API, so they
+ * can be called without holding the global interpreter lock.
+ */
+typedef struct WorkspaceStruct {
+    void        *raw;
+    void        *memory;
+    size_t      size;
+} Workspace;
+
+void *workspace_reserve(Workspace *self, size_t size);
+void workspace_release(Workspace *self);
+
+#endif
+  /* vim: set et cindent sw=4 ts=4: */
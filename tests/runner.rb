@@ -11,6 +11,10 @@ require 'test_longest_subsequence'
 require 'test_longest_substring'
 require 'test_jaro'
 require 'test_jaro_winkler'
+require 'test_bitap'
+require 'test_pattern_set'
+require 'test_bktree'
+require 'test_qgram_index'
 
 class TS_AllTests
   def self.suite
@@ -23,6 +27,10 @@ class TS_AllTests
     suite << TC_LongestSubstring.suite
     suite << TC_Jaro.suite
     suite << TC_JaroWinkler.suite
+    suite << TC_Bitap.suite
+    suite << TC_PatternSet.suite
+    suite << TC_BKTree.suite
+    suite << TC_QGramIndex.suite
     suite
   end
 end
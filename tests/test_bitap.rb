@@ -0,0 +1,102 @@
+require 'test/unit'
+require 'amatch'
+
+class TC_Bitap < Test::Unit::TestCase
+  include Amatch
+
+  def setup
+    @empty    = Bitap.new('')
+    @simple   = Bitap.new('test')
+    @class    = Bitap.new('t[aeiou]st')
+  end
+
+  def test_search
+    assert_equal 4,     @simple.search('test')
+    assert_equal 7,     @simple.search('aaatestbbb')
+    assert_nil          @simple.search('aaatextbbb')
+    assert_equal 7,     @simple.search('aaatextbbb', 1)
+    assert_equal 5,     @simple.search('a tst here', 1)
+    assert_nil          @simple.search('a tst here', 0)
+    assert_nil          @simple.search('test', -1)
+    assert_nil          @simple.search('')
+    assert_equal 0,     @simple.search('', 4)
+    assert_equal 0,     @empty.search('')
+    assert_equal 0,     @empty.search('test')
+    assert_equal [nil, 4, 6], @simple.search(['xxxx', 'test', 'a test'])
+    assert_raises(TypeError) { @simple.search(:test) }
+  end
+
+  def test_syntax
+    assert_equal 6,     @class.search('a tost here')
+    assert_nil          @class.search('a tst here')
+    assert_nil          @class.search('a txst here')
+    assert_equal 3,     Bitap.new('a.c').search('a-c')
+    assert_equal 3,     Bitap.new('[^0-9]b').search('1ab')
+    assert_nil          Bitap.new('[^0-9]b').search('12b')
+    assert_equal 2,     Bitap.new('[]x]').search('a]')
+    assert_equal 2,     Bitap.new('a\.').search('a.a-')
+    assert_nil          Bitap.new('a\.').search('a-')
+    assert_equal 1,     Bitap.new('[\]]').search(']')
+    assert_equal 2,     Bitap.new('[a-c][x-z]').search('by')
+    assert_raises(ArgumentError) { Bitap.new('te[st') }
+    assert_raises(ArgumentError) { Bitap.new('a' * 65) }
+    assert_nothing_raised { Bitap.new('[ab]' * 64) }
+  end
+
+  def test_search_all
+    assert_equal [[3, 1], [4, 0], [5, 1], [8, 1]],
+      @class.search_all('test tst', 1)
+    assert_equal [[4, 0]],              @class.search_all('test tst')
+    assert_equal [[4, 0], [8, 0]],      @simple.search_all('testtest')
+    assert_equal [],                    @simple.search_all('xxxx', 2)
+    assert_equal [],                    @simple.search_all('test', -1)
+    assert_equal [[0, 0], [1, 0], [2, 0]], @empty.search_all('ab')
+    assert_equal [[0, 2], [1, 1]],      Bitap.new('ab').search_all('a', 5)
+    hits = Bitap.new('ab').search_all('ab--' * 100_000)
+    assert_equal 100_000,               hits.size
+    assert_equal [399_998, 0],          hits.last
+    assert_raises(TypeError) { @simple.search_all(:test, 1) }
+  end
+
+  def test_levenshtein
+    pattern = 'abcab'
+    text = 'xxabcaxbabcbxabbcab' * 3
+    levenshtein = Levenshtein.new(pattern)
+    expected = (0..text.size).map { |e|
+      [e, (0..e).map { |s| levenshtein.match(text[s...e]) }.min]
+    }.select { |e, d| d <= 2 }
+    assert_equal expected, Bitap.new(pattern).search_all(text, 2)
+  end
+
+  def test_unblocked
+    long = Bitap.new('a' * 64)
+    text = 'b' * 3_000_000 + 'a' * 63 + 'c'
+    assert_equal 3_000_063, long.search(text, 1)
+    assert_equal [[3_000_063, 1], [3_000_064, 1]], long.search_all(text, 1)
+    assert_equal [[3_000_063, 1], [3_000_064, 1]],
+      long.search_all(text.freeze, 1)
+  end
+
+  def test_ignore_case
+    assert_equal false, @class.ignore_case
+    assert_nil          @class.search('a TOST')
+    @class.ignore_case = true
+    assert_equal true,  @class.ignore_case
+    assert_equal 6,     @class.search('a TOST')
+    negated = Bitap.new('[^a]')
+    negated.ignore_case = true
+    assert_nil          negated.search('A')
+    assert_equal 1,     negated.search('B')
+  end
+
+  def test_pattern_setting
+    assert_raises(TypeError) { @simple.pattern = :something }
+    assert_raises(ArgumentError) { @simple.pattern = '[ab' }
+    assert_equal 'test', @simple.pattern
+    assert_equal 4,     @simple.search('test')
+    @simple.pattern = 't.t'
+    assert_equal 't.t', @simple.pattern
+    assert_equal 3,     @simple.search('tat')
+  end
+end
+  # vim: set et sw=2 ts=2:
@@ -0,0 +1,74 @@
+require 'test/unit'
+require 'amatch'
+
+class TC_BKTree < Test::Unit::TestCase
+  include Amatch
+
+  WORDS = %w[book books cake boo boon cook cape cart test tent text toast
+    book]
+
+  def setup
+    @tree     = BKTree.new(WORDS)
+    @hamming  = BKTree.new(WORDS, Hamming)
+    @empty    = BKTree.new([])
+  end
+
+  def test_search
+    assert_equal [[0, 0], [12, 0]],     @tree.search('book', 0)
+    assert_equal [[0, 1], [3, 1], [4, 1], [12, 1]],
+      @tree.search('bool', 1)
+    assert_equal [[8, 1], [9, 1], [10, 1]], @tree.search('tet', 1)
+    assert_equal [],                    @tree.search('xyzzy', 2)
+    assert_equal [],                    @tree.search('book', -1)
+    assert_equal [],                    @empty.search('book', 3)
+    assert_equal WORDS.size,            @tree.search('', 5).size
+    small = BKTree.new(%w[a b test])
+    [2**40, 1.0 / 0].each do |k|
+      assert_equal [[2, 1], [0, 3], [1, 3]], small.search('tst', k)
+    end
+    assert_equal [[0, 3], [1, 3], [2, 3]], BKTree.new(%w[a b test], Hamming).
+      search('tst', 2**40)
+  end
+
+  def test_nearest
+    assert_equal [0, 0],                @tree.nearest('book')
+    assert_equal [2, 1],                @tree.nearest('bake')
+    assert_equal [11, 2],               @tree.nearest('roast!')
+    assert_nil                          @empty.nearest('book')
+  end
+
+  def test_hamming
+    assert_equal [[0, 1], [3, 1], [4, 1], [12, 1]],
+      @hamming.search('boot', 1)
+    assert_equal [[0, 1], [1, 1], [12, 1]], @hamming.search('bookx', 1)
+    assert_equal [9, 1],                @hamming.nearest('tend')
+  end
+
+  def test_agrees_with_matchers
+    words = Array.new(200) { |i| i.to_s(5).tr('01234', 'abcde') * (1 + i % 3) }
+    tree = BKTree.new(words)
+    %w[abc bad deed aaaa eeab].each do |query|
+      distances = Levenshtein.new(query).match(words)
+      expected = distances.each_with_index.select { |d, i| d <= 2 }.
+        sort.map { |d, i| [i, d] }
+      assert_equal expected, tree.search(query, 2)
+      assert_operator tree.visited, :<=, words.size
+    end
+  end
+
+  def test_visited
+    @tree.search('book', 0)
+    assert_operator @tree.visited, :>, 0
+    assert_operator @tree.visited, :<, WORDS.size
+  end
+
+  def test_attributes
+    assert_equal WORDS.size,            @tree.size
+    assert_equal Levenshtein,           @tree.metric
+    assert_equal Hamming,               @hamming.metric
+    assert_equal 0,                     @empty.size
+    assert_raises(ArgumentError) { BKTree.new(WORDS, Sellers) }
+    assert_raises(TypeError) { BKTree.new([:foo]) }
+  end
+end
+  # vim: set et sw=2 ts=2:
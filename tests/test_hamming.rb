@@ -55,5 +55,20 @@ class TC_Hamming < Test::Unit::TestCase
   def test_long
     assert_in_delta 1.0, @long.similar(@long.pattern), D
   end
+
+  def test_long_records
+    record = (0...4099).map { |i| (i * 7 % 256).chr }.join
+    hamming = Hamming.new(record)
+    assert_equal 0, hamming.match(record)
+    [0, 15, 16, 31, 63, 64, 255, 4095, 4098].each do |i|
+      other = record.dup
+      other[i] = (other[i] == 'x' ? 'y' : 'x')
+      assert_equal 1, hamming.match(other)
+      assert_equal 4, hamming.match(other + 'abc')
+      assert_equal 4099 - i, hamming.match(other[0, i])
+    end
+    shifted = (0...4099).map { |i| ((i * 7 + 1) % 256).chr }.join
+    assert_equal 4099, hamming.match(shifted)
+  end
 end
   # vim: set et sw=2 ts=2:
@@ -20,6 +20,21 @@ class TC_Jaro < Test::Unit::TestCase
     assert_in_delta 0.444, @martha.match('MARHTA'), D
   end
 
+  def test_codepoints
+    m = Jaro.new('Mär')
+    assert_in_delta 0.833, m.match('MÄR'), D
+    m.codepoints = true
+    assert_in_delta 0.778, m.match('MÄR'), D
+    assert_in_delta 1.0, m.match('mär'), D
+  end
+
+  def test_select
+    selected = @martha.select(%w[MARHTA xyzxyz M], 0.9)
+    assert_equal [0],                   selected.map { |i, s| i }
+    assert_in_delta 0.944, selected[0][1], D
+    assert_equal [1, 1, 0],             @martha.rejected
+  end
+
   def test_match
     assert_in_delta 0.944, @martha.match('MARHTA'), D
     assert_in_delta 0.822, @dwayne.match('DUANE'), D
@@ -18,6 +18,18 @@ class TC_JaroWinkler < Test::Unit::TestCase
     assert_in_delta 0.961, @martha.match('MARHTA'), D
     @martha.ignore_case = false
     assert_in_delta 0.500, @martha.match('MARHTA'), D
+    assert_in_delta 0.961, @martha.match('Marhta'), D
+    @martha.pattern = 'MARTHA'
+    assert_in_delta 0.961, @martha.match('MARHTA'), D
+    assert_in_delta 0.0, @martha.match('marhta'), D
+  end
+
+  def test_long
+    long = JaroWinkler.new('martha ' * 20)
+    assert_in_delta 1.0, long.match('MARTHA ' * 20), D
+    assert_in_delta long.match('marhta ' * 20),
+      JaroWinkler.new('marhta ' * 20).match('martha ' * 20), D
+    assert_in_delta 0.809, long.match('MARTHA'), D
   end
 
   def test_match
@@ -28,6 +40,29 @@ class TC_JaroWinkler < Test::Unit::TestCase
     assert_in_delta 0.700, @one.match('orange'), D
   end
 
+  def test_select
+    names = %w[MARHTA Marhta xyzxyz M Mark]
+    selected = @martha.select(names, 0.9)
+    assert_equal [0, 1],                selected.map { |i, s| i }
+    assert_in_delta 0.961, selected[0][1], D
+    assert_equal [1, 2, 0],             @martha.rejected
+    assert_equal 5,                     @martha.select(names, 0.0).size
+    m = JaroWinkler.new("babbbabbbabbaa")
+    score = m.match("baba")
+    assert_equal [[0, score]],          m.select(["baba"], score)
+    assert_equal [0, 0, 0],             m.rejected
+  end
+
+  def test_best
+    names = %w[Mark MARHTA Arthur Martha M]
+    best = @martha.best(names, 2)
+    assert_equal [3, 1], best.map { |i, s| i }
+    assert_in_delta 1.0,   best[0][1], D
+    assert_in_delta 0.961, best[1][1], D
+    assert_equal @martha.match(names).sort.reverse,
+      @martha.best(names, 10).map { |i, s| s }
+  end
+
   def test_scaling_factor
     assert_in_delta 0.1, @martha.scaling_factor, 0.0000001
     @martha.scaling_factor = 0.2
@@ -35,4 +70,34 @@ class TC_JaroWinkler < Test::Unit::TestCase
     @martha.scaling_factor = 0.5 # this is far too high
     assert_in_delta 1.028, @martha.match('MARHTA'), D
   end
+
+  def test_join
+    left = %w[Martha dwayne DIXON one] + ['']
+    right = %w[MARHTA duane dicksonx orange Marhta] + ['']
+    [0.0, 0.8, 0.95].each do |threshold|
+      expected = []
+      left.each_with_index do |a, i|
+        right.each_with_index do |b, j|
+          s = JaroWinkler.new(a).match(b)
+          expected << [i, j, s] if s >= threshold
+        end
+      end
+      assert_equal expected, Amatch.join(left, right,
+        :metric => JaroWinkler, :threshold => threshold)
+    end
+    assert_equal [[0, 0], [0, 4], [4, 5]], Amatch.join(left, right,
+      :metric => JaroWinkler, :threshold => 0.96).map { |i, j, s| [i, j] }
+    assert_equal [[0, 4], [4, 5]], Amatch.join(left, right, :metric => JaroWinkler,
+      :threshold => 0.96, :ignore_case => false).map { |i, j, s| [i, j] }
+  end
+
+  def test_cluster
+    names = %w[Martha Marhta Dwayne Duane Martha MARTHA]
+    assert_equal [0, 0, 1, 2, 0, 0],    Amatch.cluster(names,
+      :metric => JaroWinkler, :threshold => 0.9)
+    assert_equal [0, 0, 1, 2, 0, 3],    Amatch.cluster(names,
+      :metric => JaroWinkler, :threshold => 0.9, :ignore_case => false)
+    assert_equal [0, 0, 1, 1, 0, 0],    Amatch.cluster(names,
+      :metric => JaroWinkler, :threshold => 0.8)
+  end
 end
@@ -1,4 +1,6 @@
 require 'test/unit'
+require 'tempfile'
+require 'stringio'
 require 'amatch'
 
 class TC_Levenshtein < Test::Unit::TestCase
@@ -44,12 +46,327 @@ class TC_Levenshtein < Test::Unit::TestCase
     assert_equal 4,     @simple.search('aaaaaaaaa')
   end
 
+  def test_multiword_pattern
+    assert_equal 0,     @long.match('A' * 160)
+    assert_equal 10,    @long.match('A' * 150 + 'B' * 10)
+    assert_equal 10,    @long.match('B' * 10 + 'A' * 150)
+    assert_equal 96,    @long.match('A' * 64)
+    assert_equal 160,   @long.match('')
+    assert_equal 0,     @long.search('B' * 20 + 'A' * 160 + 'B' * 20)
+    assert_equal 1,     @long.search('B' * 20 + 'A' * 80 + 'B' + 'A' * 79)
+    assert_equal 32,    @long.search('B' * 20 + 'A' * 128 + 'B' * 20)
+    word = Levenshtein.new('a' * 63 + 'b')
+    assert_equal 1,     word.match('a' * 64)
+    assert_equal 0,     word.search('b' + 'a' * 63 + 'b' + 'a')
+    block = Levenshtein.new('a' * 64 + 'b')
+    assert_equal 1,     block.match('a' * 65)
+    assert_equal 0,     block.search('b' + 'a' * 64 + 'b' + 'a')
+  end
+
+  def test_max_distance
+    assert_equal 1,     @simple.match('tst', 1)
+    assert_equal 1,     @simple.match('tst', 1.5)
+    assert_nil          @simple.match('taex', 2)
+    assert_equal 3,     @simple.match('taex', 3)
+    assert_nil          @simple.match('aaatestbbb', 5)
+    assert_nil          @simple.match('test', -1)
+    assert_equal 0,     @simple.search('aaatestbbb', 0)
+    assert_equal 3,     @simple.search('aaataexbbb', 3)
+    assert_nil          @simple.search('aaataexbbb', 2)
+    assert_equal [nil, 0], @simple.match(["tets", "test"], 1)
+    assert_equal [1, nil], @simple.search(["tetsaaa", "xxxx"], 1)
+    assert_equal 10,    @long.match('A' * 150 + 'B' * 10, 10)
+    assert_nil          @long.match('A' * 150 + 'B' * 10, 9)
+    assert_nil          @long.match('A' * 140, 19)
+    assert_equal 1,     @long.search('B' * 20 + 'A' * 80 + 'B' + 'A' * 79, 1)
+    assert_nil          @long.search('B' * 20 + 'A' * 128 + 'B' * 20, 31)
+  end
+
+  def test_unblocked
+    text = 'B' * 400_000 + 'A' * 160
+    assert_equal 400_000, @long.match(text)
+    assert_equal 0,       @long.search(text.freeze)
+    threads = Array.new(2) { Thread.new { @long.search(text + 'B') } }
+    assert_equal [0, 0],  threads.map { |t| t.value }
+  end
+
+  def test_threads
+    strings = Array.new(600) { |i| 'AB' * (i * 7 % 1000) + 'A' * (i % 170) }
+    expected = strings.map { |s| @long.search(s) }
+    assert_equal 1, Amatch.threads
+    Amatch.threads = 4
+    assert_equal expected, @long.search(strings)
+    assert_equal strings.map { |s| @long.match(s) }, @long.match(strings)
+    assert_raises(ArgumentError) { Amatch.threads = 0 }
+  ensure
+    Amatch.threads = 1
+  end
+
+  def test_search_all
+    assert_equal [[2, 5, 1], [9, 13, 0]], @simple.search_all('a tst, a test', 1)
+    assert_equal [[9, 13, 0]],          @simple.search_all('a tst, a test', 0)
+    assert_equal [[0, 4, 0], [5, 9, 0]], @simple.search_all('test test', 0)
+    assert_equal [[0, 4, 0], [4, 8, 0]], @simple.search_all('testtest', 1)
+    assert_equal [],                    @simple.search_all('xxxx', 2)
+    assert_equal [],                    @simple.search_all('test', -1)
+    assert_equal [[0, 0, 0]],           @empty.search_all('test', 0)
+    text = 'B' * 100 + 'A' * 159 + 'B' * 100 + 'A' * 160
+    assert_equal [[100, 259, 1], [359, 519, 0]], @long.search_all(text, 1)
+    hits = Levenshtein.new('ab').search_all('ab--' * 100_000, 0)
+    assert_equal 100_000,               hits.size
+    assert_equal [399_996, 399_998, 0], hits.last
+    assert_raises(TypeError) { @simple.search_all(:test, 1) }
+  end
+
+  # Reads at most 3 bytes at a time, splitting occurrences and characters.
+  class TrickleIO
+    def initialize(string)
+      @string, @offset = string, 0
+    end
+
+    def read(length)
+      return nil if @offset >= @string.size
+      chunk = @string[@offset, 3]
+      @offset += 3
+      chunk
+    end
+  end
+
+  def test_search_io
+    text = 'a tst, a test'
+    assert_equal @simple.search_all(text, 1),
+      @simple.search_io(StringIO.new(text), 1)
+    assert_equal @simple.search_all(text, 1),
+      @simple.search_io(TrickleIO.new(text), 1)
+    hits = []
+    assert_same @simple, @simple.search_io(TrickleIO.new(text), 0) { |*hit|
+      hits << hit
+    }
+    assert_equal @simple.search_all(text, 0), hits
+    assert_equal [],                    @simple.search_io(StringIO.new(''), 1)
+    assert_equal [],                    @simple.search_io(StringIO.new(text), -1)
+    assert_equal @empty.search_all('test', 0),
+      @empty.search_io(TrickleIO.new('test'), 0)
+    text = 'B' * 100 + 'A' * 159 + 'B' * 100 + 'A' * 160
+    assert_equal @long.search_all(text, 1),
+      @long.search_io(TrickleIO.new(text), 1)
+    text = 'x' * ((1 << 20) - 2) + 'tesst' + 'x' * (1 << 20) + 'tst'
+    assert_equal @simple.search_all(text, 1),
+      @simple.search_io(StringIO.new(text), 1)
+    assert_raises(TypeError) { @simple.search_io('test', 1) }
+  end
+
+  def test_join
+    left = %w[kitten sitting test tset tester] + ['']
+    right = %w[mitten fitting bitten test t] + ['']
+    expected = []
+    left.each_with_index do |a, i|
+      right.each_with_index do |b, j|
+        d = Levenshtein.new(a).match(b)
+        expected << [i, j, d] if d <= 2
+      end
+    end
+    assert_equal expected,              Amatch.join(left, right, :threshold => 2)
+    assert_equal [[0, 0, 1], [0, 2, 1], [1, 1, 1]],
+      Amatch.join(%w[kitten sitting], %w[mitten fitting bitten],
+        :metric => Levenshtein, :threshold => 1)
+    assert_equal [],                    Amatch.join(left, right, :threshold => -1)
+    [1.0 / 0, 1e300, 2**40].each do |threshold|
+      assert_equal [[0, 0, 3], [0, 1, 1]],
+        Amatch.join(%w[abc], %w[xyz ab], :threshold => threshold)
+    end
+    many = Array.new(90) { |i| '%03d' % i }
+    assert_equal 90 * 90,               Amatch.join(many, many, :threshold => 1e7).size
+    assert_raises(ArgumentError) { Amatch.join(left, right, {}) }
+    assert_raises(ArgumentError) do
+      Amatch.join(left, right, :metric => Hamming, :threshold => 1)
+    end
+    assert_raises(TypeError) { Amatch.join(left, [1], :threshold => 1) }
+  end
+
+  def test_cluster
+    strings = %w[test tset best toast tester] + ['']
+    assert_equal [0, 1, 0, 2, 3, 4],    Amatch.cluster(strings, :threshold => 1)
+    assert_equal [0, 0, 0, 0, 0, 1],    Amatch.cluster(strings, :threshold => 2)
+    assert_equal [0, 1, 2, 3, 4, 5],
+      Amatch.cluster(strings, :threshold => 2, :keys => [0, 1, 2, 3, 4, 5])
+    assert_equal [0, 1, 0, 2, 3, 4],
+      Amatch.cluster(strings, :threshold => 2, :keys => %w[a b a b c c])
+    assert_equal [0, 1, 2, 3, 4, 5],    Amatch.cluster(strings, :threshold => -1)
+    [1.0 / 0, 1e300, 2**40].each do |threshold|
+      assert_equal [0, 0],              Amatch.cluster(%w[abc xyz], :threshold => threshold)
+    end
+    assert_equal [],                    Amatch.cluster([], :threshold => 1)
+    assert_raises(ArgumentError) do
+      Amatch.cluster(strings, :threshold => 1, :keys => [1])
+    end
+  end
+
+  def test_stats
+    @simple.match('tset')
+    assert_equal({}, @simple.stats)
+    Amatch.collect_stats = true
+    assert_equal true, Amatch.collect_stats
+    @simple.match(%w[tset test])
+    @simple.match('testing')
+    @simple.search_all('a tst, a test', 1)
+    match = @simple.stats[:match]
+    assert_equal 2,                     match[:calls]
+    assert_equal 3,                     match[:comparisons]
+    assert_equal 2,                     match[:max_batch]
+    assert_equal 15,                    match[:bytes]
+    assert_equal 2,
+      match[:histogram].inject(0) { |sum, (_, n)| sum + n }
+    assert_equal 13,                    @simple.stats[:search_all][:bytes]
+    global = Amatch.stats[@simple.class][:match]
+    assert global[:comparisons] >= 3
+    @simple.reset_stats
+    assert_equal({}, @simple.stats)
+    Amatch.reset_stats
+    assert_equal({}, Amatch.stats)
+  ensure
+    Amatch.collect_stats = false
+  end
+
+  def test_search_io_codepoints
+    @simple.pattern = "t\xc3\xa4st"
+    @simple.codepoints = true
+    text = "a t\xc3\xa4t, a t\xc3\xa4st"
+    assert_equal @simple.search_all(text, 1),
+      @simple.search_io(TrickleIO.new(text), 1)
+  end
+
+  def test_alignment
+    assert_equal [[:match, 1], [:substitute, 2], [:match, 1], [:delete, 1]],
+      Levenshtein.new('wine').alignment('water')
+    assert_equal [[:match, 4]],         @simple.alignment('test')
+    assert_equal [[:insert, 4]],        @simple.alignment('')
+    assert_equal [[:delete, 4]],        @empty.alignment('test')
+    assert_equal [],                    @empty.alignment('')
+    assert_equal [[:delete, 3], [:match, 4], [:delete, 3]],
+      @simple.alignment('aaatestbbb')
+    assert_raises(TypeError) { @simple.alignment(:test) }
+  end
+
+  def test_long_alignment
+    srand 7
+    a = Array.new(50_000) { 'abcdefgh'[rand(8), 1] }.join
+    b = a.dup
+    100.times { b[rand(b.size)] = 'x' }
+    b[20_000, 10] = ''
+    script = Levenshtein.new(a).alignment(b)
+    pattern, i, j, cost = '', 0, 0, 0
+    script.each do |op, n|
+      case op
+      when :match
+        assert_equal a[i, n], b[j, n]
+        pattern << b[j, n]
+        i += n; j += n
+      when :substitute
+        pattern << a[i, n]
+        i += n; j += n; cost += n
+      when :insert
+        pattern << a[i, n]
+        i += n; cost += n
+      when :delete
+        j += n; cost += n
+      end
+    end
+    assert_equal a,                     pattern
+    assert_equal b.size,                j
+    assert_equal Levenshtein.new(a).match(b), cost
+  end
+
+  def test_grep_file
+    file = Tempfile.new('amatch')
+    file.write "a test\nno match\ntest\n\nteast here\nthe last tst"
+    file.close
+    assert_equal [['a test', 1, 0], ['test', 3, 16]],
+      @simple.grep_file(file.path, 0)
+    expected = [['a test', 1, 0], ['test', 3, 16], ['teast here', 5, 22],
+      ['the last tst', 6, 33]]
+    assert_equal expected,              @simple.grep_file(file.path, 1)
+    lines = []
+    assert_same @simple, @simple.grep_file(file.path, 1.5) { |*l| lines << l }
+    assert_equal expected,              lines
+    assert_equal [],                    @simple.grep_file(file.path, -1)
+    assert_equal 6,                     @empty.grep_file(file.path, 0).size
+    long = Levenshtein.new('testing ' * 10)
+    assert_equal [],                    long.grep_file(file.path, 3)
+    assert_raises(Errno::ENOENT) { @simple.grep_file(file.path + '.none', 1) }
+  ensure
+    file.close!
+  end
+
+  def test_select
+    assert_equal [[1, 0]],              @simple.select(%w[tset test testing bestow], 1)
+    assert_equal [2, 0, 1],             @simple.rejected
+    assert_equal [[0, 1], [1, 0], [3, 1]],
+      @simple.select(%w[tst test testing best], 1)
+    assert_equal [1, 0, 0],             @simple.rejected
+    assert_equal [],                    @simple.select(%w[test], -1)
+    assert_equal [[1, 0]],              @long.select(['A' * 158 + 'BB', 'A' * 160], 1)
+    assert_equal [0, 1, 0],             @long.rejected
+    strings = Array.new(100) { |i| 'test'[0, i % 5] + 'xt'[0, i % 3] }
+    expected = []
+    @simple.match(strings).each_with_index { |d, i| expected << [i, d] if d <= 2 }
+    assert_equal expected,              @simple.select(strings, 2)
+    assert_raises(TypeError) { @simple.select('test', 1) }
+  end
+
+  def test_codepoints
+    m = @simple.class.new('häll')
+    assert_equal false,                 m.codepoints
+    assert_equal 2,                     m.match('hell')
+    m.codepoints = true
+    assert_equal true,                  m.codepoints
+    assert_equal 1,                     m.match('hell')
+    assert_equal [1, 0, 3],             m.match(['hell', 'häll', 'hällööö'])
+    assert_equal 0,                     m.search('ein häll')
+    assert_equal [[4, 8, 0], [9, 13, 1]], m.search_all('ein häll hell', 1)
+    assert_equal [[:match, 1], [:substitute, 1], [:match, 2]],
+      m.alignment('hell')
+    assert_equal [[1, 1], [0, 2]],      m.best(['hello', 'hälle'], 2)
+    m.pattern = '€€'
+    assert_equal 1,                     m.match('€£')
+    assert_equal 2,                     m.match("\xe2\x82")
+    assert_raises(ArgumentError) { m.pattern = [*0x400..0x47f].pack('U*') }
+    assert_equal 0,                     m.match('€€')
+    m.codepoints = false
+    assert_equal 3,                     m.match('€£')
+  end
+
+  def test_codepoints_grep_file
+    file = Tempfile.new('amatch')
+    file.write "hällo wörld\nhello world\nhallo"
+    file.close
+    m = Levenshtein.new('wörld')
+    m.codepoints = true
+    assert_equal [[1, 0], [2, 14]],
+      m.grep_file(file.path, 1).map { |line, number, offset| [number, offset] }
+  ensure
+    file.close!
+  end
+
   def test_array_result
     assert_equal [2, 0],    @simple.match(["tets", "test"])
     assert_equal [1, 0],    @simple.search(["tetsaaa", "testaaa"])
     assert_raises(TypeError) { @simple.match([:foo, "bar"]) }
   end
 
+  def test_best
+    strings = %w[tets test testing tost tes t aaatestbbb best]
+    assert_equal [[1, 0], [3, 1], [4, 1]], @simple.best(strings, 3)
+    assert_equal [[1, 0], [3, 1], [4, 1], [7, 1], [0, 2]],
+      @simple.best(strings, 5)
+    assert_equal strings.size, @simple.best(strings, 100).size
+    assert_equal [],                    @simple.best(strings, 0)
+    assert_equal [],                    @simple.best([], 3)
+    assert_equal [[1, 0]],              @long.best(['A' * 150, 'A' * 160], 1)
+    assert_raises(ArgumentError) { @simple.best(strings, -1) }
+    assert_raises(TypeError) { @simple.best('test', 1) }
+  end
+
   def test_pattern_setting
     assert_raises(TypeError) { @simple.pattern = :something }
     assert_equal 0, @simple.match('test')
@@ -58,5 +58,17 @@ class TC_LongestSubsequence < Test::Unit::TestCase
   def test_long
     assert_in_delta 1.0, @long.similar(@long.pattern), D
   end
+
+  def test_multiword_pattern
+    assert_equal 160, @long.match('A' * 200)
+    assert_equal 64,  @long.match('B' * 10 + 'A' * 64 + 'B' * 10)
+    assert_equal 159, @long.match('A' * 80 + 'B' + 'A' * 79)
+    assert_equal 0,   @long.match('B' * 300)
+    block = LongestSubsequence.new('a' * 64 + 'b' * 64 + 'a')
+    assert_equal 65,  block.match('b' * 64 + 'a' * 2)
+    assert_equal 129, block.match('a' * 64 + 'b' * 64 + 'a')
+    assert_in_delta 0.5, @long.similar('A' * 80), D
+    assert_in_delta 0.5, LongestSubsequence.new('A' * 80).similar(@long.pattern), D
+  end
 end
   # vim: set et sw=2 ts=2:
@@ -58,5 +58,34 @@ class TC_LongestSubstring < Test::Unit::TestCase
   def test_long
     assert_in_delta 1.0, @long.similar(@long.pattern), D
   end
+
+  def test_locate
+    assert_equal [4, 3, 2], LongestSubstring.new('storing').locate('string')
+    assert_equal [4, 0, 3], @small.locate('aaatestbbb')
+    assert_equal [2, 0, 0], @small.locate('tesa'[0, 2])
+    assert_equal [0, 0, 0], @small.locate('xyz')
+    assert_equal [0, 0, 0], @empty.locate('test')
+    assert_equal [160, 0, 20], @long.locate('B' * 20 + 'A' * 200)
+    assert_equal [[3, 0, 0], [1, 0, 0]], @small.locate(%w[tes t])
+    repeated = LongestSubstring.new('abcabcabd')
+    assert_equal [5, 1, 2], repeated.locate('xxbcabcx')
+    assert_equal 5, repeated.match('xxbcabcx')
+  end
+
+  def test_codepoints
+    m = LongestSubstring.new('größe')
+    assert_equal [6, 0, 4], m.locate('die größte')
+    m.codepoints = true
+    assert_equal [4, 0, 4], m.locate('die größte')
+    assert_in_delta 0.4, m.similar('große'), D
+  end
+
+  def test_pattern_setting
+    assert_equal 4, @small.match('test')
+    @small.pattern = 'tesla'
+    assert_equal 'tesla', @small.pattern
+    assert_equal 3, @small.match('test')
+    assert_equal [4, 0, 1], @small.locate('xtesl')
+  end
 end
   # vim: set et sw=2 ts=2:
@@ -83,5 +83,33 @@ class TC_PairDistance < Test::Unit::TestCase
   def test_long
     assert_in_delta 1.0, @long.similar(@long.pattern), D
   end
+
+  def test_repeated_pairs
+    assert_in_delta 0.5,        @long.match('A' * 54), D
+    assert_in_delta 0.5,        PairDistance.new('aaaa').match('aa'), D
+    assert_in_delta 0.8,        PairDistance.new('abab').match('aba'), D
+  end
+
+  def test_best
+    countries = ['france', 'germany', 'french republic',
+      'german democratic republic', 'republic of france']
+    best = @france.best(countries, 3)
+    assert_equal [4, 2, 0],             best.map { |i, s| i }
+    assert_in_delta 1.0,                best[0][1], D
+    assert_in_delta 0.72,               best[1][1], D
+    assert_in_delta 0.5555555,          best[2][1], D
+    assert_equal [[0, 1.0]],            @csv.best(['foo,bar,baz'], 1, nil)
+    assert_equal [2, 1],
+      @csv.best(['foo', 'bar,foo', 'baz,bar,foo'], 2, /,/).map { |i, s| i }
+  end
+
+  def test_switching_regexp
+    assert_in_delta 0.8,        @csv.match('foo,bar', /,/), D
+    assert_in_delta 0.9,        @csv.match('foo,baz,bar', nil), D
+    assert_in_delta 0.8,        @csv.match('foo,bar', /,/), D
+    assert_in_delta 0.8,        @csv.match('foo,bar', /[,]/), D
+    assert_equal [0.5, 1.0].map { |x| (x * 1000).round },
+      @csv.match(['bar', 'baz,bar,foo'], /,/).map { |x| (x * 1000).round }
+  end
 end
   # vim: set et sw=2 ts=2:
@@ -0,0 +1,69 @@
+require 'test/unit'
+require 'amatch'
+
+class TC_PatternSet < Test::Unit::TestCase
+  include Amatch
+
+  def setup
+    @set = PatternSet.new(%w[amatch ruby test], 1)
+  end
+
+  def test_search
+    assert_equal [[0, 4, 9, 1], [1, 13, 17, 0]],
+      @set.search('use amtch in rubyy')
+    assert_equal [[2, 0, 4, 0], [2, 5, 9, 0]], @set.search('test test')
+    assert_equal [],                    @set.search('nothing here')
+    assert_equal [],                    @set.search('')
+    assert_equal [[[2, 0, 3, 1]], []],  @set.search(%w[tst xyz])
+    assert_raises(TypeError) { @set.search(:test) }
+    assert_raises(TypeError) { @set.search([:test]) }
+  end
+
+  def test_levenshtein
+    patterns = %w[abcab bca cabba a ab abcabcabca]
+    text = 'xxabcaxbabcbxabbcab' * 3
+    [0, 1, 2, 3].each do |k|
+      expected = []
+      patterns.each_with_index do |pattern, i|
+        Levenshtein.new(pattern).search_all(text, k).each do |start, stop, d|
+          expected << [i, start, stop, d]
+        end
+      end
+      expected = expected.sort_by { |i, start, stop, d| [start, i, stop] }
+      assert_equal expected, PatternSet.new(patterns, k).search(text)
+    end
+  end
+
+  def test_short_patterns
+    set = PatternSet.new(['', 'ab', 'abc'], 2)
+    assert_equal [[0, 0, 0, 0], [1, 1, 2, 1], [2, 1, 2, 2]],
+      set.search('xbz')
+    assert_equal [[0, 0, 0, 0], [1, 0, 0, 2]], set.search('xyz')
+  end
+
+  def test_many_patterns
+    patterns = Array.new(2000) { |i| "name%04dx" % i }
+    set = PatternSet.new(patterns, 1)
+    assert_equal 2000,                  set.size
+    assert_equal 1,                     set.max_distance
+    assert_equal [[1234, 4, 13, 0], [1999, 14, 22, 1]],
+      set.search('log name1234x nme1999x').
+        select { |i, start, stop, d| [1234, 1999].include?(i) }
+  end
+
+  def test_unblocked
+    set = PatternSet.new(%w[needle haystack], 1)
+    text = 'x' * 2_000_000 + 'nedle'
+    assert_equal [[0, 2_000_000, 2_000_005, 1]], set.search(text)
+    assert_equal [[0, 2_000_000, 2_000_005, 1]], set.search(text.freeze)
+    threads = Array.new(2) { Thread.new { set.search(text + 'haystack') } }
+    assert_equal [2, 2], threads.map { |t| t.value.size }
+  end
+
+  def test_arguments
+    assert_raises(ArgumentError) { PatternSet.new(%w[test], -1) }
+    assert_raises(TypeError) { PatternSet.new([:test], 1) }
+    assert_equal 2, PatternSet.new(%w[test], 2.5).max_distance
+  end
+end
+  # vim: set et sw=2 ts=2:
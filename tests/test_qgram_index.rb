@@ -0,0 +1,66 @@
+require 'test/unit'
+require 'amatch'
+
+class TC_QGramIndex < Test::Unit::TestCase
+  include Amatch
+
+  WORDS = ['amatch', 'amatcher', 'match', 'ruby', 'ruby gem', '', 'a',
+    'amatch']
+
+  def setup
+    @index    = QGramIndex.new(WORDS)
+    @unsplit  = QGramIndex.new(WORDS, 2, nil)
+    @trigrams = QGramIndex.new(WORDS, 3)
+    @empty    = QGramIndex.new([])
+  end
+
+  def test_search
+    assert_equal [[0, 1.0], [7, 1.0], [2, 8 / 9.0]],
+      @index.search('amatch', 0.85)
+    assert_equal [[0, 1.0], [7, 1.0], [2, 8 / 9.0], [1, 10 / 12.0]],
+      @index.search('amatch', 0.8)
+    assert_equal [[4, 1.0]],            @index.search('gem ruby', 1)
+    assert_equal [[4, 12 / 13.0], [3, 6 / 9.0]],
+      @unsplit.search('ruby ge', 0.5)
+    assert_equal [[5, 1.0], [6, 1.0]],  @index.search('x', 0.5)
+    assert_equal [],                    @index.search('xyz', 0.1)
+    assert_equal WORDS.size,            @index.search('xyz', 0).size
+    assert_equal [],                    @empty.search('amatch', 0.5)
+  end
+
+  def test_agrees_with_pair_distance
+    words = Array.new(300) { |i| (i * 7919).to_s(5).tr('01234', 'abc d') }
+    index = QGramIndex.new(words)
+    %w[abc bad dcba aaaa cab].each do |query|
+      similarities = PairDistance.new(query).match(words)
+      [0.2, 0.5, 0.8].each do |threshold|
+        expected = similarities.each_with_index.
+          select { |s, i| s >= threshold }.sort_by { |s, i| [-s, i] }.
+          map { |s, i| [i, s] }
+        assert_equal expected, index.search(query, threshold)
+        assert_operator index.candidates, :<=, expected.size + words.size
+      end
+    end
+  end
+
+  def test_trigrams
+    assert_equal [[0, 1.0], [7, 1.0], [2, 6 / 7.0], [1, 0.8]],
+      @trigrams.search('amatch', 0.8)
+  end
+
+  def test_candidates
+    @index.search('amatch', 0.9)
+    assert_operator @index.candidates, :<, WORDS.size
+  end
+
+  def test_attributes
+    assert_equal WORDS.size,            @index.size
+    assert_equal 2,                     @index.q
+    assert_equal 3,                     @trigrams.q
+    assert_equal 0,                     @empty.size
+    assert_raises(ArgumentError) { QGramIndex.new(WORDS, 0) }
+    assert_raises(ArgumentError) { QGramIndex.new(WORDS, 9) }
+    assert_raises(TypeError) { QGramIndex.new([:foo]) }
+  end
+end
+  # vim: set et sw=2 ts=2:
@@ -47,6 +47,139 @@ class TC_Sellers < TC_Levenshtein
     assert_in_delta 1, @simple.deletion, D
   end
 
+  def test_weighted_max_distance
+    @simple.insertion = 1
+    @simple.substitution = @simple.deletion = 1000
+    assert_in_delta 1, @simple.match('tst', 1), D
+    assert_nil @simple.match('tst', 0.5)
+    assert_in_delta 1, @simple.search('bbbtstccc', 1), D
+    assert_nil @simple.search('bbbtstccc', 0.5)
+    @simple.insertion = 0.5
+    assert_in_delta 1000, @simple.match('tests', 1000), D
+    assert_nil @simple.match('tests', 999)
+  end
+
+  def test_fractional_max_distance
+    m = Sellers.new('c')
+    m.substitution, m.insertion, m.deletion = 3, 1.1, 0.1
+    d = m.match('cbbcacbacc')
+    assert_equal d, m.match('cbbcacbacc', d)
+    srand 42
+    200.times do
+      m = Sellers.new(Array.new(rand(8)) { 'abc'[rand(3), 1] }.join)
+      m.substitution, m.insertion, m.deletion =
+        0.1 + rand * 3, 0.1 + rand * 3, 0.1 + rand * 3
+      s = Array.new(rand(12)) { 'abc'[rand(3), 1] }.join
+      assert_equal m.match(s), m.match(s, m.match(s))
+    end
+  end
+
+  def test_fractional_select
+    m = Sellers.new('aca')
+    m.substitution, m.insertion, m.deletion = 2.1, 0.7, 0.9
+    d = m.match('bcc')
+    assert_equal [[0, d]],              m.select(['bcc'], d)
+    assert_equal [0, 0, 0],             m.rejected
+    srand 42
+    200.times do
+      m = Sellers.new(Array.new(rand(8)) { 'abc'[rand(3), 1] }.join)
+      m.substitution, m.insertion, m.deletion =
+        0.1 + rand * 3, 0.1 + rand * 3, 0.1 + rand * 3
+      s = Array.new(rand(12)) { 'abc'[rand(3), 1] }.join
+      assert_equal [[0, m.match(s)]],   m.select([s], m.match(s))
+    end
+  end
+
+  def test_interrupt
+    strings = Array.new(4000) { 'AB' * 5000 }
+    thread = Thread.new { @long.match(strings) }
+    sleep 0.2
+    started = Time.now
+    thread.kill.join
+    assert_operator Time.now - started, :<, 1
+    @long.pattern = 'A' * 160
+    assert_in_delta 9840, @long.match(strings.first), D
+  end
+
+  def test_workspace_memsize
+    begin
+      require 'objspace'
+    rescue LoadError
+    end
+    defined?(ObjectSpace.memsize_of) or return
+    before = ObjectSpace.memsize_of(@long)
+    assert_in_delta 1000, @long.match('B' * 1000 + 'A' * 160), D
+    after = ObjectSpace.memsize_of(@long)
+    assert_operator after, :>=, before + 2 * 1161 * 8
+    @long.match('A')
+    assert_equal after, ObjectSpace.memsize_of(@long)
+  end
+
+  def test_alignment
+    sellers = Sellers.new('wine')
+    assert_equal [[:match, 1], [:substitute, 2], [:match, 1], [:delete, 1]],
+      sellers.alignment('water')
+    sellers.substitution = 3
+    assert_equal [[:match, 1], [:insert, 2], [:delete, 2], [:match, 1],
+      [:delete, 1]], sellers.alignment('water')
+    assert_in_delta 5, sellers.match('water'), D
+    # insertions before the first character cost a deletion, like in match
+    sellers = Sellers.new('abcd')
+    sellers.substitution = 3
+    sellers.deletion = 0.5
+    sellers.insertion = 2
+    assert_equal [[:insert, 4], [:delete, 3]], sellers.alignment('xyz')
+    assert_in_delta 3.5, sellers.match('xyz'), D
+    sellers = Sellers.new('ab')
+    sellers.substitution = 3
+    sellers.deletion = 0.5
+    sellers.insertion = 9
+    assert_equal [[:insert, 1], [:delete, 1], [:match, 1]],
+      sellers.alignment('bb')
+    assert_in_delta 1, sellers.match('bb'), D
+  end
+
+  def test_search_all
+    assert_equal [[2, 5, 1.0], [9, 13, 0.0]],
+      @simple.search_all('a tst, a test', 1)
+    assert_equal [[9, 13, 0.0]],        @simple.search_all('a tst, a test', 0.5)
+    @simple.insertion = 0.5
+    assert_equal [[2, 5, 0.5], [9, 13, 0.0]],
+      @simple.search_all('a tst, a test', 0.5)
+    assert_equal [],                    @simple.search_all('test', -1)
+    assert_raises(TypeError) { @simple.search_all(['test'], 1) }
+  end
+
+  def test_search_io_deletion
+    @simple.insertion = 0.5
+    assert_equal [[2, 5, 0.5], [9, 13, 0.0]],
+      @simple.search_io(TrickleIO.new('a tst, a test'), 0.5)
+    @simple.deletion = 0
+    assert_raises(ArgumentError) { @simple.search_io(StringIO.new('test'), 1) }
+    @simple.deletion = 1
+    [1.0 / 0, 1e300].each do |max|
+      assert_equal @simple.search_all('xx tst', max),
+        @simple.search_io(StringIO.new('xx tst'), max)
+    end
+    @simple.deletion = 1e-300
+    assert_equal @simple.search_all('xx tst', 1),
+      @simple.search_io(TrickleIO.new('xx tst'), 1)
+  end
+
+  def test_best
+    strings = %w[tets test testing tost tes aaatestbbb]
+    assert_equal [[1, 0.0], [3, 1.0], [4, 1.0]], @simple.best(strings, 3)
+    @simple.insertion = 0.5
+    assert_equal [[1, 0.0], [4, 0.5], [3, 1.0]], @simple.best(strings, 3)
+    assert_equal [],                    @simple.best(strings, 0)
+    m = Sellers.new('c')
+    m.substitution, m.insertion, m.deletion = 1.8, 2.9, 2.1
+    strings = %w[aabaaacc abbbbb bcaaacca]
+    expected = m.match(strings).each_with_index.sort.first(2).
+      map { |d, i| [i, d] }
+    assert_equal expected,              m.best(strings, 2)
+  end
+
   def test_weight_exceptions
     assert_raises(TypeError) { @simple.substitution = :something }
     assert_raises(TypeError) { @simple.insertion = :something }